@@ -0,0 +1,58 @@
+// Rate of db_update_task against an in-memory SQLite database, where the
+// cost is statement handling rather than I/O.
+//
+// Build and run: make bench && bin/bench_db_update
+
+#include "../include/db.h"
+#include "../include/task.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define TASK_COUNT 1000
+#define UPDATES 200000
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void) {
+    if (!db_init(":memory:")) {
+        fprintf(stderr, "Failed to open the database\n");
+        return 1;
+    }
+
+    Task task;
+    for (int i = 1; i <= TASK_COUNT; i++) {
+        task_init(&task);
+        task.id = i;
+        snprintf(task.name, sizeof(task.name), "task-%d", i);
+        strcpy(task.command, "true");
+        if (!db_save_task(&task)) {
+            fprintf(stderr, "Failed to save task %d\n", i);
+            return 1;
+        }
+    }
+
+    // Cycle through the rows, changing a few columns each time
+    double start = now_seconds();
+    for (int i = 0; i < UPDATES; i++) {
+        task.id = i % TASK_COUNT + 1;
+        snprintf(task.name, sizeof(task.name), "task-%d", task.id);
+        task.last_run_time = i;
+        task.exit_code = i & 1;
+        if (!db_update_task(&task)) {
+            fprintf(stderr, "Failed to update task %d\n", task.id);
+            return 1;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("%d updates over %d tasks in %.2f s\n", UPDATES, TASK_COUNT, elapsed);
+    printf("  db_update_task: %10.0f calls/s\n", UPDATES / elapsed);
+
+    db_cleanup();
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Startup time of scheduler_init over a database of many tasks, with the
+// storage settings of data/config.json (or the defaults). Tasks are spread
+// evenly over the next day, so those within the resident window load in
+// full and the rest only as summaries.
+//
+// Build and run: make bench && bin/bench_startup [task_count] [data_dir]
+
+#include "../include/scheduler.h"
+#include "../include/db.h"
+#include "../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_TASK_COUNT 1000000
+#define DEFAULT_DATA_DIR "/tmp/bench_startup"
+#define IMPORT_CHUNK 10000
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Write task_count tasks into a new database under data_dir
+static bool populate(const char *data_dir, int task_count) {
+    char db_path[MAX_PATH];
+    snprintf(db_path, sizeof(db_path), "%s/tasks.db", data_dir);
+
+    const char *suffixes[] = { "", "-wal", "-shm" };
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        char path[MAX_PATH + 8];
+        snprintf(path, sizeof(path), "%s%s", db_path, suffixes[i]);
+        unlink(path);
+    }
+
+    if (!db_init(db_path)) {
+        return false;
+    }
+
+    Task *tasks = (Task*)malloc(sizeof(Task) * IMPORT_CHUNK);
+    if (!tasks) {
+        db_cleanup();
+        return false;
+    }
+
+    time_t now = time(NULL);
+    bool success = true;
+    for (int start = 0; start < task_count && success; start += IMPORT_CHUNK) {
+        int count = task_count - start < IMPORT_CHUNK ? task_count - start : IMPORT_CHUNK;
+        for (int i = 0; i < count; i++) {
+            int id = start + i + 1;
+            task_init(&tasks[i]);
+            tasks[i].id = id;
+            snprintf(tasks[i].name, sizeof(tasks[i].name), "task-%d", id);
+            strcpy(tasks[i].command, "true");
+            tasks[i].frequency = DAILY;
+            tasks[i].interval = 1;
+            tasks[i].next_run_time = now + 60 + (time_t)((long long)id * 86400 / task_count);
+        }
+        success = db_import_tasks(tasks, count, NULL, NULL, 0);
+    }
+
+    free(tasks);
+    db_checkpoint(true);
+    db_cleanup();
+    return success;
+}
+
+int main(int argc, char *argv[]) {
+    int task_count = argc > 1 ? atoi(argv[1]) : DEFAULT_TASK_COUNT;
+    const char *data_dir = argc > 2 ? argv[2] : DEFAULT_DATA_DIR;
+    if (task_count <= 0) {
+        fprintf(stderr, "Usage: %s [task_count] [data_dir]\n", argv[0]);
+        return 1;
+    }
+
+    mkdir(data_dir, 0755);
+    double start = now_seconds();
+    if (!populate(data_dir, task_count)) {
+        fprintf(stderr, "Failed to create %d tasks in %s\n", task_count, data_dir);
+        return 1;
+    }
+    printf("created %d tasks in %.2f s\n", task_count, now_seconds() - start);
+
+    Scheduler scheduler;
+    memset(&scheduler, 0, sizeof(scheduler));
+    start = now_seconds();
+    if (!scheduler_init(&scheduler, data_dir)) {
+        fprintf(stderr, "Failed to initialize the scheduler\n");
+        return 1;
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("scheduler_init: %.2f s (%d tasks resident, %s)\n", elapsed, scheduler.task_count,
+           scheduler.partial ? "partial" : "all loaded");
+
+    scheduler_cleanup(&scheduler);
+    return 0;
+}
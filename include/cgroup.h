@@ -0,0 +1,129 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CGROUP_LIMITS_MAX_LENGTH 256
+#define CGROUP_MAX_IO_DEVICES 4
+#define CGROUP_CPU_PERIOD_US 100000
+
+/**
+ * cgroup v2 settings, read from the "cgroup" section of the config file
+ */
+typedef struct {
+    bool enabled;                // "enabled": run every task in a cgroup of its own
+    char root[PATH_MAX];         // "root": delegated cgroup to create them in, empty for the daemon's own
+    char default_limits[CGROUP_LIMITS_MAX_LENGTH];  // "default_limits": for tasks that set none
+} CgroupConfig;
+
+/**
+ * Resource limits of a task. Written as comma-separated key=value pairs:
+ *
+ *   cpu=150%            CPU time per period, in percent of one CPU (cpu.max)
+ *   memory=512M         Memory in bytes, K/M/G suffixes allowed (memory.max)
+ *   pids=64             Number of processes and threads (pids.max)
+ *   io=8:0 wbps=1048576 A line of io.max for one device; may be repeated
+ */
+typedef struct {
+    long long cpu_quota_us;      // Microseconds per CGROUP_CPU_PERIOD_US, 0 for no limit
+    long long memory_max;        // Bytes, 0 for no limit
+    long long pids_max;          // 0 for no limit
+    char io_max[CGROUP_MAX_IO_DEVICES][64];  // io.max lines
+    int io_count;
+} CgroupLimits;
+
+/**
+ * Resource usage of everything that ran in a cgroup, including processes
+ * the task left behind or that were never waited for
+ */
+typedef struct {
+    double user_cpu;             // User CPU seconds (cpu.stat)
+    double sys_cpu;              // System CPU seconds (cpu.stat)
+    long memory_peak_kb;         // Peak memory charged, page cache included (memory.peak), -1 if unknown
+    long long io_read_bytes;     // Bytes read from block devices (io.stat), -1 if unknown
+    long long io_write_bytes;    // Bytes written to block devices (io.stat), -1 if unknown
+} CgroupStats;
+
+/**
+ * The cgroup of one run
+ */
+typedef struct {
+    char path[PATH_MAX];
+    int dir_fd;                  // The cgroup directory, -1 if there is none
+    int kill_fd;                 // Its cgroup.kill, -1 if the kernel has none
+} TaskCgroup;
+
+/**
+ * Load cgroup settings. Missing files, sections or keys keep the defaults
+ * (disabled).
+ *
+ * @param config_path Path to the config file (NULL for the default path)
+ * @param config Pointer to store the settings
+ * @return true on success, false if the file exists but cannot be parsed
+ */
+bool cgroup_load_config(const char *config_path, CgroupConfig *config);
+
+/**
+ * Prepare the root under which runs get their cgroups. If the root is the
+ * daemon's own cgroup, the daemon moves into a "scheduler" leaf below it,
+ * since cgroup v2 only hands controllers to children of cgroups without
+ * processes. Every available controller among cpu, memory, io and pids is
+ * enabled for the children. Without a usable root, tasks run in the
+ * daemon's cgroup as before.
+ *
+ * @param config cgroup settings
+ * @return true if runs get cgroups, false otherwise
+ */
+bool cgroup_init(const CgroupConfig *config);
+
+/**
+ * Whether runs get cgroups
+ *
+ * @return true after a successful cgroup_init()
+ */
+bool cgroup_enabled(void);
+
+/**
+ * Parse a limits string
+ *
+ * @param text Limits, empty or NULL for none
+ * @param limits Pointer to store the limits
+ * @param error Buffer for the reason of a failure
+ * @param error_size Size of the error buffer
+ * @return true on success, false if the text is malformed
+ */
+bool cgroup_parse_limits(const char *text, CgroupLimits *limits, char *error, size_t error_size);
+
+/**
+ * Create the cgroup of one run and apply limits to it. The task's own
+ * limits win over the configured default ones. A limit whose controller is
+ * not available is logged and skipped.
+ *
+ * @param task_id ID of the task
+ * @param limits The task's limits string, empty or NULL for the defaults
+ * @param cgroup Pointer to store the cgroup
+ * @return true on success, false if cgroups are disabled or on failure
+ */
+bool cgroup_create(int task_id, const char *limits, TaskCgroup *cgroup);
+
+/**
+ * Read the resource usage of a run's cgroup
+ *
+ * @param cgroup The cgroup
+ * @param stats Pointer to store the usage
+ * @return true on success, false on failure
+ */
+bool cgroup_collect(const TaskCgroup *cgroup, CgroupStats *stats);
+
+/**
+ * Close a run's cgroup and remove it. A cgroup that still has processes
+ * (left running in the background by the task) is removed by a later
+ * cgroup_create() once it has emptied.
+ *
+ * @param cgroup The cgroup
+ */
+void cgroup_destroy(TaskCgroup *cgroup);
+
+#endif /* CGROUP_H */
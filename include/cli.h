@@ -63,6 +63,12 @@ bool cli_parse_time(const char *time_str, time_t *result);
  */
 void cli_run_interactive(const char *data_dir);
 
+/**
+ * Make interactive mode return, ending the prompt it waits on.
+ * Safe to call from a signal handler.
+ */
+void cli_request_stop(void);
+
 /**
  * Get a command from the user (interactive mode)
  * 
@@ -102,9 +108,20 @@ void cli_help(int argc, char *argv[]);
 void cli_add_dependency(int argc, char *argv[]);
 void cli_remove_dependency(int argc, char *argv[]);
 void cli_set_dep_behavior(int argc, char *argv[]);
+void cli_run_workflow(int argc, char *argv[]);
+void cli_workflow_status(int argc, char *argv[]);
+void cli_task_output(int argc, char *argv[]);
+void cli_tail_task(int argc, char *argv[]);
+void cli_critical_path(int argc, char *argv[]);
 void cli_convert_to_script(int argc, char *argv[]);
 void cli_convert_to_command(int argc, char *argv[]);
 
+/**
+ * CLI commands for bulk import and export of task definitions
+ */
+void cli_import_tasks(int argc, char *argv[]);
+void cli_export_tasks(int argc, char *argv[]);
+
 /**
  * CLI commands for email configuration
  */
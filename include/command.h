@@ -0,0 +1,55 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdbool.h>
+#include <limits.h>
+
+#define COMMAND_MAX_ARGS 64
+#define COMMAND_MAX_LENGTH 1024
+#define COMMAND_CACHE_SLOTS 1024
+#define COMMAND_PATH_CACHE_SLOTS 256
+
+/**
+ * A command that can be executed without a shell: a program and its
+ * arguments. argv points into text.
+ */
+typedef struct {
+    char path[PATH_MAX];                 // Program to execute
+    char *argv[COMMAND_MAX_ARGS + 1];    // NULL-terminated argument vector
+    char text[COMMAND_MAX_LENGTH];       // The arguments, NUL-separated
+} CommandPlan;
+
+/**
+ * Commands are parsed once and the result is kept in a process-wide
+ * cache keyed by the command text. A command made only of plain words
+ * separated by blanks, whose program is not a shell builtin and can be
+ * found, is executed directly. Anything else (quotes, expansions,
+ * redirections, pipes, lists, assignments) needs /bin/sh. Program names
+ * are resolved through a cache of PATH lookups, dropped whenever PATH
+ * changes.
+ */
+
+/**
+ * Get the direct execution plan of a command
+ *
+ * @param command Command text
+ * @param plan Pointer to store the plan
+ * @return true if the command can be executed directly, false if it
+ *         needs a shell
+ */
+bool command_plan(const char *command, CommandPlan *plan);
+
+/**
+ * Remember that a command needs a shell after all, e.g. because its
+ * program could not be executed directly
+ *
+ * @param command Command text
+ */
+void command_require_shell(const char *command);
+
+/**
+ * Drop every cached command and PATH lookup
+ */
+void command_cache_clear(void);
+
+#endif /* COMMAND_H */
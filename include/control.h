@@ -0,0 +1,70 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/un.h>
+
+#define CONTROL_SOCKET_NAME "control.sock"
+#define CONTROL_MAX_CLIENTS 64
+
+struct ControlClient;
+
+/**
+ * Control interface of a running scheduler: a Unix socket in the data
+ * directory served by one thread with epoll. Every request is one line,
+ * answered by "ok" or "error <reason>" on a line of its own:
+ *
+ *   tail <task_id>   Stream the output of the task's current run: the
+ *                    kept backlog first, then output as it arrives, until
+ *                    the run ends and the connection is closed. A client
+ *                    that reads too slowly skips ahead and finds a
+ *                    "[... N bytes skipped ...]" line in the stream.
+ *
+ * Sockets are never written with more than the kernel accepts at once,
+ * so a stalled client holds up nobody. One server per process.
+ */
+typedef struct {
+    char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    int listen_fd;
+    int epoll_fd;
+    int stop_fd;                 // eventfd that tells the thread to exit
+    pthread_t thread;
+    bool running;
+    struct ControlClient *clients;  // Connected clients
+    int client_count;
+} ControlServer;
+
+/**
+ * Start serving the control socket. Fails if another live process
+ * already serves socket_path; a stale socket file is replaced.
+ *
+ * @param server Pointer to the server structure
+ * @param socket_path Path of the socket
+ * @return true on success, false on failure
+ */
+bool control_start(ControlServer *server, const char *socket_path);
+
+/**
+ * Stop serving, disconnect every client and remove the socket file
+ *
+ * @param server Pointer to the server structure
+ */
+void control_stop(ControlServer *server);
+
+/**
+ * Follow the current run of a task through a control socket, copying its
+ * output to out_fd until the run ends
+ *
+ * @param socket_path Path of the socket
+ * @param task_id ID of the task
+ * @param out_fd Descriptor to copy the output to
+ * @param error Buffer for the reason of a failure
+ * @param error_size Size of the error buffer
+ * @return true if the run was followed to its end, false on failure
+ */
+bool control_tail(const char *socket_path, int task_id, int out_fd,
+                  char *error, size_t error_size);
+
+#endif /* CONTROL_H */
@@ -1,14 +1,129 @@
 #ifndef DB_H
 #define DB_H
 
-#include <sqlite3.h>
 #include <stdbool.h>
 #include "task.h"
+#include "utils.h"
+#include "depgraph.h"
 
 /**
- * Initialize the database
+ * Persisted state of a workflow run. Node states are stored one byte per
+ * task, in the same order as task_ids.
+ */
+typedef struct {
+    int run_id;                  // Unique run ID
+    int root_task_id;            // Task that triggered the run
+    time_t start_time;           // When the run started
+    time_t end_time;             // When the run finished (0 while running)
+    int status;                  // WorkflowRunStatus
+    int node_count;              // Number of tasks in the run
+    int *task_ids;               // Task IDs in topological order
+    unsigned char *node_states;  // WorkflowNodeState per task
+} WorkflowRunRecord;
+
+/**
+ * Run state of a task, enough to seed the dependency graph without loading
+ * the whole row
+ */
+typedef struct {
+    int id;                      // Task ID
+    time_t last_run_time;        // Last run (0 if never run)
+    int exit_code;               // Exit code of the last run
+    double avg_runtime;          // Smoothed runtime in seconds
+} TaskSummary;
+
+/**
+ * Persistent ID counters, stored in the meta table
+ */
+typedef enum {
+    DB_COUNTER_TASK_ID,          // Task IDs
+    DB_COUNTER_RUN_ID            // Workflow run IDs
+} DbIdCounter;
+
+/**
+ * What started a task execution
+ */
+typedef enum {
+    RUN_TRIGGER_SCHEDULE,        // Due according to the task's schedule
+    RUN_TRIGGER_MANUAL,          // Requested by a user
+    RUN_TRIGGER_WORKFLOW         // Part of a workflow run
+} TaskRunTrigger;
+
+/**
+ * One row of the execution history (task_runs table)
+ */
+typedef struct {
+    int task_id;                 // Executed task
+    int run_id;                  // Workflow run ID, 0 outside workflow runs
+    TaskRunTrigger trigger;      // What started the execution
+    double start_time;           // Wall-clock start (seconds since the epoch)
+    double end_time;             // Wall-clock end (seconds since the epoch)
+    double duration;             // Elapsed seconds
+    int exit_code;               // Exit status, -1 if the command did not exit normally
+    int term_signal;             // Terminating signal, 0 if none
+    bool timed_out;              // Killed after exceeding max_runtime
+    double user_cpu;             // User CPU seconds
+    double sys_cpu;              // System CPU seconds
+    long max_rss_kb;             // Peak resident set size in KB
+    long memory_peak_kb;         // Peak memory of the run's cgroup in KB, -1 if not measured
+    long long io_read_bytes;     // Block device bytes read by the run's cgroup, -1 if not measured
+    long long io_write_bytes;    // Block device bytes written by the run's cgroup, -1 if not measured
+    CapturedOutput output;       // Captured stdout
+    CapturedOutput error_output; // Captured stderr
+} TaskRunRecord;
+
+/**
+ * Where the db_* functions keep their data
+ */
+typedef enum {
+    DB_BACKEND_SQLITE,       // One SQLite database file in WAL mode
+    DB_BACKEND_JOURNAL       // Memory-mapped binary snapshot plus an append-only journal
+} DbBackend;
+
+/**
+ * How hard committed writes are pushed to disk. The SQLite database always
+ * runs in WAL mode, so readers never block the writer.
+ */
+typedef enum {
+    DB_DURABILITY_STRICT,    // synchronous=FULL / fsync per commit: every commit survives power loss
+    DB_DURABILITY_BALANCED,  // synchronous=NORMAL / fsync per checkpoint: last commits may be lost on power loss
+    DB_DURABILITY_FAST       // synchronous=OFF / no fsync: the OS decides when data reaches disk
+} DbDurability;
+
+/**
+ * Storage settings, read from the "storage" section of the config file
+ */
+typedef struct {
+    DbBackend backend;           // "backend": "sqlite" or "journal" (one process per data directory)
+    DbDurability durability;     // "durability": "strict", "balanced" or "fast"
+    int cache_size_kb;           // "cache_size_kb": page cache size
+    int mmap_size_mb;            // "mmap_size_mb": memory-mapped I/O window (0 disables)
+    int busy_timeout_ms;         // "busy_timeout_ms": wait for locks held by other processes
+    int wal_autocheckpoint;      // "wal_autocheckpoint": WAL pages between automatic checkpoints
+    int history_days;            // "history_days": drop execution history older than this (0 keeps all)
+    int history_max_rows;        // "history_max_rows": keep at most this many history rows (0 for no limit)
+    int history_output_kb;       // "history_output_kb": stdout and stderr kept per run, head plus tail (0 disables capture)
+    int resident_max_tasks;      // "resident_max_tasks": tasks kept in memory when there are more in total
+    int resident_window_sec;     // "resident_window_sec": tasks due this far ahead are kept in memory
+    int journal_compact_mb;      // "journal_compact_mb": journal size that triggers a new snapshot
+    int script_cache_kb;         // "script_cache_kb": decompressed script bodies kept in memory
+    int read_connections;        // "read_connections": read-only connections for lookups (0 reads through the writer)
+} DbStorageConfig;
+
+/**
+ * Load storage settings. Missing files, sections or keys keep the defaults.
+ * 
+ * @param config_path Path to the config file (NULL for the default path)
+ * @param config Pointer to store the settings
+ * @return true on success, false if the file exists but cannot be parsed
+ */
+bool db_load_storage_config(const char *config_path, DbStorageConfig *config);
+
+/**
+ * Initialize the database with the backend selected in the storage config
  * 
- * @param db_path Path to the database file
+ * @param db_path Path to the database file (the journal backend adds
+ *                suffixes for its files)
  * @return true on success, false on failure
  */
 bool db_init(const char *db_path);
@@ -18,6 +133,36 @@ bool db_init(const char *db_path);
  */
 void db_cleanup(void);
 
+/**
+ * Begin a transaction. The calling thread keeps exclusive use of the
+ * connection until db_commit_transaction or db_rollback_transaction.
+ * 
+ * @return true on success, false on failure
+ */
+bool db_begin_transaction(void);
+
+/**
+ * Commit the transaction begun by db_begin_transaction
+ * 
+ * @return true on success, false on failure (the transaction is rolled back)
+ */
+bool db_commit_transaction(void);
+
+/**
+ * Roll back the transaction begun by db_begin_transaction
+ */
+void db_rollback_transaction(void);
+
+/**
+ * Fold logged changes back into the main file: copy committed WAL content
+ * into the SQLite database, or compact a large journal into a new snapshot
+ * 
+ * @param truncate SQLite: also wait for readers and truncate the WAL to zero
+ *                 bytes. Journal: compact at an eighth of the configured size.
+ * @return true on success, false on failure
+ */
+bool db_checkpoint(bool truncate);
+
 /**
  * Save a task to the database
  * 
@@ -26,6 +171,28 @@ void db_cleanup(void);
  */
 bool db_save_task(const Task *task);
 
+/**
+ * Insert many new tasks and the dependency rows between them in one
+ * transaction; either all of them are written or none
+ * 
+ * @param tasks Tasks to insert (IDs already assigned)
+ * @param count Number of tasks
+ * @param task_ids Dependent task of each dependency row
+ * @param dependency_ids Task depended upon for each dependency row
+ * @param edge_count Number of dependency rows
+ * @return true on success, false on failure
+ */
+bool db_import_tasks(const Task *tasks, int count, const int *task_ids,
+                     const int *dependency_ids, int edge_count);
+
+/**
+ * Insert a task, or overwrite every column of the existing row
+ * 
+ * @param task Pointer to the task to write
+ * @return true on success, false on failure
+ */
+bool db_upsert_task(const Task *task);
+
 /**
  * Update a task in the database
  * 
@@ -34,6 +201,15 @@ bool db_save_task(const Task *task);
  */
 bool db_update_task(const Task *task);
 
+/**
+ * Write only the run-state columns of a task (next and last run time,
+ * exit code, last run ID and average runtime)
+ * 
+ * @param task Pointer to the task to update
+ * @return true on success, false on failure
+ */
+bool db_update_task_status(const Task *task);
+
 /**
  * Delete a task from the database
  * 
@@ -61,10 +237,192 @@ bool db_load_tasks(Task **tasks, int *count);
 bool db_get_task(int task_id, Task *task);
 
 /**
- * Get the next available task ID
+ * Load the tasks with IDs above a given one, ordered by ID, so that large
+ * task sets can be listed a page at a time
+ * 
+ * @param after_id Only tasks with a greater ID are loaded (0 for the first page)
+ * @param limit Maximum number of tasks to load
+ * @param tasks Pointer to store the array (caller must free, NULL if none)
+ * @param count Pointer to store the number of tasks
+ * @return true on success, false on failure
+ */
+bool db_load_tasks_page(int after_id, int limit, Task **tasks, int *count);
+
+/**
+ * Count the tasks in the database
+ * 
+ * @return Number of tasks, -1 on failure
+ */
+int db_count_tasks(void);
+
+/**
+ * Load the run state of every task, ordered by ID
+ * 
+ * @param summaries Pointer to store the array (caller must free)
+ * @param count Pointer to store the number of entries
+ * @return true on success, false on failure
+ */
+bool db_load_task_summaries(TaskSummary **summaries, int *count);
+
+/**
+ * Get the enabled, scheduled tasks due at or before a time, soonest first
+ * 
+ * @param until Latest next_run_time to include
+ * @param limit Maximum number of IDs to return
+ * @param ids Pointer to store the array of IDs (caller must free)
+ * @param count Pointer to store the number of IDs
+ * @return true on success, false on failure
+ */
+bool db_get_due_task_ids(time_t until, int limit, int **ids, int *count);
+
+/**
+ * Reserve a block of consecutive IDs. Blocks handed to different threads,
+ * connections or processes never overlap; IDs are never handed out twice.
+ * Unused IDs are skipped unless given back with db_release_ids.
  * 
- * @return Next available ID
+ * @param counter Counter to draw from
+ * @param count Number of IDs to reserve
+ * @param first Pointer to store the first ID of the block
+ * @return true on success, false on failure
+ */
+bool db_reserve_ids(DbIdCounter counter, int count, int *first);
+
+/**
+ * Give back the unused end of a reserved block, so the next reservation
+ * starts there. This only happens while no later block has been reserved;
+ * otherwise the IDs stay skipped.
+ * 
+ * @param counter Counter the block was reserved from
+ * @param first First unused ID of the block
+ * @param limit End of the block (one past its last ID)
+ * @return true if the IDs were given back, false otherwise
+ */
+bool db_release_ids(DbIdCounter counter, int first, int limit);
+
+/**
+ * Reserve a single task ID
+ * 
+ * @return Task ID, -1 on failure
  */
 int db_get_next_id(void);
 
+/**
+ * Add a dependency row (task_id depends on dependency_id)
+ * 
+ * @param task_id ID of the dependent task
+ * @param dependency_id ID of the task depended upon
+ * @return true on success, false on failure
+ */
+bool db_add_dependency(int task_id, int dependency_id);
+
+/**
+ * Remove a dependency row
+ * 
+ * @param task_id ID of the dependent task
+ * @param dependency_id ID of the task depended upon
+ * @return true on success, false on failure
+ */
+bool db_remove_dependency(int task_id, int dependency_id);
+
+/**
+ * Load every dependency edge into a graph with a single ordered query
+ * 
+ * @param graph Graph to fill (previous contents are replaced)
+ * @return true on success, false on failure
+ */
+bool db_load_dependencies(DepGraph *graph);
+
+/**
+ * Reserve a single workflow run ID
+ * 
+ * @return Run ID, -1 on failure
+ */
+int db_get_next_run_id(void);
+
+/**
+ * Insert or replace the persisted state of a workflow run
+ * 
+ * @param run Run record to save
+ * @return true on success, false on failure
+ */
+bool db_save_workflow_run(const WorkflowRunRecord *run);
+
+/**
+ * Load the persisted state of a workflow run
+ * 
+ * @param run_id ID of the run
+ * @param run Record to fill; task_ids and node_states are newly allocated
+ *            (caller must free)
+ * @return true on success, false if not found or on failure
+ */
+bool db_get_workflow_run(int run_id, WorkflowRunRecord *run);
+
+/**
+ * Append a row to the execution history
+ * 
+ * @param run Pointer to the record to insert
+ * @return true on success, false on failure
+ */
+bool db_insert_task_run(const TaskRunRecord *run);
+
+/**
+ * Load the most recent execution history row of a task
+ * 
+ * @param task_id ID of the task
+ * @param run Record to fill; output.data and error_output.data are newly
+ *            allocated (caller must free)
+ * @return true on success, false if the task has no recorded run or on failure
+ */
+bool db_get_last_task_run(int task_id, TaskRunRecord *run);
+
+/**
+ * Delete execution history beyond the configured age and row limits. Rows
+ * are deleted in small chunks so other writers are not held up.
+ * 
+ * @return Number of rows deleted, -1 on failure
+ */
+int db_prune_task_runs(void);
+
+/**
+ * Store a compressed script body under its hash. Storing a hash that
+ * already exists keeps the body and refreshes its timestamp.
+ * 
+ * @param hash Content address of the body (see scripts.h)
+ * @param blob Compressed body
+ * @param size Number of compressed bytes
+ * @param raw_size Length of the body before compression
+ * @return true on success, false on failure
+ */
+bool db_save_script(const char *hash, const unsigned char *blob, size_t size, size_t raw_size);
+
+/**
+ * Load a compressed script body
+ * 
+ * @param hash Content address of the body
+ * @param blob Pointer to store the compressed body (caller must free)
+ * @param size Pointer to store the number of compressed bytes
+ * @param raw_size Pointer to store the length of the body before compression
+ * @return true if found, false otherwise
+ */
+bool db_load_script(const char *hash, unsigned char **blob, size_t *size, size_t *raw_size);
+
+/**
+ * Get the length a script body had before compression, without reading
+ * the body
+ * 
+ * @param hash Content address of the body
+ * @param raw_size Pointer to store the length
+ * @return true if found, false otherwise
+ */
+bool db_get_script_size(const char *hash, size_t *raw_size);
+
+/**
+ * Delete script bodies no task refers to. Bodies stored within the last
+ * day are kept, so a script is never collected between being stored and
+ * the task that refers to it being written.
+ * 
+ * @return Number of scripts deleted, -1 on failure
+ */
+int db_prune_scripts(void);
+
 #endif /* DB_H */ 
\ No newline at end of file
@@ -0,0 +1,317 @@
+#ifndef DEPGRAPH_H
+#define DEPGRAPH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Compressed (CSR-style) adjacency lists indexed by the graph's dense node
+ * index. The neighbours of node n are targets[start[n] .. start[n] + count[n]),
+ * kept sorted by task ID, with their nodes at the same positions in nodes.
+ * Each list has room for reserved[n] entries, so adding or removing an edge
+ * only moves entries of its own list. A full list moves to the end with
+ * twice the room; the rooms left behind are reclaimed in one compaction
+ * once they outweigh the lists in use.
+ */
+typedef struct {
+    int *start;          // Node -> first entry of its list
+    int *count;          // Node -> number of neighbours
+    int *reserved;       // Node -> entries reserved for its list
+    int *targets;        // Neighbour task IDs, grouped by owning node
+    int *nodes;          // Node of each neighbour
+    int used;            // Entries taken by lists and their spare room
+    int garbage;         // Entries left behind by lists that moved
+    int edge_count;      // Number of edges
+    int edge_capacity;   // Allocated entries in targets and nodes
+    int node_capacity;   // Nodes 0 .. node_capacity - 1 are addressable
+} DepAdjacency;
+
+/**
+ * Result of adding a dependency edge
+ */
+typedef enum {
+    DEP_EDGE_OK = 0,        // Edge added (or already present)
+    DEP_EDGE_CYCLE,         // Edge rejected: it would close a cycle
+    DEP_EDGE_NOT_FOUND,     // One or both tasks do not exist
+    DEP_EDGE_ERROR          // Allocation or storage failure
+} DepEdgeResult;
+
+/**
+ * Timing of one task on its workflow's critical path analysis (seconds,
+ * relative to the start of the workflow)
+ */
+typedef struct {
+    int task_id;             // Task ID
+    double duration;         // Expected runtime
+    double earliest_start;   // Earliest start once all upstream tasks finished
+    double earliest_finish;  // earliest_start + duration
+    double latest_start;     // Latest start that does not delay the workflow
+    double slack;            // latest_start - earliest_start
+    bool critical;           // On a longest path (no slack)
+} DepPathNode;
+
+/**
+ * Critical path analysis of a connected group of tasks
+ */
+typedef struct {
+    DepPathNode *nodes;      // All tasks of the group, in topological order
+    int node_count;          // Number of tasks
+    int *path;               // Task IDs of one critical path, first to last
+    int path_length;         // Number of tasks on the path
+    double makespan;         // Expected time from start to the last finish
+} DepCriticalPath;
+
+/**
+ * Dependency graph shared by the scheduler and the database loader.
+ * Both directions are stored so fan-in and fan-out lookups are O(1) + O(degree).
+ *
+ * A task gets a dense node index the first time it has an edge, a runtime
+ * or a completed run, and gives it back when it is removed. Every per-task
+ * array is indexed by node, so memory follows the number of tasks in the
+ * graph rather than the highest task ID.
+ *
+ * A topological order of all nodes is maintained online (Pearce-Kelly):
+ * adding an edge only reorders the tasks between its two endpoints, and an
+ * edge that would close a cycle is detected during that same search.
+ * Levels (longest path from a root) are derived from the order lazily.
+ *
+ * The last-run state of every task is kept as one bit per node, and each
+ * task's dependencies as a sparse list of 64-node blocks with a bit mask per
+ * block, so dependency satisfaction is a handful of word-wide AND/OR
+ * reductions instead of a walk over the dependency IDs.
+ */
+typedef struct {
+    DepAdjacency upstream;   // task -> tasks it depends on
+    DepAdjacency downstream; // task -> tasks that depend on it
+
+    int *node_ids;           // Node -> task ID, -1 for a free node
+    int *slots;              // Open-addressing table of nodes, keyed by task ID
+    int slot_capacity;       // Entries in slots, a power of two
+    int *free_nodes;         // Nodes of removed tasks, handed out first
+    int free_count;          // Entries in free_nodes
+    int node_count;          // Nodes handed out so far, free ones included
+    int node_capacity;       // Entries in every per-node array
+
+    int *order;              // Node -> position in topological order
+    int *by_order;           // Position -> node
+
+    unsigned char *mark;     // Scratch: visited flags for the reorder search
+    int *stack;              // Scratch: DFS stack
+    int *affected;           // Scratch: nodes to reorder
+    int *pool;               // Scratch: positions being reassigned
+
+    double *duration;        // Node -> expected runtime in seconds
+    double *finish;          // Node -> earliest finish, maintained incrementally
+
+    uint64_t *completed_bits; // Bit per node: has run at least once
+    uint64_t *succeeded_bits; // Bit per node: last run exited with 0
+    int *mask_offsets;       // mask_node_capacity + 1 entries into mask_blocks/mask_words
+    int *mask_blocks;        // Block index (node / 64) of each dependency word
+    uint64_t *mask_words;    // Dependencies of the task within that block
+    int mask_node_capacity;  // Nodes covered by mask_offsets
+    int mask_capacity;       // Allocated entries in mask_blocks/mask_words
+    bool masks_dirty;        // Dependency masks must be rebuilt before use
+
+    int *levels;             // Node -> topological level
+    int *level_offsets;      // level_count + 1 entries into level_nodes
+    int *level_nodes;        // Task IDs of tasks with at least one edge, grouped by level
+    int level_count;         // Number of levels
+    bool levels_dirty;       // Levels must be recomputed before use
+} DepGraph;
+
+/**
+ * Initialize an empty dependency graph
+ *
+ * @param graph Pointer to the graph structure
+ * @return true on success, false on failure
+ */
+bool depgraph_init(DepGraph *graph);
+
+/**
+ * Free all memory held by a dependency graph
+ *
+ * @param graph Pointer to the graph structure
+ */
+void depgraph_free(DepGraph *graph);
+
+/**
+ * Replace the graph contents with a list of edges in one pass
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_ids Dependent task of each edge
+ * @param dependency_ids Task depended upon for each edge
+ * @param count Number of edges
+ * @return true on success, false on failure
+ */
+bool depgraph_load(DepGraph *graph, const int *task_ids, const int *dependency_ids, int count);
+
+/**
+ * Add many dependency edges at once: the new edges are merged with the
+ * existing ones and the graph is rebuilt in one pass, instead of reordering
+ * it edge by edge. Nothing changes if the merged graph would have a cycle.
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_ids Dependent task of each new edge
+ * @param dependency_ids Task depended upon for each new edge
+ * @param count Number of new edges
+ * @return DEP_EDGE_OK on success, DEP_EDGE_CYCLE if the edges would create a
+ *         cycle, DEP_EDGE_ERROR on failure
+ */
+DepEdgeResult depgraph_add_dependencies(DepGraph *graph, const int *task_ids,
+                                        const int *dependency_ids, int count);
+
+/**
+ * Add a dependency edge (task_id depends on dependency_id)
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the dependent task
+ * @param dependency_id ID of the task depended upon
+ * @return DEP_EDGE_OK on success (including an already existing edge),
+ *         DEP_EDGE_CYCLE if the edge would create a cycle, DEP_EDGE_ERROR on failure
+ */
+DepEdgeResult depgraph_add_dependency(DepGraph *graph, int task_id, int dependency_id);
+
+/**
+ * Remove a dependency edge
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the dependent task
+ * @param dependency_id ID of the task depended upon
+ * @return true if the edge existed and was removed, false otherwise
+ */
+bool depgraph_remove_dependency(DepGraph *graph, int task_id, int dependency_id);
+
+/**
+ * Remove every edge touching a task
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the task being deleted
+ */
+void depgraph_remove_task(DepGraph *graph, int task_id);
+
+/**
+ * Get the tasks a task depends on
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the task
+ * @param count Pointer to store the number of dependencies
+ * @return Pointer into the graph (valid until the next modification), NULL if none
+ */
+const int* depgraph_get_dependencies(const DepGraph *graph, int task_id, int *count);
+
+/**
+ * Get the tasks that depend on a task
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the task
+ * @param count Pointer to store the number of dependents
+ * @return Pointer into the graph (valid until the next modification), NULL if none
+ */
+const int* depgraph_get_dependents(const DepGraph *graph, int task_id, int *count);
+
+/**
+ * Check whether a dependency edge exists
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the dependent task
+ * @param dependency_id ID of the task depended upon
+ * @return true if task_id depends on dependency_id
+ */
+bool depgraph_has_dependency(const DepGraph *graph, int task_id, int dependency_id);
+
+/**
+ * Collect the weakly connected component containing a task, i.e. every task
+ * reachable by following dependency edges in either direction
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the task
+ * @param ids Pointer to store a newly allocated array of task IDs in
+ *            topological order (caller must free)
+ * @param count Pointer to store the number of tasks
+ * @return true on success, false on failure
+ */
+bool depgraph_get_component(DepGraph *graph, int task_id, int **ids, int *count);
+
+/**
+ * Record the outcome of a task's last run
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the task
+ * @param completed Whether the task has run at least once
+ * @param succeeded Whether its last run exited with code 0
+ * @return true on success, false on failure
+ */
+bool depgraph_set_task_state(DepGraph *graph, int task_id, bool completed, bool succeeded);
+
+/**
+ * Check a task's dependencies against the recorded task states
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the task
+ * @param require_success Count only dependencies whose last run succeeded
+ *                        (otherwise any that have run)
+ * @param require_all Require every dependency (otherwise at least one)
+ * @return true if satisfied or the task has no dependencies
+ */
+bool depgraph_dependencies_satisfied(DepGraph *graph, int task_id,
+                                     bool require_success, bool require_all);
+
+/**
+ * Get the topological level of a task (0 for tasks without dependencies)
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the task
+ * @return Level of the task
+ */
+int depgraph_get_level(DepGraph *graph, int task_id);
+
+/**
+ * Get the number of topological levels among tasks that have edges
+ *
+ * @param graph Pointer to the graph structure
+ * @return Number of levels, 0 if the graph has no edges
+ */
+int depgraph_get_level_count(DepGraph *graph);
+
+/**
+ * Get the tasks on one topological level. Only tasks with at least one edge
+ * are listed; tasks without edges are implicitly on level 0.
+ *
+ * @param graph Pointer to the graph structure
+ * @param level Level to query
+ * @param count Pointer to store the number of tasks
+ * @return Pointer into the graph (valid until the next modification), NULL if none
+ */
+const int* depgraph_get_level_nodes(DepGraph *graph, int level, int *count);
+
+/**
+ * Set the expected runtime of a task. Earliest finish times of the task and
+ * everything downstream of it are updated incrementally.
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of the task
+ * @param seconds Expected runtime in seconds
+ * @return true on success, false on failure
+ */
+bool depgraph_set_duration(DepGraph *graph, int task_id, double seconds);
+
+/**
+ * Compute the critical path, makespan and per-task slack of the connected
+ * group of tasks containing a task. Earliest times come from the
+ * incrementally maintained values; latest times are derived on each call.
+ *
+ * @param graph Pointer to the graph structure
+ * @param task_id ID of any task in the group
+ * @param result Pointer to store the analysis (free with depgraph_free_critical_path)
+ * @return true on success, false on failure
+ */
+bool depgraph_get_critical_path(DepGraph *graph, int task_id, DepCriticalPath *result);
+
+/**
+ * Free the arrays of a critical path analysis
+ *
+ * @param result Pointer to the analysis
+ */
+void depgraph_free_critical_path(DepCriticalPath *result);
+
+#endif /* DEPGRAPH_H */
@@ -0,0 +1,74 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#define EXECUTOR_DEFAULT_WORKERS 4
+
+/**
+ * Function run by an executor worker
+ */
+typedef void (*ExecutorJobFunc)(void *arg);
+
+/**
+ * Queued unit of work
+ */
+typedef struct ExecutorJob {
+    ExecutorJobFunc func;        // Function to run
+    void *arg;                   // Argument passed to func
+    struct ExecutorJob *next;    // Next job in the queue
+} ExecutorJob;
+
+/**
+ * Fixed-size pool of worker threads fed from a FIFO queue.
+ * Workers are started lazily on the first submitted job.
+ */
+typedef struct {
+    pthread_t *workers;          // Worker threads
+    int worker_count;            // Number of workers to run
+    int started;                 // Number of workers actually started
+    ExecutorJob *head;           // First queued job
+    ExecutorJob *tail;           // Last queued job
+    int active;                  // Jobs currently running
+    bool stopping;               // Workers should exit once the queue is drained
+    pthread_mutex_t lock;        // Protects the queue and counters
+    pthread_cond_t work_ready;   // Signalled when a job is queued or on stop
+    pthread_cond_t idle;         // Signalled when the pool becomes idle
+} Executor;
+
+/**
+ * Initialize an executor
+ *
+ * @param executor Pointer to the executor structure
+ * @param worker_count Number of worker threads (<= 0 for the default)
+ * @return true on success, false on failure
+ */
+bool executor_init(Executor *executor, int worker_count);
+
+/**
+ * Queue a job for execution on the pool
+ *
+ * @param executor Pointer to the executor structure
+ * @param func Function to run
+ * @param arg Argument passed to func
+ * @return true if the job was queued, false on failure
+ */
+bool executor_submit(Executor *executor, ExecutorJobFunc func, void *arg);
+
+/**
+ * Wait until the queue is empty and no job is running. Jobs may submit
+ * further jobs; those are waited for as well.
+ *
+ * @param executor Pointer to the executor structure
+ */
+void executor_wait_idle(Executor *executor);
+
+/**
+ * Drain the queue, stop the workers and free resources
+ *
+ * @param executor Pointer to the executor structure
+ */
+void executor_shutdown(Executor *executor);
+
+#endif /* EXECUTOR_H */
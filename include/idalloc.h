@@ -0,0 +1,64 @@
+#ifndef IDALLOC_H
+#define IDALLOC_H
+
+#include "db.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IDALLOC_DEFAULT_BLOCK_SIZE 32
+
+/**
+ * Hands out IDs from blocks reserved in the database. The current block is
+ * one 64-bit word (limit in the high half, next ID in the low half) taken
+ * from with compare-and-swap, so allocation does not lock or touch the
+ * database until the block runs out. IDs left in the block are given back
+ * when the allocator is destroyed, unless another process has reserved a
+ * block since; then they are skipped, never reused.
+ */
+typedef struct {
+    uint64_t window;             // (limit << 32) | next; empty while next >= limit
+    DbIdCounter counter;         // Database counter blocks are reserved from
+    int block_size;              // IDs reserved per refill
+    pthread_mutex_t refill_lock; // Serializes refills
+} IdAllocator;
+
+/**
+ * Initialize an allocator. The first block is reserved on first use.
+ *
+ * @param allocator Pointer to the allocator structure
+ * @param counter Database counter to draw from
+ * @param block_size IDs to reserve at a time (<= 0 for the default)
+ * @return true on success, false on failure
+ */
+bool idalloc_init(IdAllocator *allocator, DbIdCounter counter, int block_size);
+
+/**
+ * Allocate one ID
+ *
+ * @param allocator Pointer to the allocator structure
+ * @return New ID, -1 on failure
+ */
+int idalloc_next(IdAllocator *allocator);
+
+/**
+ * Allocate a run of consecutive IDs, from the current block if it has room
+ * and from a block reserved for the purpose otherwise
+ *
+ * @param allocator Pointer to the allocator structure
+ * @param count Number of IDs
+ * @param first Pointer to store the first ID
+ * @return true on success, false on failure
+ */
+bool idalloc_next_range(IdAllocator *allocator, int count, int *first);
+
+/**
+ * Give back the unused IDs of the current block and free resources of an
+ * allocator. Call it while the database is still open and no other thread
+ * allocates.
+ *
+ * @param allocator Pointer to the allocator structure
+ */
+void idalloc_destroy(IdAllocator *allocator);
+
+#endif /* IDALLOC_H */
@@ -0,0 +1,123 @@
+#ifndef LIVE_OUTPUT_H
+#define LIVE_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LIVE_OUTPUT_CHUNK_BYTES (16 * 1024)   // Smallest chunk allocated
+#define LIVE_OUTPUT_MAX_IOV 16                // Chunks gathered per send
+
+/**
+ * Output of a running task as it is produced: stdout and stderr
+ * interleaved in arrival order, in chunks kept in a list. Only the last
+ * `backlog` bytes are kept, so a producer never waits for its readers.
+ * Readers hold only a stream position; they gather their next bytes
+ * straight from the chunks, so any number of them costs no copies. A
+ * reader that falls behind the backlog is moved up to its oldest byte
+ * and told how much it missed.
+ *
+ * At most one stream per task is registered: the one of its current run.
+ * Every function here is thread-safe.
+ */
+typedef struct LiveOutput LiveOutput;
+
+/**
+ * Read position of one subscriber
+ */
+typedef struct {
+    LiveOutput *output;          // Stream followed (holds a reference)
+    long long position;          // Stream offset of the next byte to send
+} LiveCursor;
+
+/**
+ * Start the stream of a task's run, replacing the task's previous one
+ *
+ * @param task_id ID of the task
+ * @param backlog Bytes kept for subscribers that join late
+ * @return The stream (finish it with live_output_end()), or NULL on failure
+ */
+LiveOutput* live_output_begin(int task_id, size_t backlog);
+
+/**
+ * Append output to a stream
+ *
+ * @param output The stream
+ * @param data Bytes to append
+ * @param length Number of bytes
+ */
+void live_output_append(LiveOutput *output, const char *data, size_t length);
+
+/**
+ * Count output that was discarded without being read
+ *
+ * @param output The stream
+ * @param length Number of bytes
+ */
+void live_output_skip(LiveOutput *output, size_t length);
+
+/**
+ * Whether anyone follows a stream, i.e. whether output is worth reading
+ * rather than discarding
+ *
+ * @param output The stream
+ * @return true if the stream has subscribers
+ */
+bool live_output_watched(LiveOutput *output);
+
+/**
+ * End a stream: subscribers get what is left, then end of stream. The
+ * caller's reference is released.
+ *
+ * @param output The stream
+ */
+void live_output_end(LiveOutput *output);
+
+/**
+ * Follow the current run of a task, starting from the oldest byte kept
+ *
+ * @param task_id ID of the task
+ * @param cursor Cursor to set up
+ * @return true on success, false if the task is not running
+ */
+bool live_output_subscribe(int task_id, LiveCursor *cursor);
+
+/**
+ * Stop following a stream
+ *
+ * @param cursor The cursor
+ */
+void live_output_unsubscribe(LiveCursor *cursor);
+
+/**
+ * What live_output_send() did
+ */
+typedef enum {
+    LIVE_SEND_PROGRESS,          // Wrote some bytes; call again
+    LIVE_SEND_SKIPPED,           // Had fallen behind the backlog and was moved up
+    LIVE_SEND_IDLE,              // Caught up; the run is still going
+    LIVE_SEND_FULL,              // The descriptor would block
+    LIVE_SEND_END,               // Caught up and the run has ended
+    LIVE_SEND_ERROR              // The write failed (errno tells why)
+} LiveSendResult;
+
+/**
+ * Send what a cursor has not sent yet, with one sendmsg() gathering
+ * straight from the chunks. Never blocks, and a peer that hung up is an
+ * error rather than SIGPIPE.
+ *
+ * @param cursor The cursor
+ * @param fd Socket to write to
+ * @param skipped Pointer to store the bytes jumped over on LIVE_SEND_SKIPPED
+ * @return What happened
+ */
+LiveSendResult live_output_send(LiveCursor *cursor, int fd, long long *skipped);
+
+/**
+ * Descriptor that becomes readable when a followed stream gets output or
+ * ends. Reading it resets it.
+ *
+ * @return An eventfd, or -1 if it could not be created
+ */
+int live_output_event_fd(void);
+
+#endif /* LIVE_OUTPUT_H */
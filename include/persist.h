@@ -0,0 +1,147 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include "task.h"
+#include "db.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+#define PERSIST_DEFAULT_BATCH_SIZE 64
+#define PERSIST_DEFAULT_FLUSH_INTERVAL_MS 100
+#define PERSIST_PRUNE_INTERVAL_SEC 3600
+
+/**
+ * What changed in a dirty task, deciding how its row is written
+ */
+typedef enum {
+    PERSIST_STATUS = 1,          // Run state only: narrow status update
+    PERSIST_DEFINITION = 2       // User-defined fields: the whole row is rewritten
+} PersistKind;
+
+/**
+ * A dirty task in a batch being written
+ */
+typedef struct {
+    int task_id;                 // ID of the task
+    unsigned char kinds;         // PersistKind bits marked since the last write
+} PersistEntry;
+
+/**
+ * Copy the current state of a task for writing.
+ *
+ * @param context Opaque pointer given to persist_init
+ * @param task_id ID of the task
+ * @param task Pointer to store the copy
+ * @return true if the task still exists, false to skip it
+ */
+typedef bool (*PersistLoadFunc)(void *context, int task_id, Task *task);
+
+/**
+ * Write-behind persistence of task rows. Callers mark task IDs dirty; a
+ * background thread coalesces repeated marks of the same task and writes
+ * the latest state of each in one transaction (only the run-state columns
+ * when nothing but the run state changed), once a batch fills up or the
+ * oldest pending mark reaches the flush interval. Execution history rows are
+ * queued the same way and inserted in batches. Writes that fail stay
+ * queued and are retried with a growing delay. While idle, the thread also
+ * applies the history retention limits and deletes unreferenced scripts.
+ */
+typedef struct {
+    pthread_t thread;            // Flusher thread
+    bool started;                // Thread is running
+    bool stopping;               // Thread should flush and exit
+
+    PersistLoadFunc load;        // Reads the current task state
+    void *context;               // Passed to load
+
+    PersistEntry *pending;       // Dirty tasks, each listed once
+    int pending_count;           // Number of dirty tasks
+    int pending_capacity;        // Allocated entries in pending
+    PersistEntry *flushing;      // Batch being written (swapped with pending)
+    int flushing_capacity;       // Allocated entries in flushing
+    unsigned char *queued;       // task ID -> PersistKind bits pending, plus in-flight and failed bits
+    int queued_capacity;         // Entries in queued
+    TaskRunRecord *runs;         // History rows waiting to be inserted
+    int run_count;               // Number of queued history rows
+    int run_capacity;            // Allocated entries in runs
+    TaskRunRecord *runs_flushing; // Rows being inserted (swapped with runs)
+    int runs_flushing_capacity;  // Allocated entries in runs_flushing
+
+    unsigned long marked_seq;    // Bumped on every mark
+    unsigned long flushed_seq;   // Marks up to this value are on disk
+    unsigned long error_seq;     // Sequence of the last flush that failed
+    bool flush_requested;        // A barrier is waiting
+    double retry_delay;          // Seconds between attempts while writes fail (0 after a success)
+    double retry_time;           // Monotonic time before which a failed write is not retried
+    double first_mark_time;      // Monotonic time of the oldest pending mark
+    double next_prune_time;      // Monotonic time of the next retention pass
+
+    int batch_size;              // Flush once this many tasks are dirty
+    int flush_interval_ms;       // Flush once the oldest mark is this old
+
+    pthread_mutex_t lock;        // Protects the fields above
+    pthread_cond_t work_ready;   // Signalled on marks, barriers and stop
+    pthread_cond_t flushed;      // Signalled after every flush
+} Persister;
+
+/**
+ * Initialize a persister and start its thread
+ *
+ * @param persister Pointer to the persister structure
+ * @param load Function reading the current state of a task
+ * @param context Opaque pointer passed to load
+ * @return true on success, false on failure
+ */
+bool persist_init(Persister *persister, PersistLoadFunc load, void *context);
+
+/**
+ * Queue a task row to be written. Marks of a task that is already queued
+ * are merged; a definition mark wins over status marks.
+ *
+ * @param persister Pointer to the persister structure
+ * @param task_id ID of the changed task
+ * @param kind What changed
+ * @return true on success, false on failure
+ */
+bool persist_mark_dirty(Persister *persister, int task_id, PersistKind kind);
+
+/**
+ * Queue an execution history row to be inserted. Only copies the record
+ * and its bounded output, so it is cheap enough for the task completion
+ * path.
+ *
+ * @param persister Pointer to the persister structure
+ * @param run Pointer to the record to queue
+ * @return true on success, false on failure
+ */
+bool persist_record_run(Persister *persister, const TaskRunRecord *run);
+
+/**
+ * Wait until every task marked and every history row queued before the
+ * call has been written
+ *
+ * @param persister Pointer to the persister structure
+ * @return true if the writes covering those marks succeeded, false if one
+ *         failed (what it left unwritten stays queued for a retry)
+ */
+bool persist_flush(Persister *persister);
+
+/**
+ * Check whether a task has no marks waiting, no write in progress and no
+ * failed write since its last successful one, so the database row holds
+ * its latest state
+ *
+ * @param persister Pointer to the persister structure
+ * @param task_id ID of the task
+ * @return true if the row is up to date
+ */
+bool persist_is_clean(Persister *persister, int task_id);
+
+/**
+ * Flush pending writes, stop the thread and free resources
+ *
+ * @param persister Pointer to the persister structure
+ */
+void persist_shutdown(Persister *persister);
+
+#endif /* PERSIST_H */
@@ -0,0 +1,171 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "live_output.h"
+
+/**
+ * Description of a child process to start. Initialize with
+ * process_spec_init() and fill in what differs from the defaults.
+ */
+typedef struct {
+    const char *path;            // Program to execute (absolute or relative path)
+    char *const *argv;           // NULL-terminated argument vector
+    char *const *envp;           // NULL-terminated environment, NULL to inherit ours
+    const char *working_dir;     // Directory to run in, NULL for ours
+    int stdout_fd;               // Descriptor for the child's stdout, -1 to inherit
+    int stderr_fd;               // Descriptor for the child's stderr, -1 to inherit
+    int inherit_fd;              // Close-on-exec descriptor to keep open in the child, -1 for none
+    int cgroup_fd;               // cgroup v2 directory to start the child in, -1 for ours
+    bool new_group;              // Make the child the leader of a new process group
+    bool quiet;                  // Caller handles a failure to start, do not log it
+} ProcessSpec;
+
+/**
+ * Set a process description to its defaults: inherited environment,
+ * working directory and output, same process group
+ *
+ * @param spec Pointer to the description
+ */
+void process_spec_init(ProcessSpec *spec);
+
+/**
+ * Start a child process without duplicating the daemon's address space.
+ * The child starts with an empty signal mask and default signal
+ * dispositions. Failures to change directory, redirect or exec are
+ * reported here rather than as an exit status of the child.
+ *
+ * A child bound for a cgroup is started the same way, on a stack of its
+ * own, and joins the cgroup before it execs, so nothing it starts can
+ * escape the limits.
+ *
+ * @param spec Description of the process to start
+ * @param pid Pointer to store the ID of the new process
+ * @return true if the process was started, false on failure (errno tells why)
+ */
+bool process_spawn(const ProcessSpec *spec, pid_t *pid);
+
+/**
+ * Bounded capture of one output stream. The first half of the limit
+ * keeps the first bytes of the stream, the second half is a ring holding
+ * the last bytes; whatever falls in between is counted and dropped.
+ */
+typedef struct {
+    char *head;                  // First bytes of the stream
+    size_t head_length;
+    char *tail;                  // Ring holding the last bytes
+    size_t tail_start;           // Oldest byte in the ring
+    size_t tail_length;
+    size_t half;                 // Capacity of head and of tail
+    long long total;             // Bytes the stream produced
+} OutputBuffer;
+
+/**
+ * How a watched child ended
+ */
+typedef struct {
+    int status;                  // Wait status, as returned by wait4()
+    struct rusage usage;         // Resources used by the child
+    bool timed_out;              // Killed for running past its deadline
+    int error;                   // errno if the child could not be reaped, 0 otherwise
+    OutputBuffer output;         // Captured stdout (empty if not captured)
+    OutputBuffer error_output;   // Captured stderr (empty if not captured)
+} ProcessExit;
+
+/**
+ * How the reaper supervises a child. Initialize with
+ * process_watch_options_init().
+ */
+typedef struct {
+    int timeout_sec;             // Seconds the child may run, 0 for no limit
+    bool kill_group;             // Kill the child's whole process group on timeout
+    int kill_fd;                 // cgroup.kill of the child's cgroup, used on timeout instead (kept open by the caller); -1 for none
+    int output_fd;               // Read end of the child's stdout pipe, -1 for none
+    int error_fd;                // Read end of the child's stderr pipe, -1 for none
+    size_t output_limit;         // Bytes kept per captured stream, head plus tail
+    LiveOutput *live;            // Stream that also gets the output as it arrives, NULL for none
+} ProcessWatchOptions;
+
+/**
+ * Called on the reaper thread once a watched child has been reaped and
+ * its output drained. func owns the output buffers in outcome and must
+ * release them with output_buffer_free(). Must not block for long: every
+ * other child waits behind it.
+ */
+typedef void (*ProcessExitFunc)(pid_t pid, ProcessExit *outcome, void *arg);
+
+/**
+ * Children are supervised by a single reaper thread, started on first
+ * use. It waits on a pidfd per child with epoll (falling back to a
+ * SIGCHLD self-pipe on kernels without pidfd_open), keeps deadlines in a
+ * min-heap, and kills a child with SIGKILL once its deadline passes.
+ * Output pipes are drained by the same loop as data arrives, so a child
+ * never stalls on a full pipe; once a buffer's head is full, bytes that
+ * would only pass through its ring are spliced to /dev/null unread,
+ * unless someone follows the child's live output.
+ */
+
+/**
+ * Set watch options to their defaults: no timeout, no capture
+ *
+ * @param options Pointer to the options
+ */
+void process_watch_options_init(ProcessWatchOptions *options);
+
+/**
+ * Hand a started child to the reaper. The child must not be waited for
+ * by anyone else. The reaper takes over the output descriptors, also
+ * when this fails.
+ *
+ * @param pid ID of the child
+ * @param options How to supervise the child
+ * @param func Function called once the child has been reaped
+ * @param arg Argument passed to func
+ * @return true if the child is being watched, false on failure
+ */
+bool process_watch(pid_t pid, const ProcessWatchOptions *options,
+                   ProcessExitFunc func, void *arg);
+
+/**
+ * Hand a started child to the reaper and block until it has been reaped
+ *
+ * @param pid ID of the child
+ * @param options How to supervise the child
+ * @param outcome Pointer to store how the child ended; release its
+ *                output buffers with output_buffer_free()
+ * @return true if the child was watched to the end, false on failure
+ */
+bool process_wait(pid_t pid, const ProcessWatchOptions *options, ProcessExit *outcome);
+
+/**
+ * Append bytes to an output buffer, allocating it on first use
+ *
+ * @param buffer Pointer to the buffer
+ * @param data Bytes to append
+ * @param length Number of bytes
+ * @param limit Bytes kept, head plus tail
+ */
+void output_buffer_append(OutputBuffer *buffer, const char *data, size_t length, size_t limit);
+
+/**
+ * Copy the kept bytes out: the head, a marker line if bytes were
+ * dropped, then the tail
+ *
+ * @param buffer Pointer to the buffer
+ * @param length Pointer to store the number of bytes returned
+ * @return Newly allocated, NUL-terminated text (caller must free), or NULL
+ *         if the stream was empty
+ */
+char* output_buffer_flatten(const OutputBuffer *buffer, size_t *length);
+
+/**
+ * Release an output buffer
+ *
+ * @param buffer Pointer to the buffer
+ */
+void output_buffer_free(OutputBuffer *buffer);
+
+#endif /* PROCESS_H */
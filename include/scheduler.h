@@ -2,24 +2,57 @@
 #define SCHEDULER_H
 
 #include "task.h"
+#include "depgraph.h"
+#include "executor.h"
+#include "persist.h"
+#include "idalloc.h"
+#include "control.h"
 #include <pthread.h>
 #include <stdbool.h>
 
 #define MAX_PATH 256
 
 /**
- * Structure to hold the task list and scheduler state
+ * Dependency between two tasks of a bulk import, by position in the
+ * imported array (the tasks have no IDs until they are imported)
  */
 typedef struct {
-    Task *tasks;                // Array of tasks
-    int task_count;             // Number of tasks
+    int task;                   // Index of the dependent task
+    int dependency;             // Index of the task it depends on
+} TaskImportEdge;
+
+/**
+ * Structure to hold the task list and scheduler state. When there are more
+ * tasks than the resident limit, tasks holds only those due within the
+ * resident window plus recently used ones; the others stay in the database
+ * and are loaded by ID when needed.
+ */
+typedef struct {
+    Task *tasks;                // Array of resident tasks
+    int task_count;             // Number of resident tasks
     int capacity;               // Capacity of tasks array
+    int *slots;                 // Task ID -> index in tasks, -1 if not resident
+    int slot_capacity;          // Entries in slots
+    bool partial;               // Some tasks are only in the database
+    int resident_max;           // Resident tasks to keep when partial
+    int resident_window;        // Seconds ahead whose due tasks stay resident
+    unsigned long unloads;      // Bumped whenever a task leaves memory
+    int deletes_pending;        // Removed tasks whose rows are not deleted yet
     char data_dir[MAX_PATH];    // Data directory
     char db_path[MAX_PATH];     // Database path
     pthread_t scheduler_thread; // Scheduler thread
     pthread_mutex_t lock;       // Mutex for thread safety
     int check_interval;         // Check interval in seconds
     bool running;               // Is the scheduler running
+    DepGraph deps;              // Dependency edges between tasks
+    Executor executor;          // Worker pool running workflow tasks
+    struct WorkflowRun *workflows;  // Active workflow runs
+    pthread_mutex_t workflow_lock;  // Protects workflows
+    pthread_cond_t workflow_done;   // Signalled when a workflow run finishes
+    Persister persister;        // Write-behind of changed task rows
+    IdAllocator task_ids;       // Allocates task IDs
+    IdAllocator run_ids;        // Allocates workflow run IDs
+    ControlServer control;      // Control socket, served while running
 } Scheduler;
 
 /**
@@ -54,6 +87,30 @@ bool scheduler_start(Scheduler *scheduler);
  */
 bool scheduler_stop(Scheduler *scheduler);
 
+/**
+ * Get the index of a task in scheduler->tasks, loading it from the
+ * database first if it is not resident. Must be called with the scheduler
+ * lock held.
+ * 
+ * @param scheduler Pointer to the scheduler structure
+ * @param task_id ID of the task
+ * @return Index into scheduler->tasks, -1 if the task does not exist
+ */
+int scheduler_resident_index(Scheduler *scheduler, int task_id);
+
+/**
+ * Load the given tasks that are not resident, reading their rows without
+ * the scheduler lock so that callers about to need many of them do not
+ * hold it over the database. Tasks that cannot be loaded this way are
+ * left to scheduler_resident_index(). Must be called without the
+ * scheduler lock held.
+ * 
+ * @param scheduler Pointer to the scheduler structure
+ * @param task_ids IDs of the tasks
+ * @param count Number of IDs
+ */
+void scheduler_page_in(Scheduler *scheduler, const int *task_ids, int count);
+
 /**
  * Add a new task to the scheduler
  * 
@@ -63,6 +120,21 @@ bool scheduler_stop(Scheduler *scheduler);
  */
 int scheduler_add_task(Scheduler *scheduler, Task task);
 
+/**
+ * Add many tasks at once. Every definition and dependency is checked
+ * first and nothing is added if any is invalid. IDs are allocated as one
+ * consecutive block, the rows are written in one transaction and the
+ * dependency graph is rebuilt once at the end.
+ * @param scheduler Pointer to the scheduler structure
+ * @param tasks Task definitions; their IDs and next run times are filled in
+ * @param count Number of tasks
+ * @param edges Dependencies between the tasks (may be NULL if none)
+ * @param edge_count Number of dependencies
+ * @return ID of the first task (task i gets first + i), -1 on failure
+ */
+int scheduler_import_tasks(Scheduler *scheduler, Task *tasks, int count,
+                           const TaskImportEdge *edges, int edge_count);
+
 /**
  * Remove a task from the scheduler
  * 
@@ -91,7 +163,9 @@ bool scheduler_update_task(Scheduler *scheduler, Task task);
 Task* scheduler_get_task(Scheduler *scheduler, int task_id);
 
 /**
- * Get a list of all tasks
+ * Get a list of all tasks. This copies every task at once, including
+ * those that are only in the database; use scheduler_get_tasks_page to
+ * walk large task sets.
  * 
  * @param scheduler Pointer to the scheduler structure
  * @param count Pointer to store the number of tasks
@@ -99,6 +173,19 @@ Task* scheduler_get_task(Scheduler *scheduler, int task_id);
  */
 Task* scheduler_get_all_tasks(Scheduler *scheduler, int *count);
 
+/**
+ * Get the next tasks in ascending ID order, holding at most one page in
+ * memory however many tasks live only in the database
+ * 
+ * @param scheduler Pointer to the scheduler structure
+ * @param after_id Return tasks with a greater ID (0 for the first page,
+ *                 then the ID of the last task of the previous page)
+ * @param limit Maximum number of tasks to return
+ * @param count Pointer to store the number of tasks (0 after the last page)
+ * @return Array of tasks (caller must free), NULL if none are left
+ */
+Task* scheduler_get_tasks_page(Scheduler *scheduler, int after_id, int limit, int *count);
+
 /**
  * Execute a specific task immediately
  * 
@@ -109,7 +196,20 @@ Task* scheduler_get_all_tasks(Scheduler *scheduler, int *count);
 bool scheduler_execute_task(Scheduler *scheduler, int task_id);
 
 /**
- * Sync tasks with database
+ * Execute a task as part of a workflow run. Dependencies are not checked
+ * here; the workflow evaluates them against the same run.
+ * 
+ * @param scheduler Pointer to the scheduler structure
+ * @param task_id ID of the task to execute
+ * @param run_id ID of the workflow run, recorded on the task
+ * @param exit_code Pointer to store the exit code
+ * @return true if the task ran, false on failure
+ */
+bool scheduler_execute_task_in_run(Scheduler *scheduler, int task_id, int run_id, int *exit_code);
+
+/**
+ * Sync tasks with database: write out every task changed since the last
+ * write, without holding the scheduler lock during I/O
  * 
  * @param scheduler Pointer to the scheduler structure
  * @return true on success, false on failure
@@ -122,9 +222,10 @@ bool scheduler_sync(Scheduler *scheduler);
  * @param scheduler Pointer to the scheduler structure
  * @param task_id ID of the task to add dependency
  * @param dependency_id ID of the dependency task
- * @return true on success, false on failure
+ * @return DEP_EDGE_OK on success, DEP_EDGE_CYCLE if the edge would create a
+ *         cycle, DEP_EDGE_NOT_FOUND if a task is missing, DEP_EDGE_ERROR otherwise
  */
-bool scheduler_add_dependency(Scheduler *scheduler, int task_id, int dependency_id);
+DepEdgeResult scheduler_add_dependency(Scheduler *scheduler, int task_id, int dependency_id);
 
 /**
  * Remove a dependency between tasks
@@ -136,6 +237,16 @@ bool scheduler_add_dependency(Scheduler *scheduler, int task_id, int dependency_
  */
 bool scheduler_remove_dependency(Scheduler *scheduler, int task_id, int dependency_id);
 
+/**
+ * Get the IDs of the tasks a task depends on
+ * 
+ * @param scheduler Pointer to the scheduler structure
+ * @param task_id ID of the task
+ * @param count Pointer to store the number of dependencies
+ * @return Newly allocated array of task IDs (caller must free), NULL if none
+ */
+int* scheduler_get_dependencies(Scheduler *scheduler, int task_id, int *count);
+
 /**
  * Set the task execution mode
  * 
@@ -150,4 +261,15 @@ bool scheduler_remove_dependency(Scheduler *scheduler, int task_id, int dependen
 bool scheduler_set_exec_mode(Scheduler *scheduler, int task_id, TaskExecMode mode, 
                            const char *script_content, const char *ai_prompt, const char *system_metrics);
 
+/**
+ * Compute the critical path, makespan and slack of the workflow containing
+ * a task, from the tasks' average runtimes
+ * 
+ * @param scheduler Pointer to the scheduler structure
+ * @param task_id ID of any task in the workflow
+ * @param result Pointer to store the analysis (free with depgraph_free_critical_path)
+ * @return true on success, false on failure
+ */
+bool scheduler_get_critical_path(Scheduler *scheduler, int task_id, DepCriticalPath *result);
+
 #endif /* SCHEDULER_H */ 
\ No newline at end of file
@@ -0,0 +1,117 @@
+#ifndef SCRIPTS_H
+#define SCRIPTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SCRIPT_HASH_LENGTH 64              // Hex SHA-256 of the script body
+#define SCRIPT_MAX_LENGTH (1024 * 1024)    // Largest script body accepted
+#define SCRIPT_DEFAULT_CACHE_KB 4096
+#define SCRIPT_IMAGE_SLOTS 64              // Executable images kept open
+
+/**
+ * Scripts are stored once per distinct body, zlib-compressed, in the
+ * database's script store, and referenced from tasks by the SHA-256 of the
+ * body. Decompressed bodies are kept in a process-wide LRU cache bounded
+ * by size, so running a task again does not touch the database.
+ *
+ * For execution, a body is written once into a sealed memfd (an
+ * "image") and the most recently used images are kept open, so running a
+ * script touches neither the database nor the filesystem. Images are
+ * keyed by hash, so a changed script gets a new image and the old one
+ * ages out.
+ */
+
+/**
+ * Executable image of a script body
+ */
+typedef struct {
+    int fd;                      // Sealed memfd holding the body
+    bool shebang;                // Body starts with #!, so it can be executed itself
+} ScriptImage;
+
+/**
+ * Set the size of the decompressed-script cache. Entries beyond the new
+ * size are dropped.
+ *
+ * @param cache_kb Cache size in KB (0 disables caching)
+ */
+void script_cache_init(int cache_kb);
+
+/**
+ * Drop every cached script body and close every cached image
+ */
+void script_cache_clear(void);
+
+/**
+ * Compute the content address of a script body
+ *
+ * @param content Script body
+ * @param length Length of the body in bytes
+ * @param hash Buffer of SCRIPT_HASH_LENGTH + 1 bytes for the hex digest
+ * @return true on success, false on failure
+ */
+bool script_hash(const char *content, size_t length, char *hash);
+
+/**
+ * Compress a script body for storage
+ *
+ * @param content Script body
+ * @param length Length of the body in bytes
+ * @param blob Pointer to store the compressed bytes (caller must free)
+ * @param size Pointer to store the number of compressed bytes
+ * @return true on success, false on failure
+ */
+bool script_compress(const char *content, size_t length, unsigned char **blob, size_t *size);
+
+/**
+ * Decompress a stored script body
+ *
+ * @param blob Compressed bytes
+ * @param size Number of compressed bytes
+ * @param raw_size Length of the body before compression
+ * @return Newly allocated, NUL-terminated body (caller must free), or NULL
+ */
+char* script_decompress(const unsigned char *blob, size_t size, size_t raw_size);
+
+/**
+ * Store a script body (once per distinct body) and return its address
+ *
+ * @param content Script body
+ * @param length Length of the body in bytes (at most SCRIPT_MAX_LENGTH)
+ * @param hash Buffer of SCRIPT_HASH_LENGTH + 1 bytes for the address
+ * @return true on success, false on failure
+ */
+bool script_store(const char *content, size_t length, char *hash);
+
+/**
+ * Get a script body by address, from the cache or the database
+ *
+ * @param hash Address returned by script_store
+ * @param length Pointer to store the length of the body (may be NULL)
+ * @return Newly allocated, NUL-terminated body (caller must free), or NULL
+ *         if not found
+ */
+char* script_load(const char *hash, size_t *length);
+
+/**
+ * Get the length of a script body without decompressing it, from the
+ * cache or the size kept with the stored body
+ *
+ * @param hash Address returned by script_store
+ * @param length Pointer to store the length of the body
+ * @return true if found, false otherwise
+ */
+bool script_size(const char *hash, size_t *length);
+
+/**
+ * Get the executable image of a script, creating it on first use
+ *
+ * @param hash Address returned by script_store
+ * @param image Pointer to store the image; image->fd is a new descriptor
+ *              (close-on-exec) that the caller must close
+ * @return true on success, false on failure
+ */
+bool script_image_open(const char *hash, ScriptImage *image);
+
+#endif /* SCRIPTS_H */
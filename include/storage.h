@@ -0,0 +1,65 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "db.h"
+
+/**
+ * Storage backend behind the db_* functions. db.c validates arguments,
+ * logs successful changes and forwards each call to the backend selected
+ * by the "backend" storage setting, so backends only report their own
+ * errors. Every function may be called from several threads at once.
+ */
+typedef struct {
+    const char *name;                                               // Name used in config and logs
+
+    bool (*open)(const char *db_path, const DbStorageConfig *config);
+    void (*close)(void);
+    bool (*begin_transaction)(void);
+    bool (*commit_transaction)(void);
+    void (*rollback_transaction)(void);
+    bool (*checkpoint)(bool truncate);
+
+    bool (*save_task)(const Task *task);
+    bool (*upsert_task)(const Task *task);
+    bool (*update_task)(const Task *task);
+    bool (*update_task_status)(const Task *task);
+    bool (*delete_task)(int task_id);
+    bool (*load_tasks)(Task **tasks, int *count);
+    bool (*load_tasks_page)(int after_id, int limit, Task **tasks, int *count);   // Ordered by ID
+    bool (*get_task)(int task_id, Task *task);
+    int (*count_tasks)(void);
+    bool (*load_task_summaries)(TaskSummary **summaries, int *count);
+    bool (*get_due_task_ids)(time_t until, int limit, int **ids, int *count);
+    bool (*reserve_ids)(DbIdCounter counter, int count, int *first);
+    bool (*release_ids)(DbIdCounter counter, int first, int limit);  // Only if the counter still stands at limit
+
+    bool (*add_dependency)(int task_id, int dependency_id);
+    bool (*remove_dependency)(int task_id, int dependency_id);
+    bool (*load_dependency_edges)(int **task_ids, int **dependency_ids, int *count);   // Ordered by task, then dependency
+
+    bool (*save_workflow_run)(const WorkflowRunRecord *run);
+    bool (*get_workflow_run)(int run_id, WorkflowRunRecord *run);
+    bool (*insert_task_run)(const TaskRunRecord *run);
+    bool (*get_last_task_run)(int task_id, TaskRunRecord *run);     // Output newly allocated
+    int (*prune_task_runs)(void);
+
+    bool (*save_script)(const char *hash, const unsigned char *blob, size_t size, size_t raw_size);
+    bool (*load_script)(const char *hash, unsigned char **blob, size_t *size, size_t *raw_size);
+    bool (*get_script_size)(const char *hash, size_t *raw_size);
+    int (*prune_scripts)(time_t older_than);                        // Unreferenced scripts stored before older_than
+} StorageBackend;
+
+/**
+ * SQLite database in WAL mode (sqlite_store.c)
+ */
+extern const StorageBackend SQLITE_STORAGE_BACKEND;
+
+/**
+ * Memory-mapped snapshot plus append-only journal (journal_store.c).
+ * Single-process: a second process opening the same files is refused.
+ * While the daemon runs, that includes every CLI command and the web UI,
+ * which runs the CLI for each action; they need the sqlite backend.
+ */
+extern const StorageBackend JOURNAL_STORAGE_BACKEND;
+
+#endif /* STORAGE_H */
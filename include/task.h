@@ -4,12 +4,11 @@
 #include <time.h>
 #include <stdbool.h>
 #include "ai.h"
+#include "scripts.h"
+#include "cgroup.h"
 
-// Giới hạn tối đa số lượng tác vụ phụ thuộc
-#define MAX_DEPENDENCIES 10
-#define SCRIPT_CONTENT_MAX_LENGTH 4096
 #define TASK_COMMAND_MAX_LENGTH 1024
-#define TASK_SCRIPT_MAX_LENGTH SCRIPT_CONTENT_MAX_LENGTH
+#define TASK_SCRIPT_MAX_LENGTH SCRIPT_MAX_LENGTH
 #define TASK_AI_PROMPT_MAX_LENGTH 2048
 
 /**
@@ -70,15 +69,16 @@ typedef struct {
     bool enabled;            // Whether the task is active
     int exit_code;           // Exit code from the last run
     int max_runtime;         // Maximum runtime in seconds (0 for unlimited)
+    double avg_runtime;      // Smoothed runtime of past runs in seconds (0 if never run)
     char working_dir[512];   // Working directory for the task
+    char resource_limits[CGROUP_LIMITS_MAX_LENGTH];  // cgroup limits of each run (see cgroup.h), empty for the defaults
     
-    // Dependencies
-    int dependencies[MAX_DEPENDENCIES]; // IDs of dependent tasks
-    int dependency_count;               // Number of dependencies
+    // Dependencies (the edges themselves live in the scheduler's DepGraph)
     DependencyBehavior dep_behavior;    // How to handle dependencies
+    int last_run_id;                    // Workflow run of the last execution (0 if standalone)
     
-    // Script content (if exec_mode is EXEC_SCRIPT)
-    char script_content[SCRIPT_CONTENT_MAX_LENGTH];  // Content of the script if stored in DB
+    // Script (if exec_mode is EXEC_SCRIPT); the body lives in the script store
+    char script_hash[SCRIPT_HASH_LENGTH + 1];  // Address of the script body, empty if none
     
     // AI-Dynamic execution (if exec_mode is EXEC_AI_DYNAMIC)
     char ai_prompt[2048];              // AI prompt/goal for dynamic command generation
@@ -123,31 +123,41 @@ bool task_is_due(Task *task);
 bool task_mark_executed(Task *task, int exit_code);
 
 /**
- * Add a dependency to a task
+ * Fold the duration of a finished run into the task's average runtime
+ * (exponentially weighted, so recent runs count the most)
  * 
  * @param task Pointer to the task structure
- * @param dependency_id ID of the task to depend on
- * @return true on success, false on failure
+ * @param seconds Wall-clock duration of the run
+ */
+void task_record_runtime(Task *task, double seconds);
+
+/**
+ * Compare the user-defined fields of two tasks, ignoring run state
+ * (next/last run time, exit code, last run ID, average runtime)
+ * 
+ * @param a First task
+ * @param b Second task
+ * @return true if both tasks have the same definition
  */
-bool task_add_dependency(Task *task, int dependency_id);
+bool task_same_definition(const Task *a, const Task *b);
 
 /**
- * Remove a dependency from a task
+ * Check that a task definition is complete and its fields are in range
+ * (name, what to run for its execution mode, schedule). The reason a task
+ * is rejected is logged.
  * 
  * @param task Pointer to the task structure
- * @param dependency_id ID of the task to remove dependency on
- * @return true on success, false on failure
+ * @return true if the task can be scheduled as defined
  */
-bool task_remove_dependency(Task *task, int dependency_id);
+bool task_validate(const Task *task);
 
 /**
- * Save script content to a temporary file for execution
+ * Open the executable image of the task's script
  * 
  * @param task Pointer to the task structure
- * @param temp_path Buffer to store the path to the temporary file
- * @param temp_path_size Size of the temp_path buffer
+ * @param image Pointer to store the image (caller must close image->fd)
  * @return true on success, false on failure
  */
-bool task_prepare_script(Task *task, char *temp_path, size_t temp_path_size);
+bool task_open_script(const Task *task, ScriptImage *image);
 
 #endif /* TASK_H */ 
\ No newline at end of file
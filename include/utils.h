@@ -2,11 +2,12 @@
 #define UTILS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
+#include <pthread.h>
 #include "ai.h"
 
-// Thêm vào đầu file sau các includes
-#define DEBUG_OUTPUT 1
+#define COMMAND_DEFAULT_OUTPUT_KB 64
 
 /**
  * Logging levels
@@ -18,6 +19,36 @@ typedef enum {
     LOG_DEBUG
 } LogLevel;
 
+/**
+ * Captured output of one stream of a command: the first and last bytes it
+ * wrote, joined by a marker line if anything in between was dropped
+ */
+typedef struct {
+    char *data;                   // NUL-terminated text, NULL if nothing was captured
+    size_t length;                // Bytes in data
+    long long total;              // Bytes the command wrote to the stream
+} CapturedOutput;
+
+/**
+ * Outcome and resource usage of one command run
+ */
+typedef struct {
+    int exit_code;                // Exit status, -1 if the command did not exit normally
+    int term_signal;              // Signal that terminated the command, 0 if none
+    bool timed_out;               // Killed after exceeding its timeout
+    double start_time;            // Wall-clock start (seconds since the epoch)
+    double end_time;              // Wall-clock end (seconds since the epoch)
+    double duration;              // Elapsed time in seconds (monotonic)
+    double user_cpu;              // User CPU time in seconds
+    double sys_cpu;               // System CPU time in seconds
+    long max_rss_kb;              // Peak resident set size in KB
+    long memory_peak_kb;          // Peak memory of the run's cgroup in KB, -1 if not measured
+    long long io_read_bytes;      // Block device bytes read by the run's cgroup, -1 if not measured
+    long long io_write_bytes;     // Block device bytes written by the run's cgroup, -1 if not measured
+    CapturedOutput output;        // What the command wrote to stdout
+    CapturedOutput error_output;  // What the command wrote to stderr
+} CommandResult;
+
 /**
  * Structure to store system metrics
  */
@@ -105,6 +136,26 @@ void log_cleanup(void);
  */
 char* time_to_string(time_t time, char *buffer, size_t size, const char *format);
 
+/**
+ * Get a monotonic timestamp, for measuring elapsed time
+ * 
+ * @return Seconds since an arbitrary fixed point
+ */
+double monotonic_seconds(void);
+
+/**
+ * Start a thread with SIGINT and SIGTERM blocked, so they are only ever
+ * delivered to the main thread, which handles them
+ * 
+ * @param thread Pointer to store the thread
+ * @param attr Thread attributes, NULL for the defaults
+ * @param func Thread function
+ * @param arg Argument for the thread function
+ * @return 0 on success, otherwise the pthread_create() error
+ */
+int thread_create(pthread_t *thread, const pthread_attr_t *attr,
+                  void *(*func)(void*), void *arg);
+
 /**
  * Create a directory if it doesn't exist
  * 
@@ -150,6 +201,55 @@ char* safe_strcpy(char *dest, const char *src, size_t size);
 bool run_command_with_timeout(const char *command, const char *working_dir, 
                               int timeout_sec, int *exit_code);
 
+/**
+ * Set how much of each command's stdout and stderr is captured
+ * 
+ * @param output_kb KB kept per stream, first half from the start and
+ *                  second half from the end (0 disables capture; output
+ *                  then goes wherever the daemon's own output goes)
+ */
+void command_output_init(int output_kb);
+
+/**
+ * Release the captured output of a command result
+ * 
+ * @param result Pointer to the result
+ */
+void command_result_free(CommandResult *result);
+
+/**
+ * Run a command with timeout and report how it ended and what it used.
+ * start_time stays 0 if no process was started. Release the result with
+ * command_result_free().
+ * 
+ * @param command Command to run
+ * @param working_dir Working directory, NULL for current directory
+ * @param timeout_sec Timeout in seconds, 0 for no timeout
+ * @param task_id Task whose live output subscribers follow the run, 0 for none
+ * @param limits Task's cgroup limits (see cgroup.h), NULL or empty for the defaults
+ * @param result Pointer to store the outcome
+ * @return true if the command exited normally, false otherwise
+ */
+bool run_command_ex(const char *command, const char *working_dir, 
+                    int timeout_sec, int task_id, const char *limits, CommandResult *result);
+
+/**
+ * Run a script image with timeout. A body starting with #! is executed
+ * itself, anything else is run by /bin/sh. Release the result with
+ * command_result_free().
+ * 
+ * @param script_fd Descriptor of the script body
+ * @param shebang Whether the body starts with #!
+ * @param working_dir Working directory, NULL for current directory
+ * @param timeout_sec Timeout in seconds, 0 for no timeout
+ * @param task_id Task whose live output subscribers follow the run, 0 for none
+ * @param limits Task's cgroup limits (see cgroup.h), NULL or empty for the defaults
+ * @param result Pointer to store the outcome
+ * @return true if the script exited normally, false otherwise
+ */
+bool run_script_ex(int script_fd, bool shebang, const char *working_dir,
+                   int timeout_sec, int task_id, const char *limits, CommandResult *result);
+
 /**
  * Initialize the SystemMetrics structure with default values
  * 
@@ -0,0 +1,130 @@
+#ifndef WORKFLOW_H
+#define WORKFLOW_H
+
+#include "scheduler.h"
+#include "db.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+/**
+ * State of one task within a workflow run
+ */
+typedef enum {
+    WF_NODE_PENDING,    // Waiting for upstream tasks of this run
+    WF_NODE_RUNNING,    // Queued or executing on the executor pool
+    WF_NODE_SUCCEEDED,  // Ran with exit code 0
+    WF_NODE_FAILED,     // Ran with a non-zero exit code or could not run
+    WF_NODE_SKIPPED     // Upstream results of this run ruled it out, or disabled
+} WorkflowNodeState;
+
+/**
+ * Overall state of a workflow run
+ */
+typedef enum {
+    WF_RUN_RUNNING,     // Some tasks have not finished yet
+    WF_RUN_SUCCEEDED,   // Every task succeeded
+    WF_RUN_FAILED       // At least one task failed or was skipped
+} WorkflowRunStatus;
+
+/**
+ * Per-task bookkeeping within a run. Dependency satisfaction is judged
+ * only on the outcomes of upstream tasks in the same run.
+ */
+typedef struct {
+    int task_id;                    // Task executed by this node
+    DependencyBehavior behavior;    // Snapshot of the task's dep_behavior
+    unsigned char state;            // WorkflowNodeState
+    int dep_count;                  // Upstream tasks in the run
+    int finished;                   // Upstream tasks in a terminal state
+    int completed;                  // Upstream tasks that ran (succeeded or failed)
+    int succeeded;                  // Upstream tasks that succeeded
+} WorkflowNode;
+
+/**
+ * One run of a connected group of dependent tasks
+ */
+typedef struct WorkflowRun {
+    int run_id;                     // Unique run ID (persisted, set on each task)
+    int root_task_id;               // Task that triggered the run
+    time_t start_time;              // When the run started
+    time_t end_time;                // When the run finished
+    WorkflowRunStatus status;       // Overall state
+    Scheduler *scheduler;           // Owning scheduler
+
+    WorkflowNode *nodes;            // Nodes in topological order
+    int node_count;                 // Number of nodes
+    int *sorted_ids;                // Task IDs in ascending order, for membership tests
+    int *sorted_nodes;              // Node index of each entry of sorted_ids
+    int *down_offsets;              // node_count + 1 entries into down_targets
+    int *down_targets;              // Dependent node indices, grouped by node
+    int remaining;                  // Nodes not yet in a terminal state
+    int active_jobs;                // Jobs (plus the starter) still referencing the run
+
+    int version;                    // Bumped on every state change
+    int persisted_version;          // Last version written to the database
+    pthread_mutex_t lock;           // Protects the node states
+    pthread_mutex_t persist_lock;   // Serializes writes of the run record
+
+    struct WorkflowRun *next;       // Next active run of the scheduler
+} WorkflowRun;
+
+/**
+ * Start a run of every task connected (through dependencies) to a task.
+ * Tasks without upstream tasks start immediately; the others start as soon
+ * as the upstream tasks of this run satisfy their dependency behavior.
+ * Independent branches execute in parallel on the scheduler's executor.
+ *
+ * @param scheduler Pointer to the scheduler structure
+ * @param task_id ID of the task triggering the run
+ * @return Run ID on success, 0 if a run of the same tasks is already
+ *         active, -1 on failure
+ */
+int workflow_start(Scheduler *scheduler, int task_id);
+
+/**
+ * Check whether a task belongs to an active run
+ *
+ * @param scheduler Pointer to the scheduler structure
+ * @param task_id ID of the task
+ * @return true if an active run contains the task
+ */
+bool workflow_is_active(Scheduler *scheduler, int task_id);
+
+/**
+ * Judge a task's dependencies on the outcomes of its upstream tasks in the
+ * active run that contains it, rather than on their last runs overall
+ *
+ * @param scheduler Pointer to the scheduler structure
+ * @param task_id ID of the task
+ * @param satisfied Pointer to store whether the run's upstream results
+ *                  satisfy the task's dependency behavior
+ * @return true if an active run contains the task, false otherwise
+ */
+bool workflow_dependencies_satisfied(Scheduler *scheduler, int task_id, bool *satisfied);
+
+/**
+ * Wait for a run to finish
+ *
+ * @param scheduler Pointer to the scheduler structure
+ * @param run_id ID of the run
+ */
+void workflow_wait(Scheduler *scheduler, int run_id);
+
+/**
+ * Get a printable name for a node state
+ *
+ * @param state Node state
+ * @return Static string
+ */
+const char* workflow_node_state_name(WorkflowNodeState state);
+
+/**
+ * Get a printable name for a run status
+ *
+ * @param status Run status
+ * @return Static string
+ */
+const char* workflow_run_status_name(WorkflowRunStatus status);
+
+#endif /* WORKFLOW_H */
@@ -3,17 +3,25 @@
 #include "../../include/task.h"
 #include "../../include/utils.h"
 #include "../../include/db.h"
+#include "../../include/workflow.h"
 #include "../../include/ai.h"
 #include "../../include/email.h"
+#include "../../include/cgroup.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
+#include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <readline/readline.h>
 #include <readline/history.h>
+#include <cjson/cJSON.h>
+
+// Tasks fetched at a time when listing or exporting
+#define LIST_PAGE_SIZE 256
 
 // Global variables
 static const char *VERSION = "1.0.0";
@@ -38,6 +46,24 @@ static const char *commands[] = {
 
 // Helper function for trimming whitespace
 static void trim_whitespace(char *str);
+static void cli_print_workflow_run(const WorkflowRunRecord *run);
+static void format_duration(double seconds, char *buffer, size_t size);
+static void print_captured_output(const char *label, const CapturedOutput *output);
+static bool cli_check_limits(const char *limits);
+static char* read_script_file(const char *path, size_t *length);
+static void print_task_script(const Task *task, const char *label);
+static char* read_text_file(const char *path);
+static int name_to_enum(const char *const *names, int count, const char *name);
+static int compare_import_keys(const void *a, const void *b);
+static cJSON* task_to_json(const Task *task, const int *dependencies, int dependency_count);
+static bool task_from_json(const cJSON *item, Task *task);
+static int read_key(FILE *stream);
+
+// Position of a task in an import file, looked up by the ID the file gives it
+typedef struct {
+    int file_id;
+    int index;
+} ImportKey;
 
 // Khai báo tiên quyết
 void cli_convert_to_ai_dynamic(int argc, char *argv[]);
@@ -50,6 +76,7 @@ void cli_create_ai_task_with_agent(int argc, char *argv[]);
 // Global scheduler instance
 static Scheduler scheduler;
 static bool scheduler_initialized = false;
+static volatile sig_atomic_t stop_requested = 0;    // Set from a signal handler
 
 // Hàm để lấy tên tương ứng cho TaskFrequency
 static const char* cli_get_frequency_name(TaskFrequency freq) {
@@ -268,6 +295,20 @@ void cli_process_command(int argc, char *argv[]) {
         cli_remove_dependency(argc, argv);
     } else if (strcmp(command, "set-dep-behavior") == 0) {
         cli_set_dep_behavior(argc, argv);
+    } else if (strcmp(command, "run-dag") == 0) {
+        cli_run_workflow(argc, argv);
+    } else if (strcmp(command, "dag-status") == 0) {
+        cli_workflow_status(argc, argv);
+    } else if (strcmp(command, "output") == 0) {
+        cli_task_output(argc, argv);
+    } else if (strcmp(command, "tail") == 0) {
+        cli_tail_task(argc, argv);
+    } else if (strcmp(command, "critical-path") == 0) {
+        cli_critical_path(argc, argv);
+    } else if (strcmp(command, "import") == 0) {
+        cli_import_tasks(argc, argv);
+    } else if (strcmp(command, "export") == 0) {
+        cli_export_tasks(argc, argv);
     } else if (strcmp(command, "to-script") == 0) {
         cli_convert_to_script(argc, argv);
     } else if (strcmp(command, "to-command") == 0) {
@@ -323,7 +364,7 @@ void cli_display_task(const Task *task, bool detailed) {
     if (task->exec_mode == EXEC_COMMAND) {
         printf("Command: %s\n", task->command);
     } else if (task->exec_mode == EXEC_SCRIPT) {
-        printf("Script Content:\n%s\n", task->script_content);
+        print_task_script(task, "Script Content");
     } else if (task->exec_mode == EXEC_AI_DYNAMIC) {
         printf("AI Prompt: %s\n", task->ai_prompt);
         printf("System Metrics: %s\n", task->system_metrics);
@@ -369,11 +410,14 @@ void cli_display_task(const Task *task, bool detailed) {
     if (detailed) {
         printf("Working Directory: %s\n", task->working_dir[0] ? task->working_dir : "Default");
         printf("Max Runtime: %d seconds (0 = unlimited)\n", task->max_runtime);
+        printf("Resource Limits: %s\n", task->resource_limits[0] ? task->resource_limits : "Default");
         
-        if (task->dependency_count > 0) {
+        int dep_count = 0;
+        int *deps = scheduler_get_dependencies(&scheduler, task->id, &dep_count);
+        if (dep_count > 0) {
             printf("Dependencies: ");
-            for (int i = 0; i < task->dependency_count; i++) {
-                printf("%d ", task->dependencies[i]);
+            for (int i = 0; i < dep_count; i++) {
+                printf("%d ", deps[i]);
             }
             printf("\n");
             
@@ -383,6 +427,7 @@ void cli_display_task(const Task *task, bool detailed) {
             };
             printf("Dependency Behavior: %s\n", behavior_names[task->dep_behavior]);
         }
+        free(deps);
         
         if (task->schedule_type == SCHEDULE_CRON) {
             printf("Cron Expression: %s\n", task->cron_expression);
@@ -552,6 +597,7 @@ void cli_add_task(int argc, char *argv[]) {
         printf("  -s <cron>        : Schedule in cron format (e.g., \"0 9 * * 1-5\")\n");
         printf("  -d <directory>   : Working directory\n");
         printf("  -m <max_runtime> : Maximum runtime in seconds\n");
+        printf("  -L <limits>      : cgroup limits, e.g. \"cpu=50%%,memory=512M,pids=64\"\n");
         printf("  -x <script>      : Treat as script (provide script content)\n");
         printf("  -f <script_file> : Execute script from file\n");
         return;
@@ -573,7 +619,9 @@ void cli_add_task(int argc, char *argv[]) {
     // Parse arguments
     int i = 3;
     bool is_script = false;
-    char script_content[SCRIPT_CONTENT_MAX_LENGTH] = {0};
+    const char *script_content = NULL;
+    char *script_buffer = NULL;
+    size_t script_length = 0;
     char script_file[512] = {0};
     bool is_script_file = false;
     bool command_set = false;
@@ -602,10 +650,18 @@ void cli_add_task(int argc, char *argv[]) {
                 // Set max runtime
                 task.max_runtime = atoi(argv[i + 1]);
                 i += 2;
+            } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+                // Set resource limits
+                if (!cli_check_limits(argv[i + 1])) {
+                    return;
+                }
+                safe_strcpy(task.resource_limits, argv[i + 1], sizeof(task.resource_limits));
+                i += 2;
             } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
                 // Set script content and mode
                 is_script = true;
-                safe_strcpy(script_content, argv[i + 1], sizeof(script_content));
+                script_content = argv[i + 1];
+                script_length = strlen(script_content);
                 task.exec_mode = EXEC_SCRIPT;
                 i += 2;
             } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
@@ -632,22 +688,11 @@ void cli_add_task(int argc, char *argv[]) {
     
     // If it's a script file, read the file content
     if (is_script_file) {
-        FILE *file = fopen(script_file, "r");
-        if (!file) {
-            printf("Failed to open script file: %s\n", script_file);
+        script_buffer = read_script_file(script_file, &script_length);
+        if (!script_buffer) {
             return;
         }
-        
-        size_t bytes_read = fread(script_content, 1, sizeof(script_content) - 1, file);
-        fclose(file);
-        
-        if (bytes_read == 0) {
-            printf("Script file is empty or failed to read\n");
-            return;
-        }
-        
-        // Null-terminate the content
-        script_content[bytes_read] = '\0';
+        script_content = script_buffer;
         
         // Set to script mode
         is_script = true;
@@ -660,22 +705,30 @@ void cli_add_task(int argc, char *argv[]) {
     // Validate the task
     if (task.name[0] == '\0') {
         printf("Task name is required\n");
+        free(script_buffer);
         return;
     }
     
     if (task.exec_mode == EXEC_COMMAND && !command_set) {
         printf("Command is required for command-mode tasks\n");
+        free(script_buffer);
         return;
     }
     
-    if (task.exec_mode == EXEC_SCRIPT && script_content[0] == '\0') {
+    if (task.exec_mode == EXEC_SCRIPT && script_length == 0) {
         printf("Script content is required for script-mode tasks\n");
+        free(script_buffer);
         return;
     }
     
-    // Apply script content if in script mode
+    // Store the script body; the task keeps its hash
     if (is_script) {
-        safe_strcpy(task.script_content, script_content, sizeof(task.script_content));
+        bool stored = script_store(script_content, script_length, task.script_hash);
+        free(script_buffer);
+        if (!stored) {
+            printf("Failed to store script\n");
+            return;
+        }
     }
     
     // Calculate initial next run time
@@ -695,9 +748,9 @@ void cli_list_tasks(int argc, char *argv[]) {
     (void)argv; // Unused parameter
     
     int count = 0;
-    Task *tasks = scheduler_get_all_tasks(&scheduler, &count);
+    Task *tasks = scheduler_get_tasks_page(&scheduler, 0, LIST_PAGE_SIZE, &count);
     
-    if (!tasks || count == 0) {
+    if (!tasks) {
         printf("No tasks found\n");
         return;
     }
@@ -705,111 +758,121 @@ void cli_list_tasks(int argc, char *argv[]) {
     printf("Task List:\n");
     printf("----------\n");
     
-    for (int i = 0; i < count; i++) {
-        Task *task = &tasks[i];
-        char next_run[64] = "Not scheduled";
-        
-        if (task->next_run_time > 0) {
-            time_t next = task->next_run_time;
-            struct tm *tm_info = localtime(&next);
-            strftime(next_run, sizeof(next_run), "%Y-%m-%d %H:%M:%S", tm_info);
-        }
-        
-        char last_run[64] = "Never";
-        if (task->last_run_time > 0) {
-            time_t last = task->last_run_time;
-            struct tm *tm_info = localtime(&last);
-            strftime(last_run, sizeof(last_run), "%Y-%m-%d %H:%M:%S", tm_info);
-        }
-        
-        printf("ID: %d\n", task->id);
-        printf("Name: %s\n", task->name);
-        printf("Enabled: %s\n", task->enabled ? "Yes" : "No");
-        
-        // Hiển thị loại tác vụ dựa trên exec_mode
-        const char *type_name;
-        switch (task->exec_mode) {
-            case EXEC_COMMAND:
-                type_name = "Command";
-                break;
-            case EXEC_SCRIPT:
-                type_name = "Script";
-                break;
-            case EXEC_AI_DYNAMIC:
-                type_name = "AI Dynamic";
-                break;
-            default:
-                type_name = "Unknown";
-        }
-        printf("Type: %s\n", type_name);
-        
-        if (task->exec_mode == EXEC_COMMAND) {
-            printf("Command: %s\n", task->command);
-        } else if (task->exec_mode == EXEC_SCRIPT) {
-            printf("Script size: %ld bytes\n", strlen(task->script_content));
-        } else if (task->exec_mode == EXEC_AI_DYNAMIC) {
-            printf("AI Prompt: %s\n", task->ai_prompt);
-            printf("System Metrics: %s\n", task->system_metrics);
-        }
-        
-        printf("Schedule: ");
-        if (task->schedule_type == SCHEDULE_INTERVAL) {
-            printf("Every %d minutes\n", task->interval);
-        } else if (task->schedule_type == SCHEDULE_CRON) {
-            printf("Cron: %s\n", task->cron_expression);
-        } else {
-            printf("Manual\n");
-        }
-        
-        printf("Working Dir: %s\n", task->working_dir[0] ? task->working_dir : "(default)");
-        printf("Max Runtime: %d seconds\n", task->max_runtime);
-        
-        // Luôn hiển thị thông tin Last Run nếu có, bất kể trạng thái enabled
-        printf("Last Run: %s\n", last_run);
-        
-        // Hiển thị Exit Code nếu đã từng chạy
-        if (task->last_run_time > 0) {
-            printf("Exit Code: %d\n", task->exit_code);
-        }
-        
-        // Hiển thị Next Run
-        printf("Next Run: %s\n", next_run);
-        
-        // Show dependencies if any
-        if (task->dependency_count > 0) {
-            printf("Dependencies: ");
-            for (int j = 0; j < task->dependency_count; j++) {
-                printf("%d", task->dependencies[j]);
-                if (j < task->dependency_count - 1) {
-                    printf(", ");
-                }
+    while (tasks) {
+        for (int i = 0; i < count; i++) {
+            Task *task = &tasks[i];
+            char next_run[64] = "Not scheduled";
+            
+            if (task->next_run_time > 0) {
+                time_t next = task->next_run_time;
+                struct tm *tm_info = localtime(&next);
+                strftime(next_run, sizeof(next_run), "%Y-%m-%d %H:%M:%S", tm_info);
             }
-            printf("\n");
             
-            // Show dependency behavior
-            printf("Dependency Behavior: ");
-            switch (task->dep_behavior) {
-                case DEP_ANY_SUCCESS:
-                    printf("Any Success\n");
-                    break;
-                case DEP_ALL_SUCCESS:
-                    printf("All Success\n");
+            char last_run[64] = "Never";
+            if (task->last_run_time > 0) {
+                time_t last = task->last_run_time;
+                struct tm *tm_info = localtime(&last);
+                strftime(last_run, sizeof(last_run), "%Y-%m-%d %H:%M:%S", tm_info);
+            }
+            
+            printf("ID: %d\n", task->id);
+            printf("Name: %s\n", task->name);
+            printf("Enabled: %s\n", task->enabled ? "Yes" : "No");
+            
+            // Hiển thị loại tác vụ dựa trên exec_mode
+            const char *type_name;
+            switch (task->exec_mode) {
+                case EXEC_COMMAND:
+                    type_name = "Command";
                     break;
-                case DEP_ANY_COMPLETION:
-                    printf("Any Completion\n");
+                case EXEC_SCRIPT:
+                    type_name = "Script";
                     break;
-                case DEP_ALL_COMPLETION:
-                    printf("All Completion\n");
+                case EXEC_AI_DYNAMIC:
+                    type_name = "AI Dynamic";
                     break;
                 default:
-                    printf("Unknown\n");
+                    type_name = "Unknown";
+            }
+            printf("Type: %s\n", type_name);
+            
+            if (task->exec_mode == EXEC_COMMAND) {
+                printf("Command: %s\n", task->command);
+            } else if (task->exec_mode == EXEC_SCRIPT) {
+                size_t script_length = 0;
+                script_size(task->script_hash, &script_length);
+                printf("Script size: %zu bytes\n", script_length);
+            } else if (task->exec_mode == EXEC_AI_DYNAMIC) {
+                printf("AI Prompt: %s\n", task->ai_prompt);
+                printf("System Metrics: %s\n", task->system_metrics);
+            }
+            
+            printf("Schedule: ");
+            if (task->schedule_type == SCHEDULE_INTERVAL) {
+                printf("Every %d minutes\n", task->interval);
+            } else if (task->schedule_type == SCHEDULE_CRON) {
+                printf("Cron: %s\n", task->cron_expression);
+            } else {
+                printf("Manual\n");
+            }
+            
+            printf("Working Dir: %s\n", task->working_dir[0] ? task->working_dir : "(default)");
+            printf("Max Runtime: %d seconds\n", task->max_runtime);
+            printf("Resource Limits: %s\n", task->resource_limits[0] ? task->resource_limits : "(default)");
+            
+            // Luôn hiển thị thông tin Last Run nếu có, bất kể trạng thái enabled
+            printf("Last Run: %s\n", last_run);
+            
+            // Hiển thị Exit Code nếu đã từng chạy
+            if (task->last_run_time > 0) {
+                printf("Exit Code: %d\n", task->exit_code);
+            }
+            
+            // Hiển thị Next Run
+            printf("Next Run: %s\n", next_run);
+            
+            // Show dependencies if any
+            int dep_count = 0;
+            int *deps = scheduler_get_dependencies(&scheduler, task->id, &dep_count);
+            if (dep_count > 0) {
+                printf("Dependencies: ");
+                for (int j = 0; j < dep_count; j++) {
+                    printf("%d", deps[j]);
+                    if (j < dep_count - 1) {
+                        printf(", ");
+                    }
+                }
+                printf("\n");
+            
+                // Show dependency behavior
+                printf("Dependency Behavior: ");
+                switch (task->dep_behavior) {
+                    case DEP_ANY_SUCCESS:
+                        printf("Any Success\n");
+                        break;
+                    case DEP_ALL_SUCCESS:
+                        printf("All Success\n");
+                        break;
+                    case DEP_ANY_COMPLETION:
+                        printf("Any Completion\n");
+                        break;
+                    case DEP_ALL_COMPLETION:
+                        printf("All Completion\n");
+                        break;
+                    default:
+                        printf("Unknown\n");
+                }
             }
+            free(deps);
+            
+            printf("----------\n");
         }
-        
-        printf("----------\n");
+            
+        int last_id = tasks[count - 1].id;
+        free(tasks);
+        tasks = scheduler_get_tasks_page(&scheduler, last_id, LIST_PAGE_SIZE, &count);
     }
-    
-    free(tasks);
 }
 
 void cli_remove_task(int argc, char *argv[]) {
@@ -1082,7 +1145,7 @@ void cli_view_task(int argc, char *argv[]) {
     if (task->exec_mode == EXEC_COMMAND) {
         printf("Command: %s\n", task->command);
     } else if (task->exec_mode == EXEC_SCRIPT) {
-        printf("Script:\n%s\n", task->script_content);
+        print_task_script(task, "Script");
     } else if (task->exec_mode == EXEC_AI_DYNAMIC) {
         printf("AI Prompt: %s\n", task->ai_prompt);
         printf("System Metrics: %s\n", task->system_metrics);
@@ -1107,6 +1170,7 @@ void cli_view_task(int argc, char *argv[]) {
     
     printf("Working Directory: %s\n", task->working_dir[0] ? task->working_dir : "(default)");
     printf("Max Runtime: %d seconds\n", task->max_runtime);
+    printf("Resource Limits: %s\n", task->resource_limits[0] ? task->resource_limits : "(default)");
     
     // Hiển thị thời gian tạo
     char creation_time_str[64] = "Unknown";
@@ -1137,12 +1201,18 @@ void cli_view_task(int argc, char *argv[]) {
     }
     printf("Next Run: %s\n", next_run);
     
+    if (task->last_run_id > 0) {
+        printf("Last Workflow Run: %d\n", task->last_run_id);
+    }
+    
     // Show dependencies if any
-    if (task->dependency_count > 0) {
+    int dep_count = 0;
+    int *deps = scheduler_get_dependencies(&scheduler, task->id, &dep_count);
+    if (dep_count > 0) {
         printf("Dependencies: ");
-        for (int i = 0; i < task->dependency_count; i++) {
-            printf("%d", task->dependencies[i]);
-            if (i < task->dependency_count - 1) {
+        for (int i = 0; i < dep_count; i++) {
+            printf("%d", deps[i]);
+            if (i < dep_count - 1) {
                 printf(", ");
             }
         }
@@ -1167,6 +1237,7 @@ void cli_view_task(int argc, char *argv[]) {
                 printf("Unknown\n");
         }
     }
+    free(deps);
     
     free(task);
 }
@@ -1174,7 +1245,7 @@ void cli_view_task(int argc, char *argv[]) {
 void cli_edit_task(int argc, char *argv[]) {
     if (argc < 4) {
         printf("Usage: %s edit <task_id> <field> <value>\n", argv[0]);
-        printf("Fields: name, command, interval, cron, dir, runtime\n");
+        printf("Fields: name, command, interval, cron, dir, runtime, limits\n");
         return;
     }
     
@@ -1204,13 +1275,13 @@ void cli_edit_task(int argc, char *argv[]) {
             return;
         }
     } else if (strcmp(field, "script") == 0) {
-        if (task->exec_mode == EXEC_SCRIPT) {
-            safe_strcpy(task->script_content, value, sizeof(task->script_content));
-        } else {
-            // Convert to script mode
-            task->exec_mode = EXEC_SCRIPT;
-            safe_strcpy(task->script_content, value, sizeof(task->script_content));
+        if (!script_store(value, strlen(value), task->script_hash)) {
+            printf("Failed to store script\n");
+            free(task);
+            return;
         }
+        // Converts command-mode tasks to script mode
+        task->exec_mode = EXEC_SCRIPT;
     } else if (strcmp(field, "interval") == 0) {
         task->interval = atoi(value);
         task->schedule_type = SCHEDULE_INTERVAL;
@@ -1223,6 +1294,12 @@ void cli_edit_task(int argc, char *argv[]) {
         safe_strcpy(task->working_dir, value, sizeof(task->working_dir));
     } else if (strcmp(field, "runtime") == 0) {
         task->max_runtime = atoi(value);
+    } else if (strcmp(field, "limits") == 0) {
+        if (!cli_check_limits(value)) {
+            free(task);
+            return;
+        }
+        safe_strcpy(task->resource_limits, value, sizeof(task->resource_limits));
     } else if (strcmp(field, "dep_behavior") == 0) {
         int behavior = atoi(value);
         if (behavior >= DEP_ANY_SUCCESS && behavior <= DEP_ALL_COMPLETION) {
@@ -1261,10 +1338,23 @@ void cli_add_dependency(int argc, char *argv[]) {
         return;
     }
     
-    if (scheduler_add_dependency(&scheduler, task_id, dependency_id)) {
-        printf("Added dependency: Task %d now depends on Task %d\n", task_id, dependency_id);
-    } else {
-        printf("Failed to add dependency\n");
+    switch (scheduler_add_dependency(&scheduler, task_id, dependency_id)) {
+        case DEP_EDGE_OK:
+            printf("Added dependency: Task %d now depends on Task %d\n", task_id, dependency_id);
+            break;
+        case DEP_EDGE_CYCLE:
+            if (task_id == dependency_id) {
+                printf("Failed to add dependency: A task cannot depend on itself\n");
+            } else {
+                printf("Failed to add dependency: Task %d already depends on Task %d "
+                       "(directly or indirectly), this would create a cycle\n", dependency_id, task_id);
+            }
+            break;
+        case DEP_EDGE_NOT_FOUND:
+            printf("Failed to add dependency: One or both tasks not found\n");
+            break;
+        default:
+            printf("Failed to add dependency\n");
     }
 }
 
@@ -1289,6 +1379,364 @@ void cli_remove_dependency(int argc, char *argv[]) {
     }
 }
 
+void cli_run_workflow(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s run-dag <task_id>\n", argv[0]);
+        return;
+    }
+    
+    int task_id = atoi(argv[2]);
+    if (task_id <= 0) {
+        printf("Invalid task ID\n");
+        return;
+    }
+    
+    Task *task = scheduler_get_task(&scheduler, task_id);
+    if (!task) {
+        printf("Task %d not found\n", task_id);
+        return;
+    }
+    free(task);
+    
+    int run_id = workflow_start(&scheduler, task_id);
+    if (run_id == 0) {
+        printf("A workflow run containing task %d is already active\n", task_id);
+        return;
+    } else if (run_id < 0) {
+        printf("Failed to start workflow run for task %d\n", task_id);
+        return;
+    }
+    
+    printf("Workflow run %d started, waiting for it to finish...\n", run_id);
+    workflow_wait(&scheduler, run_id);
+    
+    WorkflowRunRecord run;
+    if (db_get_workflow_run(run_id, &run)) {
+        cli_print_workflow_run(&run);
+        free(run.task_ids);
+        free(run.node_states);
+    } else {
+        printf("Workflow run %d finished but its state could not be loaded\n", run_id);
+    }
+}
+
+void cli_workflow_status(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s dag-status <run_id>\n", argv[0]);
+        return;
+    }
+    
+    int run_id = atoi(argv[2]);
+    if (run_id <= 0) {
+        printf("Invalid run ID\n");
+        return;
+    }
+    
+    WorkflowRunRecord run;
+    if (!db_get_workflow_run(run_id, &run)) {
+        printf("Workflow run %d not found\n", run_id);
+        return;
+    }
+    
+    cli_print_workflow_run(&run);
+    free(run.task_ids);
+    free(run.node_states);
+}
+
+void cli_task_output(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s output <task_id>\n", argv[0]);
+        return;
+    }
+    
+    int task_id = atoi(argv[2]);
+    if (task_id <= 0) {
+        printf("Invalid task ID\n");
+        return;
+    }
+    
+    // Runs are recorded in the background; write out the queued ones first
+    if (scheduler_initialized) {
+        persist_flush(&scheduler.persister);
+    }
+    
+    TaskRunRecord run;
+    if (!db_get_last_task_run(task_id, &run)) {
+        printf("No recorded run for task %d\n", task_id);
+        return;
+    }
+    
+    char started[64];
+    char duration[32];
+    time_to_string((time_t)run.start_time, started, sizeof(started), "%Y-%m-%d %H:%M:%S");
+    format_duration(run.duration, duration, sizeof(duration));
+    printf("Last run of task %d: %s, took %s, ", task_id, started, duration);
+    if (run.timed_out) {
+        printf("timed out\n");
+    } else if (run.term_signal > 0) {
+        printf("killed by signal %d\n", run.term_signal);
+    } else {
+        printf("exit code %d\n", run.exit_code);
+    }
+    printf("CPU: %.2fs user, %.2fs system, peak RSS %ld KB\n",
+           run.user_cpu, run.sys_cpu, run.max_rss_kb);
+    if (run.memory_peak_kb >= 0) {
+        printf("cgroup: memory peak %ld KB", run.memory_peak_kb);
+        if (run.io_read_bytes >= 0) {
+            printf(", %lld bytes read, %lld bytes written", run.io_read_bytes, run.io_write_bytes);
+        }
+        printf("\n");
+    }
+    
+    print_captured_output("stdout", &run.output);
+    print_captured_output("stderr", &run.error_output);
+    free(run.output.data);
+    free(run.error_output.data);
+}
+
+void cli_tail_task(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s tail <task_id>\n", argv[0]);
+        return;
+    }
+    
+    int task_id = atoi(argv[2]);
+    if (task_id <= 0) {
+        printf("Invalid task ID\n");
+        return;
+    }
+    
+    // Whichever process runs the tasks serves the socket, maybe this one
+    char socket_path[MAX_PATH + sizeof(CONTROL_SOCKET_NAME)];
+    snprintf(socket_path, sizeof(socket_path), "%s/%s", scheduler.data_dir, CONTROL_SOCKET_NAME);
+    
+    char error[256];
+    fflush(stdout);
+    if (!control_tail(socket_path, task_id, STDOUT_FILENO, error, sizeof(error))) {
+        printf("Cannot follow task %d: %s\n", task_id, error);
+        printf("Use '%s output %d' for its last finished run\n", argv[0], task_id);
+        return;
+    }
+    printf("\n--- run of task %d ended\n", task_id);
+}
+
+void cli_critical_path(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s critical-path <task_id> [deadline]\n", argv[0]);
+        return;
+    }
+    
+    int task_id = atoi(argv[2]);
+    if (task_id <= 0) {
+        printf("Invalid task ID\n");
+        return;
+    }
+    
+    time_t deadline = 0;
+    if (argc >= 4 && !cli_parse_time(argv[3], &deadline)) {
+        printf("Invalid deadline format. Use YYYY-MM-DD HH:MM[:SS] or HH:MM[:SS]\n");
+        return;
+    }
+    
+    DepCriticalPath cp;
+    if (!scheduler_get_critical_path(&scheduler, task_id, &cp)) {
+        printf("Failed to compute critical path for task %d\n", task_id);
+        return;
+    }
+    
+    char buf[64];
+    format_duration(cp.makespan, buf, sizeof(buf));
+    printf("Workflow of Task %d: %d tasks, makespan %s\n", task_id, cp.node_count, buf);
+    
+    printf("Critical path:");
+    for (int i = 0; i < cp.path_length; i++) {
+        Task *task = scheduler_get_task(&scheduler, cp.path[i]);
+        printf("%s %d (%s)", i > 0 ? " ->" : "", cp.path[i], task ? task->name : "?");
+        free(task);
+    }
+    printf("\n\n");
+    
+    printf("%-6s %-20s %10s %10s %10s %10s %10s\n",
+           "ID", "Name", "Duration", "Start", "Finish", "Latest", "Slack");
+    int unmeasured = 0;
+    for (int i = 0; i < cp.node_count; i++) {
+        const DepPathNode *node = &cp.nodes[i];
+        Task *task = scheduler_get_task(&scheduler, node->task_id);
+        char name[21] = "?";
+        if (task) {
+            safe_strcpy(name, task->name, sizeof(name));
+            if (task->avg_runtime <= 0) {
+                unmeasured++;
+            }
+            free(task);
+        }
+        
+        char duration[16], start[16], finish[16], latest[16], slack[16];
+        format_duration(node->duration, duration, sizeof(duration));
+        format_duration(node->earliest_start, start, sizeof(start));
+        format_duration(node->earliest_finish, finish, sizeof(finish));
+        format_duration(node->latest_start, latest, sizeof(latest));
+        format_duration(node->slack, slack, sizeof(slack));
+        printf("%-6d %-20s %10s %10s %10s %10s %10s%s\n", node->task_id, name,
+               duration, start, finish, latest, slack, node->critical ? " *" : "");
+    }
+    printf("(* = on a critical path; times are relative to the workflow start)\n");
+    if (unmeasured > 0) {
+        printf("Note: %d task(s) have never run and are counted as taking no time\n", unmeasured);
+    }
+    
+    // Start recommendations for the tasks that trigger the workflow
+    printf("\n");
+    if (deadline > 0) {
+        time_t latest_start = deadline - (time_t)(cp.makespan + 0.5);
+        time_to_string(latest_start, buf, sizeof(buf), NULL);
+        printf("To finish by the deadline, start the workflow no later than %s\n", buf);
+        if (latest_start < time(NULL)) {
+            printf("Warning: that time has already passed\n");
+        }
+    }
+    for (int i = 0; i < cp.node_count; i++) {
+        const DepPathNode *node = &cp.nodes[i];
+        int dep_count = 0;
+        int *deps = scheduler_get_dependencies(&scheduler, node->task_id, &dep_count);
+        free(deps);
+        if (dep_count > 0) {
+            continue;
+        }
+        
+        Task *task = scheduler_get_task(&scheduler, node->task_id);
+        if (!task) {
+            continue;
+        }
+        if (deadline > 0) {
+            time_to_string(deadline - (time_t)(cp.makespan - node->latest_start + 0.5),
+                           buf, sizeof(buf), NULL);
+            printf("  Task %d (%s): start by %s\n", task->id, task->name, buf);
+        } else if (task->next_run_time > 0) {
+            char finish_str[64];
+            time_to_string(task->next_run_time, buf, sizeof(buf), NULL);
+            time_to_string(task->next_run_time + (time_t)(cp.makespan + 0.5),
+                           finish_str, sizeof(finish_str), NULL);
+            printf("  Task %d (%s): next run %s, workflow expected to finish by %s\n",
+                   task->id, task->name, buf, finish_str);
+        }
+        free(task);
+    }
+    
+    depgraph_free_critical_path(&cp);
+}
+
+// Helper function to print a workflow run with per-task states
+static void cli_print_workflow_run(const WorkflowRunRecord *run) {
+    char start_str[64];
+    char end_str[64] = "N/A";
+    time_to_string(run->start_time, start_str, sizeof(start_str), NULL);
+    if (run->end_time > 0) {
+        time_to_string(run->end_time, end_str, sizeof(end_str), NULL);
+    }
+    
+    int counts[WF_NODE_SKIPPED + 1] = {0};
+    for (int i = 0; i < run->node_count; i++) {
+        if (run->node_states[i] <= WF_NODE_SKIPPED) {
+            counts[run->node_states[i]]++;
+        }
+    }
+    
+    printf("Workflow Run %d (triggered by Task %d)\n", run->run_id, run->root_task_id);
+    printf("Status: %s\n", workflow_run_status_name((WorkflowRunStatus)run->status));
+    printf("Started: %s\n", start_str);
+    printf("Finished: %s\n", end_str);
+    printf("Tasks: %d (%d succeeded, %d failed, %d skipped, %d running, %d pending)\n",
+           run->node_count, counts[WF_NODE_SUCCEEDED], counts[WF_NODE_FAILED],
+           counts[WF_NODE_SKIPPED], counts[WF_NODE_RUNNING], counts[WF_NODE_PENDING]);
+    
+    for (int i = 0; i < run->node_count; i++) {
+        printf("  Task %d: %s\n", run->task_ids[i],
+               workflow_node_state_name((WorkflowNodeState)run->node_states[i]));
+    }
+}
+
+// Helper function to format seconds as a short human-readable duration
+static void format_duration(double seconds, char *buffer, size_t size) {
+    if (seconds < 60) {
+        snprintf(buffer, size, "%.1fs", seconds);
+    } else if (seconds < 3600) {
+        snprintf(buffer, size, "%dm%02ds", (int)seconds / 60, (int)seconds % 60);
+    } else {
+        snprintf(buffer, size, "%dh%02dm", (int)seconds / 3600, ((int)seconds % 3600) / 60);
+    }
+}
+
+// Helper function to validate resource limits given by the user
+static bool cli_check_limits(const char *limits) {
+    CgroupLimits parsed;
+    char error[128];
+    if (!cgroup_parse_limits(limits, &parsed, error, sizeof(error))) {
+        printf("Invalid resource limits: %s\n", error);
+        return false;
+    }
+    if (limits[0] && !cgroup_enabled()) {
+        printf("Note: limits only apply while cgroups are enabled (\"cgroup\": {\"enabled\": true} in the config)\n");
+    }
+    return true;
+}
+
+// Helper function to print one captured output stream of a run
+static void print_captured_output(const char *label, const CapturedOutput *output) {
+    if (output->total == 0) {
+        printf("--- %s: empty\n", label);
+        return;
+    }
+    
+    printf("--- %s: %lld bytes", label, output->total);
+    if (!output->data) {
+        printf(", not captured\n");
+        return;
+    }
+    printf("\n");
+    fwrite(output->data, 1, output->length, stdout);
+    if (output->length > 0 && output->data[output->length - 1] != '\n') {
+        printf("\n");
+    }
+}
+
+// Read a whole script file (caller must free), NULL if it cannot be used
+static char* read_script_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        printf("Failed to open script file: %s\n", path);
+        return NULL;
+    }
+
+    // One byte more than allowed, to notice files that are too large
+    char *content = (char*)malloc(TASK_SCRIPT_MAX_LENGTH + 2);
+    size_t bytes_read = content ? fread(content, 1, TASK_SCRIPT_MAX_LENGTH + 1, file) : 0;
+    fclose(file);
+
+    if (bytes_read == 0) {
+        printf("Script file is empty or failed to read\n");
+        free(content);
+        return NULL;
+    }
+
+    if (bytes_read > TASK_SCRIPT_MAX_LENGTH) {
+        printf("Script file is too large (limit %d bytes)\n", TASK_SCRIPT_MAX_LENGTH);
+        free(content);
+        return NULL;
+    }
+
+    content[bytes_read] = '\0';
+    *length = bytes_read;
+    return content;
+}
+
+// Print the script body of a task, fetched from the script store
+static void print_task_script(const Task *task, const char *label) {
+    char *script = script_load(task->script_hash, NULL);
+    printf("%s:\n%s\n", label, script ? script : "(script not found)");
+    free(script);
+}
+
 void cli_set_dep_behavior(int argc, char *argv[]) {
     if (argc < 4) {
         printf("Usage: %s set-dep-behavior <task_id> <behavior>\n", argv[0]);
@@ -1330,6 +1778,165 @@ void cli_set_dep_behavior(int argc, char *argv[]) {
     free(task);
 }
 
+// Names used for enum fields in import/export files, indexed by value
+static const char *EXEC_MODE_NAMES[] = { "command", "script", "ai" };
+static const char *SCHEDULE_TYPE_NAMES[] = { "manual", "interval", "cron" };
+static const char *FREQUENCY_NAMES[] = { "once", "daily", "weekly", "monthly", "custom" };
+static const char *DEP_BEHAVIOR_NAMES[] = { "any_success", "all_success", "any_completion", "all_completion" };
+
+void cli_import_tasks(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s import <file>\n", argv[0]);
+        return;
+    }
+    
+    double started = monotonic_seconds();
+    
+    char *text = read_text_file(argv[2]);
+    if (!text) {
+        printf("Failed to read %s\n", argv[2]);
+        return;
+    }
+    
+    cJSON *root = cJSON_Parse(text);
+    free(text);
+    
+    // Either {"tasks": [...]} as written by export, or a bare array
+    const cJSON *list = cJSON_IsArray(root) ? root : cJSON_GetObjectItem(root, "tasks");
+    if (!cJSON_IsArray(list) || cJSON_GetArraySize(list) == 0) {
+        printf("No tasks found in %s (expected a JSON array of tasks or {\"tasks\": [...]})\n", argv[2]);
+        cJSON_Delete(root);
+        return;
+    }
+    
+    int count = cJSON_GetArraySize(list);
+    Task *tasks = (Task*)malloc(sizeof(Task) * count);
+    ImportKey *keys = (ImportKey*)malloc(sizeof(ImportKey) * count);
+    if (!tasks || !keys) {
+        printf("Out of memory\n");
+        free(tasks);
+        free(keys);
+        cJSON_Delete(root);
+        return;
+    }
+    
+    // Definitions, and the file's own IDs, which dependencies refer to
+    int index = 0;
+    int edge_count = 0;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, list) {
+        if (!task_from_json(item, &tasks[index])) {
+            printf("Task %d in %s is invalid\n", index + 1, argv[2]);
+            free(tasks);
+            free(keys);
+            cJSON_Delete(root);
+            return;
+        }
+        
+        const cJSON *id = cJSON_GetObjectItem(item, "id");
+        keys[index].file_id = cJSON_IsNumber(id) ? id->valueint : -1;
+        keys[index].index = index;
+        
+        const cJSON *depends_on = cJSON_GetObjectItem(item, "depends_on");
+        if (cJSON_IsArray(depends_on)) {
+            edge_count += cJSON_GetArraySize(depends_on);
+        }
+        index++;
+    }
+    qsort(keys, count, sizeof(ImportKey), compare_import_keys);
+    
+    TaskImportEdge *edges = (TaskImportEdge*)malloc(sizeof(TaskImportEdge) * (edge_count > 0 ? edge_count : 1));
+    if (!edges) {
+        printf("Out of memory\n");
+        free(tasks);
+        free(keys);
+        cJSON_Delete(root);
+        return;
+    }
+    
+    edge_count = 0;
+    index = 0;
+    bool resolved = true;
+    cJSON_ArrayForEach(item, list) {
+        const cJSON *dependency;
+        cJSON_ArrayForEach(dependency, cJSON_GetObjectItem(item, "depends_on")) {
+            ImportKey key = { cJSON_IsNumber(dependency) ? dependency->valueint : -1, 0 };
+            const ImportKey *found = key.file_id >= 0
+                ? (const ImportKey*)bsearch(&key, keys, count, sizeof(ImportKey), compare_import_keys)
+                : NULL;
+            if (!found) {
+                printf("Task %d (%s) depends on ID %d, which is not in the file\n",
+                       index + 1, tasks[index].name, key.file_id);
+                resolved = false;
+                continue;
+            }
+            edges[edge_count].task = index;
+            edges[edge_count].dependency = found->index;
+            edge_count++;
+        }
+        index++;
+    }
+    cJSON_Delete(root);
+    free(keys);
+    
+    int first = resolved ? scheduler_import_tasks(&scheduler, tasks, count, edges, edge_count) : -1;
+    free(tasks);
+    free(edges);
+    
+    if (first < 0) {
+        printf("Import failed, no tasks were added\n");
+        return;
+    }
+    
+    double elapsed = monotonic_seconds() - started;
+    printf("Imported %d tasks (IDs %d-%d) and %d dependencies in %.3f s (%.0f tasks/s)\n",
+           count, first, first + count - 1, edge_count, elapsed, elapsed > 0 ? count / elapsed : 0.0);
+}
+
+void cli_export_tasks(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s export <file>\n", argv[0]);
+        return;
+    }
+    
+    cJSON *root = cJSON_CreateObject();
+    cJSON *list = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "tasks", list);
+    
+    // Page through the tasks so only the JSON grows with the task count
+    int count = 0;
+    int page_count = 0;
+    int last_id = 0;
+    Task *tasks;
+    while ((tasks = scheduler_get_tasks_page(&scheduler, last_id, LIST_PAGE_SIZE, &page_count)) != NULL) {
+        for (int i = 0; i < page_count; i++) {
+            int dependency_count = 0;
+            int *dependencies = scheduler_get_dependencies(&scheduler, tasks[i].id, &dependency_count);
+            cJSON_AddItemToArray(list, task_to_json(&tasks[i], dependencies, dependency_count));
+            free(dependencies);
+        }
+        count += page_count;
+        last_id = tasks[page_count - 1].id;
+        free(tasks);
+    }
+    
+    char *text = cJSON_Print(root);
+    cJSON_Delete(root);
+    
+    FILE *file = text ? fopen(argv[2], "w") : NULL;
+    bool written = file && fputs(text, file) >= 0 && fputc('\n', file) != EOF;
+    if (file && fclose(file) != 0) {
+        written = false;
+    }
+    free(text);
+    
+    if (!written) {
+        printf("Failed to write %s\n", argv[2]);
+        return;
+    }
+    printf("Exported %d tasks to %s\n", count, argv[2]);
+}
+
 void cli_convert_to_script(int argc, char *argv[]) {
     if (argc < 4) {
         printf("Usage: %s to-script <task_id> <script_content>\n", argv[0]);
@@ -1429,6 +2036,7 @@ void cli_help(int argc, char *argv[]) {
     printf("      -s <cron>        : Schedule in cron format (e.g., \"0 9 * * 1-5\")\n");
     printf("      -d <directory>   : Working directory\n");
     printf("      -m <max_runtime> : Maximum runtime in seconds\n");
+    printf("      -L <limits>      : cgroup limits, e.g. \"cpu=50%%,memory=512M,pids=64\"\n");
     printf("      -x <script>      : Treat as script (provide script content)\n");
     printf("      -f <script_file> : Execute script from file\n");
     printf("  %s ai-create \"<description>\" : Create task with AI-generated command/script\n", argv[0]);
@@ -1443,6 +2051,13 @@ void cli_help(int argc, char *argv[]) {
     printf("  %s add-dep <task_id> <dependency_id> : Add dependency between tasks\n", argv[0]);
     printf("  %s remove-dep <task_id> <dependency_id> : Remove dependency\n", argv[0]);
     printf("  %s set-dep-behavior <task_id> <behavior> : Set dependency behavior\n", argv[0]);
+    printf("  %s run-dag <task_id>  : Run all tasks connected to a task as one workflow run\n", argv[0]);
+    printf("  %s dag-status <run_id> : Show the state of a workflow run\n", argv[0]);
+    printf("  %s output <task_id>  : Show the output of a task's last run\n", argv[0]);
+    printf("  %s tail <task_id>    : Follow the output of a task while it runs\n", argv[0]);
+    printf("  %s critical-path <task_id> [deadline] : Show the critical path and start times of a workflow\n", argv[0]);
+    printf("  %s import <file>     : Add every task in a JSON file (from export) in one transaction\n", argv[0]);
+    printf("  %s export <file>     : Write all task definitions and dependencies to a JSON file\n", argv[0]);
     printf("  %s to-script <task_id> <script> : Convert task to script mode\n", argv[0]);
     printf("  %s to-command <task_id> <command> : Convert task to command mode\n", argv[0]);
     printf("  %s to-ai <task_id> <ai_prompt> <system_metrics> : Convert task to AI-Dynamic mode\n", argv[0]);
@@ -1525,8 +2140,13 @@ void cli_run_interactive(const char *data_dir) {
     printf("Task Scheduler Interactive Mode\n");
     printf("Type 'help' for available commands\n");
     
+    // main() handles SIGINT and SIGTERM; readline's handlers would pass
+    // them on and go back to reading
+    rl_catch_signals = 0;
+    rl_getc_function = read_key;
+    
     bool running = true;
-    while (running) {
+    while (running && !stop_requested) {
         char *line = cli_get_command();
         if (line) {
             // Bỏ qua dòng trống
@@ -1624,6 +2244,29 @@ void cli_run_interactive(const char *data_dir) {
     cli_cleanup();
 }
 
+void cli_request_stop(void) {
+    stop_requested = 1;
+}
+
+// Read one key for readline, giving up once a stop is requested. The stop
+// signals are handled without SA_RESTART, so they interrupt a blocked read.
+static int read_key(FILE *stream) {
+    unsigned char c;
+    while (!stop_requested) {
+        ssize_t n = read(fileno(stream), &c, 1);
+        if (n == 1) {
+            return c;
+        }
+        if (n == 0 || errno != EINTR) {
+            return EOF;
+        }
+    }
+    
+    // readline would accept a partly typed line on EOF
+    rl_replace_line("", 0);
+    return EOF;
+}
+
 // Hàm đọc lệnh từ người dùng
 char* cli_get_command() {
     char *line = readline("> ");
@@ -1809,7 +2452,10 @@ void cli_create_ai_task_with_agent(int argc, char *argv[]) {
     // Set execution mode and content based on AI result
     if (ai_task.is_script) {
         task.exec_mode = EXEC_SCRIPT;
-        safe_strcpy(task.script_content, ai_task.content, sizeof(task.script_content));
+        if (!script_store(ai_task.content, strlen(ai_task.content), task.script_hash)) {
+            printf("Failed to store script\n");
+            return;
+        }
     } else {
         task.exec_mode = EXEC_COMMAND;
         safe_strcpy(task.command, ai_task.content, sizeof(task.command));
@@ -2033,3 +2679,160 @@ int cli_set_recipient_email(int argc, char *argv[]) {
     printf("Successfully set recipient email to: %s\n", recipient_email);
     return 0;
 }
+
+static char* read_text_file(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *buffer = file_size >= 0 ? (char*)malloc(file_size + 1) : NULL;
+    if (!buffer) {
+        fclose(file);
+        return NULL;
+    }
+
+    size_t read_size = fread(buffer, 1, file_size, file);
+    buffer[read_size] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+// Look up the value of an enum field by its name; -1 if not one of them
+static int name_to_enum(const char *const *names, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int compare_import_keys(const void *a, const void *b) {
+    int x = ((const ImportKey*)a)->file_id;
+    int y = ((const ImportKey*)b)->file_id;
+    return (x > y) - (x < y);
+}
+
+// Definition of a task in the import/export format; run state is left out
+static cJSON* task_to_json(const Task *task, const int *dependencies, int dependency_count) {
+    cJSON *item = cJSON_CreateObject();
+    cJSON_AddNumberToObject(item, "id", task->id);
+    cJSON_AddStringToObject(item, "name", task->name);
+    cJSON_AddBoolToObject(item, "enabled", task->enabled);
+    cJSON_AddStringToObject(item, "exec_mode", EXEC_MODE_NAMES[task->exec_mode]);
+    cJSON_AddStringToObject(item, "command", task->command);
+    
+    if (task->exec_mode == EXEC_SCRIPT) {
+        char *script = script_load(task->script_hash, NULL);
+        if (script) {
+            cJSON_AddStringToObject(item, "script", script);
+            free(script);
+        }
+    } else if (task->exec_mode == EXEC_AI_DYNAMIC) {
+        cJSON_AddStringToObject(item, "ai_prompt", task->ai_prompt);
+        cJSON_AddStringToObject(item, "system_metrics", task->system_metrics);
+    }
+    
+    cJSON_AddStringToObject(item, "schedule_type", SCHEDULE_TYPE_NAMES[task->schedule_type]);
+    cJSON_AddStringToObject(item, "frequency", FREQUENCY_NAMES[task->frequency]);
+    cJSON_AddNumberToObject(item, "interval", task->interval);
+    cJSON_AddStringToObject(item, "cron_expression", task->cron_expression);
+    cJSON_AddStringToObject(item, "working_dir", task->working_dir);
+    cJSON_AddNumberToObject(item, "max_runtime", task->max_runtime);
+    cJSON_AddStringToObject(item, "resource_limits", task->resource_limits);
+    cJSON_AddStringToObject(item, "dep_behavior", DEP_BEHAVIOR_NAMES[task->dep_behavior]);
+    
+    cJSON *depends_on = cJSON_CreateArray();
+    for (int i = 0; i < dependency_count; i++) {
+        cJSON_AddItemToArray(depends_on, cJSON_CreateNumber(dependencies[i]));
+    }
+    cJSON_AddItemToObject(item, "depends_on", depends_on);
+    return item;
+}
+
+// Fill a task from its import/export form. Missing fields keep the
+// defaults of task_init; a script body is stored and referenced by hash.
+static bool task_from_json(const cJSON *item, Task *task) {
+    task_init(task);
+    task->schedule_type = SCHEDULE_MANUAL;
+    
+    if (!cJSON_IsObject(item)) {
+        return false;
+    }
+    
+    const cJSON *field;
+    if (cJSON_IsString(field = cJSON_GetObjectItem(item, "name"))) {
+        safe_strcpy(task->name, field->valuestring, sizeof(task->name));
+    }
+    if (cJSON_IsBool(field = cJSON_GetObjectItem(item, "enabled"))) {
+        task->enabled = cJSON_IsTrue(field);
+    }
+    if (cJSON_IsString(field = cJSON_GetObjectItem(item, "command"))) {
+        safe_strcpy(task->command, field->valuestring, sizeof(task->command));
+    }
+    if (cJSON_IsString(field = cJSON_GetObjectItem(item, "ai_prompt"))) {
+        safe_strcpy(task->ai_prompt, field->valuestring, sizeof(task->ai_prompt));
+    }
+    if (cJSON_IsString(field = cJSON_GetObjectItem(item, "system_metrics"))) {
+        safe_strcpy(task->system_metrics, field->valuestring, sizeof(task->system_metrics));
+    }
+    if (cJSON_IsNumber(field = cJSON_GetObjectItem(item, "interval"))) {
+        task->interval = field->valueint;
+    }
+    if (cJSON_IsString(field = cJSON_GetObjectItem(item, "cron_expression"))) {
+        safe_strcpy(task->cron_expression, field->valuestring, sizeof(task->cron_expression));
+    }
+    if (cJSON_IsString(field = cJSON_GetObjectItem(item, "working_dir"))) {
+        safe_strcpy(task->working_dir, field->valuestring, sizeof(task->working_dir));
+    }
+    if (cJSON_IsNumber(field = cJSON_GetObjectItem(item, "max_runtime"))) {
+        task->max_runtime = field->valueint;
+    }
+    if (cJSON_IsString(field = cJSON_GetObjectItem(item, "resource_limits"))) {
+        if (!cli_check_limits(field->valuestring)) {
+            return false;
+        }
+        safe_strcpy(task->resource_limits, field->valuestring, sizeof(task->resource_limits));
+    }
+    
+    // Enum fields: an unknown name is an error rather than a silent default
+    struct {
+        const char *key;
+        const char *const *names;
+        int count;
+        int *value;
+    } enums[] = {
+        { "exec_mode", EXEC_MODE_NAMES, 3, (int*)&task->exec_mode },
+        { "schedule_type", SCHEDULE_TYPE_NAMES, 3, (int*)&task->schedule_type },
+        { "frequency", FREQUENCY_NAMES, 5, (int*)&task->frequency },
+        { "dep_behavior", DEP_BEHAVIOR_NAMES, 4, (int*)&task->dep_behavior },
+    };
+    for (size_t i = 0; i < sizeof(enums) / sizeof(enums[0]); i++) {
+        field = cJSON_GetObjectItem(item, enums[i].key);
+        if (!field) {
+            continue;
+        }
+        int value = cJSON_IsString(field) ? name_to_enum(enums[i].names, enums[i].count, field->valuestring) : -1;
+        if (value < 0) {
+            printf("Unknown %s in task '%s'\n", enums[i].key, task->name);
+            return false;
+        }
+        *enums[i].value = value;
+    }
+    
+    field = cJSON_GetObjectItem(item, "script");
+    if (task->exec_mode == EXEC_SCRIPT && cJSON_IsString(field)) {
+        size_t length = strlen(field->valuestring);
+        if (length == 0 || !script_store(field->valuestring, length, task->script_hash)) {
+            printf("Failed to store the script of task '%s'\n", task->name);
+            return false;
+        }
+    }
+    
+    return task_validate(task);
+}
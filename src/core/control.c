@@ -0,0 +1,508 @@
+#include "../../include/control.h"
+#include "../../include/live_output.h"
+#include "../../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define CONTROL_MAX_EVENTS 32
+#define CONTROL_REQUEST_MAX 128
+
+// epoll data of the server's own descriptors; clients use their pointer
+#define TAG_LISTEN ((void*)1)
+#define TAG_STOP ((void*)2)
+#define TAG_LIVE ((void*)3)
+
+typedef struct ControlClient {
+    int fd;
+    char request[CONTROL_REQUEST_MAX];
+    size_t request_length;
+    char notice[128];            // Reply line or skip marker being sent
+    size_t notice_length;
+    size_t notice_sent;
+    bool closing;                // Close once the notice is sent
+    bool following;              // cursor is set up
+    bool blocked;                // Waiting for the socket to drain
+    bool read_closed;            // Peer shut down its sending side; no longer read
+    LiveCursor cursor;
+    struct ControlClient *next;
+} ControlClient;
+
+static bool control_running = false;    // The one server of the process is up
+
+// Helper functions
+static void* control_thread_func(void *arg);
+static bool bind_socket(ControlServer *server);
+static void accept_clients(ControlServer *server);
+static void read_request(ControlServer *server, ControlClient *client);
+static void handle_request(ControlClient *client);
+static void set_notice(ControlClient *client, bool closing, const char *format, ...);
+static void pump(ControlServer *server, ControlClient *client);
+static void set_blocked(ControlServer *server, ControlClient *client, bool blocked);
+static void watch_client(ControlServer *server, ControlClient *client);
+static void drop_client(ControlServer *server, ControlClient *client);
+static bool epoll_add(int epoll_fd, int fd, uint32_t events, void *ptr);
+
+bool control_start(ControlServer *server, const char *socket_path) {
+    if (!server || !socket_path) {
+        return false;
+    }
+
+    memset(server, 0, sizeof(ControlServer));
+    server->listen_fd = -1;
+    server->epoll_fd = -1;
+    server->stop_fd = -1;
+
+    if (control_running) {
+        log_message(LOG_WARNING, "Control socket already served by this process");
+        return false;
+    }
+    if (strlen(socket_path) >= sizeof(server->socket_path)) {
+        log_message(LOG_WARNING, "Control socket path too long: %s", socket_path);
+        return false;
+    }
+    safe_strcpy(server->socket_path, socket_path, sizeof(server->socket_path));
+
+    int live_fd = live_output_event_fd();
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (live_fd < 0 || server->epoll_fd < 0 || server->stop_fd < 0 || !bind_socket(server) ||
+        !epoll_add(server->epoll_fd, server->listen_fd, EPOLLIN, TAG_LISTEN) ||
+        !epoll_add(server->epoll_fd, server->stop_fd, EPOLLIN, TAG_STOP) ||
+        !epoll_add(server->epoll_fd, live_fd, EPOLLIN, TAG_LIVE)) {
+        log_message(LOG_ERROR, "Failed to set up control socket %s: %s", socket_path, strerror(errno));
+        control_stop(server);
+        return false;
+    }
+
+    server->running = true;
+    if (thread_create(&server->thread, NULL, control_thread_func, server) != 0) {
+        log_message(LOG_ERROR, "Failed to create control thread");
+        server->running = false;
+        control_stop(server);
+        return false;
+    }
+
+    control_running = true;
+    log_message(LOG_INFO, "Control socket listening on %s", socket_path);
+    return true;
+}
+
+void control_stop(ControlServer *server) {
+    if (!server) {
+        return;
+    }
+
+    if (server->running) {
+        uint64_t one = 1;
+        if (write(server->stop_fd, &one, sizeof(one)) < 0) {
+            log_message(LOG_WARNING, "Failed to signal control thread: %s", strerror(errno));
+        }
+        pthread_join(server->thread, NULL);
+        server->running = false;
+        control_running = false;
+    }
+
+    while (server->clients) {
+        drop_client(server, server->clients);
+    }
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        unlink(server->socket_path);
+        server->listen_fd = -1;
+    }
+    if (server->epoll_fd >= 0) {
+        close(server->epoll_fd);
+        server->epoll_fd = -1;
+    }
+    if (server->stop_fd >= 0) {
+        close(server->stop_fd);
+        server->stop_fd = -1;
+    }
+}
+
+bool control_tail(const char *socket_path, int task_id, int out_fd,
+                  char *error, size_t error_size) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        snprintf(error, error_size, "control socket path too long");
+        return false;
+    }
+    safe_strcpy(address.sun_path, socket_path, sizeof(address.sun_path));
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        snprintf(error, error_size, "cannot reach the scheduler at %s: %s", socket_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    char request[64];
+    int length = snprintf(request, sizeof(request), "tail %d\n", task_id);
+    if (send(fd, request, (size_t)length, MSG_NOSIGNAL) != length) {
+        snprintf(error, error_size, "failed to send request: %s", strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // The reply line, then the stream until the server closes it
+    char buffer[64 * 1024];
+    size_t used = 0;
+    bool replied = false;
+    bool success = false;
+    for (;;) {
+        ssize_t n = read(fd, buffer + used, sizeof(buffer) - used);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (!replied) {
+                snprintf(error, error_size, "no reply from the scheduler");
+            } else {
+                success = n == 0;
+                if (!success) {
+                    snprintf(error, error_size, "connection lost: %s", strerror(errno));
+                }
+            }
+            break;
+        }
+        used += (size_t)n;
+
+        size_t start = 0;
+        if (!replied) {
+            char *newline = memchr(buffer, '\n', used);
+            if (!newline) {
+                if (used == sizeof(buffer)) {
+                    snprintf(error, error_size, "malformed reply");
+                    break;
+                }
+                continue;
+            }
+            *newline = '\0';
+            if (strcmp(buffer, "ok") != 0) {
+                snprintf(error, error_size, "%s", strncmp(buffer, "error ", 6) == 0 ? buffer + 6 : buffer);
+                break;
+            }
+            replied = true;
+            start = (size_t)(newline + 1 - buffer);
+        }
+
+        if (used > start && write(out_fd, buffer + start, used - start) < 0) {
+            snprintf(error, error_size, "failed to write output: %s", strerror(errno));
+            break;
+        }
+        used = 0;
+    }
+
+    close(fd);
+    return success;
+}
+
+static void* control_thread_func(void *arg) {
+    ControlServer *server = (ControlServer*)arg;
+    int live_fd = live_output_event_fd();
+    struct epoll_event events[CONTROL_MAX_EVENTS];
+
+    for (;;) {
+        int count = epoll_wait(server->epoll_fd, events, CONTROL_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_message(LOG_ERROR, "Control socket wait failed: %s", strerror(errno));
+            break;
+        }
+
+        bool stop = false;
+        bool output_ready = false;
+        for (int i = 0; i < count; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == TAG_STOP) {
+                stop = true;
+            } else if (tag == TAG_LISTEN) {
+                accept_clients(server);
+            } else if (tag == TAG_LIVE) {
+                uint64_t ignored;
+                if (read(live_fd, &ignored, sizeof(ignored)) < 0 && errno != EAGAIN) {
+                    log_message(LOG_WARNING, "Failed to read live output event: %s", strerror(errno));
+                }
+                output_ready = true;
+            } else {
+                // A half-closed client may still be following; only a
+                // connection closed both ways or broken is dropped here
+                ControlClient *client = (ControlClient*)tag;
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    drop_client(server, client);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    set_blocked(server, client, false);
+                }
+                if (events[i].events & EPOLLIN) {
+                    read_request(server, client);
+                } else {
+                    pump(server, client);
+                }
+            }
+        }
+        if (stop) {
+            break;
+        }
+
+        // New output: every follower that can take more gets it
+        if (output_ready) {
+            ControlClient *client = server->clients;
+            while (client) {
+                ControlClient *next = client->next;
+                if (client->following && !client->blocked) {
+                    pump(server, client);
+                }
+                client = next;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static bool bind_socket(ControlServer *server) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    safe_strcpy(address.sun_path, server->socket_path, sizeof(address.sun_path));
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        return false;
+    }
+
+    bool bound = bind(server->listen_fd, (struct sockaddr*)&address, sizeof(address)) == 0;
+    if (!bound && errno == EADDRINUSE) {
+        // Left behind by a process that is gone, or served by a live one
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (live) {
+            log_message(LOG_WARNING, "Control socket %s is served by another process", server->socket_path);
+            close(server->listen_fd);
+            server->listen_fd = -1;
+            errno = EADDRINUSE;
+            return false;
+        }
+        unlink(server->socket_path);
+        bound = bind(server->listen_fd, (struct sockaddr*)&address, sizeof(address)) == 0;
+    }
+    if (!bound) {
+        int saved = errno;
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        errno = saved;
+        return false;
+    }
+
+    // Only the owner may follow task output
+    if (chmod(server->socket_path, 0600) != 0 || listen(server->listen_fd, 16) != 0) {
+        close(server->listen_fd);
+        unlink(server->socket_path);
+        server->listen_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+static void accept_clients(ControlServer *server) {
+    for (;;) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_message(LOG_WARNING, "Failed to accept control connection: %s", strerror(errno));
+            }
+            return;
+        }
+
+        ControlClient *client = server->client_count < CONTROL_MAX_CLIENTS ?
+                                (ControlClient*)calloc(1, sizeof(ControlClient)) : NULL;
+        if (!client) {
+            log_message(LOG_WARNING, "Refusing control connection: too many clients");
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        if (!epoll_add(server->epoll_fd, fd, EPOLLIN, client)) {
+            log_message(LOG_WARNING, "Failed to watch control connection: %s", strerror(errno));
+            close(fd);
+            free(client);
+            continue;
+        }
+        client->next = server->clients;
+        server->clients = client;
+        server->client_count++;
+    }
+}
+
+static void read_request(ControlServer *server, ControlClient *client) {
+    // Followers have nothing more to say; anything they send is ignored
+    char discard[256];
+    char *into = client->following || client->closing ? discard : client->request + client->request_length;
+    size_t room = client->following || client->closing ? sizeof(discard) :
+                  sizeof(client->request) - 1 - client->request_length;
+
+    ssize_t n = read(client->fd, into, room);
+    if (n == 0 && (client->following || client->closing)) {
+        // Done sending after its request: keep answering, stop reading
+        client->read_closed = true;
+        watch_client(server, client);
+        return;
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        drop_client(server, client);
+        return;
+    }
+    if (n < 0 || client->following || client->closing) {
+        return;
+    }
+
+    client->request_length += (size_t)n;
+    client->request[client->request_length] = '\0';
+    char *newline = strchr(client->request, '\n');
+    if (newline) {
+        *newline = '\0';
+        handle_request(client);
+    } else if (client->request_length == sizeof(client->request) - 1) {
+        set_notice(client, true, "error request too long\n");
+    } else {
+        return;
+    }
+    pump(server, client);
+}
+
+static void handle_request(ControlClient *client) {
+    int task_id;
+    char extra;
+    if (sscanf(client->request, "tail %d %c", &task_id, &extra) != 1 || task_id <= 0) {
+        set_notice(client, true, "error unknown request\n");
+        return;
+    }
+
+    if (!live_output_subscribe(task_id, &client->cursor)) {
+        set_notice(client, true, "error task %d is not running\n", task_id);
+        return;
+    }
+    client->following = true;
+    set_notice(client, false, "ok\n");
+}
+
+static void set_notice(ControlClient *client, bool closing, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(client->notice, sizeof(client->notice), format, args);
+    va_end(args);
+
+    client->notice_length = length > 0 && (size_t)length < sizeof(client->notice) ?
+                            (size_t)length : strlen(client->notice);
+    client->notice_sent = 0;
+    client->closing = closing;
+}
+
+// Send a client whatever it can take now
+static void pump(ControlServer *server, ControlClient *client) {
+    while (!client->blocked) {
+        if (client->notice_sent < client->notice_length) {
+            ssize_t n = send(client->fd, client->notice + client->notice_sent,
+                             client->notice_length - client->notice_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    set_blocked(server, client, true);
+                } else {
+                    drop_client(server, client);
+                }
+                return;
+            }
+            client->notice_sent += (size_t)n;
+            continue;
+        }
+        if (client->closing) {
+            drop_client(server, client);
+            return;
+        }
+        if (!client->following) {
+            return;
+        }
+
+        long long skipped = 0;
+        switch (live_output_send(&client->cursor, client->fd, &skipped)) {
+            case LIVE_SEND_PROGRESS:
+                break;
+            case LIVE_SEND_SKIPPED:
+                set_notice(client, false, "\n[... %lld bytes skipped ...]\n", skipped);
+                break;
+            case LIVE_SEND_IDLE:
+                return;
+            case LIVE_SEND_FULL:
+                set_blocked(server, client, true);
+                return;
+            case LIVE_SEND_END:
+            case LIVE_SEND_ERROR:
+                drop_client(server, client);
+                return;
+        }
+    }
+}
+
+static void set_blocked(ControlServer *server, ControlClient *client, bool blocked) {
+    if (client->blocked == blocked) {
+        return;
+    }
+
+    client->blocked = blocked;
+    watch_client(server, client);
+}
+
+// Watch for input until the client shuts down its side, and for room to
+// write while blocked. Hangups and errors are always reported.
+static void watch_client(ControlServer *server, ControlClient *client) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (client->read_closed ? 0 : EPOLLIN) | (client->blocked ? EPOLLOUT : 0);
+    event.data.ptr = client;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+static void drop_client(ControlServer *server, ControlClient *client) {
+    for (ControlClient **link = &server->clients; *link; link = &(*link)->next) {
+        if (*link == client) {
+            *link = client->next;
+            break;
+        }
+    }
+    server->client_count--;
+
+    if (client->following) {
+        live_output_unsubscribe(&client->cursor);
+    }
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client);
+}
+
+static bool epoll_add(int epoll_fd, int fd, uint32_t events, void *ptr) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = ptr;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
@@ -0,0 +1,1610 @@
+#include "../../include/depgraph.h"
+#include "../../include/utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_NODE_CAPACITY 64
+#define INITIAL_EDGE_CAPACITY 64
+#define INITIAL_LIST_CAPACITY 2
+#define INITIAL_SLOT_CAPACITY 128
+#define CRITICAL_SLACK_EPSILON 1e-6
+
+// Helper functions for the dense node index
+static int node_find(const DepGraph *graph, int task_id);
+static int node_get(DepGraph *graph, int task_id);
+static void node_release(DepGraph *graph, int node);
+static bool nodes_reserve(DepGraph *graph, int node);
+static bool slots_resize(DepGraph *graph, int capacity);
+static unsigned int slot_hash(int task_id, int capacity);
+
+// Helper functions for a single adjacency direction
+static bool adjacency_init(DepAdjacency *adj);
+static void adjacency_free(DepAdjacency *adj);
+static bool adjacency_reserve_nodes(DepAdjacency *adj, int capacity);
+static bool adjacency_reserve_edges(DepAdjacency *adj, int needed);
+static bool adjacency_grow_list(DepAdjacency *adj, int node);
+static bool adjacency_compact(DepAdjacency *adj);
+static int adjacency_find(const DepAdjacency *adj, int node, int target, bool *found);
+static bool adjacency_insert(DepAdjacency *adj, int node, int target, int target_node);
+static bool adjacency_erase(DepAdjacency *adj, int node, int target);
+static void adjacency_clear(DepAdjacency *adj, int node);
+static bool adjacency_build(DepAdjacency *adj, const int *sources, const int *targets,
+                            int count, const int *node_ids);
+static const int* adjacency_ids(const DepAdjacency *adj, int node, int *count);
+static const int* adjacency_nodes(const DepAdjacency *adj, int node, int *count);
+
+// Helper functions for the topological order and levels
+static bool graph_build(DepGraph *graph, const int *task_nodes, const int *dependency_nodes, int count);
+static bool order_rebuild(DepGraph *graph);
+static bool order_collect(DepGraph *graph, const DepAdjacency *adj, int start,
+                          int lower, int upper, int target, int *out, int *out_count);
+static void order_sort_nodes(DepGraph *graph, int *nodes, int count);
+static bool component_collect(DepGraph *graph, int node, int **nodes, int *count);
+static bool levels_update(DepGraph *graph);
+static bool masks_update(DepGraph *graph);
+static void finish_propagate(DepGraph *graph, int start);
+static void finish_rebuild(DepGraph *graph);
+static void heap_push(DepGraph *graph, int *size, int node);
+static int heap_pop(DepGraph *graph, int *size);
+static int compare_ints(const void *a, const void *b);
+static int compare_packed(const void *a, const void *b);
+static bool edges_acyclic(const int *task_nodes, const int *dependency_nodes, int count, int node_count);
+
+bool depgraph_init(DepGraph *graph) {
+    if (!graph) {
+        return false;
+    }
+
+    memset(graph, 0, sizeof(DepGraph));
+
+    if (!adjacency_init(&graph->upstream) || !adjacency_init(&graph->downstream) ||
+        !nodes_reserve(graph, INITIAL_NODE_CAPACITY - 1) ||
+        !slots_resize(graph, INITIAL_SLOT_CAPACITY)) {
+        depgraph_free(graph);
+        return false;
+    }
+
+    graph->levels_dirty = true;
+    return true;
+}
+
+void depgraph_free(DepGraph *graph) {
+    if (!graph) {
+        return;
+    }
+
+    adjacency_free(&graph->upstream);
+    adjacency_free(&graph->downstream);
+
+    free(graph->node_ids);
+    free(graph->slots);
+    free(graph->free_nodes);
+    free(graph->order);
+    free(graph->by_order);
+    free(graph->mark);
+    free(graph->stack);
+    free(graph->affected);
+    free(graph->pool);
+    free(graph->duration);
+    free(graph->finish);
+    free(graph->completed_bits);
+    free(graph->succeeded_bits);
+    free(graph->mask_offsets);
+    free(graph->mask_blocks);
+    free(graph->mask_words);
+    free(graph->levels);
+    free(graph->level_offsets);
+    free(graph->level_nodes);
+    memset(graph, 0, sizeof(DepGraph));
+}
+
+bool depgraph_load(DepGraph *graph, const int *task_ids, const int *dependency_ids, int count) {
+    if (!graph || count < 0 || (count > 0 && (!task_ids || !dependency_ids))) {
+        return false;
+    }
+
+    int *task_nodes = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+    int *dependency_nodes = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+    if (!task_nodes || !dependency_nodes) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependency edges");
+        free(task_nodes);
+        free(dependency_nodes);
+        return false;
+    }
+
+    bool success = true;
+    for (int i = 0; i < count && success; i++) {
+        task_nodes[i] = node_get(graph, task_ids[i]);
+        dependency_nodes[i] = node_get(graph, dependency_ids[i]);
+        success = task_nodes[i] >= 0 && dependency_nodes[i] >= 0;
+    }
+
+    if (success) {
+        success = graph_build(graph, task_nodes, dependency_nodes, count);
+    } else {
+        log_message(LOG_ERROR, "Failed to build dependency graph with %d edges", count);
+    }
+
+    free(task_nodes);
+    free(dependency_nodes);
+    return success;
+}
+
+DepEdgeResult depgraph_add_dependencies(DepGraph *graph, const int *task_ids,
+                                        const int *dependency_ids, int count) {
+    if (!graph || count < 0 || (count > 0 && (!task_ids || !dependency_ids))) {
+        return DEP_EDGE_ERROR;
+    }
+
+    int existing = graph->upstream.edge_count;
+    int total = existing + count;
+    int *all_tasks = (int*)malloc(sizeof(int) * (total > 0 ? total : 1));
+    int *all_dependencies = (int*)malloc(sizeof(int) * (total > 0 ? total : 1));
+    if (!all_tasks || !all_dependencies) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependency edges");
+        free(all_tasks);
+        free(all_dependencies);
+        return DEP_EDGE_ERROR;
+    }
+
+    // Current edges, then the new ones, as nodes; duplicates are dropped by the build
+    int n = 0;
+    for (int node = 0; node < graph->node_count; node++) {
+        int degree = 0;
+        const int *dependencies = adjacency_nodes(&graph->upstream, node, &degree);
+        for (int i = 0; i < degree; i++) {
+            all_tasks[n] = node;
+            all_dependencies[n] = dependencies[i];
+            n++;
+        }
+    }
+
+    DepEdgeResult result = DEP_EDGE_OK;
+    for (int i = 0; i < count && result == DEP_EDGE_OK; i++) {
+        if (task_ids[i] < 0 || dependency_ids[i] < 0) {
+            result = DEP_EDGE_ERROR;
+        } else if (task_ids[i] == dependency_ids[i]) {
+            result = DEP_EDGE_CYCLE;
+        } else {
+            all_tasks[n] = node_get(graph, task_ids[i]);
+            all_dependencies[n] = node_get(graph, dependency_ids[i]);
+            if (all_tasks[n] < 0 || all_dependencies[n] < 0) {
+                result = DEP_EDGE_ERROR;
+            }
+            n++;
+        }
+    }
+
+    if (result == DEP_EDGE_OK && !edges_acyclic(all_tasks, all_dependencies, n, graph->node_count)) {
+        result = DEP_EDGE_CYCLE;
+    }
+    if (result == DEP_EDGE_OK && !graph_build(graph, all_tasks, all_dependencies, n)) {
+        result = DEP_EDGE_ERROR;
+    }
+
+    free(all_tasks);
+    free(all_dependencies);
+    return result;
+}
+
+DepEdgeResult depgraph_add_dependency(DepGraph *graph, int task_id, int dependency_id) {
+    if (!graph || task_id < 0 || dependency_id < 0) {
+        return DEP_EDGE_ERROR;
+    }
+
+    if (task_id == dependency_id) {
+        return DEP_EDGE_CYCLE;
+    }
+
+    if (depgraph_has_dependency(graph, task_id, dependency_id)) {
+        // Already exists, not an error
+        return DEP_EDGE_OK;
+    }
+
+    int task = node_get(graph, task_id);
+    int dependency = node_get(graph, dependency_id);
+    if (task < 0 || dependency < 0) {
+        return DEP_EDGE_ERROR;
+    }
+
+    // The dependency must precede the task. If it already does, the order
+    // stays valid; otherwise reorder the affected region [lower, upper].
+    int lower = graph->order[task];
+    int upper = graph->order[dependency];
+
+    if (upper > lower) {
+        int forward_count = 0;
+        int backward_count = 0;
+
+        // Tasks reachable from the task inside the region; reaching the
+        // dependency itself means the new edge would close a cycle
+        if (order_collect(graph, &graph->downstream, task, lower, upper, dependency,
+                          graph->affected, &forward_count)) {
+            return DEP_EDGE_CYCLE;
+        }
+
+        // Tasks that reach the dependency inside the region
+        order_collect(graph, &graph->upstream, dependency, lower, upper, -1,
+                      graph->affected + forward_count, &backward_count);
+
+        int *forward = graph->affected;
+        int *backward = graph->affected + forward_count;
+        int total = forward_count + backward_count;
+
+        order_sort_nodes(graph, forward, forward_count);
+        order_sort_nodes(graph, backward, backward_count);
+
+        // Pool the positions the affected tasks occupy, in ascending order
+        for (int i = 0; i < total; i++) {
+            graph->pool[i] = graph->order[graph->affected[i]];
+            graph->mark[graph->affected[i]] = 0;
+        }
+        qsort(graph->pool, total, sizeof(int), compare_ints);
+
+        // Hand them out again: everything reaching the dependency first,
+        // then everything reachable from the task
+        int next = 0;
+        for (int i = 0; i < backward_count; i++, next++) {
+            graph->order[backward[i]] = graph->pool[next];
+            graph->by_order[graph->pool[next]] = backward[i];
+        }
+        for (int i = 0; i < forward_count; i++, next++) {
+            graph->order[forward[i]] = graph->pool[next];
+            graph->by_order[graph->pool[next]] = forward[i];
+        }
+    }
+
+    if (!adjacency_insert(&graph->upstream, task, dependency_id, dependency)) {
+        return DEP_EDGE_ERROR;
+    }
+
+    if (!adjacency_insert(&graph->downstream, dependency, task_id, task)) {
+        // Keep both directions consistent
+        adjacency_erase(&graph->upstream, task, dependency_id);
+        return DEP_EDGE_ERROR;
+    }
+
+    graph->levels_dirty = true;
+    graph->masks_dirty = true;
+
+    // A new edge can only move the task's finish later, and only if the
+    // dependency finishes after the task's other dependencies
+    if (graph->finish[dependency] + graph->duration[task] > graph->finish[task]) {
+        finish_propagate(graph, task);
+    }
+    return DEP_EDGE_OK;
+}
+
+bool depgraph_remove_dependency(DepGraph *graph, int task_id, int dependency_id) {
+    if (!graph) {
+        return false;
+    }
+
+    int task = node_find(graph, task_id);
+    int dependency = node_find(graph, dependency_id);
+    if (task < 0 || dependency < 0) {
+        return false;
+    }
+
+    bool removed = adjacency_erase(&graph->upstream, task, dependency_id);
+    adjacency_erase(&graph->downstream, dependency, task_id);
+
+    // Removing an edge never invalidates the order, only the levels. The
+    // task's finish only moves if the dependency was the one it waited for.
+    if (removed) {
+        graph->levels_dirty = true;
+        graph->masks_dirty = true;
+        if (graph->finish[dependency] + graph->duration[task] >= graph->finish[task]) {
+            finish_propagate(graph, task);
+        }
+    }
+
+    return removed;
+}
+
+void depgraph_remove_task(DepGraph *graph, int task_id) {
+    if (!graph) {
+        return;
+    }
+
+    int node = node_find(graph, task_id);
+    if (node < 0) {
+        return;
+    }
+
+    int count = 0;
+
+    // Drop the task from the fan-out lists of its dependencies
+    const int *deps = adjacency_nodes(&graph->upstream, node, &count);
+    for (int i = 0; i < count; i++) {
+        adjacency_erase(&graph->downstream, deps[i], task_id);
+    }
+    adjacency_clear(&graph->upstream, node);
+
+    // Drop the task from the fan-in lists of its dependents
+    const int *dependents = adjacency_nodes(&graph->downstream, node, &count);
+    for (int i = 0; i < count; i++) {
+        adjacency_erase(&graph->upstream, dependents[i], task_id);
+        if (graph->finish[node] + graph->duration[dependents[i]] >= graph->finish[dependents[i]]) {
+            finish_propagate(graph, dependents[i]);
+        }
+    }
+    adjacency_clear(&graph->downstream, node);
+
+    // The node goes back to the free list without edges, so its position
+    // in the order stays valid for whichever task gets it next
+    graph->duration[node] = 0;
+    graph->finish[node] = 0;
+    graph->levels[node] = 0;
+    graph->completed_bits[node >> 6] &= ~((uint64_t)1 << (node & 63));
+    graph->succeeded_bits[node >> 6] &= ~((uint64_t)1 << (node & 63));
+    node_release(graph, node);
+
+    graph->levels_dirty = true;
+    graph->masks_dirty = true;
+}
+
+const int* depgraph_get_dependencies(const DepGraph *graph, int task_id, int *count) {
+    if (!graph) {
+        if (count) {
+            *count = 0;
+        }
+        return NULL;
+    }
+
+    return adjacency_ids(&graph->upstream, node_find(graph, task_id), count);
+}
+
+const int* depgraph_get_dependents(const DepGraph *graph, int task_id, int *count) {
+    if (!graph) {
+        if (count) {
+            *count = 0;
+        }
+        return NULL;
+    }
+
+    return adjacency_ids(&graph->downstream, node_find(graph, task_id), count);
+}
+
+bool depgraph_has_dependency(const DepGraph *graph, int task_id, int dependency_id) {
+    if (!graph) {
+        return false;
+    }
+
+    int node = node_find(graph, task_id);
+    if (node < 0) {
+        return false;
+    }
+
+    bool found = false;
+    adjacency_find(&graph->upstream, node, dependency_id, &found);
+    return found;
+}
+
+bool depgraph_get_component(DepGraph *graph, int task_id, int **ids, int *count) {
+    if (!graph || !ids || !count || task_id < 0) {
+        return false;
+    }
+
+    *ids = NULL;
+    *count = 0;
+
+    int node = node_get(graph, task_id);
+    if (node < 0) {
+        return false;
+    }
+
+    int *nodes = NULL;
+    int n = 0;
+    if (!component_collect(graph, node, &nodes, &n)) {
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        nodes[i] = graph->node_ids[nodes[i]];
+    }
+
+    *ids = nodes;
+    *count = n;
+    return true;
+}
+
+bool depgraph_set_duration(DepGraph *graph, int task_id, double seconds) {
+    if (!graph || task_id < 0 || seconds < 0) {
+        return false;
+    }
+
+    // A task without a node has no edges and no runtime yet
+    int node = node_find(graph, task_id);
+    if (node < 0 && seconds == 0) {
+        return true;
+    }
+    if (node < 0 && (node = node_get(graph, task_id)) < 0) {
+        return false;
+    }
+
+    if (graph->duration[node] == seconds) {
+        return true;
+    }
+
+    graph->duration[node] = seconds;
+    finish_propagate(graph, node);
+    return true;
+}
+
+bool depgraph_get_critical_path(DepGraph *graph, int task_id, DepCriticalPath *result) {
+    if (!graph || !result) {
+        return false;
+    }
+
+    memset(result, 0, sizeof(DepCriticalPath));
+
+    int start = node_get(graph, task_id);
+    int *nodes = NULL;
+    int count = 0;
+    if (start < 0 || !component_collect(graph, start, &nodes, &count)) {
+        return false;
+    }
+
+    result->nodes = (DepPathNode*)calloc(count, sizeof(DepPathNode));
+    result->path = (int*)malloc(sizeof(int) * count);
+    if (!result->nodes || !result->path) {
+        log_message(LOG_ERROR, "Failed to allocate memory for critical path");
+        free(nodes);
+        depgraph_free_critical_path(result);
+        return false;
+    }
+    result->node_count = count;
+
+    // Forward pass is already done incrementally; read it off
+    double makespan = 0;
+    for (int i = 0; i < count; i++) {
+        int node = nodes[i];
+        DepPathNode *entry = &result->nodes[i];
+        entry->task_id = graph->node_ids[node];
+        entry->duration = graph->duration[node];
+        entry->earliest_finish = graph->finish[node];
+        entry->earliest_start = graph->finish[node] - graph->duration[node];
+        if (entry->earliest_finish > makespan) {
+            makespan = entry->earliest_finish;
+        }
+    }
+    result->makespan = makespan;
+
+    // Backward pass in reverse topological order; pool maps nodes to their
+    // index in the component
+    for (int i = 0; i < count; i++) {
+        graph->pool[nodes[i]] = i;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        DepPathNode *entry = &result->nodes[i];
+        double latest_finish = makespan;
+
+        int n = 0;
+        const int *dependents = adjacency_nodes(&graph->downstream, nodes[i], &n);
+        for (int j = 0; j < n; j++) {
+            double dependent_start = result->nodes[graph->pool[dependents[j]]].latest_start;
+            if (dependent_start < latest_finish) {
+                latest_finish = dependent_start;
+            }
+        }
+
+        entry->latest_start = latest_finish - entry->duration;
+        entry->slack = entry->latest_start - entry->earliest_start;
+        if (entry->slack < CRITICAL_SLACK_EPSILON) {
+            entry->slack = 0;
+            entry->critical = true;
+        }
+    }
+
+    // Walk back from a task finishing last, always through the upstream
+    // task that finishes latest
+    int current = -1;
+    for (int i = 0; i < count; i++) {
+        if (result->nodes[i].critical &&
+            result->nodes[i].earliest_finish >= makespan - CRITICAL_SLACK_EPSILON) {
+            current = i;
+            break;
+        }
+    }
+    while (current >= 0) {
+        result->path[result->path_length++] = result->nodes[current].task_id;
+
+        int n = 0;
+        const int *deps = adjacency_nodes(&graph->upstream, nodes[current], &n);
+        int next = -1;
+        double latest = -1;
+        for (int j = 0; j < n; j++) {
+            if (graph->finish[deps[j]] > latest) {
+                latest = graph->finish[deps[j]];
+                next = graph->pool[deps[j]];
+            }
+        }
+        current = next;
+    }
+    for (int i = 0; i < result->path_length / 2; i++) {
+        int tmp = result->path[i];
+        result->path[i] = result->path[result->path_length - 1 - i];
+        result->path[result->path_length - 1 - i] = tmp;
+    }
+
+    free(nodes);
+    return true;
+}
+
+void depgraph_free_critical_path(DepCriticalPath *result) {
+    if (!result) {
+        return;
+    }
+
+    free(result->nodes);
+    free(result->path);
+    memset(result, 0, sizeof(DepCriticalPath));
+}
+
+bool depgraph_set_task_state(DepGraph *graph, int task_id, bool completed, bool succeeded) {
+    if (!graph || task_id < 0) {
+        return false;
+    }
+
+    // A task without a node reads as never run already
+    int node = node_find(graph, task_id);
+    if (node < 0 && !completed) {
+        return true;
+    }
+    if (node < 0 && (node = node_get(graph, task_id)) < 0) {
+        return false;
+    }
+
+    uint64_t bit = (uint64_t)1 << (node & 63);
+    int word = node >> 6;
+    graph->completed_bits[word] = completed ? (graph->completed_bits[word] | bit)
+                                            : (graph->completed_bits[word] & ~bit);
+    graph->succeeded_bits[word] = (completed && succeeded) ? (graph->succeeded_bits[word] | bit)
+                                                           : (graph->succeeded_bits[word] & ~bit);
+    return true;
+}
+
+bool depgraph_dependencies_satisfied(DepGraph *graph, int task_id,
+                                     bool require_success, bool require_all) {
+    if (!graph || task_id < 0) {
+        return false;
+    }
+
+    if (graph->masks_dirty && !masks_update(graph)) {
+        return false;
+    }
+
+    int node = node_find(graph, task_id);
+    if (node < 0 || node >= graph->mask_node_capacity) {
+        return true;
+    }
+
+    int begin = graph->mask_offsets[node];
+    int end = graph->mask_offsets[node + 1];
+    if (begin == end) {
+        return true;
+    }
+
+    // Branch-free reductions over the dependency words: bits still missing
+    // for "all", bits present for "any"
+    const uint64_t *state = require_success ? graph->succeeded_bits : graph->completed_bits;
+    const int *blocks = graph->mask_blocks;
+    const uint64_t *words = graph->mask_words;
+    uint64_t missing = 0;
+    uint64_t present = 0;
+    for (int k = begin; k < end; k++) {
+        uint64_t have = state[blocks[k]];
+        missing |= words[k] & ~have;
+        present |= words[k] & have;
+    }
+
+    return require_all ? missing == 0 : present != 0;
+}
+
+int depgraph_get_level(DepGraph *graph, int task_id) {
+    if (!graph) {
+        return 0;
+    }
+
+    int node = node_find(graph, task_id);
+    if (node < 0) {
+        return 0;
+    }
+
+    if (graph->levels_dirty && !levels_update(graph)) {
+        return 0;
+    }
+
+    return graph->levels[node];
+}
+
+int depgraph_get_level_count(DepGraph *graph) {
+    if (!graph) {
+        return 0;
+    }
+
+    if (graph->levels_dirty && !levels_update(graph)) {
+        return 0;
+    }
+
+    return graph->level_count;
+}
+
+const int* depgraph_get_level_nodes(DepGraph *graph, int level, int *count) {
+    if (count) {
+        *count = 0;
+    }
+
+    if (!graph) {
+        return NULL;
+    }
+
+    if (graph->levels_dirty && !levels_update(graph)) {
+        return NULL;
+    }
+
+    if (level < 0 || level >= graph->level_count) {
+        return NULL;
+    }
+
+    int start = graph->level_offsets[level];
+    int n = graph->level_offsets[level + 1] - start;
+
+    if (count) {
+        *count = n;
+    }
+
+    return n > 0 ? &graph->level_nodes[start] : NULL;
+}
+
+static unsigned int slot_hash(int task_id, int capacity) {
+    // Multiplicative hashing; consecutive IDs land in distinct slots
+    return ((unsigned int)task_id * 2654435761u) & (unsigned int)(capacity - 1);
+}
+
+// Helper function to look up the node of a task, -1 if it has none
+static int node_find(const DepGraph *graph, int task_id) {
+    if (task_id < 0 || graph->slot_capacity == 0) {
+        return -1;
+    }
+
+    unsigned int mask = (unsigned int)graph->slot_capacity - 1;
+    for (unsigned int i = slot_hash(task_id, graph->slot_capacity); ; i = (i + 1) & mask) {
+        int node = graph->slots[i];
+        if (node < 0) {
+            return -1;
+        }
+        if (graph->node_ids[node] == task_id) {
+            return node;
+        }
+    }
+}
+
+// Helper function to get the node of a task, giving it one if it has none.
+// Nodes of removed tasks are reused first, so nodes stay dense.
+static int node_get(DepGraph *graph, int task_id) {
+    if (task_id < 0) {
+        return -1;
+    }
+
+    int node = node_find(graph, task_id);
+    if (node >= 0) {
+        return node;
+    }
+
+    // Keep the table at most half full so probes stay short
+    int live = graph->node_count - graph->free_count;
+    if ((live + 1) * 2 > graph->slot_capacity && !slots_resize(graph, graph->slot_capacity * 2)) {
+        return -1;
+    }
+
+    if (graph->free_count > 0) {
+        node = graph->free_nodes[--graph->free_count];
+    } else {
+        if (!nodes_reserve(graph, graph->node_count)) {
+            return -1;
+        }
+        node = graph->node_count++;
+    }
+
+    graph->node_ids[node] = task_id;
+    unsigned int mask = (unsigned int)graph->slot_capacity - 1;
+    unsigned int i = slot_hash(task_id, graph->slot_capacity);
+    while (graph->slots[i] >= 0) {
+        i = (i + 1) & mask;
+    }
+    graph->slots[i] = node;
+    return node;
+}
+
+// Helper function to give a node without edges back to the free list
+static void node_release(DepGraph *graph, int node) {
+    unsigned int mask = (unsigned int)graph->slot_capacity - 1;
+    unsigned int i = slot_hash(graph->node_ids[node], graph->slot_capacity);
+    while (graph->slots[i] != node) {
+        i = (i + 1) & mask;
+    }
+    graph->slots[i] = -1;
+
+    // Shift back entries that probed past the freed slot, unless their home
+    // slot lies between it and where they are
+    for (unsigned int j = (i + 1) & mask; graph->slots[j] >= 0; j = (j + 1) & mask) {
+        unsigned int home = slot_hash(graph->node_ids[graph->slots[j]], graph->slot_capacity);
+        bool stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays) {
+            graph->slots[i] = graph->slots[j];
+            graph->slots[j] = -1;
+            i = j;
+        }
+    }
+
+    graph->node_ids[node] = -1;
+    graph->free_nodes[graph->free_count++] = node;
+}
+
+// Helper function to rehash every task into a table of the given size
+static bool slots_resize(DepGraph *graph, int capacity) {
+    int *slots = (int*)malloc(sizeof(int) * capacity);
+    if (!slots) {
+        log_message(LOG_ERROR, "Failed to resize dependency graph index");
+        return false;
+    }
+
+    for (int i = 0; i < capacity; i++) {
+        slots[i] = -1;
+    }
+
+    unsigned int mask = (unsigned int)capacity - 1;
+    for (int node = 0; node < graph->node_count; node++) {
+        if (graph->node_ids[node] < 0) {
+            continue;
+        }
+        unsigned int i = slot_hash(graph->node_ids[node], capacity);
+        while (slots[i] >= 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = node;
+    }
+
+    free(graph->slots);
+    graph->slots = slots;
+    graph->slot_capacity = capacity;
+    return true;
+}
+
+// Helper function to make a node addressable in every per-node array; new
+// nodes are appended at the end of the order, which keeps it a valid permutation
+static bool nodes_reserve(DepGraph *graph, int node) {
+    if (node < graph->node_capacity) {
+        return true;
+    }
+
+    int old_capacity = graph->node_capacity;
+    int new_capacity = old_capacity > 0 ? old_capacity : INITIAL_NODE_CAPACITY;
+    while (new_capacity <= node) {
+        new_capacity *= 2;
+    }
+
+    int *node_ids = (int*)realloc(graph->node_ids, sizeof(int) * new_capacity);
+    if (node_ids) graph->node_ids = node_ids;
+    int *free_nodes = (int*)realloc(graph->free_nodes, sizeof(int) * new_capacity);
+    if (free_nodes) graph->free_nodes = free_nodes;
+    int *order = (int*)realloc(graph->order, sizeof(int) * new_capacity);
+    if (order) graph->order = order;
+    int *by_order = (int*)realloc(graph->by_order, sizeof(int) * new_capacity);
+    if (by_order) graph->by_order = by_order;
+    unsigned char *mark = (unsigned char*)realloc(graph->mark, new_capacity);
+    if (mark) graph->mark = mark;
+    int *stack = (int*)realloc(graph->stack, sizeof(int) * new_capacity);
+    if (stack) graph->stack = stack;
+    int *affected = (int*)realloc(graph->affected, sizeof(int) * new_capacity);
+    if (affected) graph->affected = affected;
+    int *pool = (int*)realloc(graph->pool, sizeof(int) * new_capacity);
+    if (pool) graph->pool = pool;
+    int *levels = (int*)realloc(graph->levels, sizeof(int) * new_capacity);
+    if (levels) graph->levels = levels;
+    double *duration = (double*)realloc(graph->duration, sizeof(double) * new_capacity);
+    if (duration) graph->duration = duration;
+    double *finish = (double*)realloc(graph->finish, sizeof(double) * new_capacity);
+    if (finish) graph->finish = finish;
+
+    // Capacities are multiples of 64, so state words map exactly onto nodes
+    int old_words = old_capacity / 64;
+    int new_words = new_capacity / 64;
+    uint64_t *completed = (uint64_t*)realloc(graph->completed_bits, sizeof(uint64_t) * new_words);
+    if (completed) graph->completed_bits = completed;
+    uint64_t *succeeded = (uint64_t*)realloc(graph->succeeded_bits, sizeof(uint64_t) * new_words);
+    if (succeeded) graph->succeeded_bits = succeeded;
+
+    if (!node_ids || !free_nodes || !order || !by_order || !mark || !stack || !affected ||
+        !pool || !levels || !duration || !finish || !completed || !succeeded ||
+        !adjacency_reserve_nodes(&graph->upstream, new_capacity) ||
+        !adjacency_reserve_nodes(&graph->downstream, new_capacity)) {
+        log_message(LOG_ERROR, "Failed to resize dependency graph nodes");
+        return false;
+    }
+
+    for (int i = old_capacity; i < new_capacity; i++) {
+        graph->node_ids[i] = -1;
+        graph->order[i] = i;
+        graph->by_order[i] = i;
+        graph->mark[i] = 0;
+        graph->levels[i] = 0;
+        graph->duration[i] = 0;
+        graph->finish[i] = 0;
+    }
+    for (int i = old_words; i < new_words; i++) {
+        graph->completed_bits[i] = 0;
+        graph->succeeded_bits[i] = 0;
+    }
+
+    graph->node_capacity = new_capacity;
+    graph->levels_dirty = true;
+    return true;
+}
+
+// Helper function to initialize one adjacency direction
+static bool adjacency_init(DepAdjacency *adj) {
+    memset(adj, 0, sizeof(DepAdjacency));
+
+    adj->targets = (int*)malloc(sizeof(int) * INITIAL_EDGE_CAPACITY);
+    adj->nodes = (int*)malloc(sizeof(int) * INITIAL_EDGE_CAPACITY);
+    if (!adj->targets || !adj->nodes) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependency graph");
+        adjacency_free(adj);
+        return false;
+    }
+
+    adj->edge_capacity = INITIAL_EDGE_CAPACITY;
+    return true;
+}
+
+static void adjacency_free(DepAdjacency *adj) {
+    free(adj->start);
+    free(adj->count);
+    free(adj->reserved);
+    free(adj->targets);
+    free(adj->nodes);
+    memset(adj, 0, sizeof(DepAdjacency));
+}
+
+// Helper function to grow the per-node arrays; new nodes start with empty lists
+static bool adjacency_reserve_nodes(DepAdjacency *adj, int capacity) {
+    if (capacity <= adj->node_capacity) {
+        return true;
+    }
+
+    int *start = (int*)realloc(adj->start, sizeof(int) * capacity);
+    if (start) adj->start = start;
+    int *count = (int*)realloc(adj->count, sizeof(int) * capacity);
+    if (count) adj->count = count;
+    int *reserved = (int*)realloc(adj->reserved, sizeof(int) * capacity);
+    if (reserved) adj->reserved = reserved;
+    if (!start || !count || !reserved) {
+        return false;
+    }
+
+    for (int i = adj->node_capacity; i < capacity; i++) {
+        adj->start[i] = 0;
+        adj->count[i] = 0;
+        adj->reserved[i] = 0;
+    }
+
+    adj->node_capacity = capacity;
+    return true;
+}
+
+static bool adjacency_reserve_edges(DepAdjacency *adj, int needed) {
+    if (needed <= adj->edge_capacity) {
+        return true;
+    }
+
+    int new_capacity = adj->edge_capacity > 0 ? adj->edge_capacity : INITIAL_EDGE_CAPACITY;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+
+    int *targets = (int*)realloc(adj->targets, sizeof(int) * new_capacity);
+    if (targets) adj->targets = targets;
+    int *nodes = (int*)realloc(adj->nodes, sizeof(int) * new_capacity);
+    if (nodes) adj->nodes = nodes;
+    if (!targets || !nodes) {
+        log_message(LOG_ERROR, "Failed to resize dependency graph edges");
+        return false;
+    }
+
+    adj->edge_capacity = new_capacity;
+    return true;
+}
+
+// Helper function to double the room of a full list. The list at the end
+// grows in place; any other moves to the end, leaving its old room behind.
+static bool adjacency_grow_list(DepAdjacency *adj, int node) {
+    int old_room = adj->reserved[node];
+    int new_room = old_room > 0 ? old_room * 2 : INITIAL_LIST_CAPACITY;
+
+    if (old_room > 0 && adj->start[node] + old_room == adj->used) {
+        if (!adjacency_reserve_edges(adj, adj->used + new_room - old_room)) {
+            return false;
+        }
+        adj->used += new_room - old_room;
+        adj->reserved[node] = new_room;
+        return true;
+    }
+
+    // Reclaim the rooms left behind once they outweigh the lists in use;
+    // the walk over every node is paid for by the moves that left them
+    if (adj->garbage > adj->used / 2 && adj->garbage > adj->node_capacity &&
+        !adjacency_compact(adj)) {
+        return false;
+    }
+
+    if (!adjacency_reserve_edges(adj, adj->used + new_room)) {
+        return false;
+    }
+
+    memcpy(&adj->targets[adj->used], &adj->targets[adj->start[node]], sizeof(int) * adj->count[node]);
+    memcpy(&adj->nodes[adj->used], &adj->nodes[adj->start[node]], sizeof(int) * adj->count[node]);
+    adj->garbage += old_room;
+    adj->start[node] = adj->used;
+    adj->reserved[node] = new_room;
+    adj->used += new_room;
+    return true;
+}
+
+// Helper function to pack every list tightly, dropping the rooms left behind
+static bool adjacency_compact(DepAdjacency *adj) {
+    int *targets = (int*)malloc(sizeof(int) * adj->edge_capacity);
+    int *nodes = (int*)malloc(sizeof(int) * adj->edge_capacity);
+    if (!targets || !nodes) {
+        log_message(LOG_ERROR, "Failed to compact dependency graph edges");
+        free(targets);
+        free(nodes);
+        return false;
+    }
+
+    int next = 0;
+    for (int node = 0; node < adj->node_capacity; node++) {
+        memcpy(&targets[next], &adj->targets[adj->start[node]], sizeof(int) * adj->count[node]);
+        memcpy(&nodes[next], &adj->nodes[adj->start[node]], sizeof(int) * adj->count[node]);
+        adj->start[node] = next;
+        adj->reserved[node] = adj->count[node];
+        next += adj->count[node];
+    }
+
+    free(adj->targets);
+    free(adj->nodes);
+    adj->targets = targets;
+    adj->nodes = nodes;
+    adj->used = next;
+    adj->garbage = 0;
+    return true;
+}
+
+// Binary search within the sorted list of a node; returns the insertion position
+static int adjacency_find(const DepAdjacency *adj, int node, int target, bool *found) {
+    int lo = adj->start[node];
+    int end = lo + adj->count[node];
+    int hi = end;
+
+    *found = false;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (adj->targets[mid] < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < end && adj->targets[lo] == target) {
+        *found = true;
+    }
+
+    return lo;
+}
+
+// Insert into one list; only the entries of that list move
+static bool adjacency_insert(DepAdjacency *adj, int node, int target, int target_node) {
+    bool found;
+    int pos = adjacency_find(adj, node, target, &found);
+    if (found) {
+        // Already exists, not an error
+        return true;
+    }
+
+    if (adj->count[node] == adj->reserved[node]) {
+        if (!adjacency_grow_list(adj, node)) {
+            return false;
+        }
+        pos = adjacency_find(adj, node, target, &found);
+    }
+
+    int end = adj->start[node] + adj->count[node];
+    memmove(&adj->targets[pos + 1], &adj->targets[pos], sizeof(int) * (end - pos));
+    memmove(&adj->nodes[pos + 1], &adj->nodes[pos], sizeof(int) * (end - pos));
+    adj->targets[pos] = target;
+    adj->nodes[pos] = target_node;
+    adj->count[node]++;
+    adj->edge_count++;
+    return true;
+}
+
+static bool adjacency_erase(DepAdjacency *adj, int node, int target) {
+    if (node < 0 || node >= adj->node_capacity) {
+        return false;
+    }
+
+    bool found;
+    int pos = adjacency_find(adj, node, target, &found);
+    if (!found) {
+        return false;
+    }
+
+    int end = adj->start[node] + adj->count[node];
+    memmove(&adj->targets[pos], &adj->targets[pos + 1], sizeof(int) * (end - pos - 1));
+    memmove(&adj->nodes[pos], &adj->nodes[pos + 1], sizeof(int) * (end - pos - 1));
+    adj->count[node]--;
+    adj->edge_count--;
+    return true;
+}
+
+// Empty one list, keeping its room for later edges
+static void adjacency_clear(DepAdjacency *adj, int node) {
+    adj->edge_count -= adj->count[node];
+    adj->count[node] = 0;
+}
+
+// Build the lists with a counting sort over the source nodes. Each target
+// is packed with its task ID in the high half so one sort orders a list.
+static bool adjacency_build(DepAdjacency *adj, const int *sources, const int *targets,
+                            int count, const int *node_ids) {
+    uint64_t *packed = (uint64_t*)malloc(sizeof(uint64_t) * (count > 0 ? count : 1));
+    if (!packed || !adjacency_reserve_edges(adj, count)) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependency graph build");
+        free(packed);
+        return false;
+    }
+
+    // Count the degree of each node, then turn counts into start offsets
+    memset(adj->count, 0, sizeof(int) * adj->node_capacity);
+    for (int i = 0; i < count; i++) {
+        adj->count[sources[i]]++;
+    }
+    int next = 0;
+    for (int node = 0; node < adj->node_capacity; node++) {
+        adj->start[node] = next;
+        next += adj->count[node];
+        adj->count[node] = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int node = sources[i];
+        packed[adj->start[node] + adj->count[node]++] =
+            ((uint64_t)(uint32_t)node_ids[targets[i]] << 32) | (uint32_t)targets[i];
+    }
+
+    // Sort each list and drop duplicate edges; rows usually arrive ordered
+    int write = 0;
+    for (int node = 0; node < adj->node_capacity; node++) {
+        int start = adj->start[node];
+        int end = start + adj->count[node];
+
+        for (int i = start + 1; i < end; i++) {
+            if (packed[i] < packed[i - 1]) {
+                qsort(&packed[start], end - start, sizeof(uint64_t), compare_packed);
+                break;
+            }
+        }
+
+        adj->start[node] = write;
+        for (int i = start; i < end; i++) {
+            if (i > start && packed[i] == packed[i - 1]) {
+                continue;
+            }
+            adj->targets[write] = (int)(packed[i] >> 32);
+            adj->nodes[write] = (int)(uint32_t)packed[i];
+            write++;
+        }
+        adj->count[node] = write - adj->start[node];
+        adj->reserved[node] = adj->count[node];
+    }
+
+    adj->used = write;
+    adj->garbage = 0;
+    adj->edge_count = write;
+    free(packed);
+    return true;
+}
+
+// Neighbours of a node as task IDs
+static const int* adjacency_ids(const DepAdjacency *adj, int node, int *count) {
+    if (node < 0 || node >= adj->node_capacity || adj->count[node] == 0) {
+        if (count) {
+            *count = 0;
+        }
+        return NULL;
+    }
+
+    if (count) {
+        *count = adj->count[node];
+    }
+    return &adj->targets[adj->start[node]];
+}
+
+// Neighbours of a node as nodes, in the same order as adjacency_ids
+static const int* adjacency_nodes(const DepAdjacency *adj, int node, int *count) {
+    if (node < 0 || node >= adj->node_capacity || adj->count[node] == 0) {
+        if (count) {
+            *count = 0;
+        }
+        return NULL;
+    }
+
+    if (count) {
+        *count = adj->count[node];
+    }
+    return &adj->nodes[adj->start[node]];
+}
+
+// Replace every edge with the given ones and recompute the order from scratch
+static bool graph_build(DepGraph *graph, const int *task_nodes, const int *dependency_nodes, int count) {
+    // Fan-in lists are keyed by the dependent task, fan-out lists by the dependency
+    if (!adjacency_build(&graph->upstream, task_nodes, dependency_nodes, count, graph->node_ids) ||
+        !adjacency_build(&graph->downstream, dependency_nodes, task_nodes, count, graph->node_ids)) {
+        log_message(LOG_ERROR, "Failed to build dependency graph with %d edges", count);
+        return false;
+    }
+
+    graph->levels_dirty = true;
+    graph->masks_dirty = true;
+    if (!order_rebuild(graph)) {
+        return false;
+    }
+
+    finish_rebuild(graph);
+    return true;
+}
+
+// Recompute the whole order from scratch (Kahn's algorithm) after a bulk load
+static bool order_rebuild(DepGraph *graph) {
+    int n = graph->node_capacity;
+    int *indegree = (int*)malloc(sizeof(int) * n);
+    if (!indegree) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependency order");
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) {
+        indegree[i] = graph->upstream.count[i];
+        graph->order[i] = -1;
+    }
+
+    // by_order doubles as the FIFO queue: ready nodes are appended at tail
+    int head = 0;
+    int tail = 0;
+    for (int i = 0; i < n; i++) {
+        if (indegree[i] == 0) {
+            graph->by_order[tail++] = i;
+        }
+    }
+
+    while (head < tail) {
+        int node = graph->by_order[head];
+        graph->order[node] = head++;
+
+        int count = 0;
+        const int *dependents = adjacency_nodes(&graph->downstream, node, &count);
+        for (int i = 0; i < count; i++) {
+            if (--indegree[dependents[i]] == 0) {
+                graph->by_order[tail++] = dependents[i];
+            }
+        }
+    }
+    free(indegree);
+
+    // Nodes left over sit on a cycle that came from the database; keep them
+    // at the end so the order is still a permutation
+    if (tail < n) {
+        log_message(LOG_WARNING, "Dependency cycle detected among %d tasks; "
+                    "they will not be ordered correctly", n - tail);
+        for (int i = 0; i < n; i++) {
+            if (graph->order[i] < 0) {
+                graph->order[i] = tail;
+                graph->by_order[tail++] = i;
+            }
+        }
+    }
+
+    graph->levels_dirty = true;
+    return true;
+}
+
+// Depth-first search from start over adj, restricted to nodes whose order
+// lies strictly between lower and upper. Visited nodes are marked and
+// appended to out. Returns true (and clears the marks) if target is reached.
+static bool order_collect(DepGraph *graph, const DepAdjacency *adj, int start,
+                          int lower, int upper, int target, int *out, int *out_count) {
+    int top = 0;
+    int n = 0;
+
+    graph->stack[top++] = start;
+    graph->mark[start] = 1;
+
+    while (top > 0) {
+        int node = graph->stack[--top];
+        out[n++] = node;
+
+        int count = 0;
+        const int *next = adjacency_nodes(adj, node, &count);
+        for (int i = 0; i < count; i++) {
+            int w = next[i];
+            if (w == target) {
+                for (int j = 0; j < n; j++) {
+                    graph->mark[out[j]] = 0;
+                }
+                for (int j = 0; j < top; j++) {
+                    graph->mark[graph->stack[j]] = 0;
+                }
+                *out_count = 0;
+                return true;
+            }
+            if (!graph->mark[w] && graph->order[w] > lower && graph->order[w] < upper) {
+                graph->mark[w] = 1;
+                graph->stack[top++] = w;
+            }
+        }
+    }
+
+    *out_count = n;
+    return false;
+}
+
+// Sort nodes by their current position, using pool as scratch space
+static void order_sort_nodes(DepGraph *graph, int *nodes, int count) {
+    for (int i = 0; i < count; i++) {
+        graph->pool[i] = graph->order[nodes[i]];
+    }
+    qsort(graph->pool, count, sizeof(int), compare_ints);
+    for (int i = 0; i < count; i++) {
+        nodes[i] = graph->by_order[graph->pool[i]];
+    }
+}
+
+// Breadth-first search over both directions from a node; the nodes found
+// are returned in topological order (caller must free)
+static bool component_collect(DepGraph *graph, int node, int **nodes, int *count) {
+    int *result = (int*)malloc(sizeof(int) * graph->node_capacity);
+    if (!result) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependency component");
+        return false;
+    }
+
+    // result doubles as the queue
+    int head = 0;
+    int tail = 0;
+    result[tail++] = node;
+    graph->mark[node] = 1;
+
+    while (head < tail) {
+        int current = result[head++];
+
+        for (int dir = 0; dir < 2; dir++) {
+            int n = 0;
+            const int *next = adjacency_nodes(dir == 0 ? &graph->upstream : &graph->downstream,
+                                              current, &n);
+            for (int i = 0; i < n; i++) {
+                if (!graph->mark[next[i]]) {
+                    graph->mark[next[i]] = 1;
+                    result[tail++] = next[i];
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < tail; i++) {
+        graph->mark[result[i]] = 0;
+    }
+
+    order_sort_nodes(graph, result, tail);
+
+    *nodes = result;
+    *count = tail;
+    return true;
+}
+
+// Recompute levels by walking the order once, then bucket the tasks that
+// have edges by level
+static bool levels_update(DepGraph *graph) {
+    int n = graph->node_capacity;
+    const int *up_count = graph->upstream.count;
+    const int *down_count = graph->downstream.count;
+    int max_level = -1;
+    int listed = 0;
+
+    for (int pos = 0; pos < n; pos++) {
+        int node = graph->by_order[pos];
+        int level = 0;
+
+        int count = 0;
+        const int *deps = adjacency_nodes(&graph->upstream, node, &count);
+        for (int i = 0; i < count; i++) {
+            if (graph->levels[deps[i]] + 1 > level) {
+                level = graph->levels[deps[i]] + 1;
+            }
+        }
+        graph->levels[node] = level;
+
+        if (count > 0 || down_count[node] > 0) {
+            listed++;
+            if (level > max_level) {
+                max_level = level;
+            }
+        }
+    }
+
+    int level_count = max_level + 1;
+    int *offsets = (int*)calloc(level_count + 1, sizeof(int));
+    int *nodes = (int*)malloc(sizeof(int) * (listed > 0 ? listed : 1));
+    if (!offsets || !nodes) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependency levels");
+        free(offsets);
+        free(nodes);
+        return false;
+    }
+
+    // Counting sort by level; walking in order keeps each bucket topological
+    for (int node = 0; node < n; node++) {
+        if (up_count[node] > 0 || down_count[node] > 0) {
+            offsets[graph->levels[node] + 1]++;
+        }
+    }
+    for (int i = 0; i < level_count; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    for (int pos = 0; pos < n; pos++) {
+        int node = graph->by_order[pos];
+        if (up_count[node] > 0 || down_count[node] > 0) {
+            nodes[offsets[graph->levels[node]]++] = graph->node_ids[node];
+        }
+    }
+    for (int i = level_count; i > 0; i--) {
+        offsets[i] = offsets[i - 1];
+    }
+    offsets[0] = 0;
+
+    free(graph->level_offsets);
+    free(graph->level_nodes);
+    graph->level_offsets = offsets;
+    graph->level_nodes = nodes;
+    graph->level_count = level_count;
+    graph->levels_dirty = false;
+    return true;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_packed(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Rebuild the per-task dependency masks from the fan-in lists. Each list is
+// put in node order first, so the nodes of one 64-node block are adjacent
+// and fold into one word.
+static bool masks_update(DepGraph *graph) {
+    const DepAdjacency *up = &graph->upstream;
+    int n = up->node_capacity;
+
+    if (n > graph->mask_node_capacity || !graph->mask_offsets) {
+        int *offsets = (int*)realloc(graph->mask_offsets, sizeof(int) * (n + 1));
+        if (!offsets) {
+            log_message(LOG_ERROR, "Failed to allocate dependency masks");
+            return false;
+        }
+        graph->mask_offsets = offsets;
+    }
+    graph->mask_node_capacity = n;
+
+    // At most one word per edge
+    if (up->edge_count > graph->mask_capacity) {
+        int new_capacity = up->edge_count;
+        int *blocks = (int*)realloc(graph->mask_blocks, sizeof(int) * new_capacity);
+        if (blocks) graph->mask_blocks = blocks;
+        uint64_t *words = (uint64_t*)realloc(graph->mask_words, sizeof(uint64_t) * new_capacity);
+        if (words) graph->mask_words = words;
+        if (!blocks || !words) {
+            log_message(LOG_ERROR, "Failed to allocate dependency masks");
+            return false;
+        }
+        graph->mask_capacity = new_capacity;
+    }
+
+    int count = 0;
+    for (int node = 0; node < n; node++) {
+        graph->mask_offsets[node] = count;
+
+        int dep_count = 0;
+        const int *deps = adjacency_nodes(up, node, &dep_count);
+        memcpy(graph->pool, deps, sizeof(int) * dep_count);
+        qsort(graph->pool, dep_count, sizeof(int), compare_ints);
+        for (int i = 0; i < dep_count; i++) {
+            int block = graph->pool[i] >> 6;
+            uint64_t bit = (uint64_t)1 << (graph->pool[i] & 63);
+            if (count > graph->mask_offsets[node] && graph->mask_blocks[count - 1] == block) {
+                graph->mask_words[count - 1] |= bit;
+            } else {
+                graph->mask_blocks[count] = block;
+                graph->mask_words[count] = bit;
+                count++;
+            }
+        }
+    }
+    graph->mask_offsets[n] = count;
+
+    graph->masks_dirty = false;
+    return true;
+}
+
+// Recompute earliest finish times downstream of start. Nodes are processed
+// in topological order through a min-heap on their position, so each is
+// visited at most once, and propagation stops where a value is unchanged.
+static void finish_propagate(DepGraph *graph, int start) {
+    if (start < 0 || start >= graph->node_capacity) {
+        return;
+    }
+
+    int size = 0;
+    heap_push(graph, &size, start);
+
+    while (size > 0) {
+        int node = heap_pop(graph, &size);
+
+        double earliest_start = 0;
+        int count = 0;
+        const int *deps = adjacency_nodes(&graph->upstream, node, &count);
+        for (int i = 0; i < count; i++) {
+            if (graph->finish[deps[i]] > earliest_start) {
+                earliest_start = graph->finish[deps[i]];
+            }
+        }
+
+        double finish = earliest_start + graph->duration[node];
+        if (finish == graph->finish[node] && node != start) {
+            continue;
+        }
+        graph->finish[node] = finish;
+
+        const int *dependents = adjacency_nodes(&graph->downstream, node, &count);
+        for (int i = 0; i < count; i++) {
+            if (!graph->mark[dependents[i]]) {
+                heap_push(graph, &size, dependents[i]);
+            }
+        }
+    }
+}
+
+// Recompute every earliest finish time in one pass over the order
+static void finish_rebuild(DepGraph *graph) {
+    for (int pos = 0; pos < graph->node_capacity; pos++) {
+        int node = graph->by_order[pos];
+        double earliest_start = 0;
+
+        int count = 0;
+        const int *deps = adjacency_nodes(&graph->upstream, node, &count);
+        for (int i = 0; i < count; i++) {
+            if (graph->finish[deps[i]] > earliest_start) {
+                earliest_start = graph->finish[deps[i]];
+            }
+        }
+
+        graph->finish[node] = earliest_start + graph->duration[node];
+    }
+}
+
+// Min-heap on topological position, stored in the stack scratch array;
+// mark flags nodes currently in the heap
+static void heap_push(DepGraph *graph, int *size, int node) {
+    int i = (*size)++;
+    graph->stack[i] = node;
+    graph->mark[node] = 1;
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (graph->order[graph->stack[parent]] <= graph->order[graph->stack[i]]) {
+            break;
+        }
+        int tmp = graph->stack[parent];
+        graph->stack[parent] = graph->stack[i];
+        graph->stack[i] = tmp;
+        i = parent;
+    }
+}
+
+static int heap_pop(DepGraph *graph, int *size) {
+    int top = graph->stack[0];
+    graph->mark[top] = 0;
+
+    graph->stack[0] = graph->stack[--(*size)];
+    int i = 0;
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < *size && graph->order[graph->stack[left]] < graph->order[graph->stack[smallest]]) {
+            smallest = left;
+        }
+        if (right < *size && graph->order[graph->stack[right]] < graph->order[graph->stack[smallest]]) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        int tmp = graph->stack[smallest];
+        graph->stack[smallest] = graph->stack[i];
+        graph->stack[i] = tmp;
+        i = smallest;
+    }
+
+    return top;
+}
+
+// Kahn's algorithm over an edge list of nodes: true if every node can be ordered
+static bool edges_acyclic(const int *task_nodes, const int *dependency_nodes, int count, int node_count) {
+    int *indegree = (int*)calloc(node_count > 0 ? node_count : 1, sizeof(int));
+    int *offsets = (int*)calloc(node_count + 1, sizeof(int));
+    int *dependents = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+    int *queue = (int*)malloc(sizeof(int) * (node_count > 0 ? node_count : 1));
+    if (!indegree || !offsets || !dependents || !queue) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependency check");
+        free(indegree);
+        free(offsets);
+        free(dependents);
+        free(queue);
+        return false;
+    }
+
+    // Fan-out lists keyed by the dependency, as in adjacency_build
+    for (int i = 0; i < count; i++) {
+        indegree[task_nodes[i]]++;
+        offsets[dependency_nodes[i] + 1]++;
+    }
+    for (int i = 0; i < node_count; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    for (int i = 0; i < count; i++) {
+        dependents[offsets[dependency_nodes[i]]++] = task_nodes[i];
+    }
+    for (int i = node_count; i > 0; i--) {
+        offsets[i] = offsets[i - 1];
+    }
+    offsets[0] = 0;
+
+    int head = 0;
+    int tail = 0;
+    for (int i = 0; i < node_count; i++) {
+        if (indegree[i] == 0) {
+            queue[tail++] = i;
+        }
+    }
+    while (head < tail) {
+        int node = queue[head++];
+        for (int i = offsets[node]; i < offsets[node + 1]; i++) {
+            if (--indegree[dependents[i]] == 0) {
+                queue[tail++] = dependents[i];
+            }
+        }
+    }
+
+    free(indegree);
+    free(offsets);
+    free(dependents);
+    free(queue);
+    return tail == node_count;
+}
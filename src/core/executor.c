@@ -0,0 +1,155 @@
+#include "../../include/executor.h"
+#include "../../include/utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Worker thread function declaration
+static void* executor_worker_func(void *arg);
+
+bool executor_init(Executor *executor, int worker_count) {
+    if (!executor) {
+        return false;
+    }
+
+    memset(executor, 0, sizeof(Executor));
+    executor->worker_count = worker_count > 0 ? worker_count : EXECUTOR_DEFAULT_WORKERS;
+
+    executor->workers = (pthread_t*)malloc(sizeof(pthread_t) * executor->worker_count);
+    if (!executor->workers) {
+        log_message(LOG_ERROR, "Failed to allocate memory for executor workers");
+        return false;
+    }
+
+    if (pthread_mutex_init(&executor->lock, NULL) != 0) {
+        log_message(LOG_ERROR, "Failed to initialize executor mutex");
+        free(executor->workers);
+        executor->workers = NULL;
+        return false;
+    }
+
+    pthread_cond_init(&executor->work_ready, NULL);
+    pthread_cond_init(&executor->idle, NULL);
+    return true;
+}
+
+bool executor_submit(Executor *executor, ExecutorJobFunc func, void *arg) {
+    if (!executor || !executor->workers || !func) {
+        return false;
+    }
+
+    ExecutorJob *job = (ExecutorJob*)malloc(sizeof(ExecutorJob));
+    if (!job) {
+        log_message(LOG_ERROR, "Failed to allocate memory for executor job");
+        return false;
+    }
+    job->func = func;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&executor->lock);
+
+    if (executor->stopping) {
+        pthread_mutex_unlock(&executor->lock);
+        free(job);
+        return false;
+    }
+
+    // Start the workers on first use
+    while (executor->started < executor->worker_count) {
+        if (thread_create(&executor->workers[executor->started], NULL,
+                          executor_worker_func, executor) != 0) {
+            log_message(LOG_ERROR, "Failed to create executor worker thread");
+            break;
+        }
+        executor->started++;
+    }
+
+    if (executor->started == 0) {
+        pthread_mutex_unlock(&executor->lock);
+        free(job);
+        return false;
+    }
+
+    if (executor->tail) {
+        executor->tail->next = job;
+    } else {
+        executor->head = job;
+    }
+    executor->tail = job;
+
+    pthread_cond_signal(&executor->work_ready);
+    pthread_mutex_unlock(&executor->lock);
+    return true;
+}
+
+void executor_wait_idle(Executor *executor) {
+    if (!executor || !executor->workers) {
+        return;
+    }
+
+    pthread_mutex_lock(&executor->lock);
+    while (executor->head || executor->active > 0) {
+        pthread_cond_wait(&executor->idle, &executor->lock);
+    }
+    pthread_mutex_unlock(&executor->lock);
+}
+
+void executor_shutdown(Executor *executor) {
+    if (!executor || !executor->workers) {
+        return;
+    }
+
+    executor_wait_idle(executor);
+
+    pthread_mutex_lock(&executor->lock);
+    executor->stopping = true;
+    pthread_cond_broadcast(&executor->work_ready);
+    pthread_mutex_unlock(&executor->lock);
+
+    for (int i = 0; i < executor->started; i++) {
+        pthread_join(executor->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&executor->work_ready);
+    pthread_cond_destroy(&executor->idle);
+    pthread_mutex_destroy(&executor->lock);
+    free(executor->workers);
+    memset(executor, 0, sizeof(Executor));
+}
+
+// Worker thread: run queued jobs until asked to stop
+static void* executor_worker_func(void *arg) {
+    Executor *executor = (Executor *)arg;
+
+    pthread_mutex_lock(&executor->lock);
+    for (;;) {
+        while (!executor->head && !executor->stopping) {
+            pthread_cond_wait(&executor->work_ready, &executor->lock);
+        }
+
+        if (!executor->head) {
+            // Stopping and nothing left to do
+            break;
+        }
+
+        ExecutorJob *job = executor->head;
+        executor->head = job->next;
+        if (!executor->head) {
+            executor->tail = NULL;
+        }
+        executor->active++;
+
+        pthread_mutex_unlock(&executor->lock);
+        job->func(job->arg);
+        free(job);
+        pthread_mutex_lock(&executor->lock);
+
+        executor->active--;
+        if (!executor->head && executor->active == 0) {
+            pthread_cond_broadcast(&executor->idle);
+        }
+    }
+    pthread_mutex_unlock(&executor->lock);
+
+    return NULL;
+}
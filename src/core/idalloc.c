@@ -0,0 +1,101 @@
+#include "../../include/idalloc.h"
+#include "../../include/utils.h"
+#include <string.h>
+
+#define WINDOW(next, limit) (((uint64_t)(uint32_t)(limit) << 32) | (uint32_t)(next))
+#define WINDOW_NEXT(window) ((int)(uint32_t)(window))
+#define WINDOW_LIMIT(window) ((int)(uint32_t)((window) >> 32))
+
+static bool idalloc_refill(IdAllocator *allocator, uint64_t seen);
+
+bool idalloc_init(IdAllocator *allocator, DbIdCounter counter, int block_size) {
+    if (!allocator) {
+        return false;
+    }
+
+    memset(allocator, 0, sizeof(IdAllocator));
+    allocator->counter = counter;
+    allocator->block_size = block_size > 0 ? block_size : IDALLOC_DEFAULT_BLOCK_SIZE;
+
+    if (pthread_mutex_init(&allocator->refill_lock, NULL) != 0) {
+        log_message(LOG_ERROR, "Failed to initialize ID allocator mutex");
+        return false;
+    }
+
+    return true;
+}
+
+int idalloc_next(IdAllocator *allocator) {
+    if (!allocator) {
+        return -1;
+    }
+
+    for (;;) {
+        uint64_t window = __atomic_load_n(&allocator->window, __ATOMIC_ACQUIRE);
+        if (WINDOW_NEXT(window) < WINDOW_LIMIT(window)) {
+            // next is the low half, so adding one advances it
+            if (__atomic_compare_exchange_n(&allocator->window, &window, window + 1, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return WINDOW_NEXT(window);
+            }
+            continue;
+        }
+
+        if (!idalloc_refill(allocator, window)) {
+            return -1;
+        }
+    }
+}
+
+bool idalloc_next_range(IdAllocator *allocator, int count, int *first) {
+    if (!allocator || count <= 0 || !first) {
+        return false;
+    }
+
+    uint64_t window = __atomic_load_n(&allocator->window, __ATOMIC_ACQUIRE);
+    while (WINDOW_LIMIT(window) - WINDOW_NEXT(window) >= count) {
+        if (__atomic_compare_exchange_n(&allocator->window, &window, window + (uint64_t)count, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *first = WINDOW_NEXT(window);
+            return true;
+        }
+    }
+
+    // Not enough left: reserve a block of exactly this size and keep the
+    // current one for single allocations
+    return db_reserve_ids(allocator->counter, count, first);
+}
+
+void idalloc_destroy(IdAllocator *allocator) {
+    if (!allocator) {
+        return;
+    }
+
+    uint64_t window = __atomic_exchange_n(&allocator->window, 0, __ATOMIC_ACQ_REL);
+    if (WINDOW_NEXT(window) < WINDOW_LIMIT(window) &&
+        db_release_ids(allocator->counter, WINDOW_NEXT(window), WINDOW_LIMIT(window))) {
+        log_message(LOG_DEBUG, "Gave back unused IDs %d-%d", WINDOW_NEXT(window), WINDOW_LIMIT(window) - 1);
+    }
+
+    pthread_mutex_destroy(&allocator->refill_lock);
+    memset(allocator, 0, sizeof(IdAllocator));
+}
+
+// Reserve a new block unless another thread already replaced the exhausted
+// window that was seen
+static bool idalloc_refill(IdAllocator *allocator, uint64_t seen) {
+    pthread_mutex_lock(&allocator->refill_lock);
+
+    bool success = true;
+    if (__atomic_load_n(&allocator->window, __ATOMIC_ACQUIRE) == seen) {
+        int first;
+        success = db_reserve_ids(allocator->counter, allocator->block_size, &first);
+        if (success) {
+            __atomic_store_n(&allocator->window, WINDOW(first, first + allocator->block_size),
+                             __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&allocator->refill_lock);
+    return success;
+}
@@ -0,0 +1,610 @@
+#include "../../include/persist.h"
+#include "../../include/db.h"
+#include "../../include/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INITIAL_PENDING_CAPACITY 64
+
+// Wait between attempts after a failed write, doubling up to the maximum
+#define RETRY_MIN_DELAY_SEC 1.0
+#define RETRY_MAX_DELAY_SEC 60.0
+
+// queued[] bit set while a task's row is being written; the PersistKind
+// bits record marks made since it was taken into a batch
+#define QUEUED_IN_FLIGHT 0x80
+// queued[] bit set from a failed write of the task until one succeeds
+#define QUEUED_FAILED 0x40
+#define QUEUED_KIND_MASK (PERSIST_STATUS | PERSIST_DEFINITION)
+
+// Flusher thread function declaration
+static void* persist_thread_func(void *arg);
+static bool persist_write_batch(Persister *persister, PersistEntry *entries, int count);
+static bool persist_write_runs(const TaskRunRecord *runs, int count);
+static bool pending_push(Persister *persister, int task_id);
+static int requeue_tasks(Persister *persister, const PersistEntry *entries, int count);
+static bool requeue_runs(Persister *persister, const TaskRunRecord *runs, int count);
+static bool copy_output(CapturedOutput *output);
+static void free_run_outputs(TaskRunRecord *runs, int count);
+static void deadline_after(double seconds, struct timespec *deadline);
+
+bool persist_init(Persister *persister, PersistLoadFunc load, void *context) {
+    if (!persister || !load) {
+        return false;
+    }
+
+    memset(persister, 0, sizeof(Persister));
+    persister->load = load;
+    persister->context = context;
+    persister->batch_size = PERSIST_DEFAULT_BATCH_SIZE;
+    persister->flush_interval_ms = PERSIST_DEFAULT_FLUSH_INTERVAL_MS;
+
+    persister->pending = (PersistEntry*)malloc(sizeof(PersistEntry) * INITIAL_PENDING_CAPACITY);
+    persister->flushing = (PersistEntry*)malloc(sizeof(PersistEntry) * INITIAL_PENDING_CAPACITY);
+    persister->queued = (unsigned char*)calloc(INITIAL_PENDING_CAPACITY, 1);
+    persister->runs = (TaskRunRecord*)malloc(sizeof(TaskRunRecord) * INITIAL_PENDING_CAPACITY);
+    persister->runs_flushing = (TaskRunRecord*)malloc(sizeof(TaskRunRecord) * INITIAL_PENDING_CAPACITY);
+    if (!persister->pending || !persister->flushing || !persister->queued ||
+        !persister->runs || !persister->runs_flushing) {
+        log_message(LOG_ERROR, "Failed to allocate memory for persistence queue");
+        free(persister->pending);
+        free(persister->flushing);
+        free(persister->queued);
+        free(persister->runs);
+        free(persister->runs_flushing);
+        return false;
+    }
+    persister->pending_capacity = INITIAL_PENDING_CAPACITY;
+    persister->flushing_capacity = INITIAL_PENDING_CAPACITY;
+    persister->queued_capacity = INITIAL_PENDING_CAPACITY;
+    persister->run_capacity = INITIAL_PENDING_CAPACITY;
+    persister->runs_flushing_capacity = INITIAL_PENDING_CAPACITY;
+
+    pthread_mutex_init(&persister->lock, NULL);
+    pthread_cond_init(&persister->work_ready, NULL);
+    pthread_cond_init(&persister->flushed, NULL);
+
+    if (thread_create(&persister->thread, NULL, persist_thread_func, persister) != 0) {
+        log_message(LOG_ERROR, "Failed to create persistence thread");
+        pthread_cond_destroy(&persister->flushed);
+        pthread_cond_destroy(&persister->work_ready);
+        pthread_mutex_destroy(&persister->lock);
+        free(persister->pending);
+        free(persister->flushing);
+        free(persister->queued);
+        free(persister->runs);
+        free(persister->runs_flushing);
+        return false;
+    }
+    persister->started = true;
+
+    return true;
+}
+
+bool persist_mark_dirty(Persister *persister, int task_id, PersistKind kind) {
+    if (!persister || !persister->started || task_id < 0 || kind == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&persister->lock);
+
+    if (task_id >= persister->queued_capacity) {
+        int new_capacity = persister->queued_capacity;
+        while (new_capacity <= task_id) {
+            new_capacity *= 2;
+        }
+        unsigned char *queued = (unsigned char*)realloc(persister->queued, new_capacity);
+        if (!queued) {
+            log_message(LOG_ERROR, "Failed to grow persistence queue");
+            pthread_mutex_unlock(&persister->lock);
+            return false;
+        }
+        memset(queued + persister->queued_capacity, 0, new_capacity - persister->queued_capacity);
+        persister->queued = queued;
+        persister->queued_capacity = new_capacity;
+    }
+
+    persister->marked_seq++;
+
+    if (!(persister->queued[task_id] & QUEUED_KIND_MASK)) {
+        if (persister->pending_count == 0 && persister->run_count == 0) {
+            persister->first_mark_time = monotonic_seconds();
+        }
+        if (!pending_push(persister, task_id)) {
+            pthread_mutex_unlock(&persister->lock);
+            return false;
+        }
+
+        // Wake the thread for the first mark (to arm its timer) and full batches
+        int queued = persister->pending_count + persister->run_count;
+        if (queued == 1 || persister->pending_count >= persister->batch_size) {
+            pthread_cond_signal(&persister->work_ready);
+        }
+    }
+    persister->queued[task_id] |= kind;
+
+    pthread_mutex_unlock(&persister->lock);
+    return true;
+}
+
+bool persist_record_run(Persister *persister, const TaskRunRecord *run) {
+    if (!persister || !persister->started || !run) {
+        return false;
+    }
+
+    pthread_mutex_lock(&persister->lock);
+
+    if (persister->run_count == persister->run_capacity) {
+        int new_capacity = persister->run_capacity * 2;
+        TaskRunRecord *runs = (TaskRunRecord*)realloc(persister->runs,
+                                                      sizeof(TaskRunRecord) * new_capacity);
+        if (!runs) {
+            log_message(LOG_ERROR, "Failed to grow execution history queue");
+            pthread_mutex_unlock(&persister->lock);
+            return false;
+        }
+        persister->runs = runs;
+        persister->run_capacity = new_capacity;
+    }
+
+    // The caller keeps its output buffers; the queue holds copies
+    TaskRunRecord *entry = &persister->runs[persister->run_count];
+    *entry = *run;
+    bool copied = copy_output(&entry->output);
+    if (!copied) {
+        entry->error_output.data = NULL;
+    } else {
+        copied = copy_output(&entry->error_output);
+    }
+    if (!copied) {
+        log_message(LOG_ERROR, "Failed to allocate memory for task run output");
+        free_run_outputs(entry, 1);
+        pthread_mutex_unlock(&persister->lock);
+        return false;
+    }
+
+    persister->marked_seq++;
+
+    if (persister->pending_count == 0 && persister->run_count == 0) {
+        persister->first_mark_time = monotonic_seconds();
+    }
+    persister->run_count++;
+
+    // Same wake-up rule as task marks: arm the timer, or flush a full batch
+    int queued = persister->pending_count + persister->run_count;
+    if (queued == 1 || persister->run_count >= persister->batch_size) {
+        pthread_cond_signal(&persister->work_ready);
+    }
+
+    pthread_mutex_unlock(&persister->lock);
+    return true;
+}
+
+bool persist_flush(Persister *persister) {
+    if (!persister || !persister->started) {
+        return false;
+    }
+
+    pthread_mutex_lock(&persister->lock);
+    unsigned long target = persister->marked_seq;
+    while (persister->flushed_seq < target) {
+        persister->flush_requested = true;
+        pthread_cond_signal(&persister->work_ready);
+        pthread_cond_wait(&persister->flushed, &persister->lock);
+    }
+
+    // Only a flush that covered the target can have failed our marks
+    bool success = target == 0 || persister->error_seq < target;
+    pthread_mutex_unlock(&persister->lock);
+
+    return success;
+}
+
+bool persist_is_clean(Persister *persister, int task_id) {
+    if (!persister || !persister->started) {
+        return true;
+    }
+
+    pthread_mutex_lock(&persister->lock);
+    bool clean = task_id < 0 || task_id >= persister->queued_capacity ||
+                 persister->queued[task_id] == 0;
+    pthread_mutex_unlock(&persister->lock);
+
+    return clean;
+}
+
+void persist_shutdown(Persister *persister) {
+    if (!persister || !persister->started) {
+        return;
+    }
+
+    pthread_mutex_lock(&persister->lock);
+    persister->stopping = true;
+    pthread_cond_signal(&persister->work_ready);
+    pthread_mutex_unlock(&persister->lock);
+
+    pthread_join(persister->thread, NULL);
+
+    pthread_cond_destroy(&persister->flushed);
+    pthread_cond_destroy(&persister->work_ready);
+    pthread_mutex_destroy(&persister->lock);
+    free(persister->pending);
+    free(persister->flushing);
+    free(persister->queued);
+    free(persister->runs);
+    free(persister->runs_flushing);
+    memset(persister, 0, sizeof(Persister));
+}
+
+// Flusher thread: wait for a full batch, an expired timer, a barrier or
+// stop, then write everything pending. Whatever a failed write leaves
+// unwritten is queued again and retried after a growing delay; only the
+// last attempt at shutdown gives up on it. Retention runs while idle.
+static void* persist_thread_func(void *arg) {
+    Persister *persister = (Persister *)arg;
+
+    pthread_mutex_lock(&persister->lock);
+    for (;;) {
+        while (persister->pending_count == 0 && persister->run_count == 0 && !persister->stopping) {
+            if (persister->flush_requested) {
+                // Nothing pending: everything marked so far is already written
+                persister->flushed_seq = persister->marked_seq;
+                persister->flush_requested = false;
+                pthread_cond_broadcast(&persister->flushed);
+            }
+
+            double now = monotonic_seconds();
+            if (now >= persister->next_prune_time) {
+                pthread_mutex_unlock(&persister->lock);
+                db_prune_task_runs();
+                db_prune_scripts();
+                pthread_mutex_lock(&persister->lock);
+                persister->next_prune_time = monotonic_seconds() + PERSIST_PRUNE_INTERVAL_SEC;
+                continue;
+            }
+
+            struct timespec deadline;
+            deadline_after(persister->next_prune_time - now, &deadline);
+            pthread_cond_timedwait(&persister->work_ready, &persister->lock, &deadline);
+        }
+
+        if (persister->pending_count == 0 && persister->run_count == 0) {
+            // Stopping and nothing left to write
+            persister->flushed_seq = persister->marked_seq;
+            pthread_cond_broadcast(&persister->flushed);
+            break;
+        }
+
+        // After a failed write, wait out the delay unless a barrier or stop
+        // wants the next attempt now
+        while (!persister->flush_requested && !persister->stopping) {
+            double now = monotonic_seconds();
+            if (now >= persister->retry_time) {
+                break;
+            }
+
+            struct timespec deadline;
+            deadline_after(persister->retry_time - now, &deadline);
+            pthread_cond_timedwait(&persister->work_ready, &persister->lock, &deadline);
+        }
+
+        // Let marks accumulate until a batch fills or the oldest one is due
+        double due = persister->first_mark_time + persister->flush_interval_ms / 1000.0;
+        while ((persister->pending_count > 0 || persister->run_count > 0) &&
+               persister->pending_count < persister->batch_size &&
+               persister->run_count < persister->batch_size &&
+               !persister->flush_requested && !persister->stopping) {
+            double now = monotonic_seconds();
+            if (now >= due) {
+                break;
+            }
+
+            struct timespec deadline;
+            deadline_after(due - now, &deadline);
+            pthread_cond_timedwait(&persister->work_ready, &persister->lock, &deadline);
+        }
+
+        // Take the whole pending lists; new marks go to the spare ones
+        PersistEntry *batch = persister->pending;
+        int count = persister->pending_count;
+        persister->pending = persister->flushing;
+        persister->flushing = batch;
+        int capacity = persister->pending_capacity;
+        persister->pending_capacity = persister->flushing_capacity;
+        persister->flushing_capacity = capacity;
+        persister->pending_count = 0;
+        for (int i = 0; i < count; i++) {
+            batch[i].kinds = persister->queued[batch[i].task_id] & QUEUED_KIND_MASK;
+            persister->queued[batch[i].task_id] = QUEUED_IN_FLIGHT;
+        }
+
+        TaskRunRecord *runs = persister->runs;
+        int run_count = persister->run_count;
+        persister->runs = persister->runs_flushing;
+        persister->runs_flushing = runs;
+        capacity = persister->run_capacity;
+        persister->run_capacity = persister->runs_flushing_capacity;
+        persister->runs_flushing_capacity = capacity;
+        persister->run_count = 0;
+
+        unsigned long batch_seq = persister->marked_seq;
+        persister->flush_requested = false;
+
+        pthread_mutex_unlock(&persister->lock);
+        bool tasks_written = persist_write_batch(persister, batch, count);
+        bool runs_written = persist_write_runs(runs, run_count);
+        if (runs_written) {
+            free_run_outputs(runs, run_count);
+        }
+        pthread_mutex_lock(&persister->lock);
+
+        for (int i = 0; i < count; i++) {
+            unsigned char *queued = &persister->queued[batch[i].task_id];
+            *queued &= ~QUEUED_IN_FLIGHT;
+            if (batch[i].kinds != 0) {
+                *queued |= QUEUED_FAILED;
+            } else {
+                *queued &= ~QUEUED_FAILED;
+            }
+        }
+        if (tasks_written && runs_written) {
+            persister->retry_delay = 0;
+            persister->retry_time = 0;
+        } else {
+            persister->error_seq = batch_seq;
+
+            // Merge the unwritten tasks back with the marks made meanwhile
+            // and put the history rows back in front of newer ones
+            int lost_tasks = 0;
+            int lost_runs = 0;
+            if (persister->stopping) {
+                for (int i = 0; i < count; i++) {
+                    lost_tasks += batch[i].kinds != 0;
+                }
+                lost_runs = runs_written ? 0 : run_count;
+            } else {
+                lost_tasks = requeue_tasks(persister, batch, count);
+                if (!runs_written && !requeue_runs(persister, runs, run_count)) {
+                    lost_runs = run_count;
+                }
+            }
+            if (!runs_written && lost_runs > 0) {
+                free_run_outputs(runs, run_count);
+            }
+
+            if (lost_tasks > 0 || lost_runs > 0) {
+                log_message(LOG_ERROR, "Dropped %d unwritten tasks and %d history rows", lost_tasks, lost_runs);
+            }
+            if (!persister->stopping) {
+                persister->retry_delay = persister->retry_delay == 0 ? RETRY_MIN_DELAY_SEC
+                                         : persister->retry_delay * 2;
+                if (persister->retry_delay > RETRY_MAX_DELAY_SEC) {
+                    persister->retry_delay = RETRY_MAX_DELAY_SEC;
+                }
+                persister->retry_time = monotonic_seconds() + persister->retry_delay;
+                log_message(LOG_WARNING, "Persisting failed, retrying in %.0f seconds", persister->retry_delay);
+            }
+        }
+        persister->flushed_seq = batch_seq;
+        pthread_cond_broadcast(&persister->flushed);
+    }
+    pthread_mutex_unlock(&persister->lock);
+
+    return NULL;
+}
+
+// Write the current state of the tasks, batch_size tasks per transaction.
+// Each chunk is copied before its transaction begins, so the load callback
+// never runs while the database is held. Tasks whose definition is
+// unchanged only get their run-state columns updated. The kinds of every
+// entry that no longer needs writing (committed, or removed) are cleared,
+// so what is left nonzero is what failed.
+static bool persist_write_batch(Persister *persister, PersistEntry *entries, int count) {
+    int chunk_size = count < persister->batch_size ? count : persister->batch_size;
+    Task *tasks = (Task*)malloc(sizeof(Task) * (chunk_size > 0 ? chunk_size : 1));
+    int *index = (int*)malloc(sizeof(int) * (chunk_size > 0 ? chunk_size : 1));
+    if (!tasks || !index) {
+        log_message(LOG_ERROR, "Failed to allocate memory for persistence batch");
+        free(tasks);
+        free(index);
+        return false;
+    }
+
+    bool success = true;
+    int written = 0;
+    int narrow = 0;
+    for (int start = 0; start < count; start += chunk_size) {
+        int end = start + chunk_size < count ? start + chunk_size : count;
+
+        int loaded = 0;
+        for (int i = start; i < end; i++) {
+            // Tasks removed since they were marked are skipped
+            if (persister->load(persister->context, entries[i].task_id, &tasks[loaded])) {
+                index[loaded] = i;
+                loaded++;
+            } else {
+                entries[i].kinds = 0;
+            }
+        }
+        if (loaded == 0) {
+            continue;
+        }
+
+        if (!db_begin_transaction()) {
+            success = false;
+            continue;
+        }
+        int chunk_written = 0;
+        int chunk_narrow = 0;
+        for (int i = 0; i < loaded; i++) {
+            PersistEntry *entry = &entries[index[i]];
+            bool status_only = !(entry->kinds & PERSIST_DEFINITION);
+            bool ok = status_only ? db_update_task_status(&tasks[i]) : db_upsert_task(&tasks[i]);
+            if (ok) {
+                chunk_written++;
+                if (status_only) {
+                    chunk_narrow++;
+                }
+            } else {
+                log_message(LOG_ERROR, "Failed to persist task: ID=%d", tasks[i].id);
+                success = false;
+                index[i] = -1;
+            }
+        }
+        if (!db_commit_transaction()) {
+            success = false;
+            continue;
+        }
+        for (int i = 0; i < loaded; i++) {
+            if (index[i] >= 0) {
+                entries[index[i]].kinds = 0;
+            }
+        }
+        written += chunk_written;
+        narrow += chunk_narrow;
+    }
+
+    free(tasks);
+    free(index);
+    log_message(LOG_DEBUG, "Persisted %d of %d dirty tasks (%d status only)", written, count, narrow);
+    return success;
+}
+
+// Insert queued history rows in one transaction. Inserts are not
+// idempotent, so a failed row rolls back the whole batch for a clean retry.
+static bool persist_write_runs(const TaskRunRecord *runs, int count) {
+    if (count == 0) {
+        return true;
+    }
+
+    if (!db_begin_transaction()) {
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!db_insert_task_run(&runs[i])) {
+            db_rollback_transaction();
+            return false;
+        }
+    }
+    if (!db_commit_transaction()) {
+        return false;
+    }
+
+    log_message(LOG_DEBUG, "Recorded %d task runs", count);
+    return true;
+}
+
+// Append a task to the pending list (lock held)
+static bool pending_push(Persister *persister, int task_id) {
+    if (persister->pending_count == persister->pending_capacity) {
+        int new_capacity = persister->pending_capacity * 2;
+        PersistEntry *pending = (PersistEntry*)realloc(persister->pending,
+                                                       sizeof(PersistEntry) * new_capacity);
+        if (!pending) {
+            log_message(LOG_ERROR, "Failed to grow persistence queue");
+            return false;
+        }
+        persister->pending = pending;
+        persister->pending_capacity = new_capacity;
+    }
+
+    persister->pending[persister->pending_count].task_id = task_id;
+    persister->pending[persister->pending_count].kinds = 0;
+    persister->pending_count++;
+    return true;
+}
+
+// Mark the batch entries that were not written dirty again, merged with
+// marks made while they were in flight (lock held). Returns how many could
+// not be queued.
+static int requeue_tasks(Persister *persister, const PersistEntry *entries, int count) {
+    int lost = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (entries[i].kinds == 0) {
+            continue;
+        }
+
+        int task_id = entries[i].task_id;
+        if (!(persister->queued[task_id] & QUEUED_KIND_MASK)) {
+            if (persister->pending_count == 0 && persister->run_count == 0) {
+                persister->first_mark_time = monotonic_seconds();
+            }
+            if (!pending_push(persister, task_id)) {
+                lost++;
+                continue;
+            }
+        }
+        persister->queued[task_id] |= entries[i].kinds;
+    }
+
+    return lost;
+}
+
+// Put history rows that were not inserted back in front of the queue,
+// keeping insertion order (lock held). Takes over their output buffers on
+// success.
+static bool requeue_runs(Persister *persister, const TaskRunRecord *runs, int count) {
+    int needed = persister->run_count + count;
+    if (needed > persister->run_capacity) {
+        int new_capacity = persister->run_capacity;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        TaskRunRecord *grown = (TaskRunRecord*)realloc(persister->runs,
+                                                       sizeof(TaskRunRecord) * new_capacity);
+        if (!grown) {
+            log_message(LOG_ERROR, "Failed to grow execution history queue");
+            return false;
+        }
+        persister->runs = grown;
+        persister->run_capacity = new_capacity;
+    }
+
+    if (persister->pending_count == 0 && persister->run_count == 0) {
+        persister->first_mark_time = monotonic_seconds();
+    }
+    memmove(persister->runs + count, persister->runs, sizeof(TaskRunRecord) * persister->run_count);
+    memcpy(persister->runs, runs, sizeof(TaskRunRecord) * count);
+    persister->run_count = needed;
+    return true;
+}
+
+// Replace output->data with a copy of it
+static bool copy_output(CapturedOutput *output) {
+    if (!output->data) {
+        return true;
+    }
+
+    char *copy = (char*)malloc(output->length + 1);
+    if (!copy) {
+        output->data = NULL;
+        return false;
+    }
+    memcpy(copy, output->data, output->length);
+    copy[output->length] = '\0';
+    output->data = copy;
+    return true;
+}
+
+static void free_run_outputs(TaskRunRecord *runs, int count) {
+    for (int i = 0; i < count; i++) {
+        free(runs[i].output.data);
+        free(runs[i].error_output.data);
+        runs[i].output.data = NULL;
+        runs[i].error_output.data = NULL;
+    }
+}
+
+// Absolute CLOCK_REALTIME deadline for pthread_cond_timedwait
+static void deadline_after(double seconds, struct timespec *deadline) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += (time_t)seconds;
+    deadline->tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
@@ -1,4 +1,5 @@
 #include "../../include/scheduler.h"
+#include "../../include/workflow.h"
 #include "../../include/utils.h"
 #include "../../include/db.h"
 #include "../../include/ai.h"
@@ -16,6 +17,7 @@
 #define INITIAL_CAPACITY 10
 #define DB_FILENAME "tasks.db"
 #define MAX_TASKS_TO_EXECUTE 100
+#define PAGE_IN_BATCH 64               // Rows read between two holds of the lock
 
 // Thread function declaration
 static void* scheduler_thread_func(void *arg);
@@ -23,8 +25,20 @@ static void* scheduler_thread_func(void *arg);
 // Helper functions
 static bool scheduler_resize(Scheduler *scheduler, int new_capacity);
 static int find_task_index(Scheduler *scheduler, int task_id);
+static bool slot_set(Scheduler *scheduler, int task_id, int index);
+static int append_task(Scheduler *scheduler, const Task *task);
+static void remove_task_at(Scheduler *scheduler, int index);
+static void refresh_resident_tasks(Scheduler *scheduler, time_t now);
 static bool check_dependencies_satisfied(Scheduler *scheduler, const Task *task);
-static bool execute_task_with_script(Scheduler *scheduler, Task *task);
+static int* build_dispatch_order(Scheduler *scheduler);
+static bool execute_task_with_script(Scheduler *scheduler, Task *task, int run_id, int *exit_code_out);
+static void record_runtime(Scheduler *scheduler, int idx, double seconds);
+static void sync_task_state(Scheduler *scheduler, int idx);
+static void record_run(Scheduler *scheduler, int task_id, int run_id,
+                       const CommandResult *outcome, TaskRunTrigger trigger);
+static bool load_task_for_persist(void *context, int task_id, Task *task);
+static bool execute_task_internal(Scheduler *scheduler, int task_id, bool check_deps,
+                                  int run_id, int *exit_code_out);
 
 bool scheduler_init(Scheduler *scheduler, const char *data_dir) {
     if (!scheduler || !data_dir) {
@@ -59,11 +73,45 @@ bool scheduler_init(Scheduler *scheduler, const char *data_dir) {
         return false;
     }
     
+    // IDs come from blocks reserved in the database, shared by every process
+    idalloc_init(&scheduler->task_ids, DB_COUNTER_TASK_ID, IDALLOC_DEFAULT_BLOCK_SIZE);
+    idalloc_init(&scheduler->run_ids, DB_COUNTER_RUN_ID, IDALLOC_DEFAULT_BLOCK_SIZE);
+    
+    // Initialize dependency graph
+    if (!depgraph_init(&scheduler->deps)) {
+        log_message(LOG_ERROR, "Failed to initialize dependency graph");
+        pthread_mutex_destroy(&scheduler->lock);
+        return false;
+    }
+    
+    // Initialize the worker pool and workflow run tracking
+    if (!executor_init(&scheduler->executor, EXECUTOR_DEFAULT_WORKERS)) {
+        log_message(LOG_ERROR, "Failed to initialize executor");
+        depgraph_free(&scheduler->deps);
+        pthread_mutex_destroy(&scheduler->lock);
+        return false;
+    }
+    pthread_mutex_init(&scheduler->workflow_lock, NULL);
+    pthread_cond_init(&scheduler->workflow_done, NULL);
+    scheduler->workflows = NULL;
+    
+    // Start the write-behind thread for task rows
+    if (!persist_init(&scheduler->persister, load_task_for_persist, scheduler)) {
+        log_message(LOG_ERROR, "Failed to initialize task persistence");
+        executor_shutdown(&scheduler->executor);
+        depgraph_free(&scheduler->deps);
+        pthread_mutex_destroy(&scheduler->lock);
+        return false;
+    }
+    
     // Allocate initial task array
     scheduler->capacity = INITIAL_CAPACITY;
     scheduler->tasks = (Task*)malloc(sizeof(Task) * scheduler->capacity);
     if (!scheduler->tasks) {
         log_message(LOG_ERROR, "Failed to allocate memory for tasks");
+        persist_shutdown(&scheduler->persister);
+        executor_shutdown(&scheduler->executor);
+        depgraph_free(&scheduler->deps);
         pthread_mutex_destroy(&scheduler->lock);
         return false;
     }
@@ -75,33 +123,77 @@ bool scheduler_init(Scheduler *scheduler, const char *data_dir) {
     // We're not running yet
     scheduler->running = false;
     
-    // Load tasks from database
-    Task *tasks = NULL;
-    int count = 0;
-    
-    if (db_load_tasks(&tasks, &count)) {
-        if (count > 0) {
-            // Make sure we have enough capacity
-            if (count > scheduler->capacity) {
-                if (!scheduler_resize(scheduler, count)) {
-                    log_message(LOG_ERROR, "Failed to resize task array");
-                    free(tasks);
-                    pthread_mutex_destroy(&scheduler->lock);
-                    return false;
-                }
+    DbStorageConfig storage;
+    db_load_storage_config(NULL, &storage);
+    scheduler->resident_max = storage.resident_max_tasks;
+    scheduler->resident_window = storage.resident_window_sec;
+    script_cache_init(storage.script_cache_kb);
+    command_output_init(storage.history_output_kb);
+    
+    CgroupConfig cgroup_config;
+    cgroup_load_config(NULL, &cgroup_config);
+    cgroup_init(&cgroup_config);
+    
+    int total = db_count_tasks();
+    if (total > scheduler->resident_max) {
+        // Too many tasks to keep in memory: seed the dependency graph from
+        // the run state of every task, then load only those due soon
+        TaskSummary *summaries = NULL;
+        int count = 0;
+        
+        if (db_load_task_summaries(&summaries, &count)) {
+            for (int i = 0; i < count; i++) {
+                // Same rule as sync_task_state
+                bool completed = summaries[i].last_run_time > 0;
+                depgraph_set_duration(&scheduler->deps, summaries[i].id, summaries[i].avg_runtime);
+                depgraph_set_task_state(&scheduler->deps, summaries[i].id, completed,
+                                        completed && summaries[i].exit_code == 0);
             }
-            
-            // Copy tasks to scheduler
-            memcpy(scheduler->tasks, tasks, sizeof(Task) * count);
-            scheduler->task_count = count;
-            
-            // Free temporary array
-            free(tasks);
-            
-            log_message(LOG_INFO, "Loaded %d tasks from database", count);
+            free(summaries);
+        } else {
+            log_message(LOG_ERROR, "Failed to load task states from database");
         }
+        
+        scheduler->partial = true;
+        refresh_resident_tasks(scheduler, time(NULL));
+        
+        log_message(LOG_INFO, "Loaded %d of %d tasks from database (due within %d s); "
+                   "the rest load on demand", scheduler->task_count, total,
+                   scheduler->resident_window);
     } else {
-        log_message(LOG_ERROR, "Failed to load tasks from database");
+        // Load tasks from database and adopt the array as is
+        Task *tasks = NULL;
+        int count = 0;
+        
+        if (db_load_tasks(&tasks, &count)) {
+            if (count > 0) {
+                free(scheduler->tasks);
+                scheduler->tasks = tasks;
+                scheduler->task_count = count;
+                scheduler->capacity = count;
+                
+                log_message(LOG_INFO, "Loaded %d tasks from database", count);
+            }
+        } else {
+            log_message(LOG_ERROR, "Failed to load tasks from database");
+        }
+        
+        // Seed expected runtimes before the edges so the load computes
+        // earliest finish times in one pass
+        for (int i = 0; i < scheduler->task_count; i++) {
+            slot_set(scheduler, scheduler->tasks[i].id, i);
+            depgraph_set_duration(&scheduler->deps, scheduler->tasks[i].id,
+                                  scheduler->tasks[i].avg_runtime);
+            sync_task_state(scheduler, i);
+        }
+    }
+    
+    // Load dependency edges; without all of them tasks could run ahead
+    // of the tasks they depend on
+    if (!db_load_dependencies(&scheduler->deps)) {
+        log_message(LOG_ERROR, "Failed to load dependencies from database");
+        scheduler_cleanup(scheduler);
+        return false;
     }
     
     return true;
@@ -117,18 +209,33 @@ void scheduler_cleanup(Scheduler *scheduler) {
         scheduler_stop(scheduler);
     }
     
+    // Let active workflow runs finish, then stop the worker pool
+    executor_shutdown(&scheduler->executor);
+    pthread_cond_destroy(&scheduler->workflow_done);
+    pthread_mutex_destroy(&scheduler->workflow_lock);
+    
+    // Write out every pending task change
+    persist_shutdown(&scheduler->persister);
+    
     // Free resources
     pthread_mutex_destroy(&scheduler->lock);
     if (scheduler->tasks) {
         free(scheduler->tasks);
         scheduler->tasks = NULL;
     }
+    free(scheduler->slots);
+    scheduler->slots = NULL;
+    scheduler->slot_capacity = 0;
+    depgraph_free(&scheduler->deps);
+    idalloc_destroy(&scheduler->task_ids);
+    idalloc_destroy(&scheduler->run_ids);
     
     scheduler->task_count = 0;
     scheduler->capacity = 0;
     
     // Clean up database
     db_cleanup();
+    script_cache_clear();
 }
 
 bool scheduler_start(Scheduler *scheduler) {
@@ -143,12 +250,19 @@ bool scheduler_start(Scheduler *scheduler) {
     
     // Set running flag and create thread
     scheduler->running = true;
-    if (pthread_create(&scheduler->scheduler_thread, NULL, scheduler_thread_func, scheduler) != 0) {
+    if (thread_create(&scheduler->scheduler_thread, NULL, scheduler_thread_func, scheduler) != 0) {
         log_message(LOG_ERROR, "Failed to create scheduler thread");
         scheduler->running = false;
         return false;
     }
     
+    // Tasks run without it; only following their output needs it
+    char socket_path[MAX_PATH + sizeof(CONTROL_SOCKET_NAME)];
+    snprintf(socket_path, sizeof(socket_path), "%s/%s", scheduler->data_dir, CONTROL_SOCKET_NAME);
+    if (!control_start(&scheduler->control, socket_path)) {
+        log_message(LOG_WARNING, "Live output is not available");
+    }
+    
     log_message(LOG_INFO, "Scheduler started");
     return true;
 }
@@ -163,6 +277,7 @@ bool scheduler_stop(Scheduler *scheduler) {
     
     // Wait for the thread to finish
     pthread_join(scheduler->scheduler_thread, NULL);
+    control_stop(&scheduler->control);
     
     log_message(LOG_INFO, "Scheduler stopped");
     return true;
@@ -173,18 +288,14 @@ int scheduler_add_task(Scheduler *scheduler, Task task) {
         return -1;
     }
     
-    pthread_mutex_lock(&scheduler->lock);
-    
-    // Resize if necessary
-    if (scheduler->task_count >= scheduler->capacity) {
-        if (!scheduler_resize(scheduler, scheduler->capacity * 2)) {
-            pthread_mutex_unlock(&scheduler->lock);
-            return -1;
-        }
+    // Generate a new ID; no lock needed, the allocator is thread-safe
+    task.id = idalloc_next(&scheduler->task_ids);
+    if (task.id < 0) {
+        log_message(LOG_ERROR, "Failed to allocate a task ID");
+        return -1;
     }
     
-    // Generate a new ID
-    task.id = db_get_next_id();
+    pthread_mutex_lock(&scheduler->lock);
     
     // Calculate next run time if not set
     if (task.next_run_time == 0) {
@@ -192,8 +303,12 @@ int scheduler_add_task(Scheduler *scheduler, Task task) {
     }
     
     // Add task to array
-    scheduler->tasks[scheduler->task_count] = task;
-    scheduler->task_count++;
+    int added = append_task(scheduler, &task);
+    if (added < 0) {
+        pthread_mutex_unlock(&scheduler->lock);
+        return -1;
+    }
+    sync_task_state(scheduler, added);
     
     pthread_mutex_unlock(&scheduler->lock);
     
@@ -204,10 +319,7 @@ int scheduler_add_task(Scheduler *scheduler, Task task) {
         pthread_mutex_lock(&scheduler->lock);
         int index = find_task_index(scheduler, task.id);
         if (index >= 0) {
-            if (index < scheduler->task_count - 1) {
-                scheduler->tasks[index] = scheduler->tasks[scheduler->task_count - 1];
-            }
-            scheduler->task_count--;
+            remove_task_at(scheduler, index);
         }
         pthread_mutex_unlock(&scheduler->lock);
         return -1;
@@ -217,6 +329,118 @@ int scheduler_add_task(Scheduler *scheduler, Task task) {
     return task.id;
 }
 
+int scheduler_import_tasks(Scheduler *scheduler, Task *tasks, int count,
+                           const TaskImportEdge *edges, int edge_count) {
+    if (!scheduler || !tasks || count <= 0 || edge_count < 0 || (edge_count > 0 && !edges)) {
+        return -1;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (!task_validate(&tasks[i])) {
+            log_message(LOG_ERROR, "Import rejected: task %d of %d is invalid", i + 1, count);
+            return -1;
+        }
+    }
+    
+    int *task_ids = (int*)malloc(sizeof(int) * (edge_count > 0 ? edge_count : 1));
+    int *dependency_ids = (int*)malloc(sizeof(int) * (edge_count > 0 ? edge_count : 1));
+    if (!task_ids || !dependency_ids) {
+        log_message(LOG_ERROR, "Failed to allocate memory for imported dependencies");
+        free(task_ids);
+        free(dependency_ids);
+        return -1;
+    }
+    
+    for (int i = 0; i < edge_count; i++) {
+        if (edges[i].task < 0 || edges[i].task >= count ||
+            edges[i].dependency < 0 || edges[i].dependency >= count) {
+            log_message(LOG_ERROR, "Import rejected: dependency %d refers to a task outside the import", i + 1);
+            free(task_ids);
+            free(dependency_ids);
+            return -1;
+        }
+    }
+    
+    // Check the edges on a scratch graph of positions, so a cycle is
+    // found before any ID is allocated or row written
+    if (edge_count > 0) {
+        DepGraph check;
+        DepEdgeResult result = DEP_EDGE_ERROR;
+        if (depgraph_init(&check)) {
+            for (int i = 0; i < edge_count; i++) {
+                task_ids[i] = edges[i].task;
+                dependency_ids[i] = edges[i].dependency;
+            }
+            result = depgraph_add_dependencies(&check, task_ids, dependency_ids, edge_count);
+            depgraph_free(&check);
+        }
+        if (result != DEP_EDGE_OK) {
+            log_message(LOG_ERROR, "Import rejected: %s", result == DEP_EDGE_CYCLE
+                        ? "the dependencies form a cycle" : "failed to check the dependencies");
+            free(task_ids);
+            free(dependency_ids);
+            return -1;
+        }
+    }
+    
+    // One block of IDs for the whole import
+    int first = -1;
+    if (!idalloc_next_range(&scheduler->task_ids, count, &first)) {
+        log_message(LOG_ERROR, "Failed to allocate %d task IDs", count);
+        free(task_ids);
+        free(dependency_ids);
+        return -1;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        tasks[i].id = first + i;
+        if (tasks[i].next_run_time == 0) {
+            task_calculate_next_run(&tasks[i]);
+        }
+    }
+    for (int i = 0; i < edge_count; i++) {
+        task_ids[i] = first + edges[i].task;
+        dependency_ids[i] = first + edges[i].dependency;
+    }
+    
+    if (!db_import_tasks(tasks, count, task_ids, dependency_ids, edge_count)) {
+        log_message(LOG_ERROR, "Failed to write imported tasks to database");
+        free(task_ids);
+        free(dependency_ids);
+        return -1;
+    }
+    
+    pthread_mutex_lock(&scheduler->lock);
+    
+    // The rows are already written, so with only part of the tasks in
+    // memory, the ones not due soon are left to load on demand
+    time_t until = time(NULL) + scheduler->resident_window;
+    for (int i = 0; i < count; i++) {
+        const Task *task = &tasks[i];
+        bool due_soon = task->enabled && task->next_run_time > 0 && task->next_run_time <= until;
+        if ((scheduler->partial && !due_soon) || find_task_index(scheduler, task->id) >= 0) {
+            continue;
+        }
+        int added = append_task(scheduler, task);
+        if (added >= 0) {
+            sync_task_state(scheduler, added);
+        }
+    }
+    
+    if (edge_count > 0 &&
+        depgraph_add_dependencies(&scheduler->deps, task_ids, dependency_ids, edge_count) != DEP_EDGE_OK) {
+        log_message(LOG_ERROR, "Failed to add imported dependencies to the dependency graph");
+    }
+    
+    pthread_mutex_unlock(&scheduler->lock);
+    
+    free(task_ids);
+    free(dependency_ids);
+    
+    log_message(LOG_INFO, "Tasks added: IDs %d-%d", first, first + count - 1);
+    return first;
+}
+
 bool scheduler_remove_task(Scheduler *scheduler, int task_id) {
     if (!scheduler) {
         return false;
@@ -225,24 +449,36 @@ bool scheduler_remove_task(Scheduler *scheduler, int task_id) {
     pthread_mutex_lock(&scheduler->lock);
     
     // Find the task index
-    int index = find_task_index(scheduler, task_id);
+    int index = scheduler_resident_index(scheduler, task_id);
     if (index < 0) {
         pthread_mutex_unlock(&scheduler->lock);
         return false;
     }
     
-    // Move the last task to this position (if it's not the last one)
-    if (index < scheduler->task_count - 1) {
-        scheduler->tasks[index] = scheduler->tasks[scheduler->task_count - 1];
-    }
+    // Move the last task to this position
+    remove_task_at(scheduler, index);
     
-    // Decrease task count
-    scheduler->task_count--;
+    // Drop every edge touching the task
+    depgraph_remove_task(&scheduler->deps, task_id);
+    
+    // Until the row is gone, a page-in may read it and bring the task back
+    scheduler->deletes_pending++;
     
     pthread_mutex_unlock(&scheduler->lock);
     
+    // A write of the task copied before it was removed must not land after
+    // the delete and bring the row back
+    persist_flush(&scheduler->persister);
+    
     // Delete from database
-    if (!db_delete_task(task_id)) {
+    bool deleted = db_delete_task(task_id);
+    
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->deletes_pending--;
+    scheduler->unloads++;
+    pthread_mutex_unlock(&scheduler->lock);
+    
+    if (!deleted) {
         log_message(LOG_ERROR, "Failed to delete task from database");
         return false;
     }
@@ -259,7 +495,7 @@ bool scheduler_update_task(Scheduler *scheduler, Task task) {
     pthread_mutex_lock(&scheduler->lock);
     
     // Find the task
-    int index = find_task_index(scheduler, task.id);
+    int index = scheduler_resident_index(scheduler, task.id);
     if (index < 0) {
         pthread_mutex_unlock(&scheduler->lock);
         return false;
@@ -278,6 +514,9 @@ bool scheduler_update_task(Scheduler *scheduler, Task task) {
         log_message(LOG_INFO, "Preserving exit_code during update: %d", original_exit_code);
     }
     
+    // Keep the previous state to find out what the update changed
+    Task previous = scheduler->tasks[index];
+    
     // Update the task
     scheduler->tasks[index] = task;
     
@@ -292,18 +531,23 @@ bool scheduler_update_task(Scheduler *scheduler, Task task) {
     
     // Make sure next run time is calculated
     task_calculate_next_run(&scheduler->tasks[index]);
+    sync_task_state(scheduler, index);
     
-    // Tạo bản sao của task để gửi đến database
-    Task db_task = scheduler->tasks[index];
+    // Queue the row for the persistence thread; edits that leave the
+    // definition alone only need the run-state columns written
+    const Task *updated = &scheduler->tasks[index];
+    if (!task_same_definition(&previous, updated)) {
+        persist_mark_dirty(&scheduler->persister, task.id, PERSIST_DEFINITION);
+    } else if (previous.next_run_time != updated->next_run_time ||
+               previous.last_run_time != updated->last_run_time ||
+               previous.exit_code != updated->exit_code ||
+               previous.last_run_id != updated->last_run_id ||
+               previous.avg_runtime != updated->avg_runtime) {
+        persist_mark_dirty(&scheduler->persister, task.id, PERSIST_STATUS);
+    }
     
     pthread_mutex_unlock(&scheduler->lock);
     
-    // Update in database
-    if (!db_update_task(&db_task)) {
-        log_message(LOG_ERROR, "Failed to update task in database");
-        return false;
-    }
-    
     log_message(LOG_INFO, "Task updated: ID=%d, Name=%s", task.id, task.name);
     return true;
 }
@@ -354,6 +598,34 @@ Task* scheduler_get_all_tasks(Scheduler *scheduler, int *count) {
     
     pthread_mutex_lock(&scheduler->lock);
     
+    if (scheduler->partial) {
+        pthread_mutex_unlock(&scheduler->lock);
+        
+        // Only part of the tasks is in memory: read them all from the
+        // database once pending changes are written, then overlay the
+        // resident copies, which are never older than their rows
+        persist_flush(&scheduler->persister);
+        
+        Task *tasks = NULL;
+        int db_count = 0;
+        if (!db_load_tasks(&tasks, &db_count) || db_count == 0) {
+            *count = 0;
+            return NULL;
+        }
+        
+        pthread_mutex_lock(&scheduler->lock);
+        for (int i = 0; i < db_count; i++) {
+            int index = find_task_index(scheduler, tasks[i].id);
+            if (index >= 0) {
+                tasks[i] = scheduler->tasks[index];
+            }
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+        
+        *count = db_count;
+        return tasks;
+    }
+    
     // Set count
     *count = scheduler->task_count;
     
@@ -387,7 +659,84 @@ Task* scheduler_get_all_tasks(Scheduler *scheduler, int *count) {
     return tasks;
 }
 
+Task* scheduler_get_tasks_page(Scheduler *scheduler, int after_id, int limit, int *count) {
+    if (!scheduler || !count || after_id < 0 || limit <= 0) {
+        return NULL;
+    }
+    
+    *count = 0;
+    
+    pthread_mutex_lock(&scheduler->lock);
+    
+    if (scheduler->partial) {
+        pthread_mutex_unlock(&scheduler->lock);
+        
+        // Read the page from the database once pending changes are
+        // written, then overlay the resident copies, which are never older
+        // than their rows
+        if (after_id == 0) {
+            persist_flush(&scheduler->persister);
+        }
+        
+        Task *tasks = NULL;
+        int db_count = 0;
+        if (!db_load_tasks_page(after_id, limit, &tasks, &db_count) || db_count == 0) {
+            return NULL;
+        }
+        
+        pthread_mutex_lock(&scheduler->lock);
+        for (int i = 0; i < db_count; i++) {
+            int index = find_task_index(scheduler, tasks[i].id);
+            if (index >= 0) {
+                tasks[i] = scheduler->tasks[index];
+            }
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+        
+        *count = db_count;
+        return tasks;
+    }
+    
+    // Every task is resident: walk the ID slots in order
+    Task *tasks = (Task*)malloc(sizeof(Task) * limit);
+    if (!tasks) {
+        pthread_mutex_unlock(&scheduler->lock);
+        return NULL;
+    }
+    
+    int n = 0;
+    for (int id = after_id + 1; id < scheduler->slot_capacity && n < limit; id++) {
+        int index = scheduler->slots[id];
+        if (index >= 0) {
+            tasks[n++] = scheduler->tasks[index];
+        }
+    }
+    
+    pthread_mutex_unlock(&scheduler->lock);
+    
+    if (n == 0) {
+        free(tasks);
+        return NULL;
+    }
+    *count = n;
+    return tasks;
+}
+
 bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
+    int exit_code = 0;
+    return execute_task_internal(scheduler, task_id, true, 0, &exit_code);
+}
+
+bool scheduler_execute_task_in_run(Scheduler *scheduler, int task_id, int run_id, int *exit_code) {
+    if (!exit_code) {
+        return false;
+    }
+    return execute_task_internal(scheduler, task_id, false, run_id, exit_code);
+}
+
+// Helper function shared by manual and workflow execution
+static bool execute_task_internal(Scheduler *scheduler, int task_id, bool check_deps,
+                                  int run_id, int *exit_code_out) {
     if (!scheduler || task_id < 0) {
         return false;
     }
@@ -395,7 +744,7 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
     pthread_mutex_lock(&scheduler->lock);
     
     // Find the task
-    int idx = find_task_index(scheduler, task_id);
+    int idx = scheduler_resident_index(scheduler, task_id);
     if (idx < 0) {
         log_message(LOG_ERROR, "Task not found for execution: ID=%d", task_id);
         pthread_mutex_unlock(&scheduler->lock);
@@ -412,7 +761,7 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
     }
     
     // Check if dependencies are satisfied
-    if (!check_dependencies_satisfied(scheduler, task)) {
+    if (check_deps && !check_dependencies_satisfied(scheduler, task)) {
         log_message(LOG_WARNING, "Dependencies not satisfied for task: ID=%d", task_id);
         pthread_mutex_unlock(&scheduler->lock);
         return false;
@@ -445,7 +794,6 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
     
     // Make a copy of the command or script if needed
     char command_copy[TASK_COMMAND_MAX_LENGTH] = "";
-    char script_content_copy[TASK_SCRIPT_MAX_LENGTH] = "";
     char ai_prompt_copy[TASK_AI_PROMPT_MAX_LENGTH] = "";
     char system_metrics_copy[128] = "";
     
@@ -453,9 +801,6 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
         case EXEC_COMMAND:
             safe_strcpy(command_copy, task->command, sizeof(command_copy));
             break;
-        case EXEC_SCRIPT:
-            safe_strcpy(script_content_copy, task->script_content, sizeof(script_content_copy));
-            break;
         case EXEC_AI_DYNAMIC:
             safe_strcpy(ai_prompt_copy, task->ai_prompt, sizeof(ai_prompt_copy));
             safe_strcpy(system_metrics_copy, task->system_metrics, sizeof(system_metrics_copy));
@@ -477,22 +822,28 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
     
     bool success = false;
     int exit_code = 0;
+    CommandResult outcome;
+    memset(&outcome, 0, sizeof(CommandResult));
+    double started = monotonic_seconds();
     
     // Execute task based on execution mode - without holding the lock
     switch (task_exec_mode) {
         case EXEC_COMMAND:
             // Execute command directly
             log_message(LOG_DEBUG, "Executing command: %s", command_copy);
-            success = run_command_with_timeout(command_copy, 
-                                             working_dir[0] ? working_dir : NULL, 
-                                             task_max_runtime, 
-                                             &exit_code);
+            success = run_command_ex(command_copy, 
+                                     working_dir[0] ? working_dir : NULL, 
+                                     task_max_runtime, 
+                                     task_id,
+                                     task_copy.resource_limits,
+                                     &outcome);
+            exit_code = outcome.exit_code;
             break;
             
         case EXEC_SCRIPT:
             // We handle script execution separately to ensure thread safety
             log_message(LOG_DEBUG, "Executing script task");
-            success = execute_task_with_script(scheduler, &task_copy);
+            success = execute_task_with_script(scheduler, &task_copy, run_id, exit_code_out);
             
             // execute_task_with_script already handles marking the task as executed
             // and updating the database, so we're done
@@ -525,10 +876,13 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
             log_message(LOG_INFO, "AI generated command: %s", cmd);
             
             // Execute the generated command
-            success = run_command_with_timeout(cmd, 
-                                             working_dir[0] ? working_dir : NULL, 
-                                             task_max_runtime, 
-                                             &exit_code);
+            success = run_command_ex(cmd, 
+                                     working_dir[0] ? working_dir : NULL, 
+                                     task_max_runtime, 
+                                     task_id,
+                                     task_copy.resource_limits,
+                                     &outcome);
+            exit_code = outcome.exit_code;
             
             free(cmd);
             break;
@@ -539,11 +893,16 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
             return false;
     }
     
+    *exit_code_out = exit_code;
+    record_run(scheduler, task_id, run_id, &outcome,
+               run_id > 0 ? RUN_TRIGGER_WORKFLOW : RUN_TRIGGER_MANUAL);
+    command_result_free(&outcome);
+    
     // Reacquire the lock to update task state
     pthread_mutex_lock(&scheduler->lock);
     
-    // Find the task again (it might have been removed or modified)
-    idx = find_task_index(scheduler, task_id);
+    // Find the task again (it might have been removed, modified or evicted)
+    idx = scheduler_resident_index(scheduler, task_id);
     if (idx < 0) {
         log_message(LOG_WARNING, "Task %d not found after execution, cannot update status", task_id);
         pthread_mutex_unlock(&scheduler->lock);
@@ -561,6 +920,9 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
     
     // Update task execution statistics
     task_mark_executed(&scheduler->tasks[idx], exit_code);
+    scheduler->tasks[idx].last_run_id = run_id;
+    record_runtime(scheduler, idx, monotonic_seconds() - started);
+    sync_task_state(scheduler, idx);
 
     // Send email notification for task execution, regardless of exit_code
     if (success) {
@@ -570,8 +932,8 @@ bool scheduler_execute_task(Scheduler *scheduler, int task_id) {
         }
     }
 
-    // Update in database
-    db_update_task(&scheduler->tasks[idx]);
+    // Only the run state changed: queue a status write
+    persist_mark_dirty(&scheduler->persister, task_id, PERSIST_STATUS);
     
     pthread_mutex_unlock(&scheduler->lock);
     return success;
@@ -582,37 +944,17 @@ bool scheduler_sync(Scheduler *scheduler) {
         return false;
     }
     
-    pthread_mutex_lock(&scheduler->lock);
+    // Every change marks its task dirty, so syncing means writing out the
+    // changed rows; the scheduler lock is only taken to copy each one
+    bool success = persist_flush(&scheduler->persister);
     
-    bool success = true;
-    
-    // Sync each task with the database
-    for (int i = 0; i < scheduler->task_count; i++) {
-        Task *task = &scheduler->tasks[i];
-        
-        // Check if the task exists in the database
-        Task db_task;
-        bool exists = db_get_task(task->id, &db_task);
-        
-        if (exists) {
-            // Update if it exists
-            if (!db_update_task(task)) {
-                log_message(LOG_ERROR, "Failed to update task in database during sync: ID=%d", task->id);
-                success = false;
-            }
-        } else {
-            // Save if it doesn't exist
-            if (!db_save_task(task)) {
-                log_message(LOG_ERROR, "Failed to save task to database during sync: ID=%d", task->id);
-                success = false;
-            }
-        }
-    }
-    
-    pthread_mutex_unlock(&scheduler->lock);
+    // Fold the WAL back into the database file between bursts of writes
+    db_checkpoint(false);
     
     if (success) {
         log_message(LOG_INFO, "Scheduler synced with database");
+    } else {
+        log_message(LOG_ERROR, "Failed to write some task changes to the database");
     }
     
     return success;
@@ -633,10 +975,15 @@ static void* scheduler_thread_func(void *arg) {
     TaskExecutionInfo tasks_to_execute[MAX_TASKS_TO_EXECUTE];
     int num_tasks_to_execute;
     
+    // Tasks starting a workflow run of their connected tasks
+    int workflow_roots[MAX_TASKS_TO_EXECUTE];
+    int num_workflow_roots;
+    
     log_message(LOG_INFO, "Scheduler thread started.");
     
     while (scheduler->running) {
         num_tasks_to_execute = 0;
+        num_workflow_roots = 0;
         current_time = time(NULL);
         
         // Debug log current time
@@ -644,11 +991,19 @@ static void* scheduler_thread_func(void *arg) {
         time_to_string(current_time, time_buffer, sizeof(time_buffer), NULL);
         log_message(LOG_DEBUG, "Scheduler checking tasks at %s", time_buffer);
         
+        // Page in tasks coming due and evict idle ones past the limit
+        refresh_resident_tasks(scheduler, current_time);
+        
         // Lock mutex before accessing task list
         pthread_mutex_lock(&scheduler->lock);
         
+        // Evaluate tasks level by level so upstream tasks are always
+        // considered (and queued) before the tasks that depend on them
+        int *dispatch_order = build_dispatch_order(scheduler);
+        
         // Check tasks for execution
-        for (int i = 0; i < scheduler->task_count; i++) {
+        for (int n = 0; n < scheduler->task_count; n++) {
+            int i = dispatch_order ? dispatch_order[n] : n;
             Task *task = &scheduler->tasks[i];
             
             // Debug log task info
@@ -688,6 +1043,26 @@ static void* scheduler_thread_func(void *arg) {
                 log_message(LOG_DEBUG, "Task %d (%s): Due for execution (next_run=%ld, current=%ld)", 
                     task->id, task->name, task->next_run_time, current_time);
                 
+                // Connected tasks run together as a workflow run: a due task
+                // without upstream tasks starts one, the others only run in it
+                int upstream_count = 0;
+                int downstream_count = 0;
+                depgraph_get_dependencies(&scheduler->deps, task->id, &upstream_count);
+                depgraph_get_dependents(&scheduler->deps, task->id, &downstream_count);
+                
+                if (upstream_count > 0) {
+                    log_message(LOG_DEBUG, "Task ID %d (%s) is due but runs only within workflow runs.", 
+                                task->id, task->name);
+                    continue;
+                }
+                
+                if (downstream_count > 0) {
+                    if (num_workflow_roots < MAX_TASKS_TO_EXECUTE) {
+                        workflow_roots[num_workflow_roots++] = task->id;
+                    }
+                    continue;
+                }
+                
                 // Check if dependencies are satisfied
                 if (check_dependencies_satisfied(scheduler, task)) {
                     log_message(LOG_INFO, "Task ID %d (%s) is due and dependencies are satisfied.", task->id, task->name);
@@ -718,9 +1093,19 @@ static void* scheduler_thread_func(void *arg) {
             }
         }
         
+        free(dispatch_order);
+        
         // Unlock mutex after copying necessary tasks
         pthread_mutex_unlock(&scheduler->lock);
         
+        // Start workflow runs; roots whose run is still active are retried next tick
+        for (int i = 0; i < num_workflow_roots; i++) {
+            int run_id = workflow_start(scheduler, workflow_roots[i]);
+            if (run_id > 0) {
+                log_message(LOG_INFO, "Task ID %d started workflow run %d", workflow_roots[i], run_id);
+            }
+        }
+        
         // Execute copied tasks after unlocking mutex
         for (int i = 0; i < num_tasks_to_execute; i++) {
             Task *task = &(tasks_to_execute[i].task);
@@ -734,23 +1119,28 @@ static void* scheduler_thread_func(void *arg) {
             }
             
             int exit_code = 0;
+            CommandResult outcome;
+            memset(&outcome, 0, sizeof(CommandResult));
+            double started = monotonic_seconds();
             
             log_message(LOG_INFO, "Executing task ID %d: %s", task_id, task->name);
             
             // Execute task based on mode
             if (task->exec_mode == EXEC_SCRIPT) {
-                // Create temporary script and execute
-                char temp_path[512];
-                if (task_prepare_script(task, temp_path, sizeof(temp_path))) {
-                    run_command_with_timeout(
-                        temp_path,
+                // Run the script from its in-memory image
+                ScriptImage image;
+                if (task_open_script(task, &image)) {
+                    run_script_ex(
+                        image.fd,
+                        image.shebang,
                         task->working_dir[0] ? task->working_dir : NULL,
                         task->max_runtime,
-                        &exit_code
+                        task_id,
+                        task->resource_limits,
+                        &outcome
                     );
-                    
-                    // Delete temporary file after execution
-                    unlink(temp_path);
+                    exit_code = outcome.exit_code;
+                    close(image.fd);
                 } else {
                     log_message(LOG_ERROR, "Failed to prepare script for task %d", task_id);
                     exit_code = -1;
@@ -804,12 +1194,15 @@ static void* scheduler_thread_func(void *arg) {
                                     log_message(LOG_INFO, "Added notify-send compatibility wrapper for task %d", task_id);
                                     
                                     // Thực thi lệnh đã sửa đổi trực tiếp
-                                    run_command_with_timeout(
+                                    run_command_ex(
                                         modified_command,
                                         task->working_dir[0] ? task->working_dir : NULL,
                                         task->max_runtime,
-                                        &exit_code
+                                        task_id,
+                                        task->resource_limits,
+                                        &outcome
                                     );
+                                    exit_code = outcome.exit_code;
                                     
                                     // Force exit code to 0 for notification commands
                                     exit_code = 0;
@@ -817,21 +1210,27 @@ static void* scheduler_thread_func(void *arg) {
                                 } else {
                                     // Nếu không thể cấp phát bộ nhớ, thực thi lệnh gốc
                                     log_message(LOG_WARNING, "Could not create wrapper, executing original command");
-                                    run_command_with_timeout(
+                                    run_command_ex(
                                         command,
                                         task->working_dir[0] ? task->working_dir : NULL,
                                         task->max_runtime,
-                                        &exit_code
+                                        task_id,
+                                        task->resource_limits,
+                                        &outcome
                                     );
+                                    exit_code = outcome.exit_code;
                                 }
                             } else {
                                 // Thực thi lệnh gốc nếu không có notify-send
-                                run_command_with_timeout(
+                                run_command_ex(
                                     command,
                                     task->working_dir[0] ? task->working_dir : NULL,
                                     task->max_runtime,
-                                    &exit_code
+                                    task_id,
+                                    task->resource_limits,
+                                    &outcome
                                 );
+                                exit_code = outcome.exit_code;
                             }
                             
                             // Cập nhật trạng thái thực thi vào task
@@ -844,18 +1243,24 @@ static void* scheduler_thread_func(void *arg) {
                 }
             } else {
                 // Execute shell command
-                run_command_with_timeout(
+                run_command_ex(
                     task->command,
                     task->working_dir[0] ? task->working_dir : NULL,
                     task->max_runtime,
-                    &exit_code
+                    task_id,
+                    task->resource_limits,
+                    &outcome
                 );
+                exit_code = outcome.exit_code;
             }
             
+            record_run(scheduler, task_id, 0, &outcome, RUN_TRIGGER_SCHEDULE);
+            command_result_free(&outcome);
+            
             // Find task again in main list (pointer may have changed)
             pthread_mutex_lock(&scheduler->lock);
             
-            int task_index = find_task_index(scheduler, task_id);
+            int task_index = scheduler_resident_index(scheduler, task_id);
             if (task_index >= 0) {
                 Task *original_task = &scheduler->tasks[task_index];
                 
@@ -867,6 +1272,10 @@ static void* scheduler_thread_func(void *arg) {
                     continue;
                 }
                 
+                // Standalone execution, not part of a workflow run
+                original_task->last_run_id = 0;
+                record_runtime(scheduler, task_index, monotonic_seconds() - started);
+                
                 // For AI mode, the task_mark_executed was already called, so we just update based on exec_mode
                 if (task->exec_mode != EXEC_AI_DYNAMIC) {
                     // Update execution status
@@ -879,10 +1288,11 @@ static void* scheduler_thread_func(void *arg) {
                     // Update next run time
                     task_calculate_next_run(original_task);
                 }
+                sync_task_state(scheduler, task_index);
                 
-                // Save to database
-                pthread_mutex_unlock(&scheduler->lock); // Unlock mutex before DB operation
-                db_update_task(original_task);
+                // Only the run state changed: queue a status write
+                persist_mark_dirty(&scheduler->persister, task_id, PERSIST_STATUS);
+                pthread_mutex_unlock(&scheduler->lock);
                 
                 // Log execution
                 if (task->exit_code == 0) {
@@ -934,82 +1344,326 @@ static bool scheduler_resize(Scheduler *scheduler, int new_capacity) {
 
 // Helper function to find a task by ID
 static int find_task_index(Scheduler *scheduler, int task_id) {
-    for (int i = 0; i < scheduler->task_count; i++) {
-        if (scheduler->tasks[i].id == task_id) {
-            return i;
+    if (task_id < 0 || task_id >= scheduler->slot_capacity) {
+        return -1;
+    }
+    return scheduler->slots[task_id];
+}
+
+// Helper function to record where a task lives in the array (-1 when it
+// leaves). Must be called with the scheduler lock held.
+static bool slot_set(Scheduler *scheduler, int task_id, int index) {
+    if (task_id < 0) {
+        return false;
+    }
+    
+    if (task_id >= scheduler->slot_capacity) {
+        if (index < 0) {
+            return true;
         }
+        
+        int new_capacity = scheduler->slot_capacity > 0 ? scheduler->slot_capacity : INITIAL_CAPACITY;
+        while (new_capacity <= task_id) {
+            new_capacity *= 2;
+        }
+        int *slots = (int*)realloc(scheduler->slots, sizeof(int) * new_capacity);
+        if (!slots) {
+            log_message(LOG_ERROR, "Failed to grow task index");
+            return false;
+        }
+        for (int i = scheduler->slot_capacity; i < new_capacity; i++) {
+            slots[i] = -1;
+        }
+        scheduler->slots = slots;
+        scheduler->slot_capacity = new_capacity;
     }
-    return -1;
+    
+    scheduler->slots[task_id] = index;
+    return true;
 }
 
-// Helper function to check if dependencies are satisfied
-static bool check_dependencies_satisfied(Scheduler *scheduler, const Task *task) {
-    // If no dependencies, default to satisfied
-    if (task->dependency_count == 0) {
-        return true;
+// Helper function to add a task at the end of the array. Must be called
+// with the scheduler lock held; returns its index or -1 on failure.
+static int append_task(Scheduler *scheduler, const Task *task) {
+    if (scheduler->task_count >= scheduler->capacity) {
+        int new_capacity = scheduler->capacity > 0 ? scheduler->capacity * 2 : INITIAL_CAPACITY;
+        if (!scheduler_resize(scheduler, new_capacity)) {
+            return -1;
+        }
+    }
+    
+    int index = scheduler->task_count;
+    if (!slot_set(scheduler, task->id, index)) {
+        return -1;
+    }
+    scheduler->tasks[index] = *task;
+    scheduler->task_count++;
+    return index;
+}
+
+// Helper function to drop a task from the array by moving the last task into
+// its place. Must be called with the scheduler lock held.
+static void remove_task_at(Scheduler *scheduler, int index) {
+    scheduler->unloads++;
+    int last = scheduler->task_count - 1;
+    slot_set(scheduler, scheduler->tasks[index].id, -1);
+    if (index < last) {
+        scheduler->tasks[index] = scheduler->tasks[last];
+        slot_set(scheduler, scheduler->tasks[index].id, index);
+    }
+    scheduler->task_count--;
+}
+
+int scheduler_resident_index(Scheduler *scheduler, int task_id) {
+    int index = find_task_index(scheduler, task_id);
+    if (index >= 0 || !scheduler->partial) {
+        return index;
+    }
+    
+    // Not resident: its row is up to date, since only clean tasks are evicted
+    Task task;
+    if (!db_get_task(task_id, &task)) {
+        return -1;
+    }
+    
+    index = append_task(scheduler, &task);
+    if (index >= 0) {
+        log_message(LOG_DEBUG, "Loaded task %d on demand", task_id);
+    }
+    return index;
+}
+
+void scheduler_page_in(Scheduler *scheduler, const int *task_ids, int count) {
+    if (!scheduler || !task_ids || count <= 0) {
+        return;
+    }
+    
+    int *missing = (int*)malloc(sizeof(int) * count);
+    Task *batch = (Task*)malloc(sizeof(Task) * PAGE_IN_BATCH);
+    if (!missing || !batch) {
+        log_message(LOG_ERROR, "Failed to allocate memory for loading tasks");
+        free(missing);
+        free(batch);
+        return;
+    }
+    
+    pthread_mutex_lock(&scheduler->lock);
+    int missing_count = 0;
+    if (scheduler->partial) {
+        for (int i = 0; i < count; i++) {
+            if (find_task_index(scheduler, task_ids[i]) < 0) {
+                missing[missing_count++] = task_ids[i];
+            }
+        }
     }
+    unsigned long unloads = scheduler->unloads;
+    pthread_mutex_unlock(&scheduler->lock);
     
-    // Check each dependency
-    for (int i = 0; i < task->dependency_count; i++) {
-        int dep_id = task->dependencies[i];
-        bool found = false;
+    int loaded = 0;
+    for (int start = 0; start < missing_count; start += PAGE_IN_BATCH) {
+        int read = 0;
+        for (int i = start; i < missing_count && i < start + PAGE_IN_BATCH; i++) {
+            if (db_get_task(missing[i], &batch[read])) {
+                read++;
+            }
+        }
         
-        // Find dependent task in the list
-        for (int j = 0; j < scheduler->task_count; j++) {
-            if (scheduler->tasks[j].id == dep_id) {
-                found = true;
-                
-                // Check dependency status based on defined behavior
-                switch (task->dep_behavior) {
-                    case DEP_ANY_SUCCESS:
-                        if (scheduler->tasks[j].last_run_time > 0 && scheduler->tasks[j].exit_code == 0) {
-                            return true; // At least one task succeeded
-                        }
-                        break;
-                        
-                    case DEP_ALL_SUCCESS:
-                        if (scheduler->tasks[j].last_run_time <= 0 || scheduler->tasks[j].exit_code != 0) {
-                            return false; // Need all tasks to succeed
-                        }
-                        break;
-                        
-                    case DEP_ANY_COMPLETION:
-                        if (scheduler->tasks[j].last_run_time > 0) {
-                            return true; // At least one task completed
-                        }
-                        break;
-                        
-                    case DEP_ALL_COMPLETION:
-                        if (scheduler->tasks[j].last_run_time <= 0) {
-                            return false; // Need all tasks to complete
-                        }
-                        break;
-                        
-                    default:
-                        return false; // Undefined behavior
+        pthread_mutex_lock(&scheduler->lock);
+        
+        // A task that left memory since the rows were read may have been
+        // written again or deleted; one being deleted still has its row.
+        // Such a batch is dropped and its tasks load on demand.
+        if (scheduler->unloads == unloads && scheduler->deletes_pending == 0) {
+            for (int i = 0; i < read; i++) {
+                if (find_task_index(scheduler, batch[i].id) < 0 &&
+                    append_task(scheduler, &batch[i]) >= 0) {
+                    loaded++;
                 }
-                
-                break;
             }
         }
+        unloads = scheduler->unloads;
         
-        // If dependent task not found, dependency not satisfied
-        if (!found) {
-            return false;
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+    
+    if (loaded > 0) {
+        log_message(LOG_DEBUG, "Loaded %d tasks ahead of use", loaded);
+    }
+    
+    free(missing);
+    free(batch);
+}
+
+// Helper function to keep the resident set to the tasks due within the
+// window, up to the configured limit. Tasks coming due are loaded; idle
+// tasks whose rows are up to date are evicted once the limit is exceeded.
+// A task whose last write failed stays resident until a retry succeeds,
+// since memory then holds its only current copy.
+// Takes the scheduler lock itself, and not while reading the database.
+static void refresh_resident_tasks(Scheduler *scheduler, time_t now) {
+    pthread_mutex_lock(&scheduler->lock);
+    if (!scheduler->partial) {
+        if (scheduler->task_count <= scheduler->resident_max) {
+            pthread_mutex_unlock(&scheduler->lock);
+            return;
         }
+        // Grown past the limit since startup: every task is resident and
+        // the graph is seeded, so eviction can start from here
+        scheduler->partial = true;
     }
+    pthread_mutex_unlock(&scheduler->lock);
     
-    // If DEP_ALL_SUCCESS or DEP_ALL_COMPLETION and all checked, return true
-    if (task->dep_behavior == DEP_ALL_SUCCESS || task->dep_behavior == DEP_ALL_COMPLETION) {
-        return true;
+    time_t until = now + scheduler->resident_window;
+    
+    int *due_ids = NULL;
+    int due_count = 0;
+    if (db_get_due_task_ids(until, scheduler->resident_max, &due_ids, &due_count)) {
+        scheduler_page_in(scheduler, due_ids, due_count);
+        free(due_ids);
     }
     
-    // For DEP_ANY_SUCCESS or DEP_ANY_COMPLETION, if we get here, no task satisfied the condition
-    return false;
+    pthread_mutex_lock(&scheduler->lock);
+    int evicted = 0;
+    for (int i = scheduler->task_count - 1;
+         i >= 0 && scheduler->task_count > scheduler->resident_max; i--) {
+        const Task *task = &scheduler->tasks[i];
+        bool due_soon = task->enabled && task->next_run_time > 0 && task->next_run_time <= until;
+        if (!due_soon && persist_is_clean(&scheduler->persister, task->id)) {
+            remove_task_at(scheduler, i);
+            evicted++;
+        }
+    }
+    if (evicted > 0) {
+        log_message(LOG_DEBUG, "Evicted %d idle tasks, %d resident", evicted, scheduler->task_count);
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+// Helper function to fold a measured runtime into the task's average and the
+// dependency graph's finish times. Must be called with the scheduler lock held.
+static void record_runtime(Scheduler *scheduler, int idx, double seconds) {
+    Task *task = &scheduler->tasks[idx];
+    task_record_runtime(task, seconds);
+    depgraph_set_duration(&scheduler->deps, task->id, task->avg_runtime);
+}
+
+// Helper function to publish a task's last-run outcome to the dependency
+// graph's state bits. Must be called with the scheduler lock held.
+static void sync_task_state(Scheduler *scheduler, int idx) {
+    const Task *task = &scheduler->tasks[idx];
+    bool completed = task->last_run_time > 0;
+    depgraph_set_task_state(&scheduler->deps, task->id, completed,
+                            completed && task->exit_code == 0);
+}
+
+// Helper function to queue a history row for a finished command. Only
+// appends to the persister's queue, so it adds no I/O to the completion path.
+static void record_run(Scheduler *scheduler, int task_id, int run_id,
+                       const CommandResult *outcome, TaskRunTrigger trigger) {
+    if (outcome->start_time == 0) {
+        // No process was started
+        return;
+    }
+    
+    TaskRunRecord record;
+    record.task_id = task_id;
+    record.run_id = run_id;
+    record.trigger = trigger;
+    record.start_time = outcome->start_time;
+    record.end_time = outcome->end_time;
+    record.duration = outcome->duration;
+    record.exit_code = outcome->exit_code;
+    record.term_signal = outcome->term_signal;
+    record.timed_out = outcome->timed_out;
+    record.user_cpu = outcome->user_cpu;
+    record.sys_cpu = outcome->sys_cpu;
+    record.max_rss_kb = outcome->max_rss_kb;
+    record.memory_peak_kb = outcome->memory_peak_kb;
+    record.io_read_bytes = outcome->io_read_bytes;
+    record.io_write_bytes = outcome->io_write_bytes;
+    record.output = outcome->output;
+    record.error_output = outcome->error_output;
+    
+    // The persister keeps its own copy of the output
+    persist_record_run(&scheduler->persister, &record);
+}
+
+// Persistence callback: copy the current state of a task
+static bool load_task_for_persist(void *context, int task_id, Task *task) {
+    Scheduler *scheduler = (Scheduler *)context;
+    
+    pthread_mutex_lock(&scheduler->lock);
+    int idx = find_task_index(scheduler, task_id);
+    if (idx >= 0) {
+        *task = scheduler->tasks[idx];
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    
+    return idx >= 0;
+}
+
+// Helper function to order task indices by topological level (counting sort).
+// Must be called with the scheduler lock held; returns NULL on failure.
+static int* build_dispatch_order(Scheduler *scheduler) {
+    int count = scheduler->task_count;
+    int level_count = depgraph_get_level_count(&scheduler->deps);
+    if (level_count < 1) {
+        level_count = 1;
+    }
+    
+    int *order = (int*)malloc(sizeof(int) * (count > 0 ? count : 1));
+    int *offsets = (int*)calloc(level_count + 1, sizeof(int));
+    if (!order || !offsets) {
+        free(order);
+        free(offsets);
+        return NULL;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        offsets[depgraph_get_level(&scheduler->deps, scheduler->tasks[i].id) + 1]++;
+    }
+    for (int l = 0; l < level_count; l++) {
+        offsets[l + 1] += offsets[l];
+    }
+    for (int i = 0; i < count; i++) {
+        order[offsets[depgraph_get_level(&scheduler->deps, scheduler->tasks[i].id)]++] = i;
+    }
+    
+    free(offsets);
+    return order;
+}
+
+// Helper function to check if dependencies are satisfied. While a workflow
+// run contains the task, only upstream results of that run count, so an
+// earlier run's success cannot stand in for this one. Otherwise task states
+// live in the graph's bitsets (see sync_task_state), so this costs a few
+// word-wide reductions regardless of fan-in.
+static bool check_dependencies_satisfied(Scheduler *scheduler, const Task *task) {
+    bool satisfied = false;
+    if (workflow_dependencies_satisfied(scheduler, task->id, &satisfied)) {
+        return satisfied;
+    }
+    
+    switch (task->dep_behavior) {
+        case DEP_ALL_SUCCESS:
+            return depgraph_dependencies_satisfied(&scheduler->deps, task->id, true, true);
+        case DEP_ANY_SUCCESS:
+            return depgraph_dependencies_satisfied(&scheduler->deps, task->id, true, false);
+        case DEP_ALL_COMPLETION:
+            return depgraph_dependencies_satisfied(&scheduler->deps, task->id, false, true);
+        case DEP_ANY_COMPLETION:
+            return depgraph_dependencies_satisfied(&scheduler->deps, task->id, false, false);
+        default: {
+            // Undefined behavior is only satisfied by having no dependencies
+            int dep_count = 0;
+            depgraph_get_dependencies(&scheduler->deps, task->id, &dep_count);
+            return dep_count == 0;
+        }
+    }
 }
 
 // Helper function to execute a task with script mode
-static bool execute_task_with_script(Scheduler *scheduler, Task *task) {
+static bool execute_task_with_script(Scheduler *scheduler, Task *task, int run_id, int *exit_code_out) {
     if (!scheduler || !task || task->exec_mode != EXEC_SCRIPT) {
         return false;
     }
@@ -1017,15 +1671,13 @@ static bool execute_task_with_script(Scheduler *scheduler, Task *task) {
     // Log the start of script execution
     log_message(LOG_INFO, "Starting script execution for task %d (%s)", task->id, task->name);
     
-    // Create a temporary script file
-    char temp_script_path[512];
-    if (!task_prepare_script(task, temp_script_path, sizeof(temp_script_path))) {
+    // Open the script's in-memory image
+    ScriptImage image;
+    if (!task_open_script(task, &image)) {
         log_message(LOG_ERROR, "Failed to prepare script for task %d", task->id);
         return false;
     }
     
-    log_message(LOG_INFO, "Created temporary script file at: %s", temp_script_path);
-    
     // Copy important values from task as they may change during execution
     int task_id = task->id;
     char task_name[128];
@@ -1033,28 +1685,40 @@ static bool execute_task_with_script(Scheduler *scheduler, Task *task) {
     
     // Execute the script - do not hold the mutex during execution
     int exit_code = 0;
-    bool result = run_command_with_timeout(
-        temp_script_path,
+    CommandResult outcome;
+    double started = monotonic_seconds();
+    bool result = run_script_ex(
+        image.fd,
+        image.shebang,
         task->working_dir[0] ? task->working_dir : NULL,
         task->max_runtime,
-        &exit_code
+        task_id,
+        task->resource_limits,
+        &outcome
     );
+    exit_code = outcome.exit_code;
+    close(image.fd);
+    double elapsed = monotonic_seconds() - started;
     
     log_message(LOG_INFO, "Script execution completed with result=%d, exit_code=%d", result, exit_code);
+    *exit_code_out = exit_code;
+    record_run(scheduler, task_id, run_id, &outcome,
+               run_id > 0 ? RUN_TRIGGER_WORKFLOW : RUN_TRIGGER_MANUAL);
+    command_result_free(&outcome);
     
-    // Delete the temporary script file
-    if (unlink(temp_script_path) != 0) {
-        log_message(LOG_WARNING, "Failed to delete temporary script file: %s", temp_script_path);
-    }
-    
-    // Find the task again (it might have been removed)
-    int idx = find_task_index(scheduler, task_id);
+    // Find the task again (it might have been removed); workflow runs
+    // execute tasks in parallel, so the list must be locked here
+    pthread_mutex_lock(&scheduler->lock);
+    int idx = scheduler_resident_index(scheduler, task_id);
     if (idx >= 0) {
         // Update task execution status
         task_mark_executed(&scheduler->tasks[idx], exit_code);
+        scheduler->tasks[idx].last_run_id = run_id;
+        record_runtime(scheduler, idx, elapsed);
+        sync_task_state(scheduler, idx);
         
-        // Update in database
-        db_update_task(&scheduler->tasks[idx]);
+        // Only the run state changed: queue a status write
+        persist_mark_dirty(&scheduler->persister, task_id, PERSIST_STATUS);
         
         log_message(LOG_INFO, "Script task completed: ID=%d, Name=%s, Exit code=%d", 
                   task_id, task_name, exit_code);
@@ -1062,45 +1726,54 @@ static bool execute_task_with_script(Scheduler *scheduler, Task *task) {
         log_message(LOG_WARNING, "Task not found after script execution: ID=%d, Name=%s", 
                   task_id, task_name);
     }
+    pthread_mutex_unlock(&scheduler->lock);
     
     return result;
 }
 
 // Add a dependency between tasks
-bool scheduler_add_dependency(Scheduler *scheduler, int task_id, int dependency_id) {
+DepEdgeResult scheduler_add_dependency(Scheduler *scheduler, int task_id, int dependency_id) {
     if (!scheduler || task_id < 0 || dependency_id < 0) {
-        return false;
+        return DEP_EDGE_ERROR;
     }
     
     // Avoid circular dependency
     if (task_id == dependency_id) {
         log_message(LOG_ERROR, "Cannot add dependency: Task cannot depend on itself");
-        return false;
+        return DEP_EDGE_CYCLE;
     }
     
     pthread_mutex_lock(&scheduler->lock);
     
     // Find both tasks
-    int task_index = find_task_index(scheduler, task_id);
-    int dep_index = find_task_index(scheduler, dependency_id);
+    int task_index = scheduler_resident_index(scheduler, task_id);
+    int dep_index = scheduler_resident_index(scheduler, dependency_id);
     
     if (task_index < 0 || dep_index < 0) {
         pthread_mutex_unlock(&scheduler->lock);
         log_message(LOG_ERROR, "Cannot add dependency: One or both tasks not found");
-        return false;
+        return DEP_EDGE_NOT_FOUND;
     }
     
-    // Add the dependency
-    Task *task = &scheduler->tasks[task_index];
-    bool result = task_add_dependency(task, dependency_id);
+    // Add the dependency; the graph rejects edges that would close a cycle
+    DepEdgeResult result = depgraph_add_dependency(&scheduler->deps, task_id, dependency_id);
     
     pthread_mutex_unlock(&scheduler->lock);
     
+    if (result == DEP_EDGE_CYCLE) {
+        log_message(LOG_ERROR, "Cannot add dependency: Task %d already depends on Task %d "
+                   "directly or indirectly", dependency_id, task_id);
+        return result;
+    }
+    
     // Update in database if successful
-    if (result) {
-        if (!db_update_task(task)) {
+    if (result == DEP_EDGE_OK) {
+        if (!db_add_dependency(task_id, dependency_id)) {
             log_message(LOG_ERROR, "Failed to update task dependencies in database");
-            return false;
+            pthread_mutex_lock(&scheduler->lock);
+            depgraph_remove_dependency(&scheduler->deps, task_id, dependency_id);
+            pthread_mutex_unlock(&scheduler->lock);
+            return DEP_EDGE_ERROR;
         }
     }
     
@@ -1116,7 +1789,7 @@ bool scheduler_remove_dependency(Scheduler *scheduler, int task_id, int dependen
     pthread_mutex_lock(&scheduler->lock);
     
     // Find the task
-    int task_index = find_task_index(scheduler, task_id);
+    int task_index = scheduler_resident_index(scheduler, task_id);
     
     if (task_index < 0) {
         pthread_mutex_unlock(&scheduler->lock);
@@ -1125,14 +1798,13 @@ bool scheduler_remove_dependency(Scheduler *scheduler, int task_id, int dependen
     }
     
     // Remove the dependency
-    Task *task = &scheduler->tasks[task_index];
-    bool result = task_remove_dependency(task, dependency_id);
+    bool result = depgraph_remove_dependency(&scheduler->deps, task_id, dependency_id);
     
     pthread_mutex_unlock(&scheduler->lock);
     
     // Update in database if successful
     if (result) {
-        if (!db_update_task(task)) {
+        if (!db_remove_dependency(task_id, dependency_id)) {
             log_message(LOG_ERROR, "Failed to update task dependencies in database");
             return false;
         }
@@ -1141,6 +1813,37 @@ bool scheduler_remove_dependency(Scheduler *scheduler, int task_id, int dependen
     return result;
 }
 
+// Get a copy of the dependency list of a task
+int* scheduler_get_dependencies(Scheduler *scheduler, int task_id, int *count) {
+    if (count) {
+        *count = 0;
+    }
+    
+    if (!scheduler || !count) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&scheduler->lock);
+    
+    int dep_count = 0;
+    const int *deps = depgraph_get_dependencies(&scheduler->deps, task_id, &dep_count);
+    
+    int *result = NULL;
+    if (dep_count > 0) {
+        result = (int*)malloc(sizeof(int) * dep_count);
+        if (result) {
+            memcpy(result, deps, sizeof(int) * dep_count);
+            *count = dep_count;
+        } else {
+            log_message(LOG_ERROR, "Failed to allocate memory for dependency list");
+        }
+    }
+    
+    pthread_mutex_unlock(&scheduler->lock);
+    
+    return result;
+}
+
 // Set the task execution mode
 bool scheduler_set_exec_mode(Scheduler *scheduler, int task_id, TaskExecMode mode, 
                             const char *script_content, const char *ai_prompt, const char *system_metrics) {
@@ -1148,9 +1851,16 @@ bool scheduler_set_exec_mode(Scheduler *scheduler, int task_id, TaskExecMode mod
         return false;
     }
     
+    // Store the script body first, without holding the scheduler lock
+    char hash[SCRIPT_HASH_LENGTH + 1] = "";
+    if (mode == EXEC_SCRIPT && script_content &&
+        !script_store(script_content, strlen(script_content), hash)) {
+        return false;
+    }
+    
     pthread_mutex_lock(&scheduler->lock);
     
-    int index = find_task_index(scheduler, task_id);
+    int index = scheduler_resident_index(scheduler, task_id);
     if (index < 0) {
         pthread_mutex_unlock(&scheduler->lock);
         return false;
@@ -1161,14 +1871,14 @@ bool scheduler_set_exec_mode(Scheduler *scheduler, int task_id, TaskExecMode mod
     // Set the new execution mode
     task->exec_mode = mode;
     
-    // Clear script content and AI-related fields
-    task->script_content[0] = '\0';
+    // Clear script and AI-related fields
+    task->script_hash[0] = '\0';
     task->ai_prompt[0] = '\0';
     task->system_metrics[0] = '\0';
     
     // Set the appropriate content based on mode
     if (mode == EXEC_SCRIPT && script_content) {
-        safe_strcpy(task->script_content, script_content, sizeof(task->script_content));
+        safe_strcpy(task->script_hash, hash, sizeof(task->script_hash));
     } else if (mode == EXEC_AI_DYNAMIC) {
         if (ai_prompt) {
             safe_strcpy(task->ai_prompt, ai_prompt, sizeof(task->ai_prompt));
@@ -1178,14 +1888,30 @@ bool scheduler_set_exec_mode(Scheduler *scheduler, int task_id, TaskExecMode mod
         }
     }
     
-    pthread_mutex_unlock(&scheduler->lock);
+    // Queue the row for the persistence thread
+    persist_mark_dirty(&scheduler->persister, task_id, PERSIST_DEFINITION);
     
-    // Update the task in the database
-    if (!db_update_task(task)) {
-        log_message(LOG_ERROR, "Failed to update task in database after changing execution mode");
-        return false;
-    }
+    pthread_mutex_unlock(&scheduler->lock);
     
     log_message(LOG_INFO, "Changed execution mode of task %d to %d", task_id, mode);
     return true;
 } 
+
+bool scheduler_get_critical_path(Scheduler *scheduler, int task_id, DepCriticalPath *result) {
+    if (!scheduler || !result) {
+        return false;
+    }
+    
+    pthread_mutex_lock(&scheduler->lock);
+    
+    if (scheduler_resident_index(scheduler, task_id) < 0) {
+        log_message(LOG_ERROR, "Task not found: ID=%d", task_id);
+        pthread_mutex_unlock(&scheduler->lock);
+        return false;
+    }
+    
+    bool success = depgraph_get_critical_path(&scheduler->deps, task_id, result);
+    
+    pthread_mutex_unlock(&scheduler->lock);
+    return success;
+}
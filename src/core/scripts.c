@@ -0,0 +1,484 @@
+#include "../../include/scripts.h"
+#include "../../include/db.h"
+#include "../../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <openssl/evp.h>
+
+#define CACHE_BUCKETS 256
+
+// One decompressed body. Entries sit both in a hash bucket chain (keyed by
+// the first byte of the digest) and in the LRU list.
+typedef struct CacheEntry {
+    char hash[SCRIPT_HASH_LENGTH + 1];
+    char *content;
+    size_t length;
+    struct CacheEntry *chain;     // Next entry in the same bucket
+    struct CacheEntry *newer;     // LRU neighbours
+    struct CacheEntry *older;
+} CacheEntry;
+
+// One executable image, kept open for reuse
+typedef struct {
+    bool used;
+    char hash[SCRIPT_HASH_LENGTH + 1];
+    int fd;
+    bool shebang;
+    unsigned long last_used;      // Value of image_clock at the last use
+} ImageEntry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CacheEntry *buckets[CACHE_BUCKETS];
+static CacheEntry *newest = NULL;
+static CacheEntry *oldest = NULL;
+static size_t cache_bytes = 0;
+static size_t cache_limit = (size_t)SCRIPT_DEFAULT_CACHE_KB * 1024;
+static ImageEntry images[SCRIPT_IMAGE_SLOTS];
+static unsigned long image_clock = 0;
+
+// Helper functions
+static int bucket_of(const char *hash);
+static CacheEntry* cache_find(const char *hash);
+static void cache_unlink(CacheEntry *entry);
+static void cache_push_front(CacheEntry *entry);
+static void cache_evict(CacheEntry *entry);
+static void cache_trim(void);
+static void cache_put(const char *hash, const char *content, size_t length);
+static char* cache_get(const char *hash, size_t *length);
+static ImageEntry* image_find(const char *hash);
+static ImageEntry* image_slot(void);
+static bool image_dup(ImageEntry *entry, ScriptImage *image);
+static int image_create(const char *content, size_t length);
+
+void script_cache_init(int cache_kb) {
+    pthread_mutex_lock(&cache_lock);
+    cache_limit = cache_kb > 0 ? (size_t)cache_kb * 1024 : 0;
+    cache_trim();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void script_cache_clear(void) {
+    pthread_mutex_lock(&cache_lock);
+    while (oldest) {
+        cache_evict(oldest);
+    }
+    for (int i = 0; i < SCRIPT_IMAGE_SLOTS; i++) {
+        if (images[i].used) {
+            close(images[i].fd);
+            images[i].used = false;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+bool script_hash(const char *content, size_t length, char *hash) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+
+    if (!content || !hash ||
+        EVP_Digest(content, length, digest, &digest_length, EVP_sha256(), NULL) != 1 ||
+        digest_length * 2 != SCRIPT_HASH_LENGTH) {
+        log_message(LOG_ERROR, "Failed to hash script content");
+        return false;
+    }
+
+    static const char HEX[] = "0123456789abcdef";
+    for (unsigned int i = 0; i < digest_length; i++) {
+        hash[2 * i] = HEX[digest[i] >> 4];
+        hash[2 * i + 1] = HEX[digest[i] & 0x0f];
+    }
+    hash[SCRIPT_HASH_LENGTH] = '\0';
+    return true;
+}
+
+bool script_compress(const char *content, size_t length, unsigned char **blob, size_t *size) {
+    uLongf bound = compressBound((uLong)length);
+    unsigned char *out = (unsigned char*)malloc(bound > 0 ? bound : 1);
+    if (!out) {
+        log_message(LOG_ERROR, "Failed to allocate memory for script compression");
+        return false;
+    }
+
+    if (compress2(out, &bound, (const Bytef*)content, (uLong)length, Z_BEST_COMPRESSION) != Z_OK) {
+        log_message(LOG_ERROR, "Failed to compress script content");
+        free(out);
+        return false;
+    }
+
+    *blob = out;
+    *size = (size_t)bound;
+    return true;
+}
+
+char* script_decompress(const unsigned char *blob, size_t size, size_t raw_size) {
+    if (!blob || raw_size > SCRIPT_MAX_LENGTH) {
+        return NULL;
+    }
+
+    char *content = (char*)malloc(raw_size + 1);
+    if (!content) {
+        log_message(LOG_ERROR, "Failed to allocate memory for script content");
+        return NULL;
+    }
+
+    uLongf length = (uLongf)raw_size;
+    if (uncompress((Bytef*)content, &length, blob, (uLong)size) != Z_OK || length != raw_size) {
+        log_message(LOG_ERROR, "Stored script is corrupt");
+        free(content);
+        return NULL;
+    }
+
+    content[raw_size] = '\0';
+    return content;
+}
+
+bool script_store(const char *content, size_t length, char *hash) {
+    if (!content || !hash) {
+        return false;
+    }
+
+    if (length > SCRIPT_MAX_LENGTH) {
+        log_message(LOG_ERROR, "Script is too large: %zu bytes (limit %d)", length, SCRIPT_MAX_LENGTH);
+        return false;
+    }
+
+    if (!script_hash(content, length, hash)) {
+        return false;
+    }
+
+    // Always written: storing an existing body refreshes its timestamp, so
+    // it is not collected before the task that references it is saved
+    unsigned char *blob = NULL;
+    size_t size = 0;
+    if (!script_compress(content, length, &blob, &size)) {
+        return false;
+    }
+    bool success = db_save_script(hash, blob, size, length);
+    free(blob);
+
+    if (success) {
+        pthread_mutex_lock(&cache_lock);
+        cache_put(hash, content, length);
+        pthread_mutex_unlock(&cache_lock);
+    }
+    return success;
+}
+
+char* script_load(const char *hash, size_t *length) {
+    if (!hash || strlen(hash) != SCRIPT_HASH_LENGTH) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    char *content = cache_get(hash, length);
+    pthread_mutex_unlock(&cache_lock);
+    if (content) {
+        return content;
+    }
+
+    unsigned char *blob = NULL;
+    size_t size = 0;
+    size_t raw_size = 0;
+    if (!db_load_script(hash, &blob, &size, &raw_size)) {
+        log_message(LOG_ERROR, "Script not found: %s", hash);
+        return NULL;
+    }
+
+    content = script_decompress(blob, size, raw_size);
+    free(blob);
+    if (!content) {
+        return NULL;
+    }
+
+    // The address is the digest, so a damaged body cannot go unnoticed
+    char actual[SCRIPT_HASH_LENGTH + 1];
+    if (!script_hash(content, raw_size, actual) || strcmp(actual, hash) != 0) {
+        log_message(LOG_ERROR, "Stored script does not match its hash: %s", hash);
+        free(content);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    cache_put(hash, content, raw_size);
+    pthread_mutex_unlock(&cache_lock);
+
+    if (length) {
+        *length = raw_size;
+    }
+    return content;
+}
+
+bool script_size(const char *hash, size_t *length) {
+    if (!hash || !length || strlen(hash) != SCRIPT_HASH_LENGTH) {
+        return false;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    const CacheEntry *entry = cache_find(hash);
+    if (entry) {
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (entry) {
+        return true;
+    }
+
+    return db_get_script_size(hash, length);
+}
+
+bool script_image_open(const char *hash, ScriptImage *image) {
+    if (!hash || !image || strlen(hash) != SCRIPT_HASH_LENGTH) {
+        return false;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    ImageEntry *entry = image_find(hash);
+    bool success = entry && image_dup(entry, image);
+    pthread_mutex_unlock(&cache_lock);
+    if (entry) {
+        return success;
+    }
+
+    // Built without the lock: the body may have to come from the database
+    size_t length = 0;
+    char *content = script_load(hash, &length);
+    if (!content) {
+        return false;
+    }
+    bool shebang = length >= 2 && content[0] == '#' && content[1] == '!';
+    int fd = image_create(content, length);
+    free(content);
+    if (fd < 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    entry = image_find(hash);
+    if (entry) {
+        // Another thread built the same image meanwhile
+        close(fd);
+    } else {
+        entry = image_slot();
+        memcpy(entry->hash, hash, SCRIPT_HASH_LENGTH + 1);
+        entry->fd = fd;
+        entry->shebang = shebang;
+        entry->used = true;
+    }
+    success = image_dup(entry, image);
+    pthread_mutex_unlock(&cache_lock);
+    return success;
+}
+
+static int bucket_of(const char *hash) {
+    int value = 0;
+    for (int i = 0; i < 2; i++) {
+        char c = hash[i];
+        value = value * 16 + (c >= 'a' ? c - 'a' + 10 : c - '0');
+    }
+    return value & (CACHE_BUCKETS - 1);
+}
+
+static CacheEntry* cache_find(const char *hash) {
+    for (CacheEntry *entry = buckets[bucket_of(hash)]; entry; entry = entry->chain) {
+        if (memcmp(entry->hash, hash, SCRIPT_HASH_LENGTH) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void cache_unlink(CacheEntry *entry) {
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        newest = entry->older;
+    }
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        oldest = entry->newer;
+    }
+    entry->newer = NULL;
+    entry->older = NULL;
+}
+
+static void cache_push_front(CacheEntry *entry) {
+    entry->newer = NULL;
+    entry->older = newest;
+    if (newest) {
+        newest->newer = entry;
+    }
+    newest = entry;
+    if (!oldest) {
+        oldest = entry;
+    }
+}
+
+static void cache_evict(CacheEntry *entry) {
+    cache_unlink(entry);
+
+    CacheEntry **link = &buckets[bucket_of(entry->hash)];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+
+    cache_bytes -= entry->length;
+    free(entry->content);
+    free(entry);
+}
+
+// Drop the least recently used bodies until the cache fits its limit
+static void cache_trim(void) {
+    while (oldest && cache_bytes > cache_limit) {
+        cache_evict(oldest);
+    }
+}
+
+static void cache_put(const char *hash, const char *content, size_t length) {
+    CacheEntry *entry = cache_find(hash);
+    if (entry) {
+        cache_unlink(entry);
+        cache_push_front(entry);
+        return;
+    }
+
+    if (length > cache_limit) {
+        return;
+    }
+
+    entry = (CacheEntry*)malloc(sizeof(CacheEntry));
+    char *copy = (char*)malloc(length + 1);
+    if (!entry || !copy) {
+        // The cache is an optimization; go without it
+        free(entry);
+        free(copy);
+        return;
+    }
+
+    memcpy(copy, content, length);
+    copy[length] = '\0';
+    memcpy(entry->hash, hash, SCRIPT_HASH_LENGTH + 1);
+    entry->content = copy;
+    entry->length = length;
+
+    int bucket = bucket_of(hash);
+    entry->chain = buckets[bucket];
+    buckets[bucket] = entry;
+    cache_push_front(entry);
+
+    cache_bytes += length;
+    cache_trim();
+}
+
+// Copy a cached body out (caller must free), NULL on a miss
+static char* cache_get(const char *hash, size_t *length) {
+    CacheEntry *entry = cache_find(hash);
+    if (!entry) {
+        return NULL;
+    }
+
+    char *copy = (char*)malloc(entry->length + 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, entry->content, entry->length + 1);
+
+    cache_unlink(entry);
+    cache_push_front(entry);
+
+    if (length) {
+        *length = entry->length;
+    }
+    return copy;
+}
+
+static ImageEntry* image_find(const char *hash) {
+    for (int i = 0; i < SCRIPT_IMAGE_SLOTS; i++) {
+        if (images[i].used && memcmp(images[i].hash, hash, SCRIPT_HASH_LENGTH) == 0) {
+            return &images[i];
+        }
+    }
+    return NULL;
+}
+
+// A free slot, or the least recently used image closed to make one
+static ImageEntry* image_slot(void) {
+    ImageEntry *victim = &images[0];
+    for (int i = 0; i < SCRIPT_IMAGE_SLOTS; i++) {
+        if (!images[i].used) {
+            return &images[i];
+        }
+        if (images[i].last_used < victim->last_used) {
+            victim = &images[i];
+        }
+    }
+
+    close(victim->fd);
+    victim->used = false;
+    return victim;
+}
+
+// Hand out a descriptor of the caller's own, so eviction cannot close it
+// while the script is being started
+static bool image_dup(ImageEntry *entry, ScriptImage *image) {
+    image->fd = fcntl(entry->fd, F_DUPFD_CLOEXEC, 0);
+    image->shebang = entry->shebang;
+    entry->last_used = ++image_clock;
+
+    if (image->fd < 0) {
+        log_message(LOG_ERROR, "Failed to open script image %s: %s", entry->hash, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Write a body into a new memfd and seal it against any change
+static int image_create(const char *content, size_t length) {
+    unsigned int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+#ifdef MFD_EXEC
+    // Kernels with vm.memfd_noexec default to non-executable memfds
+    flags |= MFD_EXEC;
+#endif
+
+    int fd = memfd_create("taskscript", flags);
+#ifdef MFD_EXEC
+    if (fd < 0 && errno == EINVAL) {
+        // Older kernel that does not know MFD_EXEC
+        fd = memfd_create("taskscript", flags & ~MFD_EXEC);
+    }
+#endif
+    if (fd < 0) {
+        log_message(LOG_ERROR, "Failed to create script image: %s", strerror(errno));
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(fd, content + written, length - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            log_message(LOG_ERROR, "Failed to write script image: %s", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        written += (size_t)n;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        log_message(LOG_ERROR, "Failed to seal script image: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
@@ -9,6 +9,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+// Weight of the newest sample in the runtime average
+#define RUNTIME_EWMA_WEIGHT 0.3
+
 // Hàm mới để xác định nếu một giá trị nằm trong biểu thức cron field
 // Xử lý cả số cụ thể, khoảng (1-5), danh sách (1,3,5), bước nhảy (*/2, 1-10/2)
 static bool is_matching_cron_field(const char *field_expr, int value) {
@@ -233,7 +236,6 @@ bool task_init(Task *task) {
     task->exit_code = 0;
     task->max_runtime = 0; // No limit
     task->exec_mode = EXEC_COMMAND; // Default to command execution
-    task->dependency_count = 0;
     task->dep_behavior = DEP_ALL_SUCCESS; // Default behavior
     
     return true;
@@ -463,99 +465,95 @@ bool task_mark_executed(Task *task, int exit_code) {
     return result;
 }
 
-bool task_add_dependency(Task *task, int dependency_id) {
-    if (!task || dependency_id < 0) {
-        return false;
+void task_record_runtime(Task *task, double seconds) {
+    if (!task || seconds < 0) {
+        return;
     }
     
-    // Check if already at max dependencies
-    if (task->dependency_count >= MAX_DEPENDENCIES) {
-        log_message(LOG_ERROR, "Cannot add dependency: Maximum number of dependencies reached");
-        return false;
-    }
-    
-    // Check if dependency already exists
-    for (int i = 0; i < task->dependency_count; i++) {
-        if (task->dependencies[i] == dependency_id) {
-            // Already exists, not an error
-            return true;
-        }
+    // The first sample seeds the average; later ones are blended in
+    if (task->avg_runtime <= 0) {
+        task->avg_runtime = seconds;
+    } else {
+        task->avg_runtime = RUNTIME_EWMA_WEIGHT * seconds +
+                            (1.0 - RUNTIME_EWMA_WEIGHT) * task->avg_runtime;
     }
-    
-    // Check for circular dependency (simple case: direct circular)
-    if (task->id == dependency_id) {
-        log_message(LOG_ERROR, "Cannot add dependency: Task cannot depend on itself");
+}
+
+bool task_same_definition(const Task *a, const Task *b) {
+    if (!a || !b) {
         return false;
     }
     
-    // Add the dependency
-    task->dependencies[task->dependency_count++] = dependency_id;
-    log_message(LOG_INFO, "Added dependency: Task %d now depends on Task %d", 
-               task->id, dependency_id);
-    
-    return true;
+    // Scalars first, so most differences are found before any string compare
+    return a->id == b->id &&
+           a->exec_mode == b->exec_mode &&
+           a->creation_time == b->creation_time &&
+           a->frequency == b->frequency &&
+           a->interval == b->interval &&
+           a->enabled == b->enabled &&
+           a->max_runtime == b->max_runtime &&
+           a->dep_behavior == b->dep_behavior &&
+           a->schedule_type == b->schedule_type &&
+           strcmp(a->name, b->name) == 0 &&
+           strcmp(a->command, b->command) == 0 &&
+           strcmp(a->working_dir, b->working_dir) == 0 &&
+           strcmp(a->resource_limits, b->resource_limits) == 0 &&
+           strcmp(a->cron_expression, b->cron_expression) == 0 &&
+           strcmp(a->system_metrics, b->system_metrics) == 0 &&
+           strcmp(a->ai_prompt, b->ai_prompt) == 0 &&
+           strcmp(a->script_hash, b->script_hash) == 0;
 }
 
-bool task_remove_dependency(Task *task, int dependency_id) {
+bool task_validate(const Task *task) {
     if (!task) {
         return false;
     }
     
-    // Find the dependency
-    int found = -1;
-    for (int i = 0; i < task->dependency_count; i++) {
-        if (task->dependencies[i] == dependency_id) {
-            found = i;
-            break;
-        }
+    const char *problem = NULL;
+    char fields[5][32];
+    
+    if (task->name[0] == '\0') {
+        problem = "name is required";
+    } else if (task->exec_mode == EXEC_COMMAND && task->command[0] == '\0') {
+        problem = "command is required for command-mode tasks";
+    } else if (task->exec_mode == EXEC_SCRIPT && strlen(task->script_hash) != SCRIPT_HASH_LENGTH) {
+        problem = "script is required for script-mode tasks";
+    } else if (task->exec_mode == EXEC_AI_DYNAMIC && task->ai_prompt[0] == '\0') {
+        problem = "AI prompt is required for AI-dynamic tasks";
+    } else if ((int)task->exec_mode < EXEC_COMMAND || (int)task->exec_mode > EXEC_AI_DYNAMIC) {
+        problem = "unknown execution mode";
+    } else if (task->schedule_type == SCHEDULE_INTERVAL && task->interval <= 0) {
+        problem = "interval must be positive";
+    } else if (task->schedule_type == SCHEDULE_CRON &&
+               sscanf(task->cron_expression, "%31s %31s %31s %31s %31s",
+                      fields[0], fields[1], fields[2], fields[3], fields[4]) != 5) {
+        problem = "cron expression needs 5 fields";
+    } else if ((int)task->schedule_type < SCHEDULE_MANUAL || (int)task->schedule_type > SCHEDULE_CRON) {
+        problem = "unknown schedule type";
+    } else if ((int)task->frequency < ONCE || (int)task->frequency > CUSTOM) {
+        problem = "unknown frequency";
+    } else if ((int)task->dep_behavior < DEP_ANY_SUCCESS || (int)task->dep_behavior > DEP_ALL_COMPLETION) {
+        problem = "unknown dependency behavior";
+    } else if (task->max_runtime < 0) {
+        problem = "max runtime cannot be negative";
     }
     
-    if (found < 0) {
-        // Dependency not found
+    if (problem) {
+        log_message(LOG_ERROR, "Invalid task '%s': %s", task->name, problem);
         return false;
     }
-    
-    // Remove by shifting remaining dependencies
-    for (int i = found; i < task->dependency_count - 1; i++) {
-        task->dependencies[i] = task->dependencies[i + 1];
-    }
-    
-    task->dependency_count--;
-    log_message(LOG_INFO, "Removed dependency: Task %d no longer depends on Task %d", 
-               task->id, dependency_id);
-    
     return true;
 }
 
-bool task_prepare_script(Task *task, char *temp_path, size_t temp_path_size) {
-    if (!task || !temp_path || temp_path_size == 0 || 
-        task->exec_mode != EXEC_SCRIPT || task->script_content[0] == '\0') {
+bool task_open_script(const Task *task, ScriptImage *image) {
+    if (!task || !image || task->exec_mode != EXEC_SCRIPT || task->script_hash[0] == '\0') {
         return false;
     }
     
-    // Create a temporary file for the script
-    char template[] = "/tmp/taskscript_XXXXXX";
-    int fd = mkstemp(template);
-    if (fd == -1) {
-        log_message(LOG_ERROR, "Failed to create temporary script file");
+    if (!script_image_open(task->script_hash, image)) {
+        log_message(LOG_ERROR, "Failed to load script for task %d", task->id);
         return false;
     }
     
-    // Make the script executable
-    fchmod(fd, 0755);
-    
-    // Write the script content to the file
-    if (write(fd, task->script_content, strlen(task->script_content)) == -1) {
-        log_message(LOG_ERROR, "Failed to write script content to temporary file");
-        close(fd);
-        unlink(template);
-        return false;
-    }
-    
-    close(fd);
-    
-    // Copy the path to the output buffer
-    safe_strcpy(temp_path, template, temp_path_size);
-    
     return true;
 } 
@@ -0,0 +1,611 @@
+#include "../../include/workflow.h"
+#include "../../include/utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Outcome of evaluating a pending node against its upstream results
+typedef enum {
+    NODE_WAIT,
+    NODE_READY,
+    NODE_SKIP
+} NodeDecision;
+
+// Argument of an executor job running one node
+typedef struct {
+    WorkflowRun *run;
+    int index;
+} WorkflowNodeJob;
+
+// Helper functions
+static WorkflowRun* workflow_create(Scheduler *scheduler, int task_id);
+static void workflow_free(WorkflowRun *run);
+static int find_node(const WorkflowRun *run, int task_id);
+static NodeDecision node_decide(const WorkflowNode *node);
+static void workflow_submit(WorkflowRun *run, int index);
+static void workflow_node_job(void *arg);
+static void workflow_node_done(WorkflowRun *run, int index, WorkflowNodeState state);
+static void workflow_persist(WorkflowRun *run);
+static void workflow_release(WorkflowRun *run);
+static void sort_nodes_by_id(const WorkflowRun *run, int *indices);
+static int compare_ints(const void *a, const void *b);
+
+int workflow_start(Scheduler *scheduler, int task_id) {
+    if (!scheduler || task_id < 0) {
+        return -1;
+    }
+
+    WorkflowRun *run = workflow_create(scheduler, task_id);
+    if (!run) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&scheduler->workflow_lock);
+
+    // Only one run at a time for a group of connected tasks
+    for (WorkflowRun *active = scheduler->workflows; active; active = active->next) {
+        if (bsearch(&task_id, active->sorted_ids, active->node_count,
+                    sizeof(int), compare_ints) != NULL) {
+            pthread_mutex_unlock(&scheduler->workflow_lock);
+            log_message(LOG_INFO, "Workflow run %d already active for task %d", active->run_id, task_id);
+            workflow_free(run);
+            return 0;
+        }
+    }
+
+    // Run IDs come from the shared counter, so they are unique across
+    // processes as well
+    run->run_id = idalloc_next(&scheduler->run_ids);
+    if (run->run_id < 0) {
+        pthread_mutex_unlock(&scheduler->workflow_lock);
+        log_message(LOG_ERROR, "Failed to allocate a workflow run ID");
+        workflow_free(run);
+        return -1;
+    }
+    workflow_persist(run);
+
+    run->next = scheduler->workflows;
+    scheduler->workflows = run;
+
+    pthread_mutex_unlock(&scheduler->workflow_lock);
+
+    int run_id = run->run_id;
+    log_message(LOG_INFO, "Workflow run %d started from task %d with %d tasks",
+               run_id, task_id, run->node_count);
+
+    // Start every node without upstream tasks; the starter holds a
+    // reference until all of them are queued
+    for (int i = 0; i < run->node_count; i++) {
+        if (run->nodes[i].dep_count == 0) {
+            pthread_mutex_lock(&run->lock);
+            run->nodes[i].state = WF_NODE_RUNNING;
+            run->version++;
+            pthread_mutex_unlock(&run->lock);
+            workflow_submit(run, i);
+        }
+    }
+
+    workflow_release(run);
+    return run_id;
+}
+
+bool workflow_is_active(Scheduler *scheduler, int task_id) {
+    if (!scheduler) {
+        return false;
+    }
+
+    bool active = false;
+
+    pthread_mutex_lock(&scheduler->workflow_lock);
+    for (WorkflowRun *run = scheduler->workflows; run; run = run->next) {
+        if (bsearch(&task_id, run->sorted_ids, run->node_count, sizeof(int), compare_ints) != NULL) {
+            active = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&scheduler->workflow_lock);
+
+    return active;
+}
+
+bool workflow_dependencies_satisfied(Scheduler *scheduler, int task_id, bool *satisfied) {
+    if (!scheduler || !satisfied) {
+        return false;
+    }
+
+    bool found = false;
+
+    pthread_mutex_lock(&scheduler->workflow_lock);
+    for (WorkflowRun *run = scheduler->workflows; run && !found; run = run->next) {
+        int index = find_node(run, task_id);
+        if (index < 0) {
+            continue;
+        }
+
+        // Tasks without upstream tasks in the run start it, so they are ready
+        pthread_mutex_lock(&run->lock);
+        const WorkflowNode *node = &run->nodes[index];
+        *satisfied = node->dep_count == 0 || node_decide(node) == NODE_READY;
+        pthread_mutex_unlock(&run->lock);
+        found = true;
+    }
+    pthread_mutex_unlock(&scheduler->workflow_lock);
+
+    return found;
+}
+
+void workflow_wait(Scheduler *scheduler, int run_id) {
+    if (!scheduler || run_id <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&scheduler->workflow_lock);
+    for (;;) {
+        bool found = false;
+        for (WorkflowRun *run = scheduler->workflows; run; run = run->next) {
+            if (run->run_id == run_id) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            break;
+        }
+        pthread_cond_wait(&scheduler->workflow_done, &scheduler->workflow_lock);
+    }
+    pthread_mutex_unlock(&scheduler->workflow_lock);
+}
+
+const char* workflow_node_state_name(WorkflowNodeState state) {
+    switch (state) {
+        case WF_NODE_PENDING:
+            return "Pending";
+        case WF_NODE_RUNNING:
+            return "Running";
+        case WF_NODE_SUCCEEDED:
+            return "Succeeded";
+        case WF_NODE_FAILED:
+            return "Failed";
+        case WF_NODE_SKIPPED:
+            return "Skipped";
+        default:
+            return "Unknown";
+    }
+}
+
+const char* workflow_run_status_name(WorkflowRunStatus status) {
+    switch (status) {
+        case WF_RUN_RUNNING:
+            return "Running";
+        case WF_RUN_SUCCEEDED:
+            return "Succeeded";
+        case WF_RUN_FAILED:
+            return "Failed";
+        default:
+            return "Unknown";
+    }
+}
+
+// Helper function to snapshot the connected tasks and their edges
+static WorkflowRun* workflow_create(Scheduler *scheduler, int task_id) {
+    WorkflowRun *run = (WorkflowRun*)calloc(1, sizeof(WorkflowRun));
+    if (!run) {
+        log_message(LOG_ERROR, "Failed to allocate memory for workflow run");
+        return NULL;
+    }
+
+    run->scheduler = scheduler;
+    run->root_task_id = task_id;
+    run->start_time = time(NULL);
+    run->status = WF_RUN_RUNNING;
+    run->active_jobs = 1;
+    pthread_mutex_init(&run->lock, NULL);
+    pthread_mutex_init(&run->persist_lock, NULL);
+
+    // Every task of the run is about to execute: load those not in memory
+    // first, so the snapshot below does not read the database under the lock
+    int *ids = NULL;
+    int count = 0;
+    pthread_mutex_lock(&scheduler->lock);
+    bool prefetch = scheduler->partial &&
+                    depgraph_get_component(&scheduler->deps, task_id, &ids, &count);
+    pthread_mutex_unlock(&scheduler->lock);
+    if (prefetch) {
+        scheduler_page_in(scheduler, ids, count);
+        free(ids);
+        ids = NULL;
+    }
+
+    pthread_mutex_lock(&scheduler->lock);
+
+    if (!depgraph_get_component(&scheduler->deps, task_id, &ids, &count)) {
+        pthread_mutex_unlock(&scheduler->lock);
+        workflow_free(run);
+        return NULL;
+    }
+
+    run->nodes = (WorkflowNode*)calloc(count, sizeof(WorkflowNode));
+    run->sorted_ids = (int*)malloc(sizeof(int) * count);
+    run->sorted_nodes = (int*)malloc(sizeof(int) * count);
+    run->down_offsets = (int*)calloc(count + 1, sizeof(int));
+    if (!run->nodes || !run->sorted_ids || !run->sorted_nodes || !run->down_offsets) {
+        pthread_mutex_unlock(&scheduler->lock);
+        log_message(LOG_ERROR, "Failed to allocate memory for workflow run");
+        free(ids);
+        workflow_free(run);
+        return NULL;
+    }
+    run->node_count = count;
+    run->remaining = count;
+
+    for (int i = 0; i < count; i++) {
+        run->nodes[i].task_id = ids[i];
+        run->nodes[i].behavior = DEP_ALL_SUCCESS;
+        run->nodes[i].state = WF_NODE_PENDING;
+        // Reuse ids as the list of node indices to sort by task ID
+        ids[i] = i;
+    }
+    sort_nodes_by_id(run, ids);
+    for (int i = 0; i < count; i++) {
+        run->sorted_nodes[i] = ids[i];
+        run->sorted_ids[i] = run->nodes[ids[i]].task_id;
+    }
+    free(ids);
+
+    // Snapshot the dependency behavior of each task; one that left memory
+    // since it was loaded above is loaded again here
+    for (int i = 0; i < count; i++) {
+        int index = scheduler_resident_index(scheduler, run->nodes[i].task_id);
+        if (index >= 0) {
+            run->nodes[i].behavior = scheduler->tasks[index].dep_behavior;
+        }
+    }
+
+    // Build the dependent lists as node indices
+    int edge_count = 0;
+    for (int i = 0; i < count; i++) {
+        int n = 0;
+        depgraph_get_dependencies(&scheduler->deps, run->nodes[i].task_id, &n);
+        run->nodes[i].dep_count = n;
+        edge_count += n;
+    }
+
+    run->down_targets = (int*)malloc(sizeof(int) * (edge_count > 0 ? edge_count : 1));
+    if (!run->down_targets) {
+        pthread_mutex_unlock(&scheduler->lock);
+        log_message(LOG_ERROR, "Failed to allocate memory for workflow run");
+        workflow_free(run);
+        return NULL;
+    }
+
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+        run->down_offsets[i] = next;
+        int n = 0;
+        const int *dependents = depgraph_get_dependents(&scheduler->deps, run->nodes[i].task_id, &n);
+        for (int j = 0; j < n; j++) {
+            int node = find_node(run, dependents[j]);
+            if (node >= 0) {
+                run->down_targets[next++] = node;
+            }
+        }
+    }
+    run->down_offsets[count] = next;
+
+    pthread_mutex_unlock(&scheduler->lock);
+
+    return run;
+}
+
+static void workflow_free(WorkflowRun *run) {
+    if (!run) {
+        return;
+    }
+
+    pthread_mutex_destroy(&run->lock);
+    pthread_mutex_destroy(&run->persist_lock);
+    free(run->nodes);
+    free(run->sorted_ids);
+    free(run->sorted_nodes);
+    free(run->down_offsets);
+    free(run->down_targets);
+    free(run);
+}
+
+// Binary search for a task ID; returns its node index or -1
+static int find_node(const WorkflowRun *run, int task_id) {
+    int lo = 0;
+    int hi = run->node_count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (run->sorted_ids[mid] < task_id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < run->node_count && run->sorted_ids[lo] == task_id) {
+        return run->sorted_nodes[lo];
+    }
+    return -1;
+}
+
+// Decide whether a pending node can start, must be skipped, or must wait
+static NodeDecision node_decide(const WorkflowNode *node) {
+    switch (node->behavior) {
+        case DEP_ANY_SUCCESS:
+            if (node->succeeded > 0) {
+                return NODE_READY;
+            }
+            return node->finished == node->dep_count ? NODE_SKIP : NODE_WAIT;
+
+        case DEP_ALL_SUCCESS:
+            if (node->succeeded == node->dep_count) {
+                return NODE_READY;
+            }
+            return node->finished > node->succeeded ? NODE_SKIP : NODE_WAIT;
+
+        case DEP_ANY_COMPLETION:
+            if (node->completed > 0) {
+                return NODE_READY;
+            }
+            return node->finished == node->dep_count ? NODE_SKIP : NODE_WAIT;
+
+        case DEP_ALL_COMPLETION:
+            if (node->finished < node->dep_count) {
+                return NODE_WAIT;
+            }
+            return node->completed == node->dep_count ? NODE_READY : NODE_SKIP;
+
+        default:
+            return NODE_SKIP;
+    }
+}
+
+// Queue a node (already marked running) on the executor
+static void workflow_submit(WorkflowRun *run, int index) {
+    WorkflowNodeJob *job = (WorkflowNodeJob*)malloc(sizeof(WorkflowNodeJob));
+
+    pthread_mutex_lock(&run->lock);
+    run->active_jobs++;
+    pthread_mutex_unlock(&run->lock);
+
+    if (job) {
+        job->run = run;
+        job->index = index;
+        if (executor_submit(&run->scheduler->executor, workflow_node_job, job)) {
+            return;
+        }
+        free(job);
+    }
+
+    log_message(LOG_ERROR, "Failed to queue task %d of workflow run %d",
+               run->nodes[index].task_id, run->run_id);
+    workflow_node_done(run, index, WF_NODE_FAILED);
+}
+
+// Executor job: run one task of the workflow
+static void workflow_node_job(void *arg) {
+    WorkflowNodeJob *job = (WorkflowNodeJob *)arg;
+    WorkflowRun *run = job->run;
+    int index = job->index;
+    free(job);
+
+    int task_id = run->nodes[index].task_id;
+    WorkflowNodeState state = WF_NODE_FAILED;
+
+    Task *task = scheduler_get_task(run->scheduler, task_id);
+    if (!task || !task->enabled) {
+        log_message(LOG_INFO, "Workflow run %d: skipping task %d (%s)", run->run_id, task_id,
+                   task ? "disabled" : "not found");
+        state = WF_NODE_SKIPPED;
+    } else {
+        int exit_code = -1;
+        if (scheduler_execute_task_in_run(run->scheduler, task_id, run->run_id, &exit_code) &&
+            exit_code == 0) {
+            state = WF_NODE_SUCCEEDED;
+        }
+    }
+    free(task);
+
+    workflow_node_done(run, index, state);
+}
+
+// Record a node's final state, start or skip its dependents, and release
+// the reference held by the job
+static void workflow_node_done(WorkflowRun *run, int index, WorkflowNodeState state) {
+    int *stack = (int*)malloc(sizeof(int) * run->node_count);
+    int *ready = (int*)malloc(sizeof(int) * run->node_count);
+    int ready_count = 0;
+
+    pthread_mutex_lock(&run->lock);
+
+    run->nodes[index].state = state;
+    run->remaining--;
+
+    // Propagate through the dependents; skips cascade transitively
+    int top = 0;
+    if (stack && ready) {
+        stack[top++] = index;
+    }
+    while (top > 0) {
+        int node = stack[--top];
+        unsigned char node_state = run->nodes[node].state;
+
+        for (int i = run->down_offsets[node]; i < run->down_offsets[node + 1]; i++) {
+            WorkflowNode *dependent = &run->nodes[run->down_targets[i]];
+
+            dependent->finished++;
+            if (node_state == WF_NODE_SUCCEEDED) {
+                dependent->succeeded++;
+            }
+            if (node_state == WF_NODE_SUCCEEDED || node_state == WF_NODE_FAILED) {
+                dependent->completed++;
+            }
+
+            if (dependent->state != WF_NODE_PENDING) {
+                continue;
+            }
+
+            NodeDecision decision = node_decide(dependent);
+            if (decision == NODE_READY) {
+                dependent->state = WF_NODE_RUNNING;
+                ready[ready_count++] = run->down_targets[i];
+            } else if (decision == NODE_SKIP) {
+                dependent->state = WF_NODE_SKIPPED;
+                run->remaining--;
+                stack[top++] = run->down_targets[i];
+            }
+        }
+    }
+
+    if (!stack || !ready) {
+        // Cannot make progress without scratch memory: fail what is left
+        log_message(LOG_ERROR, "Failed to allocate memory for workflow run %d", run->run_id);
+        for (int i = 0; i < run->node_count; i++) {
+            if (run->nodes[i].state == WF_NODE_PENDING) {
+                run->nodes[i].state = WF_NODE_FAILED;
+                run->remaining--;
+            }
+        }
+    }
+
+    if (run->remaining == 0) {
+        run->end_time = time(NULL);
+        run->status = WF_RUN_SUCCEEDED;
+        for (int i = 0; i < run->node_count; i++) {
+            if (run->nodes[i].state != WF_NODE_SUCCEEDED) {
+                run->status = WF_RUN_FAILED;
+                break;
+            }
+        }
+        log_message(LOG_INFO, "Workflow run %d finished: %s", run->run_id,
+                   workflow_run_status_name(run->status));
+    }
+    run->version++;
+
+    pthread_mutex_unlock(&run->lock);
+
+    for (int i = 0; i < ready_count; i++) {
+        workflow_submit(run, ready[i]);
+    }
+    free(stack);
+    free(ready);
+
+    workflow_persist(run);
+    workflow_release(run);
+}
+
+// Write the run record if it changed since the last write
+static void workflow_persist(WorkflowRun *run) {
+    pthread_mutex_lock(&run->persist_lock);
+
+    unsigned char *states = (unsigned char*)malloc(run->node_count > 0 ? run->node_count : 1);
+    int *task_ids = (int*)malloc(sizeof(int) * (run->node_count > 0 ? run->node_count : 1));
+    if (!states || !task_ids) {
+        log_message(LOG_ERROR, "Failed to allocate memory for workflow run record");
+        free(states);
+        free(task_ids);
+        pthread_mutex_unlock(&run->persist_lock);
+        return;
+    }
+
+    WorkflowRunRecord record;
+    pthread_mutex_lock(&run->lock);
+    int version = run->version;
+    record.run_id = run->run_id;
+    record.root_task_id = run->root_task_id;
+    record.start_time = run->start_time;
+    record.end_time = run->end_time;
+    record.status = run->status;
+    record.node_count = run->node_count;
+    for (int i = 0; i < run->node_count; i++) {
+        task_ids[i] = run->nodes[i].task_id;
+        states[i] = run->nodes[i].state;
+    }
+    pthread_mutex_unlock(&run->lock);
+
+    record.task_ids = task_ids;
+    record.node_states = states;
+
+    // Writes are serialized, so an older snapshot never overwrites a newer one
+    if (version > run->persisted_version || run->persisted_version == 0) {
+        if (db_save_workflow_run(&record)) {
+            run->persisted_version = version > 0 ? version : 1;
+        }
+    }
+
+    free(states);
+    free(task_ids);
+    pthread_mutex_unlock(&run->persist_lock);
+}
+
+// Drop one reference; the last one out of a finished run frees it
+static void workflow_release(WorkflowRun *run) {
+    pthread_mutex_lock(&run->lock);
+    run->active_jobs--;
+    bool finished = run->active_jobs == 0 && run->remaining == 0;
+    pthread_mutex_unlock(&run->lock);
+
+    if (!finished) {
+        return;
+    }
+
+    // Make sure the final state is on disk before the run disappears
+    workflow_persist(run);
+
+    Scheduler *scheduler = run->scheduler;
+    pthread_mutex_lock(&scheduler->workflow_lock);
+    WorkflowRun **link = &scheduler->workflows;
+    while (*link && *link != run) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = run->next;
+    }
+    pthread_cond_broadcast(&scheduler->workflow_done);
+    pthread_mutex_unlock(&scheduler->workflow_lock);
+
+    workflow_free(run);
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Sort node indices by task ID (heapsort, no allocation)
+static void sort_nodes_by_id(const WorkflowRun *run, int *indices) {
+    int n = run->node_count;
+
+    for (int end = n; end > 1; end--) {
+        // Build the heap on the first pass, then restore it after each swap
+        int start = end == n ? n / 2 - 1 : 0;
+        for (int root = start; root >= 0; root--) {
+            int parent = root;
+            for (;;) {
+                int child = 2 * parent + 1;
+                if (child >= end) {
+                    break;
+                }
+                if (child + 1 < end &&
+                    run->nodes[indices[child + 1]].task_id > run->nodes[indices[child]].task_id) {
+                    child++;
+                }
+                if (run->nodes[indices[parent]].task_id >= run->nodes[indices[child]].task_id) {
+                    break;
+                }
+                int tmp = indices[parent];
+                indices[parent] = indices[child];
+                indices[child] = tmp;
+                parent = child;
+            }
+        }
+
+        int tmp = indices[0];
+        indices[0] = indices[end - 1];
+        indices[end - 1] = tmp;
+    }
+}
@@ -1,601 +1,422 @@
 #include "../../include/db.h"
+#include "../../include/storage.h"
 #include "../../include/utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-
-// Global database connection
-static sqlite3 *db = NULL;
-
-// SQL statements
-static const char *CREATE_TABLE_SQL =
-    "CREATE TABLE IF NOT EXISTS tasks ("
-    "id INTEGER PRIMARY KEY, "
-    "name TEXT NOT NULL, "
-    "command TEXT NOT NULL, "
-    "creation_time INTEGER NOT NULL, "
-    "next_run_time INTEGER, "
-    "last_run_time INTEGER, "
-    "frequency INTEGER NOT NULL, "
-    "interval INTEGER, "
-    "enabled INTEGER NOT NULL, "
-    "exit_code INTEGER, "
-    "max_runtime INTEGER, "
-    "working_dir TEXT, "
-    "exec_mode INTEGER NOT NULL DEFAULT 0, "
-    "script_content TEXT, "
-    "dep_behavior INTEGER NOT NULL DEFAULT 0, "
-    "schedule_type INTEGER NOT NULL DEFAULT 0, "
-    "cron_expression TEXT, "
-    "ai_prompt TEXT, "
-    "system_metrics TEXT"
-    ");"
-    
-    "CREATE TABLE IF NOT EXISTS dependencies ("
-    "task_id INTEGER, "
-    "depends_on INTEGER, "
-    "PRIMARY KEY (task_id, depends_on), "
-    "FOREIGN KEY (task_id) REFERENCES tasks(id) ON DELETE CASCADE, "
-    "FOREIGN KEY (depends_on) REFERENCES tasks(id) ON DELETE CASCADE"
-    ");";
-
-static const char *INSERT_TASK_SQL =
-    "INSERT INTO tasks ("
-    "id, name, command, creation_time, next_run_time, last_run_time, "
-    "frequency, interval, enabled, exit_code, max_runtime, working_dir, "
-    "exec_mode, script_content, dep_behavior, schedule_type, cron_expression, "
-    "ai_prompt, system_metrics"
-    ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
-
-static const char *UPDATE_TASK_SQL =
-    "UPDATE tasks SET "
-    "name = ?, command = ?, next_run_time = ?, last_run_time = ?, "
-    "frequency = ?, interval = ?, enabled = ?, exit_code = ?, "
-    "max_runtime = ?, working_dir = ?, exec_mode = ?, script_content = ?, "
-    "dep_behavior = ?, schedule_type = ?, cron_expression = ?, "
-    "ai_prompt = ?, system_metrics = ? "
-    "WHERE id = ?;";
-
-static const char *DELETE_TASK_SQL =
-    "DELETE FROM tasks WHERE id = ?;";
-
-static const char *SELECT_ALL_TASKS_SQL =
-    "SELECT * FROM tasks;";
-
-static const char *SELECT_TASK_BY_ID_SQL =
-    "SELECT * FROM tasks WHERE id = ?;";
-
-static const char *SELECT_MAX_ID_SQL =
-    "SELECT MAX(id) FROM tasks;";
-
-static const char *INSERT_DEPENDENCY_SQL =
-    "INSERT OR IGNORE INTO dependencies (task_id, depends_on) VALUES (?, ?);";
-
-static const char *DELETE_ALL_DEPENDENCIES_SQL =
-    "DELETE FROM dependencies WHERE task_id = ?;";
-
-static const char *SELECT_DEPENDENCIES_SQL =
-    "SELECT depends_on FROM dependencies WHERE task_id = ?;";
+#include <cjson/cJSON.h>
 
-bool db_init(const char *db_path) {
-    if (db != NULL) {
-        // Database already initialized
-        return true;
-    }
+#define DEFAULT_CONFIG_PATH "data/config.json"
 
-    // Open database connection
-    int rc = sqlite3_open(db_path, &db);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to open database: %s", sqlite3_errmsg(db));
-        sqlite3_close(db);
-        db = NULL;
-        return false;
-    }
+// Unreferenced scripts younger than this are left alone
+#define SCRIPT_PRUNE_GRACE_SEC (24 * 60 * 60)
 
-    // Create tables if they don't exist
-    char *err_msg = NULL;
-    rc = sqlite3_exec(db, CREATE_TABLE_SQL, NULL, NULL, &err_msg);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "SQL error: %s", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_close(db);
-        db = NULL;
+// Backend opened by db_init, NULL while closed
+static const StorageBackend *backend = NULL;
+
+bool db_load_storage_config(const char *config_path, DbStorageConfig *config) {
+    if (!config) {
         return false;
     }
 
-    // Enable foreign keys
-    rc = sqlite3_exec(db, "PRAGMA foreign_keys = ON;", NULL, NULL, &err_msg);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "SQL error enabling foreign keys: %s", err_msg);
-        sqlite3_free(err_msg);
-        // Not critical, continue anyway
+    config->backend = DB_BACKEND_SQLITE;
+    config->durability = DB_DURABILITY_BALANCED;
+    config->cache_size_kb = 8192;
+    config->mmap_size_mb = 64;
+    config->busy_timeout_ms = 5000;
+    config->wal_autocheckpoint = 1000;
+    config->history_days = 90;
+    config->history_max_rows = 100000;
+    config->history_output_kb = COMMAND_DEFAULT_OUTPUT_KB;
+    config->resident_max_tasks = 10000;
+    config->resident_window_sec = 3600;
+    config->journal_compact_mb = 32;
+    config->script_cache_kb = SCRIPT_DEFAULT_CACHE_KB;
+    config->read_connections = 4;
+
+    const char *path = config_path ? config_path : DEFAULT_CONFIG_PATH;
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return true;
     }
 
-    log_message(LOG_INFO, "Database initialized: %s", db_path);
-    return true;
-}
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
 
-void db_cleanup(void) {
-    if (db != NULL) {
-        sqlite3_close(db);
-        db = NULL;
+    char *buffer = (char*)malloc(file_size + 1);
+    if (!buffer) {
+        fclose(file);
+        return false;
     }
-}
 
-// Helper function to save task dependencies
-static bool save_task_dependencies(int task_id, const int *dependencies, int count) {
-    if (db == NULL || task_id < 0 || count <= 0 || dependencies == NULL) {
-        return true; // Not an error if no dependencies
-    }
+    size_t read_size = fread(buffer, 1, file_size, file);
+    buffer[read_size] = '\0';
+    fclose(file);
 
-    // Delete existing dependencies for this task
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, DELETE_ALL_DEPENDENCIES_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
+    cJSON *json = cJSON_Parse(buffer);
+    free(buffer);
+    if (!json) {
+        log_message(LOG_WARNING, "Failed to parse config file, using default storage settings: %s", path);
         return false;
     }
 
-    sqlite3_bind_int(stmt, 1, task_id);
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    cJSON *storage = cJSON_GetObjectItem(json, "storage");
+    if (storage) {
+        cJSON *backend_name = cJSON_GetObjectItem(storage, "backend");
+        cJSON *durability = cJSON_GetObjectItem(storage, "durability");
+        cJSON *cache_size = cJSON_GetObjectItem(storage, "cache_size_kb");
+        cJSON *mmap_size = cJSON_GetObjectItem(storage, "mmap_size_mb");
+        cJSON *busy_timeout = cJSON_GetObjectItem(storage, "busy_timeout_ms");
+        cJSON *checkpoint = cJSON_GetObjectItem(storage, "wal_autocheckpoint");
+        cJSON *history_days = cJSON_GetObjectItem(storage, "history_days");
+        cJSON *history_rows = cJSON_GetObjectItem(storage, "history_max_rows");
+        cJSON *history_output = cJSON_GetObjectItem(storage, "history_output_kb");
+        cJSON *resident_max = cJSON_GetObjectItem(storage, "resident_max_tasks");
+        cJSON *resident_window = cJSON_GetObjectItem(storage, "resident_window_sec");
+        cJSON *compact_size = cJSON_GetObjectItem(storage, "journal_compact_mb");
+        cJSON *script_cache = cJSON_GetObjectItem(storage, "script_cache_kb");
+        cJSON *read_connections = cJSON_GetObjectItem(storage, "read_connections");
+
+        if (backend_name && cJSON_IsString(backend_name)) {
+            if (strcmp(backend_name->valuestring, "sqlite") == 0) {
+                config->backend = DB_BACKEND_SQLITE;
+            } else if (strcmp(backend_name->valuestring, "journal") == 0) {
+                config->backend = DB_BACKEND_JOURNAL;
+            } else {
+                log_message(LOG_WARNING, "Unknown storage backend '%s', using sqlite",
+                            backend_name->valuestring);
+            }
+        }
 
-    if (rc != SQLITE_DONE) {
-        log_message(LOG_ERROR, "Failed to delete existing dependencies: %s", sqlite3_errmsg(db));
-        return false;
-    }
+        if (durability && cJSON_IsString(durability)) {
+            if (strcmp(durability->valuestring, "strict") == 0) {
+                config->durability = DB_DURABILITY_STRICT;
+            } else if (strcmp(durability->valuestring, "balanced") == 0) {
+                config->durability = DB_DURABILITY_BALANCED;
+            } else if (strcmp(durability->valuestring, "fast") == 0) {
+                config->durability = DB_DURABILITY_FAST;
+            } else {
+                log_message(LOG_WARNING, "Unknown storage durability '%s', using balanced",
+                            durability->valuestring);
+            }
+        }
 
-    // Insert new dependencies
-    rc = sqlite3_prepare_v2(db, INSERT_DEPENDENCY_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
-        return false;
-    }
+        if (cache_size && cJSON_IsNumber(cache_size) && cache_size->valueint > 0) {
+            config->cache_size_kb = cache_size->valueint;
+        }
 
-    for (int i = 0; i < count; i++) {
-        sqlite3_bind_int(stmt, 1, task_id);
-        sqlite3_bind_int(stmt, 2, dependencies[i]);
+        if (mmap_size && cJSON_IsNumber(mmap_size) && mmap_size->valueint >= 0) {
+            config->mmap_size_mb = mmap_size->valueint;
+        }
 
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            log_message(LOG_ERROR, "Failed to insert dependency: %s", sqlite3_errmsg(db));
-            sqlite3_finalize(stmt);
-            return false;
+        if (busy_timeout && cJSON_IsNumber(busy_timeout) && busy_timeout->valueint >= 0) {
+            config->busy_timeout_ms = busy_timeout->valueint;
+        }
+
+        if (checkpoint && cJSON_IsNumber(checkpoint) && checkpoint->valueint >= 0) {
+            config->wal_autocheckpoint = checkpoint->valueint;
+        }
+
+        if (history_days && cJSON_IsNumber(history_days) && history_days->valueint >= 0) {
+            config->history_days = history_days->valueint;
+        }
+
+        if (history_rows && cJSON_IsNumber(history_rows) && history_rows->valueint >= 0) {
+            config->history_max_rows = history_rows->valueint;
+        }
+
+        if (history_output && cJSON_IsNumber(history_output) && history_output->valueint >= 0) {
+            config->history_output_kb = history_output->valueint;
+        }
+
+        if (resident_max && cJSON_IsNumber(resident_max) && resident_max->valueint > 0) {
+            config->resident_max_tasks = resident_max->valueint;
+        }
+
+        if (resident_window && cJSON_IsNumber(resident_window) && resident_window->valueint >= 0) {
+            config->resident_window_sec = resident_window->valueint;
         }
 
-        sqlite3_reset(stmt);
-        sqlite3_clear_bindings(stmt);
+        if (compact_size && cJSON_IsNumber(compact_size) && compact_size->valueint > 0) {
+            config->journal_compact_mb = compact_size->valueint;
+        }
+
+        if (script_cache && cJSON_IsNumber(script_cache) && script_cache->valueint >= 0) {
+            config->script_cache_kb = script_cache->valueint;
+        }
+
+        if (read_connections && cJSON_IsNumber(read_connections) && read_connections->valueint >= 0) {
+            config->read_connections = read_connections->valueint;
+        }
     }
 
-    sqlite3_finalize(stmt);
+    cJSON_Delete(json);
     return true;
 }
 
-// Helper function to load task dependencies
-static bool load_task_dependencies(int task_id, int *dependencies, int *count) {
-    if (db == NULL || task_id < 0 || dependencies == NULL || count == NULL) {
-        return false;
+bool db_init(const char *db_path) {
+    if (backend != NULL) {
+        // Database already initialized
+        return true;
     }
 
-    *count = 0;
-    
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, SELECT_DEPENDENCIES_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
+    DbStorageConfig storage;
+    db_load_storage_config(NULL, &storage);
+
+    const StorageBackend *selected = storage.backend == DB_BACKEND_JOURNAL
+                                     ? &JOURNAL_STORAGE_BACKEND : &SQLITE_STORAGE_BACKEND;
+    if (!selected->open(db_path, &storage)) {
         return false;
     }
+    backend = selected;
 
-    sqlite3_bind_int(stmt, 1, task_id);
+    log_message(LOG_INFO, "Database initialized: %s (%s storage)", db_path, backend->name);
+    return true;
+}
 
-    while (sqlite3_step(stmt) == SQLITE_ROW && *count < MAX_DEPENDENCIES) {
-        dependencies[*count] = sqlite3_column_int(stmt, 0);
-        (*count)++;
+void db_cleanup(void) {
+    if (backend != NULL) {
+        backend->close();
+        backend = NULL;
     }
+}
 
-    sqlite3_finalize(stmt);
-    return true;
+bool db_begin_transaction(void) {
+    return backend != NULL && backend->begin_transaction();
 }
 
-bool db_save_task(const Task *task) {
-    if (db == NULL || task == NULL) {
-        return false;
+bool db_commit_transaction(void) {
+    return backend != NULL && backend->commit_transaction();
+}
+
+void db_rollback_transaction(void) {
+    if (backend != NULL) {
+        backend->rollback_transaction();
     }
-    
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, INSERT_TASK_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
+}
+
+bool db_checkpoint(bool truncate) {
+    return backend != NULL && backend->checkpoint(truncate);
+}
+
+bool db_save_task(const Task *task) {
+    if (backend == NULL || task == NULL) {
         return false;
     }
-    
-    // Bind parameters
-    sqlite3_bind_int(stmt, 1, task->id);
-    sqlite3_bind_text(stmt, 2, task->name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, task->command, -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 4, task->creation_time);
-    sqlite3_bind_int64(stmt, 5, task->next_run_time);
-    sqlite3_bind_int64(stmt, 6, task->last_run_time);
-    sqlite3_bind_int(stmt, 7, task->frequency);
-    sqlite3_bind_int(stmt, 8, task->interval);
-    sqlite3_bind_int(stmt, 9, task->enabled ? 1 : 0);
-    sqlite3_bind_int(stmt, 10, task->exit_code);
-    sqlite3_bind_int(stmt, 11, task->max_runtime);
-    sqlite3_bind_text(stmt, 12, task->working_dir, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 13, task->exec_mode);
-    sqlite3_bind_text(stmt, 14, task->script_content, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 15, task->dep_behavior);
-    sqlite3_bind_int(stmt, 16, task->schedule_type);
-    sqlite3_bind_text(stmt, 17, task->cron_expression, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 18, task->ai_prompt, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 19, task->system_metrics, -1, SQLITE_STATIC);
-    
-    // Execute the statement
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
-    if (rc != SQLITE_DONE) {
-        log_message(LOG_ERROR, "Failed to insert task: %s", sqlite3_errmsg(db));
+
+    if (!backend->save_task(task)) {
         return false;
     }
-    
-    // Save task dependencies
-    if (task->dependency_count > 0) {
-        if (!save_task_dependencies(task->id, task->dependencies, task->dependency_count)) {
-            log_message(LOG_ERROR, "Failed to save task dependencies");
-            return false;
-        }
-    }
-    
+
     log_message(LOG_INFO, "Task saved: ID=%d, Name=%s", task->id, task->name);
     return true;
 }
 
-bool db_update_task(const Task *task) {
-    if (db == NULL || task == NULL) {
+bool db_import_tasks(const Task *tasks, int count, const int *task_ids,
+                     const int *dependency_ids, int edge_count) {
+    if (backend == NULL || tasks == NULL || count < 0 || edge_count < 0 ||
+        (edge_count > 0 && (task_ids == NULL || dependency_ids == NULL))) {
         return false;
     }
-    
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, UPDATE_TASK_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
+
+    if (!backend->begin_transaction()) {
         return false;
     }
-    
-    // Bind parameters
-    sqlite3_bind_text(stmt, 1, task->name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, task->command, -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 3, task->next_run_time);
-    sqlite3_bind_int64(stmt, 4, task->last_run_time);
-    sqlite3_bind_int(stmt, 5, task->frequency);
-    sqlite3_bind_int(stmt, 6, task->interval);
-    sqlite3_bind_int(stmt, 7, task->enabled ? 1 : 0);
-    sqlite3_bind_int(stmt, 8, task->exit_code);
-    sqlite3_bind_int(stmt, 9, task->max_runtime);
-    sqlite3_bind_text(stmt, 10, task->working_dir, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 11, task->exec_mode);
-    sqlite3_bind_text(stmt, 12, task->script_content, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 13, task->dep_behavior);
-    sqlite3_bind_int(stmt, 14, task->schedule_type);
-    sqlite3_bind_text(stmt, 15, task->cron_expression, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 16, task->ai_prompt, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 17, task->system_metrics, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 18, task->id);
-    
-    // Execute the statement
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    
-    if (rc != SQLITE_DONE) {
-        log_message(LOG_ERROR, "Failed to update task: %s", sqlite3_errmsg(db));
-        return false;
+
+    // One statement per row, reused; the rows become visible at commit
+    for (int i = 0; i < count; i++) {
+        if (!backend->save_task(&tasks[i])) {
+            backend->rollback_transaction();
+            return false;
+        }
     }
-    
-    // Update task dependencies
-    if (!save_task_dependencies(task->id, task->dependencies, task->dependency_count)) {
-        log_message(LOG_ERROR, "Failed to update task dependencies");
+    for (int i = 0; i < edge_count; i++) {
+        if (!backend->add_dependency(task_ids[i], dependency_ids[i])) {
+            backend->rollback_transaction();
+            return false;
+        }
+    }
+
+    if (!backend->commit_transaction()) {
         return false;
     }
-    
-    log_message(LOG_INFO, "Task updated: ID=%d, Name=%s", task->id, task->name);
+
+    log_message(LOG_INFO, "Tasks imported: %d tasks, %d dependencies", count, edge_count);
     return true;
 }
 
-bool db_delete_task(int task_id) {
-    if (db == NULL) {
+bool db_upsert_task(const Task *task) {
+    if (backend == NULL || task == NULL) {
         return false;
     }
 
-    // Begin transaction
-    sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
-
-    // Delete all dependencies first
-    // With foreign keys enabled, this isn't strictly necessary, but let's be explicit
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, DELETE_ALL_DEPENDENCIES_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    if (!backend->upsert_task(task)) {
         return false;
     }
 
-    sqlite3_bind_int(stmt, 1, task_id);
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    log_message(LOG_DEBUG, "Task written: ID=%d, Name=%s", task->id, task->name);
+    return true;
+}
 
-    if (rc != SQLITE_DONE) {
-        log_message(LOG_ERROR, "Failed to delete task dependencies: %s", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+bool db_update_task(const Task *task) {
+    if (backend == NULL || task == NULL) {
         return false;
     }
 
-    // Now delete the task
-    rc = sqlite3_prepare_v2(db, DELETE_TASK_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    if (!backend->update_task(task)) {
         return false;
     }
 
-    // Bind the task ID
-    sqlite3_bind_int(stmt, 1, task_id);
+    log_message(LOG_INFO, "Task updated: ID=%d, Name=%s", task->id, task->name);
+    return true;
+}
 
-    // Execute the statement
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+bool db_update_task_status(const Task *task) {
+    return backend != NULL && task != NULL && backend->update_task_status(task);
+}
 
-    if (rc != SQLITE_DONE) {
-        log_message(LOG_ERROR, "Failed to delete task: %s", sqlite3_errmsg(db));
-        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+bool db_delete_task(int task_id) {
+    if (backend == NULL) {
         return false;
     }
 
-    // Commit the transaction
-    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    if (!backend->delete_task(task_id)) {
+        return false;
+    }
 
     log_message(LOG_INFO, "Task deleted from database: ID=%d", task_id);
     return true;
 }
 
 bool db_load_tasks(Task **tasks, int *count) {
-    if (db == NULL || tasks == NULL || count == NULL) {
-        return false;
-    }
-    
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, SELECT_ALL_TASKS_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
-        return false;
-    }
-    
-    // Count tasks first
-    int task_count = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        task_count++;
-    }
-    sqlite3_reset(stmt);
-    
-    if (task_count == 0) {
-        *tasks = NULL;
-        *count = 0;
-        sqlite3_finalize(stmt);
-        return true;
-    }
-    
-    // Allocate memory for tasks
-    Task *result = (Task*)malloc(sizeof(Task) * task_count);
-    if (!result) {
-        log_message(LOG_ERROR, "Failed to allocate memory for tasks");
-        sqlite3_finalize(stmt);
-        return false;
-    }
-    
-    // Load tasks
-    int i = 0;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        Task *task = &result[i];
-        
-        task->id = sqlite3_column_int(stmt, 0);
-        
-        const char *name = (const char*)sqlite3_column_text(stmt, 1);
-        if (name) {
-            safe_strcpy(task->name, name, sizeof(task->name));
-        } else {
-            task->name[0] = '\0';
-        }
-        
-        const char *command = (const char*)sqlite3_column_text(stmt, 2);
-        if (command) {
-            safe_strcpy(task->command, command, sizeof(task->command));
-        } else {
-            task->command[0] = '\0';
-        }
-        
-        task->creation_time = sqlite3_column_int64(stmt, 3);
-        task->next_run_time = sqlite3_column_int64(stmt, 4);
-        task->last_run_time = sqlite3_column_int64(stmt, 5);
-        task->frequency = sqlite3_column_int(stmt, 6);
-        task->interval = sqlite3_column_int(stmt, 7);
-        task->enabled = sqlite3_column_int(stmt, 8) != 0;
-        task->exit_code = sqlite3_column_int(stmt, 9);
-        task->max_runtime = sqlite3_column_int(stmt, 10);
-        
-        const char *working_dir = (const char*)sqlite3_column_text(stmt, 11);
-        if (working_dir) {
-            safe_strcpy(task->working_dir, working_dir, sizeof(task->working_dir));
-        } else {
-            task->working_dir[0] = '\0';
-        }
-        
-        task->exec_mode = sqlite3_column_int(stmt, 12);
-        
-        const char *script_content = (const char*)sqlite3_column_text(stmt, 13);
-        if (script_content) {
-            safe_strcpy(task->script_content, script_content, sizeof(task->script_content));
-        } else {
-            task->script_content[0] = '\0';
-        }
-        
-        task->dep_behavior = sqlite3_column_int(stmt, 14);
-        task->schedule_type = sqlite3_column_int(stmt, 15);
-        
-        const char *cron_expr = (const char*)sqlite3_column_text(stmt, 16);
-        if (cron_expr) {
-            safe_strcpy(task->cron_expression, cron_expr, sizeof(task->cron_expression));
-        } else {
-            task->cron_expression[0] = '\0';
-        }
-        
-        const char *ai_prompt = (const char*)sqlite3_column_text(stmt, 17);
-        if (ai_prompt) {
-            safe_strcpy(task->ai_prompt, ai_prompt, sizeof(task->ai_prompt));
-        } else {
-            task->ai_prompt[0] = '\0';
-        }
-        
-        const char *system_metrics = (const char*)sqlite3_column_text(stmt, 18);
-        if (system_metrics) {
-            safe_strcpy(task->system_metrics, system_metrics, sizeof(task->system_metrics));
-        } else {
-            task->system_metrics[0] = '\0';
-        }
-        
-        // Load dependencies
-        if (!load_task_dependencies(task->id, task->dependencies, &task->dependency_count)) {
-            log_message(LOG_WARNING, "Failed to load dependencies for task %d", task->id);
-            task->dependency_count = 0;
-        }
-        
-        i++;
-    }
-    
-    sqlite3_finalize(stmt);
-    
-    *tasks = result;
-    *count = task_count;
-    
-    return true;
+    return backend != NULL && tasks != NULL && count != NULL && backend->load_tasks(tasks, count);
+}
+
+bool db_load_tasks_page(int after_id, int limit, Task **tasks, int *count) {
+    return backend != NULL && after_id >= 0 && limit > 0 && tasks != NULL && count != NULL &&
+           backend->load_tasks_page(after_id, limit, tasks, count);
 }
 
 bool db_get_task(int task_id, Task *task) {
-    if (db == NULL || task_id < 0 || task == NULL) {
-        return false;
-    }
-    
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, SELECT_TASK_BY_ID_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
+    return backend != NULL && task_id >= 0 && task != NULL && backend->get_task(task_id, task);
+}
+
+int db_count_tasks(void) {
+    return backend != NULL ? backend->count_tasks() : -1;
+}
+
+bool db_load_task_summaries(TaskSummary **summaries, int *count) {
+    return backend != NULL && summaries != NULL && count != NULL &&
+           backend->load_task_summaries(summaries, count);
+}
+
+bool db_get_due_task_ids(time_t until, int limit, int **ids, int *count) {
+    return backend != NULL && ids != NULL && count != NULL && limit > 0 &&
+           backend->get_due_task_ids(until, limit, ids, count);
+}
+
+bool db_reserve_ids(DbIdCounter counter, int count, int *first) {
+    return backend != NULL && count > 0 && first != NULL && backend->reserve_ids(counter, count, first);
+}
+
+bool db_release_ids(DbIdCounter counter, int first, int limit) {
+    return backend != NULL && first >= 0 && first < limit && backend->release_ids(counter, first, limit);
+}
+
+int db_get_next_id(void) {
+    int id;
+    return db_reserve_ids(DB_COUNTER_TASK_ID, 1, &id) ? id : -1;
+}
+
+bool db_add_dependency(int task_id, int dependency_id) {
+    return backend != NULL && task_id >= 0 && dependency_id >= 0 &&
+           backend->add_dependency(task_id, dependency_id);
+}
+
+bool db_remove_dependency(int task_id, int dependency_id) {
+    return backend != NULL && task_id >= 0 && dependency_id >= 0 &&
+           backend->remove_dependency(task_id, dependency_id);
+}
+
+bool db_load_dependencies(DepGraph *graph) {
+    if (backend == NULL || graph == NULL) {
         return false;
     }
-    
-    sqlite3_bind_int(stmt, 1, task_id);
-    
-    if (sqlite3_step(stmt) != SQLITE_ROW) {
-        log_message(LOG_WARNING, "Task not found: ID=%d", task_id);
-        sqlite3_finalize(stmt);
+
+    int *task_ids = NULL;
+    int *dependency_ids = NULL;
+    int loaded = 0;
+    if (!backend->load_dependency_edges(&task_ids, &dependency_ids, &loaded)) {
         return false;
     }
-    
-    task->id = sqlite3_column_int(stmt, 0);
-    
-    const char *name = (const char*)sqlite3_column_text(stmt, 1);
-    if (name) {
-        safe_strcpy(task->name, name, sizeof(task->name));
-    } else {
-        task->name[0] = '\0';
-    }
-    
-    const char *command = (const char*)sqlite3_column_text(stmt, 2);
-    if (command) {
-        safe_strcpy(task->command, command, sizeof(task->command));
-    } else {
-        task->command[0] = '\0';
-    }
-    
-    task->creation_time = sqlite3_column_int64(stmt, 3);
-    task->next_run_time = sqlite3_column_int64(stmt, 4);
-    task->last_run_time = sqlite3_column_int64(stmt, 5);
-    task->frequency = sqlite3_column_int(stmt, 6);
-    task->interval = sqlite3_column_int(stmt, 7);
-    task->enabled = sqlite3_column_int(stmt, 8) != 0;
-    task->exit_code = sqlite3_column_int(stmt, 9);
-    task->max_runtime = sqlite3_column_int(stmt, 10);
-    
-    const char *working_dir = (const char*)sqlite3_column_text(stmt, 11);
-    if (working_dir) {
-        safe_strcpy(task->working_dir, working_dir, sizeof(task->working_dir));
-    } else {
-        task->working_dir[0] = '\0';
-    }
-    
-    task->exec_mode = sqlite3_column_int(stmt, 12);
-    
-    const char *script_content = (const char*)sqlite3_column_text(stmt, 13);
-    if (script_content) {
-        safe_strcpy(task->script_content, script_content, sizeof(task->script_content));
-    } else {
-        task->script_content[0] = '\0';
-    }
-    
-    task->dep_behavior = sqlite3_column_int(stmt, 14);
-    task->schedule_type = sqlite3_column_int(stmt, 15);
-    
-    const char *cron_expr = (const char*)sqlite3_column_text(stmt, 16);
-    if (cron_expr) {
-        safe_strcpy(task->cron_expression, cron_expr, sizeof(task->cron_expression));
-    } else {
-        task->cron_expression[0] = '\0';
-    }
-    
-    const char *ai_prompt = (const char*)sqlite3_column_text(stmt, 17);
-    if (ai_prompt) {
-        safe_strcpy(task->ai_prompt, ai_prompt, sizeof(task->ai_prompt));
-    } else {
-        task->ai_prompt[0] = '\0';
-    }
-    
-    const char *system_metrics = (const char*)sqlite3_column_text(stmt, 18);
-    if (system_metrics) {
-        safe_strcpy(task->system_metrics, system_metrics, sizeof(task->system_metrics));
-    } else {
-        task->system_metrics[0] = '\0';
-    }
-    
-    sqlite3_finalize(stmt);
-    
-    // Load dependencies
-    if (!load_task_dependencies(task->id, task->dependencies, &task->dependency_count)) {
-        log_message(LOG_WARNING, "Failed to load dependencies for task %d", task->id);
-        task->dependency_count = 0;
+
+    bool result = depgraph_load(graph, task_ids, dependency_ids, loaded);
+
+    free(task_ids);
+    free(dependency_ids);
+
+    if (result) {
+        log_message(LOG_INFO, "Loaded %d task dependencies", loaded);
     }
-    
-    return true;
+    return result;
 }
 
-int db_get_next_id(void) {
-    if (db == NULL) {
-        return 1;
+int db_get_next_run_id(void) {
+    int id;
+    return db_reserve_ids(DB_COUNTER_RUN_ID, 1, &id) ? id : -1;
+}
+
+bool db_save_workflow_run(const WorkflowRunRecord *run) {
+    return backend != NULL && run != NULL && run->node_count >= 0 && backend->save_workflow_run(run);
+}
+
+bool db_get_workflow_run(int run_id, WorkflowRunRecord *run) {
+    return backend != NULL && run != NULL && backend->get_workflow_run(run_id, run);
+}
+
+bool db_insert_task_run(const TaskRunRecord *run) {
+    return backend != NULL && run != NULL && backend->insert_task_run(run);
+}
+
+bool db_get_last_task_run(int task_id, TaskRunRecord *run) {
+    return backend != NULL && run != NULL && backend->get_last_task_run(task_id, run);
+}
+
+int db_prune_task_runs(void) {
+    if (backend == NULL) {
+        return -1;
     }
 
-    sqlite3_stmt *stmt;
-    int rc = sqlite3_prepare_v2(db, SELECT_MAX_ID_SQL, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
-        return 1;
+    int deleted = backend->prune_task_runs();
+    if (deleted > 0) {
+        log_message(LOG_INFO, "Pruned %d execution history rows", deleted);
     }
+    return deleted;
+}
+
+bool db_save_script(const char *hash, const unsigned char *blob, size_t size, size_t raw_size) {
+    return backend != NULL && hash != NULL && strlen(hash) == SCRIPT_HASH_LENGTH && blob != NULL &&
+           backend->save_script(hash, blob, size, raw_size);
+}
+
+bool db_load_script(const char *hash, unsigned char **blob, size_t *size, size_t *raw_size) {
+    return backend != NULL && hash != NULL && blob != NULL && size != NULL && raw_size != NULL &&
+           backend->load_script(hash, blob, size, raw_size);
+}
+
+bool db_get_script_size(const char *hash, size_t *raw_size) {
+    return backend != NULL && hash != NULL && raw_size != NULL && backend->get_script_size(hash, raw_size);
+}
 
-    // Execute the statement
-    rc = sqlite3_step(stmt);
-    
-    int next_id = 1;
-    if (rc == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
-        next_id = sqlite3_column_int(stmt, 0) + 1;
+int db_prune_scripts(void) {
+    if (backend == NULL) {
+        return -1;
     }
 
-    sqlite3_finalize(stmt);
-    return next_id;
-} 
+    int deleted = backend->prune_scripts(time(NULL) - SCRIPT_PRUNE_GRACE_SEC);
+    if (deleted > 0) {
+        log_message(LOG_INFO, "Pruned %d unreferenced scripts", deleted);
+    }
+    return deleted;
+}
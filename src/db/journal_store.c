@@ -0,0 +1,3067 @@
+#include "../../include/storage.h"
+#include "../../include/scripts.h"
+#include "../../include/utils.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <zlib.h>
+
+// Journal storage backend. The state lives in memory and on disk as:
+//
+//   <db>.snap     Snapshot: fixed-size task records (ascending ID) holding the
+//                 run state, dependency edges, workflow runs, the encoded
+//                 task definitions and the compressed script bodies.
+//                 Memory-mapped at startup; definitions are decoded straight
+//                 from the map when a task is requested.
+//   <db>.journal  Append-only log of changes since the snapshot, written in
+//                 CRC-checked frames. One frame per change, or per transaction.
+//                 Replayed on top of the snapshot at startup.
+//   <db>.history  Append-only execution history, fixed-size records. The
+//                 narrower records of <db>.runs (older versions) are
+//                 converted once at startup.
+//   <db>.output   Append-only captured output of the runs that wrote any: an
+//                 OutputHeader followed by the stdout and stderr bytes.
+//
+// Once the journal outgrows journal_compact_mb it is compacted: the in-memory
+// state is written sequentially to a new snapshot, which replaces the old one
+// by rename, and the journal starts over. Both files carry a generation number,
+// so a crash between the two steps only leaves a journal that is skipped.
+// Files are in native byte order and meant for the machine that wrote them.
+
+#define SNAPSHOT_MAGIC "TSSNAP02"
+#define JOURNAL_MAGIC "TSJRNL02"
+// Version 01 files kept script bodies inside task definitions. They are
+// still read, then rewritten in the current format by upgrade_inline_scripts.
+#define LEGACY_SNAPSHOT_MAGIC "TSSNAP01"
+#define LEGACY_JOURNAL_MAGIC "TSJRNL01"
+#define SNAPSHOT_SUFFIX ".snap"
+#define JOURNAL_SUFFIX ".journal"
+#define HISTORY_SUFFIX ".history"
+#define LEGACY_HISTORY_SUFFIX ".runs"
+#define OUTPUT_SUFFIX ".output"
+#define INITIAL_CAPACITY 256
+#define WRITE_CHUNK_BYTES (1024 * 1024)
+
+// On-disk layouts
+typedef struct {
+    char magic[8];
+    uint64_t generation;          // Journals of other generations are stale
+    uint64_t task_count;
+    uint64_t edge_count;
+    uint64_t run_count;
+    int64_t next_ids[2];          // ID counters, indexed by DbIdCounter
+    uint64_t tasks_offset;        // SnapshotTask[task_count], ascending ID
+    uint64_t edges_offset;        // SnapshotEdge[edge_count], ascending
+    uint64_t runs_offset;         // Encoded workflow runs, back to back
+    uint64_t runs_bytes;
+    uint64_t defs_offset;         // Encoded task definitions
+    uint64_t defs_bytes;
+    uint64_t script_count;        // Fields from here on are new in version 02
+    uint64_t scripts_offset;      // Encoded scripts, ascending hash
+    uint64_t scripts_bytes;
+} SnapshotHeader;
+
+#define LEGACY_SNAPSHOT_HEADER_SIZE offsetof(SnapshotHeader, script_count)
+
+typedef struct {
+    int32_t id;
+    int32_t enabled;
+    int32_t exit_code;
+    int32_t last_run_id;
+    int64_t next_run_time;
+    int64_t last_run_time;
+    double avg_runtime;
+    uint64_t def_offset;          // Relative to defs_offset
+    uint32_t def_length;
+    uint32_t reserved;
+} SnapshotTask;
+
+typedef struct {
+    int32_t task_id;
+    int32_t depends_on;
+} SnapshotEdge;
+
+typedef struct {
+    char magic[8];
+    uint64_t generation;          // Snapshot this journal applies to
+} JournalHeader;
+
+typedef struct {
+    uint32_t length;              // Payload bytes after this header
+    uint32_t crc;                 // crc32 of the payload
+} FrameHeader;
+
+typedef struct {
+    int32_t task_id;
+    int32_t run_id;
+    int32_t trigger;
+    int32_t exit_code;
+    int32_t term_signal;
+    int32_t timed_out;
+    double start_time;
+    double end_time;
+    double duration;
+    double user_cpu;
+    double sys_cpu;
+    int64_t max_rss_kb;
+    int64_t memory_peak_kb;       // -1 if the run had no cgroup; new in .history files
+    int64_t io_read_bytes;        // -1 if the run had no cgroup
+    int64_t io_write_bytes;       // -1 if the run had no cgroup
+} HistoryRecord;
+
+#define LEGACY_HISTORY_RECORD_SIZE offsetof(HistoryRecord, memory_peak_kb)
+
+typedef struct {
+    int32_t task_id;
+    int32_t reserved;
+    double start_time;            // Matches the run's HistoryRecord
+    uint32_t output_length;       // Stored stdout bytes, following this header
+    uint32_t error_length;        // Stored stderr bytes, following stdout
+    int64_t output_bytes;         // Bytes the run wrote to stdout
+    int64_t error_bytes;          // Bytes the run wrote to stderr
+} OutputHeader;
+
+// Operations inside a frame: a type byte, a 32-bit payload length, the payload
+typedef enum {
+    OP_PUT_TASK = 1,              // Encoded definition (with run state)
+    OP_TASK_STATUS,               // id, next/last run time, exit code, last run ID, avg runtime
+    OP_DELETE_TASK,               // id
+    OP_ADD_DEPENDENCY,            // task ID, dependency ID
+    OP_REMOVE_DEPENDENCY,         // task ID, dependency ID
+    OP_SET_COUNTER,               // counter, next free ID
+    OP_SAVE_WORKFLOW_RUN,         // Encoded run record
+    OP_PUT_SCRIPT,                // Encoded script
+    OP_TOUCH_SCRIPT,              // hash, stored time
+    OP_DELETE_SCRIPT,             // hash
+    OP_RELEASE_COUNTER            // counter, expected next free ID, lowered next free ID
+} JournalOp;
+
+// In-memory state of one task
+typedef struct {
+    int id;
+    bool enabled;
+    int exit_code;
+    int last_run_id;
+    time_t next_run_time;
+    time_t last_run_time;
+    double avg_runtime;
+    const unsigned char *def;     // Encoded definition, in the snapshot map or owned
+    uint32_t def_length;
+    bool def_owned;               // def was allocated from a journal frame
+    int heap_pos;                 // Position in due_heap, -1 if not scheduled
+} StoredTask;
+
+// A compressed script body, keyed by the hex SHA-256 of the raw body
+typedef struct {
+    char hash[SCRIPT_HASH_LENGTH];  // Not NUL-terminated
+    int64_t stored_time;          // Last stored, for garbage collection
+    uint32_t raw_size;
+    uint32_t size;
+    const unsigned char *body;    // In the snapshot map or owned
+    bool body_owned;
+} StoredScript;
+
+// Growable encode buffer; allocation failures are latched in failed
+typedef struct {
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} Buffer;
+
+// Bounds-checked decoder; a short read clears ok and yields zeroes
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+    bool ok;
+} Reader;
+
+// Serializes every entry point. Recursive so a thread can hold it across a
+// transaction, like the SQLite connection lock.
+static pthread_mutex_t store_lock;
+static pthread_once_t store_lock_once = PTHREAD_ONCE_INIT;
+static bool store_open = false;
+static bool in_transaction = false;
+
+static char snapshot_path[PATH_MAX];
+static char journal_path[PATH_MAX];
+static char history_path[PATH_MAX];
+static char output_path[PATH_MAX];
+static int journal_fd = -1;
+static int history_fd = -1;
+static int output_fd = -1;
+static uint64_t generation;
+static off_t journal_bytes;
+
+static unsigned char *snapshot_map = NULL;
+static size_t snapshot_size;
+
+static StoredTask *tasks = NULL;
+static int task_count;
+static int task_capacity;
+static int *task_index = NULL;    // Task ID -> index into tasks, -1 if absent
+static int task_index_size;
+static int *due_heap = NULL;      // Min-heap of scheduled task indices by next_run_time
+static int due_count;
+
+static int64_t *edges = NULL;     // (task_id << 32) | depends_on, ascending
+static int edge_count;
+static int edge_capacity;
+
+static WorkflowRunRecord *runs = NULL;   // Ascending run_id
+static int run_count;
+static int run_capacity;
+
+static StoredScript *scripts = NULL;    // Ascending hash
+static int script_count;
+static int script_capacity;
+
+static int64_t next_ids[2];
+static bool legacy_format;        // A version 01 snapshot or journal was loaded
+
+static Buffer pending;            // Frame being built (open transaction or single change)
+static Buffer pending_history;    // History records waiting for the frame's commit
+static Buffer pending_output;     // Output records waiting for the frame's commit
+
+static DbDurability durability;
+static int history_days;
+static int history_max_rows;
+static off_t compact_bytes;
+
+// Helper functions
+static void store_lock_init(void);
+static bool buf_reserve(Buffer *buf, size_t extra);
+static void put_bytes(Buffer *buf, const void *data, size_t size);
+static void put_u8(Buffer *buf, uint8_t value);
+static void put_i32(Buffer *buf, int32_t value);
+static void put_i64(Buffer *buf, int64_t value);
+static void put_f64(Buffer *buf, double value);
+static void put_str(Buffer *buf, const char *value);
+static void buf_free(Buffer *buf);
+static void get_bytes(Reader *reader, void *dest, size_t size);
+static uint8_t get_u8(Reader *reader);
+static int32_t get_i32(Reader *reader);
+static int64_t get_i64(Reader *reader);
+static double get_f64(Reader *reader);
+static void get_str(Reader *reader, char *dest, size_t size);
+static bool get_str_view(Reader *reader, const unsigned char **data, uint32_t *length);
+static void encode_task(Buffer *buf, const Task *task, time_t creation_time);
+static bool decode_task(const StoredTask *entry, Task *task);
+static bool read_task_state(const unsigned char *def, uint32_t length, StoredTask *entry);
+static time_t stored_creation_time(const StoredTask *entry);
+static bool find_script_field(const StoredTask *entry, Reader *field);
+static void encode_script(Buffer *buf, const StoredScript *script);
+static bool decode_script(Reader *reader, StoredScript *script);
+static void encode_workflow_run(Buffer *buf, const WorkflowRunRecord *run);
+static bool decode_workflow_run(Reader *reader, WorkflowRunRecord *run);
+static size_t op_begin(JournalOp op);
+static void op_end(size_t at);
+static bool finish_change(void);
+static bool write_all(int fd, const void *data, size_t size, off_t offset);
+static bool write_frame(Buffer *frame);
+static bool write_op_now(JournalOp op, const Buffer *payload);
+static bool commit_pending(void);
+static void discard_pending(void);
+static bool apply_frame(const unsigned char *data, size_t length);
+static bool apply_op(JournalOp op, Reader *reader, uint32_t length);
+static StoredTask* find_task(int task_id);
+static bool put_task(const unsigned char *def, uint32_t length, bool owned);
+static void remove_task(int task_id);
+static bool grow_tasks(int needed);
+static bool grow_task_index(int task_id);
+static bool task_scheduled(const StoredTask *entry);
+static void heap_place(int pos, int index);
+static void heap_sift_up(int pos);
+static void heap_sift_down(int pos);
+static void heap_remove(int pos);
+static void frontier_push(int *frontier, int *count, int pos);
+static int frontier_pop(int *frontier, int *count);
+static void due_index_update(int index);
+static bool find_edge(int64_t key, int *pos);
+static bool insert_edge(int64_t key);
+static void erase_edge(int64_t key);
+static void erase_task_edges(int task_id);
+static bool find_run(int run_id, int *pos);
+static bool store_run(const WorkflowRunRecord *run);
+static bool find_script(const char *hash, int *pos);
+static bool store_script(const StoredScript *script);
+static void erase_script(int pos);
+static bool load_snapshot(void);
+static bool section_fits(uint64_t offset, uint64_t bytes);
+static bool open_journal(void);
+static bool replay_journal(void);
+static bool reset_journal(void);
+static bool import_sqlite(const char *db_path, const DbStorageConfig *config);
+static bool upgrade_inline_scripts(void);
+static bool compact(void);
+static bool write_snapshot(const char *path, uint64_t snapshot_generation);
+static bool flush_chunk(int fd, Buffer *out, off_t *offset, bool force);
+static void maybe_compact(void);
+static bool sync_parent_dir(const char *path);
+static bool open_output(void);
+static bool upgrade_history(const char *db_path);
+static off_t next_output_record(int fd, off_t offset, off_t end, OutputHeader *header);
+static off_t output_prune_offset(int fd, off_t end);
+static bool drop_file_prefix(const char *path, int *append_fd, int fd, off_t offset, off_t end);
+static void release_state(void);
+
+static bool journal_open(const char *db_path, const DbStorageConfig *config) {
+    pthread_once(&store_lock_once, store_lock_init);
+    pthread_mutex_lock(&store_lock);
+
+    if ((size_t)snprintf(snapshot_path, sizeof(snapshot_path), "%s%s", db_path, SNAPSHOT_SUFFIX) >= sizeof(snapshot_path) ||
+        (size_t)snprintf(journal_path, sizeof(journal_path), "%s%s", db_path, JOURNAL_SUFFIX) >= sizeof(journal_path) ||
+        (size_t)snprintf(history_path, sizeof(history_path), "%s%s", db_path, HISTORY_SUFFIX) >= sizeof(history_path) ||
+        (size_t)snprintf(output_path, sizeof(output_path), "%s%s", db_path, OUTPUT_SUFFIX) >= sizeof(output_path)) {
+        log_message(LOG_ERROR, "Storage path too long: %s", db_path);
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    durability = config->durability;
+    history_days = config->history_days;
+    history_max_rows = config->history_max_rows;
+    compact_bytes = (off_t)config->journal_compact_mb * 1024 * 1024;
+    next_ids[DB_COUNTER_TASK_ID] = 1;
+    next_ids[DB_COUNTER_RUN_ID] = 1;
+
+    double started = monotonic_seconds();
+    bool fresh = !file_exists(snapshot_path) && !file_exists(journal_path);
+
+    // The journal is locked first, so a snapshot is never read while another
+    // process compacts
+    if (!open_journal() || !load_snapshot() || !replay_journal()) {
+        release_state();
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    if (!upgrade_history(db_path)) {
+        release_state();
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    history_fd = open(history_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (history_fd < 0) {
+        log_message(LOG_ERROR, "Failed to open execution history %s: %s", history_path, strerror(errno));
+        release_state();
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    if (!open_output()) {
+        release_state();
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    store_open = true;
+
+    // First start after switching from SQLite: carry the tasks over
+    if (fresh && file_exists(db_path) && !import_sqlite(db_path, config)) {
+        store_open = false;
+        release_state();
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    if (legacy_format && !upgrade_inline_scripts()) {
+        store_open = false;
+        release_state();
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    log_message(LOG_INFO, "Journal storage: %d tasks, %lld journal bytes, loaded in %.1f ms",
+                task_count, (long long)journal_bytes, (monotonic_seconds() - started) * 1000.0);
+    pthread_mutex_unlock(&store_lock);
+    return true;
+}
+
+static void journal_close(void) {
+    pthread_mutex_lock(&store_lock);
+    if (store_open) {
+        // Leave a short journal behind so the next start replays little
+        if (journal_bytes - (off_t)sizeof(JournalHeader) >= compact_bytes / 8) {
+            compact();
+        } else if (durability != DB_DURABILITY_FAST) {
+            fdatasync(journal_fd);
+            fdatasync(history_fd);
+            fdatasync(output_fd);
+        }
+        store_open = false;
+        release_state();
+    }
+    pthread_mutex_unlock(&store_lock);
+}
+
+static bool journal_begin_transaction(void) {
+    pthread_mutex_lock(&store_lock);
+    if (!store_open || in_transaction) {
+        log_message(LOG_ERROR, "Failed to begin transaction: %s",
+                    store_open ? "a transaction is already open" : "storage is closed");
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    in_transaction = true;
+    return true;
+}
+
+static bool journal_commit_transaction(void) {
+    in_transaction = false;
+    bool success = commit_pending();
+    if (success) {
+        maybe_compact();
+    }
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static void journal_rollback_transaction(void) {
+    in_transaction = false;
+    discard_pending();
+    pthread_mutex_unlock(&store_lock);
+}
+
+static bool journal_checkpoint(bool truncate) {
+    pthread_mutex_lock(&store_lock);
+    if (!store_open) {
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    bool success = true;
+    off_t threshold = truncate ? compact_bytes / 8 : compact_bytes;
+    off_t logged = journal_bytes - (off_t)sizeof(JournalHeader);
+    if (!in_transaction && logged > 0 && logged >= threshold) {
+        success = compact();
+    } else if (durability == DB_DURABILITY_BALANCED) {
+        success = fdatasync(journal_fd) == 0 && fdatasync(history_fd) == 0 &&
+                  fdatasync(output_fd) == 0;
+        if (!success) {
+            log_message(LOG_ERROR, "Failed to sync journal: %s", strerror(errno));
+        }
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_save_task(const Task *task) {
+    pthread_mutex_lock(&store_lock);
+    if (find_task(task->id)) {
+        log_message(LOG_ERROR, "Failed to insert task: ID %d already exists", task->id);
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    size_t at = op_begin(OP_PUT_TASK);
+    encode_task(&pending, task, task->creation_time);
+    op_end(at);
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_upsert_task(const Task *task) {
+    pthread_mutex_lock(&store_lock);
+    // Like the SQL upsert, an existing row keeps its creation time
+    const StoredTask *existing = find_task(task->id);
+    time_t creation_time = existing ? stored_creation_time(existing) : task->creation_time;
+
+    size_t at = op_begin(OP_PUT_TASK);
+    encode_task(&pending, task, creation_time);
+    op_end(at);
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_update_task(const Task *task) {
+    pthread_mutex_lock(&store_lock);
+    const StoredTask *existing = find_task(task->id);
+    if (!existing) {
+        // An UPDATE of a missing row changes nothing
+        pthread_mutex_unlock(&store_lock);
+        return true;
+    }
+
+    size_t at = op_begin(OP_PUT_TASK);
+    encode_task(&pending, task, stored_creation_time(existing));
+    op_end(at);
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_update_task_status(const Task *task) {
+    pthread_mutex_lock(&store_lock);
+    size_t at = op_begin(OP_TASK_STATUS);
+    put_i32(&pending, task->id);
+    put_i64(&pending, task->next_run_time);
+    put_i64(&pending, task->last_run_time);
+    put_i32(&pending, task->exit_code);
+    put_i32(&pending, task->last_run_id);
+    put_f64(&pending, task->avg_runtime);
+    op_end(at);
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_delete_task(int task_id) {
+    pthread_mutex_lock(&store_lock);
+    size_t at = op_begin(OP_DELETE_TASK);
+    put_i32(&pending, task_id);
+    op_end(at);
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_load_tasks(Task **loaded, int *count) {
+    pthread_mutex_lock(&store_lock);
+    *loaded = NULL;
+    *count = 0;
+    if (task_count == 0) {
+        pthread_mutex_unlock(&store_lock);
+        return true;
+    }
+
+    Task *result = (Task*)malloc(sizeof(Task) * task_count);
+    if (!result) {
+        log_message(LOG_ERROR, "Failed to allocate memory for tasks");
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    // Ascending ID, like the rowid order of the SQLite table
+    int n = 0;
+    for (int id = 0; id < task_index_size; id++) {
+        if (task_index[id] >= 0 && !decode_task(&tasks[task_index[id]], &result[n++])) {
+            log_message(LOG_ERROR, "Corrupt task definition: ID=%d", id);
+            free(result);
+            pthread_mutex_unlock(&store_lock);
+            return false;
+        }
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    *loaded = result;
+    *count = n;
+    return true;
+}
+
+static bool journal_load_tasks_page(int after_id, int limit, Task **loaded, int *count) {
+    *loaded = NULL;
+    *count = 0;
+
+    Task *result = (Task*)malloc(sizeof(Task) * limit);
+    if (!result) {
+        log_message(LOG_ERROR, "Failed to allocate memory for tasks");
+        return false;
+    }
+
+    pthread_mutex_lock(&store_lock);
+    int n = 0;
+    for (int id = after_id + 1; id < task_index_size && n < limit; id++) {
+        if (task_index[id] >= 0 && !decode_task(&tasks[task_index[id]], &result[n++])) {
+            log_message(LOG_ERROR, "Corrupt task definition: ID=%d", id);
+            free(result);
+            pthread_mutex_unlock(&store_lock);
+            return false;
+        }
+    }
+    pthread_mutex_unlock(&store_lock);
+
+    if (n == 0) {
+        free(result);
+        return true;
+    }
+    *loaded = result;
+    *count = n;
+    return true;
+}
+
+static bool journal_get_task(int task_id, Task *task) {
+    pthread_mutex_lock(&store_lock);
+    const StoredTask *entry = find_task(task_id);
+    if (!entry) {
+        log_message(LOG_WARNING, "Task not found: ID=%d", task_id);
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    bool success = decode_task(entry, task);
+    if (!success) {
+        log_message(LOG_ERROR, "Corrupt task definition: ID=%d", task_id);
+    }
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static int journal_count_tasks(void) {
+    pthread_mutex_lock(&store_lock);
+    int count = store_open ? task_count : -1;
+    pthread_mutex_unlock(&store_lock);
+    return count;
+}
+
+static bool journal_load_task_summaries(TaskSummary **summaries, int *count) {
+    pthread_mutex_lock(&store_lock);
+    *summaries = NULL;
+    *count = 0;
+
+    TaskSummary *rows = (TaskSummary*)malloc(sizeof(TaskSummary) * (task_count > 0 ? task_count : 1));
+    if (!rows) {
+        log_message(LOG_ERROR, "Failed to allocate memory for task summaries");
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    int n = 0;
+    for (int id = 0; id < task_index_size; id++) {
+        if (task_index[id] >= 0) {
+            const StoredTask *entry = &tasks[task_index[id]];
+            rows[n].id = entry->id;
+            rows[n].last_run_time = entry->last_run_time;
+            rows[n].exit_code = entry->exit_code;
+            rows[n].avg_runtime = entry->avg_runtime;
+            n++;
+        }
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    *summaries = rows;
+    *count = n;
+    return true;
+}
+
+static bool journal_get_due_task_ids(time_t until, int limit, int **ids, int *count) {
+    *ids = NULL;
+    *count = 0;
+
+    int *rows = (int*)malloc(sizeof(int) * limit);
+    // Best-first walk of the due heap: frontier holds heap positions whose
+    // parents were taken, so each step yields the next soonest task
+    int *frontier = (int*)malloc(sizeof(int) * ((size_t)limit + 1));
+    if (!rows || !frontier) {
+        log_message(LOG_ERROR, "Failed to allocate memory for due task IDs");
+        free(rows);
+        free(frontier);
+        return false;
+    }
+
+    pthread_mutex_lock(&store_lock);
+
+    int n = 0;
+    int frontier_count = 0;
+    if (due_count > 0) {
+        frontier[frontier_count++] = 0;
+    }
+
+    while (frontier_count > 0 && n < limit) {
+        int pos = frontier_pop(frontier, &frontier_count);
+        const StoredTask *entry = &tasks[due_heap[pos]];
+        if (entry->next_run_time > until) {
+            break;
+        }
+        rows[n++] = entry->id;
+
+        for (int child = 2 * pos + 1; child <= 2 * pos + 2 && child < due_count; child++) {
+            frontier_push(frontier, &frontier_count, child);
+        }
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    free(frontier);
+
+    *ids = rows;
+    *count = n;
+    return true;
+}
+
+static bool journal_reserve_ids(DbIdCounter counter, int count, int *first) {
+    pthread_mutex_lock(&store_lock);
+
+    int64_t start = next_ids[counter];
+    if (start + count > INT_MAX) {
+        log_message(LOG_ERROR, "Failed to reserve IDs: counter exhausted");
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    // Written in a frame of its own, even inside a transaction, so a
+    // rollback can never hand the same block out twice
+    Buffer payload = {0};
+    put_u8(&payload, (uint8_t)counter);
+    put_i64(&payload, start + count);
+
+    bool success = write_op_now(OP_SET_COUNTER, &payload);
+    buf_free(&payload);
+    if (success) {
+        *first = (int)start;
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_release_ids(DbIdCounter counter, int first, int limit) {
+    pthread_mutex_lock(&store_lock);
+
+    // A block reserved since then keeps the IDs skipped
+    if (next_ids[counter] != limit) {
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    Buffer payload = {0};
+    put_u8(&payload, (uint8_t)counter);
+    put_i64(&payload, limit);
+    put_i64(&payload, first);
+
+    bool success = write_op_now(OP_RELEASE_COUNTER, &payload);
+    buf_free(&payload);
+
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_add_dependency(int task_id, int dependency_id) {
+    pthread_mutex_lock(&store_lock);
+    // Same rule as the foreign keys of the SQLite table. Tasks written
+    // earlier in an open transaction are only applied at commit, so there
+    // the caller vouches for them.
+    if (!in_transaction && (!find_task(task_id) || !find_task(dependency_id))) {
+        log_message(LOG_ERROR, "Failed to insert dependency: task %d not found",
+                    find_task(task_id) ? dependency_id : task_id);
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    size_t at = op_begin(OP_ADD_DEPENDENCY);
+    put_i32(&pending, task_id);
+    put_i32(&pending, dependency_id);
+    op_end(at);
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_remove_dependency(int task_id, int dependency_id) {
+    pthread_mutex_lock(&store_lock);
+    size_t at = op_begin(OP_REMOVE_DEPENDENCY);
+    put_i32(&pending, task_id);
+    put_i32(&pending, dependency_id);
+    op_end(at);
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_load_dependency_edges(int **task_ids, int **dependency_ids, int *count) {
+    pthread_mutex_lock(&store_lock);
+
+    int *from = (int*)malloc(sizeof(int) * (edge_count > 0 ? edge_count : 1));
+    int *to = (int*)malloc(sizeof(int) * (edge_count > 0 ? edge_count : 1));
+    if (!from || !to) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependencies");
+        free(from);
+        free(to);
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    for (int i = 0; i < edge_count; i++) {
+        from[i] = (int)(edges[i] >> 32);
+        to[i] = (int)(uint32_t)edges[i];
+    }
+
+    *task_ids = from;
+    *dependency_ids = to;
+    *count = edge_count;
+    pthread_mutex_unlock(&store_lock);
+    return true;
+}
+
+static bool journal_save_workflow_run(const WorkflowRunRecord *run) {
+    pthread_mutex_lock(&store_lock);
+    size_t at = op_begin(OP_SAVE_WORKFLOW_RUN);
+    encode_workflow_run(&pending, run);
+    op_end(at);
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_get_workflow_run(int run_id, WorkflowRunRecord *run) {
+    pthread_mutex_lock(&store_lock);
+
+    int pos;
+    if (!find_run(run_id, &pos)) {
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    const WorkflowRunRecord *stored = &runs[pos];
+    *run = *stored;
+    run->task_ids = NULL;
+    run->node_states = NULL;
+
+    if (stored->node_count > 0) {
+        run->task_ids = (int*)malloc(sizeof(int) * stored->node_count);
+        run->node_states = (unsigned char*)malloc(stored->node_count);
+        if (!run->task_ids || !run->node_states) {
+            log_message(LOG_ERROR, "Failed to allocate memory for workflow run");
+            free(run->task_ids);
+            free(run->node_states);
+            pthread_mutex_unlock(&store_lock);
+            return false;
+        }
+        memcpy(run->task_ids, stored->task_ids, sizeof(int) * stored->node_count);
+        memcpy(run->node_states, stored->node_states, stored->node_count);
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    return true;
+}
+
+static bool journal_insert_task_run(const TaskRunRecord *run) {
+    HistoryRecord record = {
+        .task_id = run->task_id,
+        .run_id = run->run_id,
+        .trigger = run->trigger,
+        .exit_code = run->exit_code,
+        .term_signal = run->term_signal,
+        .timed_out = run->timed_out ? 1 : 0,
+        .start_time = run->start_time,
+        .end_time = run->end_time,
+        .duration = run->duration,
+        .user_cpu = run->user_cpu,
+        .sys_cpu = run->sys_cpu,
+        .max_rss_kb = run->max_rss_kb,
+        .memory_peak_kb = run->memory_peak_kb,
+        .io_read_bytes = run->io_read_bytes,
+        .io_write_bytes = run->io_write_bytes,
+    };
+
+    pthread_mutex_lock(&store_lock);
+    put_bytes(&pending_history, &record, sizeof(record));
+    if (run->output.data || run->error_output.data) {
+        OutputHeader header = {
+            .task_id = run->task_id,
+            .start_time = run->start_time,
+            .output_length = run->output.data ? (uint32_t)run->output.length : 0,
+            .error_length = run->error_output.data ? (uint32_t)run->error_output.length : 0,
+            .output_bytes = run->output.total,
+            .error_bytes = run->error_output.total,
+        };
+        put_bytes(&pending_output, &header, sizeof(header));
+        if (header.output_length > 0) {
+            put_bytes(&pending_output, run->output.data, header.output_length);
+        }
+        if (header.error_length > 0) {
+            put_bytes(&pending_output, run->error_output.data, header.error_length);
+        }
+    }
+    bool success = finish_change();
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static int journal_prune_task_runs(void) {
+    pthread_mutex_lock(&store_lock);
+
+    struct stat st;
+    if (!store_open || fstat(history_fd, &st) != 0) {
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+
+    int fd = open(history_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_message(LOG_ERROR, "Failed to open execution history: %s", strerror(errno));
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+
+    // Records are in insertion order, so both limits drop a prefix
+    off_t total = st.st_size / (off_t)sizeof(HistoryRecord);
+    off_t drop = 0;
+    if (history_max_rows > 0 && total > history_max_rows) {
+        drop = total - history_max_rows;
+    }
+    if (history_days > 0) {
+        double cutoff = (double)time(NULL) - history_days * 86400.0;
+        HistoryRecord record;
+        while (drop < total &&
+               pread(fd, &record, sizeof(record), drop * (off_t)sizeof(record)) == (ssize_t)sizeof(record) &&
+               record.start_time < cutoff) {
+            drop++;
+        }
+    }
+
+    if (drop == 0) {
+        close(fd);
+        pthread_mutex_unlock(&store_lock);
+        return 0;
+    }
+
+    bool success = drop_file_prefix(history_path, &history_fd, fd,
+                                    drop * (off_t)sizeof(HistoryRecord), total * (off_t)sizeof(HistoryRecord));
+    close(fd);
+    if (!success) {
+        log_message(LOG_ERROR, "Failed to prune execution history: %s", strerror(errno));
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+
+    // Output records go by the same limits. Only runs that wrote something
+    // have one, so this never drops the output of a run that was kept.
+    fd = open(output_path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        off_t offset = output_prune_offset(fd, st.st_size);
+        if (offset > 0 && !drop_file_prefix(output_path, &output_fd, fd, offset, st.st_size)) {
+            log_message(LOG_ERROR, "Failed to prune captured output: %s", strerror(errno));
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    return (int)drop;
+}
+
+static bool journal_get_last_task_run(int task_id, TaskRunRecord *run) {
+    pthread_mutex_lock(&store_lock);
+    if (!store_open) {
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    // Newest first: read the history backwards in chunks
+    int fd = open(history_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    enum { CHUNK_RECORDS = 1024 };
+    HistoryRecord *chunk = (HistoryRecord*)malloc(sizeof(HistoryRecord) * CHUNK_RECORDS);
+    bool found = false;
+    HistoryRecord record;
+    off_t end = st.st_size / (off_t)sizeof(HistoryRecord);
+    while (chunk && !found && end > 0) {
+        off_t start = end > CHUNK_RECORDS ? end - CHUNK_RECORDS : 0;
+        size_t want = (size_t)(end - start) * sizeof(HistoryRecord);
+        if (pread(fd, chunk, want, start * (off_t)sizeof(HistoryRecord)) != (ssize_t)want) {
+            break;
+        }
+        for (off_t i = end - start - 1; i >= 0; i--) {
+            if (chunk[i].task_id == task_id) {
+                record = chunk[i];
+                found = true;
+                break;
+            }
+        }
+        end = start;
+    }
+    free(chunk);
+    close(fd);
+
+    if (!found) {
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    memset(run, 0, sizeof(TaskRunRecord));
+    run->task_id = record.task_id;
+    run->run_id = record.run_id;
+    run->trigger = (TaskRunTrigger)record.trigger;
+    run->start_time = record.start_time;
+    run->end_time = record.end_time;
+    run->duration = record.duration;
+    run->exit_code = record.exit_code;
+    run->term_signal = record.term_signal;
+    run->timed_out = record.timed_out != 0;
+    run->user_cpu = record.user_cpu;
+    run->sys_cpu = record.sys_cpu;
+    run->max_rss_kb = (long)record.max_rss_kb;
+    run->memory_peak_kb = (long)record.memory_peak_kb;
+    run->io_read_bytes = record.io_read_bytes;
+    run->io_write_bytes = record.io_write_bytes;
+
+    // The output record, if the run wrote anything, is the last one with
+    // the same task and start time
+    bool success = true;
+    fd = open(output_path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        OutputHeader header;
+        off_t match = -1;
+        OutputHeader matched;
+        off_t offset = 0;
+        off_t next;
+        while ((next = next_output_record(fd, offset, st.st_size, &header)) > 0) {
+            if (header.task_id == task_id && header.start_time == record.start_time) {
+                match = offset;
+                matched = header;
+            }
+            offset = next;
+        }
+
+        if (match >= 0) {
+            CapturedOutput *outputs[2] = { &run->output, &run->error_output };
+            uint32_t lengths[2] = { matched.output_length, matched.error_length };
+            int64_t totals[2] = { matched.output_bytes, matched.error_bytes };
+            off_t at = match + (off_t)sizeof(OutputHeader);
+            for (int i = 0; i < 2 && success; i++) {
+                outputs[i]->total = totals[i];
+                if (lengths[i] == 0) {
+                    continue;
+                }
+                outputs[i]->data = (char*)malloc((size_t)lengths[i] + 1);
+                success = outputs[i]->data &&
+                          pread(fd, outputs[i]->data, lengths[i], at) == (ssize_t)lengths[i];
+                if (success) {
+                    outputs[i]->data[lengths[i]] = '\0';
+                    outputs[i]->length = lengths[i];
+                }
+                at += lengths[i];
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (!success) {
+        log_message(LOG_ERROR, "Failed to read captured output of task %d", task_id);
+        free(run->output.data);
+        free(run->error_output.data);
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_save_script(const char *hash, const unsigned char *blob, size_t size, size_t raw_size) {
+    pthread_mutex_lock(&store_lock);
+
+    // Written in a frame of its own, even inside a transaction: bodies are
+    // never rolled back, and reach the journal before the tasks using them
+    Buffer payload = {0};
+    int pos;
+    JournalOp op;
+    if (find_script(hash, &pos)) {
+        op = OP_TOUCH_SCRIPT;
+        put_bytes(&payload, hash, SCRIPT_HASH_LENGTH);
+        put_i64(&payload, time(NULL));
+    } else {
+        StoredScript script = {
+            .stored_time = time(NULL),
+            .raw_size = (uint32_t)raw_size,
+            .size = (uint32_t)size,
+            .body = blob,
+            .body_owned = false,
+        };
+        memcpy(script.hash, hash, SCRIPT_HASH_LENGTH);
+        op = OP_PUT_SCRIPT;
+        encode_script(&payload, &script);
+    }
+
+    bool success = write_op_now(op, &payload);
+    buf_free(&payload);
+    if (success) {
+        maybe_compact();
+    }
+    pthread_mutex_unlock(&store_lock);
+    return success;
+}
+
+static bool journal_load_script(const char *hash, unsigned char **blob, size_t *size, size_t *raw_size) {
+    pthread_mutex_lock(&store_lock);
+
+    int pos;
+    if (!find_script(hash, &pos)) {
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+
+    const StoredScript *script = &scripts[pos];
+    *blob = (unsigned char*)malloc(script->size > 0 ? script->size : 1);
+    if (!*blob) {
+        log_message(LOG_ERROR, "Failed to allocate memory for script");
+        pthread_mutex_unlock(&store_lock);
+        return false;
+    }
+    memcpy(*blob, script->body, script->size);
+    *size = script->size;
+    *raw_size = script->raw_size;
+
+    pthread_mutex_unlock(&store_lock);
+    return true;
+}
+
+static bool journal_get_script_size(const char *hash, size_t *raw_size) {
+    pthread_mutex_lock(&store_lock);
+
+    int pos;
+    bool found = find_script(hash, &pos);
+    if (found) {
+        *raw_size = scripts[pos].raw_size;
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    return found;
+}
+
+static int journal_prune_scripts(time_t older_than) {
+    pthread_mutex_lock(&store_lock);
+
+    // Usually nothing is old enough, and the tasks need not be scanned
+    int candidates = 0;
+    for (int i = 0; i < script_count; i++) {
+        if (scripts[i].stored_time < older_than) {
+            candidates++;
+        }
+    }
+    if (candidates == 0) {
+        pthread_mutex_unlock(&store_lock);
+        return 0;
+    }
+
+    bool *referenced = (bool*)calloc((size_t)script_count, sizeof(bool));
+    if (!referenced) {
+        log_message(LOG_ERROR, "Failed to allocate memory for script pruning");
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+
+    // Only the script field of each definition is read
+    for (int i = 0; i < task_count; i++) {
+        Reader field;
+        const unsigned char *hash;
+        uint32_t length;
+        int pos;
+        if (find_script_field(&tasks[i], &field) && get_str_view(&field, &hash, &length) &&
+            length == SCRIPT_HASH_LENGTH && find_script((const char*)hash, &pos)) {
+            referenced[pos] = true;
+        }
+    }
+
+    int deleted = 0;
+    for (int i = 0; i < script_count; i++) {
+        if (!referenced[i] && scripts[i].stored_time < older_than) {
+            size_t at = op_begin(OP_DELETE_SCRIPT);
+            put_bytes(&pending, scripts[i].hash, SCRIPT_HASH_LENGTH);
+            op_end(at);
+            deleted++;
+        }
+    }
+    free(referenced);
+
+    if (deleted > 0 && !finish_change()) {
+        deleted = -1;
+    }
+    pthread_mutex_unlock(&store_lock);
+    return deleted;
+}
+
+const StorageBackend JOURNAL_STORAGE_BACKEND = {
+    .name = "journal",
+    .open = journal_open,
+    .close = journal_close,
+    .begin_transaction = journal_begin_transaction,
+    .commit_transaction = journal_commit_transaction,
+    .rollback_transaction = journal_rollback_transaction,
+    .checkpoint = journal_checkpoint,
+    .save_task = journal_save_task,
+    .upsert_task = journal_upsert_task,
+    .update_task = journal_update_task,
+    .update_task_status = journal_update_task_status,
+    .delete_task = journal_delete_task,
+    .load_tasks = journal_load_tasks,
+    .load_tasks_page = journal_load_tasks_page,
+    .get_task = journal_get_task,
+    .count_tasks = journal_count_tasks,
+    .load_task_summaries = journal_load_task_summaries,
+    .get_due_task_ids = journal_get_due_task_ids,
+    .reserve_ids = journal_reserve_ids,
+    .release_ids = journal_release_ids,
+    .add_dependency = journal_add_dependency,
+    .remove_dependency = journal_remove_dependency,
+    .load_dependency_edges = journal_load_dependency_edges,
+    .save_workflow_run = journal_save_workflow_run,
+    .get_workflow_run = journal_get_workflow_run,
+    .insert_task_run = journal_insert_task_run,
+    .get_last_task_run = journal_get_last_task_run,
+    .prune_task_runs = journal_prune_task_runs,
+    .save_script = journal_save_script,
+    .load_script = journal_load_script,
+    .get_script_size = journal_get_script_size,
+    .prune_scripts = journal_prune_scripts,
+};
+
+static void store_lock_init(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&store_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static bool buf_reserve(Buffer *buf, size_t extra) {
+    if (buf->failed) {
+        return false;
+    }
+    if (buf->length + extra <= buf->capacity) {
+        return true;
+    }
+
+    size_t capacity = buf->capacity ? buf->capacity : INITIAL_CAPACITY;
+    while (capacity < buf->length + extra) {
+        capacity *= 2;
+    }
+
+    unsigned char *grown = (unsigned char*)realloc(buf->data, capacity);
+    if (!grown) {
+        buf->failed = true;
+        return false;
+    }
+    buf->data = grown;
+    buf->capacity = capacity;
+    return true;
+}
+
+static void put_bytes(Buffer *buf, const void *data, size_t size) {
+    if (buf_reserve(buf, size)) {
+        memcpy(buf->data + buf->length, data, size);
+        buf->length += size;
+    }
+}
+
+static void put_u8(Buffer *buf, uint8_t value) {
+    put_bytes(buf, &value, sizeof(value));
+}
+
+static void put_i32(Buffer *buf, int32_t value) {
+    put_bytes(buf, &value, sizeof(value));
+}
+
+static void put_i64(Buffer *buf, int64_t value) {
+    put_bytes(buf, &value, sizeof(value));
+}
+
+static void put_f64(Buffer *buf, double value) {
+    put_bytes(buf, &value, sizeof(value));
+}
+
+// Length-prefixed, without the terminator
+static void put_str(Buffer *buf, const char *value) {
+    uint32_t length = (uint32_t)strlen(value);
+    put_bytes(buf, &length, sizeof(length));
+    put_bytes(buf, value, length);
+}
+
+static void buf_free(Buffer *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(Buffer));
+}
+
+static void get_bytes(Reader *reader, void *dest, size_t size) {
+    if (!reader->ok || (size_t)(reader->end - reader->pos) < size) {
+        reader->ok = false;
+        memset(dest, 0, size);
+        return;
+    }
+    memcpy(dest, reader->pos, size);
+    reader->pos += size;
+}
+
+static uint8_t get_u8(Reader *reader) {
+    uint8_t value;
+    get_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static int32_t get_i32(Reader *reader) {
+    int32_t value;
+    get_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static int64_t get_i64(Reader *reader) {
+    int64_t value;
+    get_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static double get_f64(Reader *reader) {
+    double value;
+    get_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+// Copy a length-prefixed string into a fixed buffer, truncating if needed
+static void get_str(Reader *reader, char *dest, size_t size) {
+    uint32_t length;
+    get_bytes(reader, &length, sizeof(length));
+    if (!reader->ok || (size_t)(reader->end - reader->pos) < length) {
+        reader->ok = false;
+        dest[0] = '\0';
+        return;
+    }
+
+    size_t copied = length < size ? length : size - 1;
+    memcpy(dest, reader->pos, copied);
+    dest[copied] = '\0';
+    reader->pos += length;
+}
+
+// Point at a length-prefixed string in place, without copying
+static bool get_str_view(Reader *reader, const unsigned char **data, uint32_t *length) {
+    get_bytes(reader, length, sizeof(*length));
+    if (!reader->ok || (size_t)(reader->end - reader->pos) < *length) {
+        reader->ok = false;
+        return false;
+    }
+
+    *data = reader->pos;
+    reader->pos += *length;
+    return true;
+}
+
+// Task definition encoding. The run state comes first so read_task_state
+// can pick it up without decoding the strings.
+static void encode_task(Buffer *buf, const Task *task, time_t creation_time) {
+    put_i32(buf, task->id);
+    put_i64(buf, creation_time);
+    put_i64(buf, task->next_run_time);
+    put_i64(buf, task->last_run_time);
+    put_u8(buf, task->enabled ? 1 : 0);
+    put_i32(buf, task->exit_code);
+    put_i32(buf, task->last_run_id);
+    put_f64(buf, task->avg_runtime);
+    put_i32(buf, task->frequency);
+    put_i32(buf, task->interval);
+    put_i32(buf, task->max_runtime);
+    put_i32(buf, task->exec_mode);
+    put_i32(buf, task->dep_behavior);
+    put_i32(buf, task->schedule_type);
+    put_str(buf, task->name);
+    put_str(buf, task->command);
+    put_str(buf, task->working_dir);
+    put_str(buf, task->script_hash);
+    put_str(buf, task->cron_expression);
+    put_str(buf, task->ai_prompt);
+    put_str(buf, task->system_metrics);
+    put_str(buf, task->resource_limits);
+}
+
+// Fill a task from its stored definition and current run state. Every field
+// is assigned, so the (large) struct is not cleared first.
+static bool decode_task(const StoredTask *entry, Task *task) {
+    Reader reader = { entry->def, entry->def + entry->def_length, true };
+
+    task->id = get_i32(&reader);
+    task->creation_time = get_i64(&reader);
+    get_i64(&reader);
+    get_i64(&reader);
+    get_u8(&reader);
+    get_i32(&reader);
+    get_i32(&reader);
+    get_f64(&reader);
+    task->frequency = get_i32(&reader);
+    task->interval = get_i32(&reader);
+    task->max_runtime = get_i32(&reader);
+    task->exec_mode = get_i32(&reader);
+    task->dep_behavior = get_i32(&reader);
+    task->schedule_type = get_i32(&reader);
+    get_str(&reader, task->name, sizeof(task->name));
+    get_str(&reader, task->command, sizeof(task->command));
+    get_str(&reader, task->working_dir, sizeof(task->working_dir));
+    get_str(&reader, task->script_hash, sizeof(task->script_hash));
+    get_str(&reader, task->cron_expression, sizeof(task->cron_expression));
+    get_str(&reader, task->ai_prompt, sizeof(task->ai_prompt));
+    get_str(&reader, task->system_metrics, sizeof(task->system_metrics));
+    // Definitions written before resource limits existed end here
+    if (reader.pos < reader.end) {
+        get_str(&reader, task->resource_limits, sizeof(task->resource_limits));
+    } else {
+        task->resource_limits[0] = '\0';
+    }
+
+    task->enabled = entry->enabled;
+    task->next_run_time = entry->next_run_time;
+    task->last_run_time = entry->last_run_time;
+    task->exit_code = entry->exit_code;
+    task->last_run_id = entry->last_run_id;
+    task->avg_runtime = entry->avg_runtime;
+    return reader.ok;
+}
+
+static bool read_task_state(const unsigned char *def, uint32_t length, StoredTask *entry) {
+    Reader reader = { def, def + length, true };
+
+    entry->id = get_i32(&reader);
+    get_i64(&reader);
+    entry->next_run_time = get_i64(&reader);
+    entry->last_run_time = get_i64(&reader);
+    entry->enabled = get_u8(&reader) != 0;
+    entry->exit_code = get_i32(&reader);
+    entry->last_run_id = get_i32(&reader);
+    entry->avg_runtime = get_f64(&reader);
+    return reader.ok && entry->id >= 0;
+}
+
+static time_t stored_creation_time(const StoredTask *entry) {
+    Reader reader = { entry->def, entry->def + entry->def_length, true };
+    get_i32(&reader);
+    return get_i64(&reader);
+}
+
+// Position a reader on the script field of a definition (the script hash,
+// or the body in version 01 files), skipping the fields before it
+static bool find_script_field(const StoredTask *entry, Reader *field) {
+    // id, creation/next/last run time, enabled, exit code, last run ID,
+    // average runtime and the six integer settings
+    static const size_t FIXED_BYTES = sizeof(int32_t) + 3 * sizeof(int64_t) + sizeof(uint8_t) +
+                                      2 * sizeof(int32_t) + sizeof(double) + 6 * sizeof(int32_t);
+
+    Reader reader = { entry->def, entry->def + entry->def_length, true };
+    if (entry->def_length < FIXED_BYTES) {
+        return false;
+    }
+    reader.pos += FIXED_BYTES;
+
+    // name, command, working_dir
+    for (int i = 0; i < 3; i++) {
+        const unsigned char *skipped;
+        uint32_t length;
+        if (!get_str_view(&reader, &skipped, &length)) {
+            return false;
+        }
+    }
+
+    *field = reader;
+    return true;
+}
+
+static void encode_script(Buffer *buf, const StoredScript *script) {
+    put_bytes(buf, script->hash, SCRIPT_HASH_LENGTH);
+    put_i64(buf, script->stored_time);
+    put_i32(buf, (int32_t)script->raw_size);
+    put_i32(buf, (int32_t)script->size);
+    put_bytes(buf, script->body, script->size);
+}
+
+// Decode a script; its body points into the reader's data
+static bool decode_script(Reader *reader, StoredScript *script) {
+    get_bytes(reader, script->hash, SCRIPT_HASH_LENGTH);
+    script->stored_time = get_i64(reader);
+    script->raw_size = (uint32_t)get_i32(reader);
+    script->size = (uint32_t)get_i32(reader);
+    if (!reader->ok || (size_t)(reader->end - reader->pos) < script->size) {
+        reader->ok = false;
+        return false;
+    }
+
+    script->body = reader->pos;
+    script->body_owned = false;
+    reader->pos += script->size;
+    return true;
+}
+
+static void encode_workflow_run(Buffer *buf, const WorkflowRunRecord *run) {
+    put_i32(buf, run->run_id);
+    put_i32(buf, run->root_task_id);
+    put_i64(buf, run->start_time);
+    put_i64(buf, run->end_time);
+    put_i32(buf, run->status);
+    put_i32(buf, run->node_count);
+    put_bytes(buf, run->task_ids, sizeof(int) * run->node_count);
+    put_bytes(buf, run->node_states, run->node_count);
+}
+
+// Decode a run record into newly allocated arrays (caller must free)
+static bool decode_workflow_run(Reader *reader, WorkflowRunRecord *run) {
+    memset(run, 0, sizeof(WorkflowRunRecord));
+    run->run_id = get_i32(reader);
+    run->root_task_id = get_i32(reader);
+    run->start_time = get_i64(reader);
+    run->end_time = get_i64(reader);
+    run->status = get_i32(reader);
+    int node_count = get_i32(reader);
+
+    if (!reader->ok || node_count < 0 ||
+        (size_t)(reader->end - reader->pos) < (sizeof(int) + 1) * (size_t)node_count) {
+        reader->ok = false;
+        return false;
+    }
+
+    if (node_count > 0) {
+        run->task_ids = (int*)malloc(sizeof(int) * node_count);
+        run->node_states = (unsigned char*)malloc(node_count);
+        if (!run->task_ids || !run->node_states) {
+            log_message(LOG_ERROR, "Failed to allocate memory for workflow run");
+            free(run->task_ids);
+            free(run->node_states);
+            run->task_ids = NULL;
+            run->node_states = NULL;
+            return false;
+        }
+        get_bytes(reader, run->task_ids, sizeof(int) * node_count);
+        get_bytes(reader, run->node_states, node_count);
+    }
+    run->node_count = node_count;
+    return true;
+}
+
+// Start an operation in the pending frame; returns where its length goes
+static size_t op_begin(JournalOp op) {
+    if (pending.length == 0) {
+        // Room for the frame header, filled in by write_frame
+        put_bytes(&pending, &(FrameHeader){0, 0}, sizeof(FrameHeader));
+    }
+    put_u8(&pending, (uint8_t)op);
+    size_t at = pending.length;
+    put_bytes(&pending, &(uint32_t){0}, sizeof(uint32_t));
+    return at;
+}
+
+static void op_end(size_t at) {
+    if (!pending.failed) {
+        uint32_t length = (uint32_t)(pending.length - at - sizeof(uint32_t));
+        memcpy(pending.data + at, &length, sizeof(length));
+    }
+}
+
+// Commit a change right away unless it belongs to an open transaction
+static bool finish_change(void) {
+    if (in_transaction) {
+        return true;
+    }
+
+    bool success = commit_pending();
+    if (success) {
+        maybe_compact();
+    }
+    return success;
+}
+
+static bool write_all(int fd, const void *data, size_t size, off_t offset) {
+    const unsigned char *pos = (const unsigned char*)data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, pos, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pos += written;
+        offset += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// Append a frame (header placeholder included) to the journal. A failed
+// write is cut off again so the journal never ends in a torn frame.
+static bool write_frame(Buffer *frame) {
+    if (frame->failed) {
+        log_message(LOG_ERROR, "Failed to allocate memory for journal frame");
+        return false;
+    }
+
+    FrameHeader header;
+    header.length = (uint32_t)(frame->length - sizeof(FrameHeader));
+    header.crc = (uint32_t)crc32(0L, frame->data + sizeof(FrameHeader), header.length);
+    memcpy(frame->data, &header, sizeof(header));
+
+    if (!write_all(journal_fd, frame->data, frame->length, journal_bytes) ||
+        (durability == DB_DURABILITY_STRICT && fdatasync(journal_fd) != 0)) {
+        log_message(LOG_ERROR, "Failed to write journal: %s", strerror(errno));
+        if (ftruncate(journal_fd, journal_bytes) != 0) {
+            log_message(LOG_ERROR, "Failed to cut off journal frame: %s", strerror(errno));
+        }
+        return false;
+    }
+
+    journal_bytes += (off_t)frame->length;
+    return true;
+}
+
+// Write one operation in a frame of its own, outside any open transaction,
+// and apply it
+static bool write_op_now(JournalOp op, const Buffer *payload) {
+    if (payload->failed) {
+        log_message(LOG_ERROR, "Failed to allocate memory for journal frame");
+        return false;
+    }
+
+    Buffer frame = {0};
+    put_bytes(&frame, &(FrameHeader){0, 0}, sizeof(FrameHeader));
+    put_u8(&frame, (uint8_t)op);
+    put_bytes(&frame, &(uint32_t){(uint32_t)payload->length}, sizeof(uint32_t));
+    put_bytes(&frame, payload->data, payload->length);
+
+    bool success = write_frame(&frame) &&
+                   apply_frame(frame.data + sizeof(FrameHeader), frame.length - sizeof(FrameHeader));
+    buf_free(&frame);
+    return success;
+}
+
+// Write the pending frame and history, then apply the frame to memory
+static bool commit_pending(void) {
+    bool success = true;
+
+    if (pending.length > 0 || pending.failed) {
+        success = write_frame(&pending) &&
+                  apply_frame(pending.data + sizeof(FrameHeader), pending.length - sizeof(FrameHeader));
+    }
+
+    if (success && pending_history.length > 0) {
+        // History is advisory: a failed append is logged but not fatal
+        if (pending_history.failed || write(history_fd, pending_history.data, pending_history.length) !=
+                                      (ssize_t)pending_history.length) {
+            log_message(LOG_ERROR, "Failed to append execution history: %s", strerror(errno));
+        } else if (durability == DB_DURABILITY_STRICT) {
+            fdatasync(history_fd);
+        }
+    }
+
+    if (success && pending_output.length > 0) {
+        if (pending_output.failed || write(output_fd, pending_output.data, pending_output.length) !=
+                                     (ssize_t)pending_output.length) {
+            log_message(LOG_ERROR, "Failed to append captured output: %s", strerror(errno));
+        } else if (durability == DB_DURABILITY_STRICT) {
+            fdatasync(output_fd);
+        }
+    }
+
+    discard_pending();
+    return success;
+}
+
+static void discard_pending(void) {
+    // Keep the buffers for the next frame unless they grew large
+    if (pending.capacity > WRITE_CHUNK_BYTES || pending.failed) {
+        buf_free(&pending);
+    }
+    if (pending_history.capacity > WRITE_CHUNK_BYTES || pending_history.failed) {
+        buf_free(&pending_history);
+    }
+    if (pending_output.capacity > WRITE_CHUNK_BYTES || pending_output.failed) {
+        buf_free(&pending_output);
+    }
+    pending.length = 0;
+    pending_history.length = 0;
+    pending_output.length = 0;
+}
+
+static bool apply_frame(const unsigned char *data, size_t length) {
+    Reader reader = { data, data + length, true };
+
+    while (reader.ok && reader.pos < reader.end) {
+        JournalOp op = (JournalOp)get_u8(&reader);
+        uint32_t op_length;
+        get_bytes(&reader, &op_length, sizeof(op_length));
+        if (!reader.ok || (size_t)(reader.end - reader.pos) < op_length) {
+            return false;
+        }
+
+        Reader payload = { reader.pos, reader.pos + op_length, true };
+        if (!apply_op(op, &payload, op_length)) {
+            return false;
+        }
+        reader.pos += op_length;
+    }
+
+    return reader.ok;
+}
+
+static bool apply_op(JournalOp op, Reader *reader, uint32_t length) {
+    switch (op) {
+        case OP_PUT_TASK: {
+            unsigned char *def = (unsigned char*)malloc(length > 0 ? length : 1);
+            if (!def) {
+                log_message(LOG_ERROR, "Failed to allocate memory for task definition");
+                return false;
+            }
+            memcpy(def, reader->pos, length);
+            if (!put_task(def, length, true)) {
+                free(def);
+                return false;
+            }
+            return true;
+        }
+
+        case OP_TASK_STATUS: {
+            int id = get_i32(reader);
+            time_t next_run_time = get_i64(reader);
+            time_t last_run_time = get_i64(reader);
+            int exit_code = get_i32(reader);
+            int last_run_id = get_i32(reader);
+            double avg_runtime = get_f64(reader);
+            StoredTask *entry = find_task(id);
+            if (reader->ok && entry) {
+                entry->next_run_time = next_run_time;
+                entry->last_run_time = last_run_time;
+                entry->exit_code = exit_code;
+                entry->last_run_id = last_run_id;
+                entry->avg_runtime = avg_runtime;
+                due_index_update((int)(entry - tasks));
+            }
+            return reader->ok;
+        }
+
+        case OP_DELETE_TASK: {
+            int id = get_i32(reader);
+            if (reader->ok) {
+                remove_task(id);
+            }
+            return reader->ok;
+        }
+
+        case OP_ADD_DEPENDENCY:
+        case OP_REMOVE_DEPENDENCY: {
+            int task_id = get_i32(reader);
+            int dependency_id = get_i32(reader);
+            if (!reader->ok) {
+                return false;
+            }
+            int64_t key = ((int64_t)task_id << 32) | (uint32_t)dependency_id;
+            if (op == OP_ADD_DEPENDENCY) {
+                return insert_edge(key);
+            }
+            erase_edge(key);
+            return true;
+        }
+
+        case OP_SET_COUNTER: {
+            uint8_t counter = get_u8(reader);
+            int64_t value = get_i64(reader);
+            if (!reader->ok || counter > DB_COUNTER_RUN_ID) {
+                return false;
+            }
+            if (value > next_ids[counter]) {
+                next_ids[counter] = value;
+            }
+            return true;
+        }
+
+        case OP_RELEASE_COUNTER: {
+            uint8_t counter = get_u8(reader);
+            int64_t expected = get_i64(reader);
+            int64_t value = get_i64(reader);
+            if (!reader->ok || counter > DB_COUNTER_RUN_ID) {
+                return false;
+            }
+            if (next_ids[counter] == expected && value < expected) {
+                next_ids[counter] = value;
+            }
+            return true;
+        }
+
+        case OP_SAVE_WORKFLOW_RUN: {
+            WorkflowRunRecord run;
+            if (!decode_workflow_run(reader, &run)) {
+                return false;
+            }
+            if (!store_run(&run)) {
+                free(run.task_ids);
+                free(run.node_states);
+                return false;
+            }
+            return true;
+        }
+
+        case OP_PUT_SCRIPT: {
+            StoredScript script;
+            if (!decode_script(reader, &script)) {
+                return false;
+            }
+            unsigned char *body = (unsigned char*)malloc(script.size > 0 ? script.size : 1);
+            if (!body) {
+                log_message(LOG_ERROR, "Failed to allocate memory for script");
+                return false;
+            }
+            memcpy(body, script.body, script.size);
+            script.body = body;
+            script.body_owned = true;
+            if (!store_script(&script)) {
+                free(body);
+                return false;
+            }
+            return true;
+        }
+
+        case OP_TOUCH_SCRIPT:
+        case OP_DELETE_SCRIPT: {
+            char hash[SCRIPT_HASH_LENGTH];
+            get_bytes(reader, hash, sizeof(hash));
+            int64_t stored_time = op == OP_TOUCH_SCRIPT ? get_i64(reader) : 0;
+            int pos;
+            if (reader->ok && find_script(hash, &pos)) {
+                if (op == OP_TOUCH_SCRIPT) {
+                    scripts[pos].stored_time = stored_time;
+                } else {
+                    erase_script(pos);
+                }
+            }
+            return reader->ok;
+        }
+    }
+
+    log_message(LOG_ERROR, "Unknown journal operation %d", (int)op);
+    return false;
+}
+
+static StoredTask* find_task(int task_id) {
+    if (task_id < 0 || task_id >= task_index_size || task_index[task_id] < 0) {
+        return NULL;
+    }
+    return &tasks[task_index[task_id]];
+}
+
+// Insert or replace a task from its encoded definition. On success the
+// entry refers to def (and frees it later if owned).
+static bool put_task(const unsigned char *def, uint32_t length, bool owned) {
+    StoredTask state;
+    if (!read_task_state(def, length, &state)) {
+        log_message(LOG_ERROR, "Corrupt task definition in journal");
+        return false;
+    }
+
+    StoredTask *entry = find_task(state.id);
+    if (!entry) {
+        if (!grow_task_index(state.id) || !grow_tasks(task_count + 1)) {
+            log_message(LOG_ERROR, "Failed to allocate memory for tasks");
+            return false;
+        }
+        entry = &tasks[task_count];
+        entry->heap_pos = -1;
+        entry->def_owned = false;
+        task_index[state.id] = task_count++;
+    } else if (entry->def_owned) {
+        free((void*)entry->def);
+    }
+
+    state.heap_pos = entry->heap_pos;
+    state.def = def;
+    state.def_length = length;
+    state.def_owned = owned;
+    *entry = state;
+
+    due_index_update((int)(entry - tasks));
+    return true;
+}
+
+// Drop a task and every edge touching it; the last task takes its slot
+static void remove_task(int task_id) {
+    StoredTask *entry = find_task(task_id);
+    if (!entry) {
+        return;
+    }
+
+    int index = (int)(entry - tasks);
+    if (entry->heap_pos >= 0) {
+        heap_remove(entry->heap_pos);
+    }
+    if (entry->def_owned) {
+        free((void*)entry->def);
+    }
+
+    int last = task_count - 1;
+    if (index != last) {
+        tasks[index] = tasks[last];
+        task_index[tasks[index].id] = index;
+        if (tasks[index].heap_pos >= 0) {
+            due_heap[tasks[index].heap_pos] = index;
+        }
+    }
+    task_count--;
+    task_index[task_id] = -1;
+
+    erase_task_edges(task_id);
+}
+
+// Grow the task array (and the due heap with it, so a push never fails)
+static bool grow_tasks(int needed) {
+    if (needed <= task_capacity) {
+        return true;
+    }
+
+    int capacity = task_capacity ? task_capacity : INITIAL_CAPACITY;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+
+    StoredTask *grown_tasks = (StoredTask*)realloc(tasks, sizeof(StoredTask) * capacity);
+    if (!grown_tasks) {
+        return false;
+    }
+    tasks = grown_tasks;
+
+    int *grown_heap = (int*)realloc(due_heap, sizeof(int) * capacity);
+    if (!grown_heap) {
+        return false;
+    }
+    due_heap = grown_heap;
+
+    task_capacity = capacity;
+    return true;
+}
+
+static bool grow_task_index(int task_id) {
+    if (task_id < task_index_size) {
+        return true;
+    }
+
+    int size = task_index_size ? task_index_size : INITIAL_CAPACITY;
+    while (size <= task_id) {
+        size = size > INT_MAX / 2 ? INT_MAX : size * 2;
+    }
+
+    int *grown = (int*)realloc(task_index, sizeof(int) * size);
+    if (!grown) {
+        return false;
+    }
+    for (int i = task_index_size; i < size; i++) {
+        grown[i] = -1;
+    }
+    task_index = grown;
+    task_index_size = size;
+    return true;
+}
+
+// Same condition as the due query of the SQLite backend
+static bool task_scheduled(const StoredTask *entry) {
+    return entry->enabled && entry->next_run_time > 0;
+}
+
+static void heap_place(int pos, int index) {
+    due_heap[pos] = index;
+    tasks[index].heap_pos = pos;
+}
+
+static void heap_sift_up(int pos) {
+    int index = due_heap[pos];
+    time_t key = tasks[index].next_run_time;
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (tasks[due_heap[parent]].next_run_time <= key) {
+            break;
+        }
+        heap_place(pos, due_heap[parent]);
+        pos = parent;
+    }
+    heap_place(pos, index);
+}
+
+static void heap_sift_down(int pos) {
+    int index = due_heap[pos];
+    time_t key = tasks[index].next_run_time;
+    for (;;) {
+        int child = 2 * pos + 1;
+        if (child >= due_count) {
+            break;
+        }
+        if (child + 1 < due_count &&
+            tasks[due_heap[child + 1]].next_run_time < tasks[due_heap[child]].next_run_time) {
+            child++;
+        }
+        if (key <= tasks[due_heap[child]].next_run_time) {
+            break;
+        }
+        heap_place(pos, due_heap[child]);
+        pos = child;
+    }
+    heap_place(pos, index);
+}
+
+static void heap_remove(int pos) {
+    tasks[due_heap[pos]].heap_pos = -1;
+    due_count--;
+    if (pos < due_count) {
+        int moved = due_heap[due_count];
+        heap_place(pos, moved);
+        heap_sift_up(pos);
+        heap_sift_down(tasks[moved].heap_pos);
+    }
+}
+
+// The due query's frontier: a small heap of due_heap positions, ordered by
+// the next_run_time of the tasks there
+static void frontier_push(int *frontier, int *count, int pos) {
+    time_t key = tasks[due_heap[pos]].next_run_time;
+    int at = (*count)++;
+    while (at > 0) {
+        int parent = (at - 1) / 2;
+        if (tasks[due_heap[frontier[parent]]].next_run_time <= key) {
+            break;
+        }
+        frontier[at] = frontier[parent];
+        at = parent;
+    }
+    frontier[at] = pos;
+}
+
+static int frontier_pop(int *frontier, int *count) {
+    int top = frontier[0];
+    int last = frontier[--(*count)];
+    time_t key = tasks[due_heap[last]].next_run_time;
+
+    int at = 0;
+    for (;;) {
+        int child = 2 * at + 1;
+        if (child >= *count) {
+            break;
+        }
+        if (child + 1 < *count &&
+            tasks[due_heap[frontier[child + 1]]].next_run_time < tasks[due_heap[frontier[child]]].next_run_time) {
+            child++;
+        }
+        if (key <= tasks[due_heap[frontier[child]]].next_run_time) {
+            break;
+        }
+        frontier[at] = frontier[child];
+        at = child;
+    }
+    if (*count > 0) {
+        frontier[at] = last;
+    }
+    return top;
+}
+
+// Move a task into, within or out of the due heap after its state changed
+static void due_index_update(int index) {
+    StoredTask *entry = &tasks[index];
+    if (!task_scheduled(entry)) {
+        if (entry->heap_pos >= 0) {
+            heap_remove(entry->heap_pos);
+        }
+        return;
+    }
+
+    if (entry->heap_pos < 0) {
+        heap_place(due_count++, index);
+    }
+    heap_sift_up(entry->heap_pos);
+    heap_sift_down(entry->heap_pos);
+}
+
+// Binary search; pos receives the match or the insertion point
+static bool find_edge(int64_t key, int *pos) {
+    int low = 0;
+    int high = edge_count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (edges[mid] < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *pos = low;
+    return low < edge_count && edges[low] == key;
+}
+
+static bool insert_edge(int64_t key) {
+    int pos;
+    if (find_edge(key, &pos)) {
+        return true;
+    }
+
+    if (edge_count == edge_capacity) {
+        int capacity = edge_capacity ? edge_capacity * 2 : INITIAL_CAPACITY;
+        int64_t *grown = (int64_t*)realloc(edges, sizeof(int64_t) * capacity);
+        if (!grown) {
+            log_message(LOG_ERROR, "Failed to allocate memory for dependencies");
+            return false;
+        }
+        edges = grown;
+        edge_capacity = capacity;
+    }
+
+    memmove(&edges[pos + 1], &edges[pos], sizeof(int64_t) * (edge_count - pos));
+    edges[pos] = key;
+    edge_count++;
+    return true;
+}
+
+static void erase_edge(int64_t key) {
+    int pos;
+    if (find_edge(key, &pos)) {
+        memmove(&edges[pos], &edges[pos + 1], sizeof(int64_t) * (edge_count - pos - 1));
+        edge_count--;
+    }
+}
+
+static void erase_task_edges(int task_id) {
+    int kept = 0;
+    for (int i = 0; i < edge_count; i++) {
+        if ((int)(edges[i] >> 32) != task_id && (int)(uint32_t)edges[i] != task_id) {
+            edges[kept++] = edges[i];
+        }
+    }
+    edge_count = kept;
+}
+
+static bool find_run(int run_id, int *pos) {
+    int low = 0;
+    int high = run_count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (runs[mid].run_id < run_id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *pos = low;
+    return low < run_count && runs[low].run_id == run_id;
+}
+
+// Insert or replace a run; takes ownership of its arrays on success
+static bool store_run(const WorkflowRunRecord *run) {
+    int pos;
+    if (find_run(run->run_id, &pos)) {
+        free(runs[pos].task_ids);
+        free(runs[pos].node_states);
+        runs[pos] = *run;
+        return true;
+    }
+
+    if (run_count == run_capacity) {
+        int capacity = run_capacity ? run_capacity * 2 : INITIAL_CAPACITY;
+        WorkflowRunRecord *grown = (WorkflowRunRecord*)realloc(runs, sizeof(WorkflowRunRecord) * capacity);
+        if (!grown) {
+            log_message(LOG_ERROR, "Failed to allocate memory for workflow runs");
+            return false;
+        }
+        runs = grown;
+        run_capacity = capacity;
+    }
+
+    // Run IDs grow, so this is almost always an append
+    memmove(&runs[pos + 1], &runs[pos], sizeof(WorkflowRunRecord) * (run_count - pos));
+    runs[pos] = *run;
+    run_count++;
+    return true;
+}
+
+// Binary search by hash (SCRIPT_HASH_LENGTH bytes, no terminator needed)
+static bool find_script(const char *hash, int *pos) {
+    int low = 0;
+    int high = script_count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (memcmp(scripts[mid].hash, hash, SCRIPT_HASH_LENGTH) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *pos = low;
+    return low < script_count && memcmp(scripts[low].hash, hash, SCRIPT_HASH_LENGTH) == 0;
+}
+
+// Insert or replace a script; takes ownership of an owned body on success
+static bool store_script(const StoredScript *script) {
+    int pos;
+    if (find_script(script->hash, &pos)) {
+        if (scripts[pos].body_owned) {
+            free((void*)scripts[pos].body);
+        }
+        scripts[pos] = *script;
+        return true;
+    }
+
+    if (script_count == script_capacity) {
+        int capacity = script_capacity ? script_capacity * 2 : INITIAL_CAPACITY;
+        StoredScript *grown = (StoredScript*)realloc(scripts, sizeof(StoredScript) * capacity);
+        if (!grown) {
+            log_message(LOG_ERROR, "Failed to allocate memory for scripts");
+            return false;
+        }
+        scripts = grown;
+        script_capacity = capacity;
+    }
+
+    memmove(&scripts[pos + 1], &scripts[pos], sizeof(StoredScript) * (script_count - pos));
+    scripts[pos] = *script;
+    script_count++;
+    return true;
+}
+
+static void erase_script(int pos) {
+    if (scripts[pos].body_owned) {
+        free((void*)scripts[pos].body);
+    }
+    memmove(&scripts[pos], &scripts[pos + 1], sizeof(StoredScript) * (script_count - pos - 1));
+    script_count--;
+}
+
+// Map the snapshot and build the in-memory state from it. Task definitions
+// stay in the map and are only decoded when a task is requested.
+static bool load_snapshot(void) {
+    int fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            generation = 0;
+            return true;
+        }
+        log_message(LOG_ERROR, "Failed to open snapshot %s: %s", snapshot_path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)LEGACY_SNAPSHOT_HEADER_SIZE) {
+        log_message(LOG_ERROR, "Snapshot is truncated: %s", snapshot_path);
+        close(fd);
+        return false;
+    }
+
+    snapshot_size = (size_t)st.st_size;
+    snapshot_map = (unsigned char*)mmap(NULL, snapshot_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snapshot_map == MAP_FAILED) {
+        snapshot_map = NULL;
+        log_message(LOG_ERROR, "Failed to map snapshot %s: %s", snapshot_path, strerror(errno));
+        return false;
+    }
+
+    // Version 01 headers end before the script fields, which stay zero
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    legacy_format = memcmp(snapshot_map, LEGACY_SNAPSHOT_MAGIC, sizeof(header.magic)) == 0;
+    if (!legacy_format && snapshot_size < sizeof(header)) {
+        log_message(LOG_ERROR, "Snapshot is truncated: %s", snapshot_path);
+        return false;
+    }
+    memcpy(&header, snapshot_map, legacy_format ? LEGACY_SNAPSHOT_HEADER_SIZE : sizeof(header));
+
+    if ((!legacy_format && memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) ||
+        header.task_count > INT_MAX || header.edge_count > INT_MAX || header.run_count > INT_MAX ||
+        header.script_count > INT_MAX ||
+        header.tasks_offset % sizeof(uint64_t) != 0 || header.edges_offset % sizeof(uint64_t) != 0 ||
+        !section_fits(header.tasks_offset, header.task_count * sizeof(SnapshotTask)) ||
+        !section_fits(header.edges_offset, header.edge_count * sizeof(SnapshotEdge)) ||
+        !section_fits(header.runs_offset, header.runs_bytes) ||
+        !section_fits(header.defs_offset, header.defs_bytes) ||
+        !section_fits(header.scripts_offset, header.scripts_bytes)) {
+        log_message(LOG_ERROR, "Snapshot is corrupt: %s", snapshot_path);
+        return false;
+    }
+
+    generation = header.generation;
+    next_ids[DB_COUNTER_TASK_ID] = header.next_ids[DB_COUNTER_TASK_ID];
+    next_ids[DB_COUNTER_RUN_ID] = header.next_ids[DB_COUNTER_RUN_ID];
+
+    int count = (int)header.task_count;
+    const SnapshotTask *records = (const SnapshotTask*)(snapshot_map + header.tasks_offset);
+    const unsigned char *defs = snapshot_map + header.defs_offset;
+    if (count > 0 && (!grow_tasks(count) || !grow_task_index(records[count - 1].id))) {
+        log_message(LOG_ERROR, "Failed to allocate memory for tasks");
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const SnapshotTask *record = &records[i];
+        if (record->id < 0 || record->id >= task_index_size || task_index[record->id] >= 0 ||
+            record->def_offset + record->def_length > header.defs_bytes) {
+            log_message(LOG_ERROR, "Snapshot is corrupt: %s (task record %d)", snapshot_path, i);
+            return false;
+        }
+
+        StoredTask *entry = &tasks[i];
+        entry->id = record->id;
+        entry->enabled = record->enabled != 0;
+        entry->exit_code = record->exit_code;
+        entry->last_run_id = record->last_run_id;
+        entry->next_run_time = record->next_run_time;
+        entry->last_run_time = record->last_run_time;
+        entry->avg_runtime = record->avg_runtime;
+        entry->def = defs + record->def_offset;
+        entry->def_length = record->def_length;
+        entry->def_owned = false;
+        entry->heap_pos = -1;
+        task_index[record->id] = i;
+
+        if (task_scheduled(entry)) {
+            heap_place(due_count++, i);
+        }
+    }
+    task_count = count;
+
+    // Heapify bottom-up, linear in the number of scheduled tasks
+    for (int pos = due_count / 2 - 1; pos >= 0; pos--) {
+        heap_sift_down(pos);
+    }
+
+    if (header.edge_count > 0) {
+        edge_capacity = (int)header.edge_count;
+        edges = (int64_t*)malloc(sizeof(int64_t) * edge_capacity);
+        if (!edges) {
+            log_message(LOG_ERROR, "Failed to allocate memory for dependencies");
+            return false;
+        }
+        const SnapshotEdge *edge_records = (const SnapshotEdge*)(snapshot_map + header.edges_offset);
+        for (int i = 0; i < edge_capacity; i++) {
+            edges[i] = ((int64_t)edge_records[i].task_id << 32) | (uint32_t)edge_records[i].depends_on;
+        }
+        edge_count = edge_capacity;
+    }
+
+    Reader reader = { snapshot_map + header.runs_offset,
+                      snapshot_map + header.runs_offset + header.runs_bytes, true };
+    for (uint64_t i = 0; i < header.run_count; i++) {
+        WorkflowRunRecord run;
+        if (!decode_workflow_run(&reader, &run) || !store_run(&run)) {
+            log_message(LOG_ERROR, "Snapshot is corrupt: %s (workflow run %llu)",
+                        snapshot_path, (unsigned long long)i);
+            return false;
+        }
+    }
+
+    // Script bodies stay in the map, like the definitions
+    reader = (Reader){ snapshot_map + header.scripts_offset,
+                       snapshot_map + header.scripts_offset + header.scripts_bytes, true };
+    for (uint64_t i = 0; i < header.script_count; i++) {
+        StoredScript script;
+        if (!decode_script(&reader, &script) || !store_script(&script)) {
+            log_message(LOG_ERROR, "Snapshot is corrupt: %s (script %llu)",
+                        snapshot_path, (unsigned long long)i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool section_fits(uint64_t offset, uint64_t bytes) {
+    return offset <= snapshot_size && bytes <= snapshot_size - offset;
+}
+
+// Open and lock the journal. Its contents are replayed by replay_journal
+// once the snapshot is loaded.
+static bool open_journal(void) {
+    journal_fd = open(journal_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (journal_fd < 0) {
+        log_message(LOG_ERROR, "Failed to open journal %s: %s", journal_path, strerror(errno));
+        return false;
+    }
+
+    // Only one process may have the data directory open, so the CLI and
+    // the web UI cannot work alongside a running daemon
+    if (flock(journal_fd, LOCK_EX | LOCK_NB) != 0) {
+        log_message(LOG_ERROR, "Journal storage %s is in use by another process; the journal "
+                   "backend allows one process per data directory, so the CLI and web UI cannot "
+                   "run while the daemon does (use \"backend\": \"sqlite\" for that)", journal_path);
+        return false;
+    }
+
+    return true;
+}
+
+// Apply the journal on top of the snapshot. A torn or corrupt tail (from a
+// crash mid-write) is cut off; everything before it is kept.
+static bool replay_journal(void) {
+    struct stat st;
+    if (fstat(journal_fd, &st) != 0) {
+        log_message(LOG_ERROR, "Failed to read journal %s: %s", journal_path, strerror(errno));
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+
+    JournalHeader header;
+    if (size < sizeof(header) || pread(journal_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 &&
+         memcmp(header.magic, LEGACY_JOURNAL_MAGIC, sizeof(header.magic)) != 0)) {
+        if (size > 0) {
+            log_message(LOG_WARNING, "Journal %s has no valid header, starting a new one", journal_path);
+        }
+        return reset_journal();
+    }
+
+    if (header.generation != generation) {
+        // Written before the last compaction finished; already in the snapshot
+        log_message(LOG_INFO, "Journal %s is already part of the snapshot", journal_path);
+        return reset_journal();
+    }
+
+    if (memcmp(header.magic, LEGACY_JOURNAL_MAGIC, sizeof(header.magic)) == 0) {
+        legacy_format = true;
+    }
+
+    unsigned char *map = NULL;
+    if (size > sizeof(header)) {
+        map = (unsigned char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, journal_fd, 0);
+        if (map == MAP_FAILED) {
+            log_message(LOG_ERROR, "Failed to map journal %s: %s", journal_path, strerror(errno));
+            return false;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+    }
+
+    size_t offset = sizeof(header);
+    while (offset < size) {
+        FrameHeader frame;
+        if (size - offset < sizeof(frame)) {
+            break;
+        }
+        memcpy(&frame, map + offset, sizeof(frame));
+        const unsigned char *payload = map + offset + sizeof(frame);
+        if (frame.length > size - offset - sizeof(frame) ||
+            (uint32_t)crc32(0L, payload, frame.length) != frame.crc) {
+            break;
+        }
+        if (!apply_frame(payload, frame.length)) {
+            log_message(LOG_ERROR, "Failed to replay journal %s at offset %zu", journal_path, offset);
+            munmap(map, size);
+            return false;
+        }
+        offset += sizeof(frame) + frame.length;
+    }
+
+    if (map) {
+        munmap(map, size);
+    }
+
+    if (offset < size) {
+        log_message(LOG_WARNING, "Journal %s ends in an incomplete frame, dropping %zu bytes",
+                    journal_path, size - offset);
+        if (ftruncate(journal_fd, (off_t)offset) != 0) {
+            log_message(LOG_ERROR, "Failed to truncate journal: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    journal_bytes = (off_t)offset;
+    return true;
+}
+
+// Empty the journal and stamp it with the current snapshot generation
+static bool reset_journal(void) {
+    JournalHeader header;
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.generation = generation;
+
+    if (ftruncate(journal_fd, 0) != 0 || !write_all(journal_fd, &header, sizeof(header), 0) ||
+        (durability != DB_DURABILITY_FAST && fdatasync(journal_fd) != 0)) {
+        log_message(LOG_ERROR, "Failed to reset journal %s: %s", journal_path, strerror(errno));
+        return false;
+    }
+
+    journal_bytes = sizeof(header);
+    return true;
+}
+
+// Copy tasks, their scripts, dependencies and ID counters from an existing SQLite
+// database, one task at a time, then write the first snapshot. Workflow
+// runs and execution history stay behind in the SQLite file.
+static bool import_sqlite(const char *db_path, const DbStorageConfig *config) {
+    const StorageBackend *sqlite = &SQLITE_STORAGE_BACKEND;
+    if (!sqlite->open(db_path, config)) {
+        return false;
+    }
+
+    TaskSummary *summaries = NULL;
+    int count = 0;
+    int *from = NULL;
+    int *to = NULL;
+    int edge_total = 0;
+    int first_task_id = 1;
+    int first_run_id = 1;
+    Task *task = (Task*)malloc(sizeof(Task));
+    bool success = task != NULL &&
+                   sqlite->load_task_summaries(&summaries, &count) &&
+                   sqlite->load_dependency_edges(&from, &to, &edge_total) &&
+                   sqlite->reserve_ids(DB_COUNTER_TASK_ID, 1, &first_task_id) &&
+                   sqlite->reserve_ids(DB_COUNTER_RUN_ID, 1, &first_run_id);
+
+    in_transaction = true;
+    for (int i = 0; success && i < count; i++) {
+        success = sqlite->get_task(summaries[i].id, task);
+
+        // Each script body once, written ahead of the tasks
+        int pos;
+        if (success && task->script_hash[0] != '\0' && !find_script(task->script_hash, &pos)) {
+            unsigned char *blob = NULL;
+            size_t size = 0;
+            size_t raw_size = 0;
+            if (sqlite->load_script(task->script_hash, &blob, &size, &raw_size)) {
+                success = journal_save_script(task->script_hash, blob, size, raw_size);
+                free(blob);
+            } else {
+                log_message(LOG_WARNING, "Script of task %d is missing: %s", task->id, task->script_hash);
+            }
+        }
+
+        if (success) {
+            size_t at = op_begin(OP_PUT_TASK);
+            encode_task(&pending, task, task->creation_time);
+            op_end(at);
+        }
+    }
+    for (int i = 0; success && i < edge_total; i++) {
+        size_t at = op_begin(OP_ADD_DEPENDENCY);
+        put_i32(&pending, from[i]);
+        put_i32(&pending, to[i]);
+        op_end(at);
+    }
+    int64_t counters[2] = { first_task_id, first_run_id };
+    for (int counter = 0; success && counter < 2; counter++) {
+        size_t at = op_begin(OP_SET_COUNTER);
+        put_u8(&pending, (uint8_t)counter);
+        put_i64(&pending, counters[counter]);
+        op_end(at);
+    }
+    in_transaction = false;
+
+    free(task);
+    free(summaries);
+    free(from);
+    free(to);
+    sqlite->close();
+
+    if (!success) {
+        log_message(LOG_ERROR, "Failed to import tasks from %s", db_path);
+        discard_pending();
+        return false;
+    }
+
+    if (!commit_pending() || !compact()) {
+        return false;
+    }
+
+    log_message(LOG_INFO, "Imported %d tasks and %d dependencies from %s", count, edge_total, db_path);
+    return true;
+}
+
+// Move the script bodies held in version 01 task definitions into the
+// script store and write a current snapshot. Nothing goes to the old
+// journal: if this is interrupted, the old files are upgraded again.
+static bool upgrade_inline_scripts(void) {
+    Task *task = (Task*)malloc(sizeof(Task));
+    if (!task) {
+        log_message(LOG_ERROR, "Failed to allocate memory for task");
+        return false;
+    }
+
+    int moved = 0;
+    bool success = true;
+    for (int i = 0; success && i < task_count; i++) {
+        StoredTask *entry = &tasks[i];
+        Reader field;
+        const unsigned char *body;
+        uint32_t length;
+        success = find_script_field(entry, &field) && get_str_view(&field, &body, &length) &&
+                  decode_task(entry, task);
+        if (!success) {
+            log_message(LOG_ERROR, "Corrupt task definition: ID=%d", entry->id);
+            break;
+        }
+
+        task->script_hash[0] = '\0';
+        int pos;
+        if (length > 0 && script_hash((const char*)body, length, task->script_hash) &&
+            !find_script(task->script_hash, &pos)) {
+            unsigned char *blob = NULL;
+            size_t size = 0;
+            success = script_compress((const char*)body, length, &blob, &size);
+            if (success) {
+                StoredScript script = {
+                    .stored_time = time(NULL),
+                    .raw_size = length,
+                    .size = (uint32_t)size,
+                    .body = blob,
+                    .body_owned = true,
+                };
+                memcpy(script.hash, task->script_hash, SCRIPT_HASH_LENGTH);
+                success = store_script(&script);
+                if (!success) {
+                    free(blob);
+                }
+            }
+        }
+        moved += length > 0 ? 1 : 0;
+
+        // The definition is read from the map or its old buffer until here
+        Buffer def = {0};
+        encode_task(&def, task, task->creation_time);
+        success = success && !def.failed && put_task(def.data, (uint32_t)def.length, true);
+        if (!success) {
+            buf_free(&def);
+        }
+    }
+    free(task);
+
+    if (!success || !compact()) {
+        log_message(LOG_ERROR, "Failed to upgrade journal storage %s", snapshot_path);
+        return false;
+    }
+
+    legacy_format = false;
+    log_message(LOG_INFO, "Upgraded journal storage: moved %d inline scripts to the script store", moved);
+    return true;
+}
+
+// Write the current state to a new snapshot, switch to it and start an
+// empty journal
+static bool compact(void) {
+    char temp_path[PATH_MAX + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", snapshot_path);
+
+    double started = monotonic_seconds();
+    off_t folded = journal_bytes - (off_t)sizeof(JournalHeader);
+    if (!write_snapshot(temp_path, generation + 1)) {
+        unlink(temp_path);
+        return false;
+    }
+
+    if (rename(temp_path, snapshot_path) != 0) {
+        log_message(LOG_ERROR, "Failed to replace snapshot: %s", strerror(errno));
+        unlink(temp_path);
+        return false;
+    }
+    sync_parent_dir(snapshot_path);
+    generation++;
+
+    // The old journal is stale now; later frames must go to a new one
+    bool success = reset_journal();
+
+    int fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    unsigned char *map = MAP_FAILED;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        map = (unsigned char*)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (map == MAP_FAILED) {
+        // Keep serving from the old map and owned definitions
+        log_message(LOG_ERROR, "Failed to map new snapshot: %s", strerror(errno));
+        return false;
+    }
+
+    // Point every definition into the new map, in the order it was written
+    SnapshotHeader header;
+    memcpy(&header, map, sizeof(header));
+    const SnapshotTask *records = (const SnapshotTask*)(map + header.tasks_offset);
+    for (int i = 0; i < task_count; i++) {
+        StoredTask *entry = &tasks[task_index[records[i].id]];
+        if (entry->def_owned) {
+            free((void*)entry->def);
+        }
+        entry->def = map + header.defs_offset + records[i].def_offset;
+        entry->def_owned = false;
+    }
+
+    // Script bodies too, written in array order
+    Reader reader = { map + header.scripts_offset, map + header.scripts_offset + header.scripts_bytes, true };
+    for (int i = 0; i < script_count; i++) {
+        StoredScript script;
+        decode_script(&reader, &script);
+        if (scripts[i].body_owned) {
+            free((void*)scripts[i].body);
+        }
+        scripts[i].body = script.body;
+        scripts[i].body_owned = false;
+    }
+
+    if (snapshot_map) {
+        munmap(snapshot_map, snapshot_size);
+    }
+    snapshot_map = map;
+    snapshot_size = (size_t)st.st_size;
+
+    log_message(LOG_INFO, "Journal compacted: %lld bytes folded into a %zu byte snapshot in %.1f ms",
+                (long long)folded, snapshot_size, (monotonic_seconds() - started) * 1000.0);
+    return success;
+}
+
+// Write the in-memory state as a snapshot file, sequentially
+static bool write_snapshot(const char *path, uint64_t snapshot_generation) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_message(LOG_ERROR, "Failed to create snapshot %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.generation = snapshot_generation;
+    header.task_count = (uint64_t)task_count;
+    header.edge_count = (uint64_t)edge_count;
+    header.run_count = (uint64_t)run_count;
+    header.script_count = (uint64_t)script_count;
+    header.next_ids[DB_COUNTER_TASK_ID] = next_ids[DB_COUNTER_TASK_ID];
+    header.next_ids[DB_COUNTER_RUN_ID] = next_ids[DB_COUNTER_RUN_ID];
+    header.tasks_offset = sizeof(SnapshotHeader);
+    header.edges_offset = header.tasks_offset + sizeof(SnapshotTask) * header.task_count;
+    header.runs_offset = header.edges_offset + sizeof(SnapshotEdge) * header.edge_count;
+
+    Buffer out = {0};
+    off_t offset = (off_t)sizeof(SnapshotHeader);
+    bool success = true;
+
+    // Sections in file order, flushed in large chunks
+    uint64_t def_offset = 0;
+    for (int id = 0; success && id < task_index_size; id++) {
+        if (task_index[id] < 0) {
+            continue;
+        }
+        const StoredTask *entry = &tasks[task_index[id]];
+        SnapshotTask record = {
+            .id = entry->id,
+            .enabled = entry->enabled ? 1 : 0,
+            .exit_code = entry->exit_code,
+            .last_run_id = entry->last_run_id,
+            .next_run_time = entry->next_run_time,
+            .last_run_time = entry->last_run_time,
+            .avg_runtime = entry->avg_runtime,
+            .def_offset = def_offset,
+            .def_length = entry->def_length,
+            .reserved = 0,
+        };
+        put_bytes(&out, &record, sizeof(record));
+        def_offset += entry->def_length;
+        success = flush_chunk(fd, &out, &offset, false);
+    }
+
+    for (int i = 0; success && i < edge_count; i++) {
+        SnapshotEdge record = { (int32_t)(edges[i] >> 32), (int32_t)(uint32_t)edges[i] };
+        put_bytes(&out, &record, sizeof(record));
+        success = flush_chunk(fd, &out, &offset, false);
+    }
+
+    off_t runs_start = offset + (off_t)out.length;
+    for (int i = 0; success && i < run_count; i++) {
+        encode_workflow_run(&out, &runs[i]);
+        success = flush_chunk(fd, &out, &offset, false);
+    }
+    off_t defs_start = offset + (off_t)out.length;
+
+    for (int id = 0; success && id < task_index_size; id++) {
+        if (task_index[id] >= 0) {
+            const StoredTask *entry = &tasks[task_index[id]];
+            put_bytes(&out, entry->def, entry->def_length);
+            success = flush_chunk(fd, &out, &offset, false);
+        }
+    }
+    off_t scripts_start = offset + (off_t)out.length;
+
+    for (int i = 0; success && i < script_count; i++) {
+        encode_script(&out, &scripts[i]);
+        success = flush_chunk(fd, &out, &offset, false);
+    }
+    off_t scripts_end = offset + (off_t)out.length;
+    success = success && flush_chunk(fd, &out, &offset, true);
+    buf_free(&out);
+
+    header.runs_bytes = (uint64_t)(defs_start - runs_start);
+    header.defs_offset = (uint64_t)defs_start;
+    header.defs_bytes = def_offset;
+    header.scripts_offset = (uint64_t)scripts_start;
+    header.scripts_bytes = (uint64_t)(scripts_end - scripts_start);
+
+    // The header goes last, so a partial file is never taken for a snapshot
+    success = success && write_all(fd, &header, sizeof(header), 0) && fdatasync(fd) == 0;
+    if (!success) {
+        log_message(LOG_ERROR, "Failed to write snapshot %s: %s", path, strerror(errno));
+    }
+    close(fd);
+    return success;
+}
+
+// Write out the buffered part of a snapshot once it is large (or when forced)
+static bool flush_chunk(int fd, Buffer *out, off_t *offset, bool force) {
+    if (out->failed) {
+        return false;
+    }
+    if (out->length < WRITE_CHUNK_BYTES && !force) {
+        return true;
+    }
+
+    bool success = write_all(fd, out->data, out->length, *offset);
+    *offset += (off_t)out->length;
+    out->length = 0;
+    return success;
+}
+
+// Compact once the journal has outgrown the configured size
+static void maybe_compact(void) {
+    if (!in_transaction && journal_bytes - (off_t)sizeof(JournalHeader) >= compact_bytes) {
+        compact();
+    }
+}
+
+// Make a rename durable
+static bool sync_parent_dir(const char *path) {
+    char copy[PATH_MAX];
+    safe_strcpy(copy, path, sizeof(copy));
+
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool success = fsync(fd) == 0;
+    close(fd);
+    return success;
+}
+
+// Open the output file for appending, cutting off a record left
+// incomplete by a crash so later records stay aligned
+static bool open_output(void) {
+    output_fd = open(output_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (output_fd < 0 || fstat(output_fd, &st) != 0) {
+        log_message(LOG_ERROR, "Failed to open captured output %s: %s", output_path, strerror(errno));
+        return false;
+    }
+
+    OutputHeader header;
+    off_t offset = 0;
+    off_t next;
+    while ((next = next_output_record(output_fd, offset, st.st_size, &header)) > 0) {
+        offset = next;
+    }
+    if (offset < st.st_size) {
+        log_message(LOG_WARNING, "Dropping %lld bytes of incomplete captured output",
+                    (long long)(st.st_size - offset));
+        if (ftruncate(output_fd, offset) != 0) {
+            log_message(LOG_ERROR, "Failed to truncate captured output: %s", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read the output record header at offset. Returns the offset of the next
+// record, or 0 if there is no complete record at offset.
+static off_t next_output_record(int fd, off_t offset, off_t end, OutputHeader *header) {
+    if (end - offset < (off_t)sizeof(OutputHeader) ||
+        pread(fd, header, sizeof(OutputHeader), offset) != (ssize_t)sizeof(OutputHeader)) {
+        return 0;
+    }
+
+    off_t next = offset + (off_t)sizeof(OutputHeader) + header->output_length + header->error_length;
+    return next <= end ? next : 0;
+}
+
+// Offset of the first output record that history retention keeps
+static off_t output_prune_offset(int fd, off_t end) {
+    OutputHeader header;
+    off_t total = 0;
+    off_t offset = 0;
+    off_t next;
+    while ((next = next_output_record(fd, offset, end, &header)) > 0) {
+        total++;
+        offset = next;
+    }
+
+    off_t drop = history_max_rows > 0 && total > history_max_rows ? total - history_max_rows : 0;
+    double cutoff = history_days > 0 ? (double)time(NULL) - history_days * 86400.0 : 0;
+
+    offset = 0;
+    for (off_t i = 0; (next = next_output_record(fd, offset, end, &header)) > 0; i++) {
+        if (i >= drop && header.start_time >= cutoff) {
+            break;
+        }
+        offset = next;
+    }
+    return offset;
+}
+
+// Convert the execution history of older versions (<db>.runs, records
+// without the cgroup measurements) into <db>.history
+static bool upgrade_history(const char *db_path) {
+    char legacy_path[PATH_MAX];
+    if ((size_t)snprintf(legacy_path, sizeof(legacy_path), "%s%s", db_path, LEGACY_HISTORY_SUFFIX) >=
+        sizeof(legacy_path) || !file_exists(legacy_path)) {
+        return true;
+    }
+    if (file_exists(history_path)) {
+        // Converted before, the old file was just not removed yet
+        unlink(legacy_path);
+        return true;
+    }
+
+    int fd = open(legacy_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        log_message(LOG_ERROR, "Failed to open execution history %s: %s", legacy_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    char temp_path[PATH_MAX + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", history_path);
+    int out = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool success = out >= 0;
+
+    Buffer converted = { 0 };
+    off_t count = st.st_size / (off_t)LEGACY_HISTORY_RECORD_SIZE;
+    off_t written = 0;
+    for (off_t i = 0; success && i < count; i++) {
+        HistoryRecord record;
+        success = pread(fd, &record, LEGACY_HISTORY_RECORD_SIZE, i * (off_t)LEGACY_HISTORY_RECORD_SIZE) ==
+                  (ssize_t)LEGACY_HISTORY_RECORD_SIZE;
+        record.memory_peak_kb = -1;
+        record.io_read_bytes = -1;
+        record.io_write_bytes = -1;
+        put_bytes(&converted, &record, sizeof(record));
+        if (success && (converted.length >= WRITE_CHUNK_BYTES || i == count - 1)) {
+            success = !converted.failed && write_all(out, converted.data, converted.length, written);
+            written += (off_t)converted.length;
+            converted.length = 0;
+        }
+    }
+    buf_free(&converted);
+    close(fd);
+
+    if (success && durability != DB_DURABILITY_FAST) {
+        success = fdatasync(out) == 0;
+    }
+    if (out >= 0) {
+        close(out);
+    }
+    success = success && rename(temp_path, history_path) == 0 && sync_parent_dir(history_path);
+    if (!success) {
+        log_message(LOG_ERROR, "Failed to convert execution history %s: %s", legacy_path, strerror(errno));
+        unlink(temp_path);
+        return false;
+    }
+
+    unlink(legacy_path);
+    log_message(LOG_INFO, "Converted %lld execution history records to %s", (long long)count, history_path);
+    return true;
+}
+
+// Replace the append-only file at path by its bytes from offset to end,
+// read through fd, and reopen *append_fd on the new file
+static bool drop_file_prefix(const char *path, int *append_fd, int fd, off_t offset, off_t end) {
+    char temp_path[PATH_MAX + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    int out = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool success = out >= 0;
+
+    unsigned char *chunk = success ? (unsigned char*)malloc(WRITE_CHUNK_BYTES) : NULL;
+    success = success && chunk != NULL;
+
+    off_t written = 0;
+    while (success && offset < end) {
+        size_t want = (size_t)(end - offset) < WRITE_CHUNK_BYTES ? (size_t)(end - offset) : WRITE_CHUNK_BYTES;
+        ssize_t got = pread(fd, chunk, want, offset);
+        success = got > 0 && write_all(out, chunk, (size_t)got, written);
+        offset += got;
+        written += got;
+    }
+    free(chunk);
+
+    if (success && durability != DB_DURABILITY_FAST) {
+        success = fdatasync(out) == 0;
+    }
+    if (out >= 0) {
+        close(out);
+    }
+    if (success) {
+        success = rename(temp_path, path) == 0;
+    }
+    if (!success) {
+        unlink(temp_path);
+        return false;
+    }
+
+    int reopened = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (reopened >= 0) {
+        close(*append_fd);
+        *append_fd = reopened;
+    } else {
+        log_message(LOG_ERROR, "Failed to reopen %s: %s", path, strerror(errno));
+    }
+    return true;
+}
+
+// Free everything and close the files; the storage can be opened again
+static void release_state(void) {
+    for (int i = 0; i < task_count; i++) {
+        if (tasks[i].def_owned) {
+            free((void*)tasks[i].def);
+        }
+    }
+    free(tasks);
+    free(task_index);
+    free(due_heap);
+    free(edges);
+    for (int i = 0; i < run_count; i++) {
+        free(runs[i].task_ids);
+        free(runs[i].node_states);
+    }
+    free(runs);
+    for (int i = 0; i < script_count; i++) {
+        if (scripts[i].body_owned) {
+            free((void*)scripts[i].body);
+        }
+    }
+    free(scripts);
+    buf_free(&pending);
+    buf_free(&pending_history);
+    buf_free(&pending_output);
+
+    tasks = NULL;
+    task_index = NULL;
+    due_heap = NULL;
+    edges = NULL;
+    runs = NULL;
+    scripts = NULL;
+    task_count = task_capacity = task_index_size = due_count = 0;
+    edge_count = edge_capacity = 0;
+    run_count = run_capacity = 0;
+    script_count = script_capacity = 0;
+    in_transaction = false;
+    legacy_format = false;
+
+    if (snapshot_map) {
+        munmap(snapshot_map, snapshot_size);
+        snapshot_map = NULL;
+    }
+    if (journal_fd >= 0) {
+        close(journal_fd);
+        journal_fd = -1;
+    }
+    if (history_fd >= 0) {
+        close(history_fd);
+        history_fd = -1;
+    }
+    if (output_fd >= 0) {
+        close(output_fd);
+        output_fd = -1;
+    }
+}
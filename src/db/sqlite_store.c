@@ -0,0 +1,1764 @@
+#include "../../include/storage.h"
+#include "../../include/scripts.h"
+#include "../../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#define INITIAL_LOAD_CAPACITY 256
+#define PRUNE_CHUNK_ROWS 1000
+#define MAX_READ_CONNECTIONS 16
+
+// SQLite storage backend: the default. Tasks, dependencies, workflow runs and
+// execution history live in tables of one database file in WAL mode. Writes
+// go through one connection; lookups and listings use a pool of read-only
+// connections so they never wait behind it.
+
+// Global database connection
+static sqlite3 *db = NULL;
+
+// Statements prepared once in db_init, indexed by DbStatement
+typedef enum {
+    STMT_INSERT_TASK,
+    STMT_UPSERT_TASK,
+    STMT_UPDATE_TASK,
+    STMT_UPDATE_TASK_STATUS,
+    STMT_DELETE_TASK,
+    STMT_SELECT_ALL_TASKS,
+    STMT_SELECT_TASK_BY_ID,
+    STMT_SELECT_TASKS_PAGE,
+    STMT_RESERVE_IDS,
+    STMT_RELEASE_IDS,
+    STMT_COUNT_TASKS,
+    STMT_SELECT_TASK_SUMMARIES,
+    STMT_SELECT_DUE_TASK_IDS,
+    STMT_INSERT_DEPENDENCY,
+    STMT_DELETE_DEPENDENCY,
+    STMT_DELETE_TASK_DEPENDENCIES,
+    STMT_SELECT_ALL_DEPENDENCIES,
+    STMT_SAVE_WORKFLOW_RUN,
+    STMT_SELECT_WORKFLOW_RUN,
+    STMT_INSERT_TASK_RUN,
+    STMT_SELECT_LAST_TASK_RUN,
+    STMT_PRUNE_TASK_RUNS_BY_AGE,
+    STMT_PRUNE_TASK_RUNS_BY_COUNT,
+    STMT_SAVE_SCRIPT,
+    STMT_SELECT_SCRIPT,
+    STMT_SELECT_SCRIPT_SIZE,
+    STMT_PRUNE_SCRIPTS,
+    STMT_COUNT
+} DbStatement;
+
+static sqlite3_stmt *statements[STMT_COUNT];
+
+// Serializes use of the connection and the shared statements. Recursive so
+// a function can hold it across a transaction while acquiring statements.
+static pthread_mutex_t db_lock;
+static pthread_once_t db_lock_once = PTHREAD_ONCE_INIT;
+
+// Read-only connection with its own copies of the read-only statements.
+// WAL lets readers see the last commit without waiting for the writer.
+typedef struct {
+    sqlite3 *conn;
+    sqlite3_stmt *statements[STMT_COUNT];   // NULL for statements that write
+    bool busy;
+} ReadConnection;
+
+// Pool serving lookups and listings; empty when readers go to the writer
+static ReadConnection readers[MAX_READ_CONNECTIONS];
+static int reader_count = 0;
+static pthread_mutex_t reader_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reader_free = PTHREAD_COND_INITIALIZER;
+
+// Non-NULL in the thread holding an open transaction on the writer; its
+// reads stay on the writer so they see its own uncommitted rows
+static pthread_key_t transaction_key;
+
+// Execution history retention limits, from the storage config
+static int history_days;
+static int history_max_rows;
+
+// Helper functions
+static void db_lock_init(void);
+static bool sqlite_checkpoint(bool truncate);
+static bool apply_storage_config(const DbStorageConfig *config);
+static bool prepare_statements(void);
+static void finalize_statements(void);
+static bool open_readers(const char *db_path, const DbStorageConfig *config);
+static void close_readers(void);
+static sqlite3_stmt* stmt_acquire(DbStatement id);
+static void stmt_release(sqlite3_stmt *stmt);
+static void bind_task_row(sqlite3_stmt *stmt, const Task *task);
+static void read_task_row(sqlite3_stmt *stmt, Task *task);
+static void read_text_column(sqlite3_stmt *stmt, int column, char *dest, size_t size);
+static void bind_output(sqlite3_stmt *stmt, int column, const CapturedOutput *output);
+static bool column_output(sqlite3_stmt *stmt, int column, CapturedOutput *output);
+static void bind_measure(sqlite3_stmt *stmt, int column, long long value);
+static long long column_measure(sqlite3_stmt *stmt, int column);
+static bool migrate_inline_scripts(void);
+
+// SQL statements
+static const char *CREATE_TABLE_SQL =
+    "CREATE TABLE IF NOT EXISTS tasks ("
+    "id INTEGER PRIMARY KEY, "
+    "name TEXT NOT NULL, "
+    "command TEXT NOT NULL, "
+    "creation_time INTEGER NOT NULL, "
+    "next_run_time INTEGER, "
+    "last_run_time INTEGER, "
+    "frequency INTEGER NOT NULL, "
+    "interval INTEGER, "
+    "enabled INTEGER NOT NULL, "
+    "exit_code INTEGER, "
+    "max_runtime INTEGER, "
+    "working_dir TEXT, "
+    "exec_mode INTEGER NOT NULL DEFAULT 0, "
+    "script_content TEXT, "      // Inline scripts of older versions, moved to scripts at startup
+    "dep_behavior INTEGER NOT NULL DEFAULT 0, "
+    "schedule_type INTEGER NOT NULL DEFAULT 0, "
+    "cron_expression TEXT, "
+    "ai_prompt TEXT, "
+    "system_metrics TEXT, "
+    "last_run_id INTEGER NOT NULL DEFAULT 0, "
+    "avg_runtime REAL NOT NULL DEFAULT 0, "
+    "script_hash TEXT, "
+    "resource_limits TEXT"
+    ");"
+    
+    // Serves the due-window queries used when only part of the tasks is resident
+    "CREATE INDEX IF NOT EXISTS idx_tasks_due ON tasks (enabled, next_run_time);"
+    
+    "CREATE TABLE IF NOT EXISTS dependencies ("
+    "task_id INTEGER, "
+    "depends_on INTEGER, "
+    "PRIMARY KEY (task_id, depends_on), "
+    "FOREIGN KEY (task_id) REFERENCES tasks(id) ON DELETE CASCADE, "
+    "FOREIGN KEY (depends_on) REFERENCES tasks(id) ON DELETE CASCADE"
+    ");"
+    
+    "CREATE TABLE IF NOT EXISTS workflow_runs ("
+    "run_id INTEGER PRIMARY KEY, "
+    "root_task_id INTEGER NOT NULL, "
+    "start_time INTEGER NOT NULL, "
+    "end_time INTEGER, "
+    "status INTEGER NOT NULL, "
+    "node_count INTEGER NOT NULL, "
+    "task_ids BLOB, "
+    "node_states BLOB"
+    ");"
+    
+    "CREATE TABLE IF NOT EXISTS task_runs ("
+    "id INTEGER PRIMARY KEY, "
+    "task_id INTEGER NOT NULL, "
+    "run_id INTEGER NOT NULL DEFAULT 0, "
+    "trigger_source INTEGER NOT NULL, "
+    "start_time REAL NOT NULL, "
+    "end_time REAL NOT NULL, "
+    "duration REAL NOT NULL, "
+    "exit_code INTEGER NOT NULL, "
+    "signal INTEGER NOT NULL DEFAULT 0, "
+    "timed_out INTEGER NOT NULL DEFAULT 0, "
+    "user_cpu REAL, "
+    "sys_cpu REAL, "
+    "max_rss_kb INTEGER, "
+    "output BLOB, "
+    "output_bytes INTEGER NOT NULL DEFAULT 0, "
+    "error_output BLOB, "
+    "error_output_bytes INTEGER NOT NULL DEFAULT 0, "
+    "memory_peak_kb INTEGER, "     // NULL where the run had no cgroup
+    "io_read_bytes INTEGER, "
+    "io_write_bytes INTEGER"
+    ");"
+    "CREATE INDEX IF NOT EXISTS idx_task_runs_task ON task_runs (task_id, start_time);"
+    "CREATE INDEX IF NOT EXISTS idx_task_runs_start ON task_runs (start_time);"
+    
+    // Script bodies, stored once each (zlib-compressed) under their SHA-256
+    "CREATE TABLE IF NOT EXISTS scripts ("
+    "hash TEXT PRIMARY KEY, "
+    "raw_size INTEGER NOT NULL, "
+    "body BLOB NOT NULL, "
+    "stored_time INTEGER NOT NULL"
+    ");"
+    
+    "CREATE TABLE IF NOT EXISTS meta ("
+    "key TEXT PRIMARY KEY, "
+    "value INTEGER NOT NULL"
+    ");";
+
+// Create the ID counters, or move them past IDs written without them
+// (databases from older versions)
+static const char *SEED_ID_COUNTERS_SQL =
+    "INSERT INTO meta (key, value) SELECT 'next_task_id', COALESCE(MAX(id), 0) + 1 FROM tasks WHERE 1 "
+    "ON CONFLICT (key) DO UPDATE SET value = MAX(value, excluded.value);"
+    "INSERT INTO meta (key, value) SELECT 'next_run_id', COALESCE(MAX(run_id), 0) + 1 FROM workflow_runs WHERE 1 "
+    "ON CONFLICT (key) DO UPDATE SET value = MAX(value, excluded.value);";
+
+static const char *ID_COUNTER_KEYS[] = {
+    [DB_COUNTER_TASK_ID] = "next_task_id",
+    [DB_COUNTER_RUN_ID] = "next_run_id",
+};
+
+// Columns added after the first release; "duplicate column" errors are expected
+static const char *MIGRATIONS_SQL[] = {
+    "ALTER TABLE tasks ADD COLUMN last_run_id INTEGER NOT NULL DEFAULT 0;",
+    "ALTER TABLE tasks ADD COLUMN avg_runtime REAL NOT NULL DEFAULT 0;",
+    "ALTER TABLE tasks ADD COLUMN script_hash TEXT;",
+    "ALTER TABLE task_runs ADD COLUMN output BLOB;",
+    "ALTER TABLE task_runs ADD COLUMN output_bytes INTEGER NOT NULL DEFAULT 0;",
+    "ALTER TABLE task_runs ADD COLUMN error_output BLOB;",
+    "ALTER TABLE task_runs ADD COLUMN error_output_bytes INTEGER NOT NULL DEFAULT 0;",
+    "ALTER TABLE tasks ADD COLUMN resource_limits TEXT;",
+    "ALTER TABLE task_runs ADD COLUMN memory_peak_kb INTEGER;",
+    "ALTER TABLE task_runs ADD COLUMN io_read_bytes INTEGER;",
+    "ALTER TABLE task_runs ADD COLUMN io_write_bytes INTEGER;",
+    NULL
+};
+
+static const char *INSERT_TASK_SQL =
+    "INSERT INTO tasks ("
+    "id, name, command, creation_time, next_run_time, last_run_time, "
+    "frequency, interval, enabled, exit_code, max_runtime, working_dir, "
+    "exec_mode, script_hash, dep_behavior, schedule_type, cron_expression, "
+    "ai_prompt, system_metrics, last_run_id, avg_runtime, resource_limits"
+    ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+static const char *UPSERT_TASK_SQL =
+    "INSERT INTO tasks ("
+    "id, name, command, creation_time, next_run_time, last_run_time, "
+    "frequency, interval, enabled, exit_code, max_runtime, working_dir, "
+    "exec_mode, script_hash, dep_behavior, schedule_type, cron_expression, "
+    "ai_prompt, system_metrics, last_run_id, avg_runtime, resource_limits"
+    ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?) "
+    "ON CONFLICT(id) DO UPDATE SET "
+    "name = excluded.name, command = excluded.command, "
+    "next_run_time = excluded.next_run_time, last_run_time = excluded.last_run_time, "
+    "frequency = excluded.frequency, interval = excluded.interval, "
+    "enabled = excluded.enabled, exit_code = excluded.exit_code, "
+    "max_runtime = excluded.max_runtime, working_dir = excluded.working_dir, "
+    "exec_mode = excluded.exec_mode, script_hash = excluded.script_hash, "
+    "dep_behavior = excluded.dep_behavior, schedule_type = excluded.schedule_type, "
+    "cron_expression = excluded.cron_expression, ai_prompt = excluded.ai_prompt, "
+    "system_metrics = excluded.system_metrics, last_run_id = excluded.last_run_id, "
+    "avg_runtime = excluded.avg_runtime, resource_limits = excluded.resource_limits;";
+
+static const char *UPDATE_TASK_SQL =
+    "UPDATE tasks SET "
+    "name = ?, command = ?, next_run_time = ?, last_run_time = ?, "
+    "frequency = ?, interval = ?, enabled = ?, exit_code = ?, "
+    "max_runtime = ?, working_dir = ?, exec_mode = ?, script_hash = ?, "
+    "dep_behavior = ?, schedule_type = ?, cron_expression = ?, "
+    "ai_prompt = ?, system_metrics = ?, last_run_id = ?, avg_runtime = ?, resource_limits = ? "
+    "WHERE id = ?;";
+
+// Run-state columns only; the definition columns (and their large text
+// values) are left untouched
+static const char *UPDATE_TASK_STATUS_SQL =
+    "UPDATE tasks SET "
+    "next_run_time = ?, last_run_time = ?, exit_code = ?, last_run_id = ?, avg_runtime = ? "
+    "WHERE id = ?;";
+
+static const char *DELETE_TASK_SQL =
+    "DELETE FROM tasks WHERE id = ?;";
+
+static const char *SELECT_ALL_TASKS_SQL =
+    "SELECT * FROM tasks;";
+
+static const char *SELECT_TASK_BY_ID_SQL =
+    "SELECT * FROM tasks WHERE id = ?;";
+
+static const char *SELECT_TASKS_PAGE_SQL =
+    "SELECT * FROM tasks WHERE id > ? ORDER BY id LIMIT ?;";
+
+// Hands out the block [value, value + count) and advances the counter in
+// one statement, so concurrent connections always get disjoint blocks
+static const char *RESERVE_IDS_SQL =
+    "UPDATE meta SET value = value + ?1 WHERE key = ?2 RETURNING value - ?1;";
+
+// Moves the counter back only if no block was reserved since
+static const char *RELEASE_IDS_SQL =
+    "UPDATE meta SET value = ?1 WHERE key = ?2 AND value = ?3;";
+
+static const char *COUNT_TASKS_SQL =
+    "SELECT COUNT(*) FROM tasks;";
+
+static const char *SELECT_TASK_SUMMARIES_SQL =
+    "SELECT id, last_run_time, exit_code, avg_runtime FROM tasks ORDER BY id;";
+
+static const char *SELECT_DUE_TASK_IDS_SQL =
+    "SELECT id FROM tasks WHERE enabled = 1 AND next_run_time > 0 AND next_run_time <= ? "
+    "ORDER BY next_run_time LIMIT ?;";
+
+static const char *INSERT_DEPENDENCY_SQL =
+    "INSERT OR IGNORE INTO dependencies (task_id, depends_on) VALUES (?, ?);";
+
+static const char *DELETE_DEPENDENCY_SQL =
+    "DELETE FROM dependencies WHERE task_id = ? AND depends_on = ?;";
+
+static const char *DELETE_TASK_DEPENDENCIES_SQL =
+    "DELETE FROM dependencies WHERE task_id = ? OR depends_on = ?;";
+
+static const char *SELECT_ALL_DEPENDENCIES_SQL =
+    "SELECT task_id, depends_on FROM dependencies ORDER BY task_id, depends_on;";
+
+static const char *SAVE_WORKFLOW_RUN_SQL =
+    "INSERT OR REPLACE INTO workflow_runs ("
+    "run_id, root_task_id, start_time, end_time, status, node_count, task_ids, node_states"
+    ") VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
+
+static const char *SELECT_WORKFLOW_RUN_SQL =
+    "SELECT root_task_id, start_time, end_time, status, node_count, task_ids, node_states "
+    "FROM workflow_runs WHERE run_id = ?;";
+
+// History rows are append-only and never reference tasks, so they outlive
+// deleted tasks until retention removes them
+static const char *INSERT_TASK_RUN_SQL =
+    "INSERT INTO task_runs ("
+    "task_id, run_id, trigger_source, start_time, end_time, duration, "
+    "exit_code, signal, timed_out, user_cpu, sys_cpu, max_rss_kb, "
+    "output, output_bytes, error_output, error_output_bytes, "
+    "memory_peak_kb, io_read_bytes, io_write_bytes"
+    ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+
+static const char *SELECT_LAST_TASK_RUN_SQL =
+    "SELECT run_id, trigger_source, start_time, end_time, duration, exit_code, signal, "
+    "timed_out, user_cpu, sys_cpu, max_rss_kb, output, output_bytes, error_output, error_output_bytes, "
+    "memory_peak_kb, io_read_bytes, io_write_bytes "
+    "FROM task_runs WHERE task_id = ? ORDER BY id DESC LIMIT 1;";
+
+// Retention deletes at most ?2 of the oldest rows per statement; ids grow
+// with insertion time, so the oldest rows are the lowest ids
+static const char *PRUNE_TASK_RUNS_BY_AGE_SQL =
+    "DELETE FROM task_runs WHERE id IN ("
+    "SELECT id FROM task_runs WHERE start_time < ?1 ORDER BY id LIMIT ?2);";
+
+static const char *PRUNE_TASK_RUNS_BY_COUNT_SQL =
+    "DELETE FROM task_runs WHERE id IN ("
+    "SELECT id FROM task_runs WHERE id <= ("
+    "SELECT id FROM task_runs ORDER BY id DESC LIMIT 1 OFFSET ?1) "
+    "ORDER BY id LIMIT ?2);";
+
+// Storing an existing body only refreshes its timestamp
+static const char *SAVE_SCRIPT_SQL =
+    "INSERT INTO scripts (hash, raw_size, body, stored_time) VALUES (?, ?, ?, ?) "
+    "ON CONFLICT(hash) DO UPDATE SET stored_time = excluded.stored_time;";
+
+static const char *SELECT_SCRIPT_SQL =
+    "SELECT raw_size, body FROM scripts WHERE hash = ?;";
+
+static const char *SELECT_SCRIPT_SIZE_SQL =
+    "SELECT raw_size FROM scripts WHERE hash = ?;";
+
+static const char *PRUNE_SCRIPTS_SQL =
+    "DELETE FROM scripts WHERE stored_time < ? AND hash NOT IN ("
+    "SELECT script_hash FROM tasks WHERE script_hash IS NOT NULL);";
+
+static const char **STATEMENT_SQL[STMT_COUNT] = {
+    [STMT_INSERT_TASK] = &INSERT_TASK_SQL,
+    [STMT_UPSERT_TASK] = &UPSERT_TASK_SQL,
+    [STMT_UPDATE_TASK] = &UPDATE_TASK_SQL,
+    [STMT_UPDATE_TASK_STATUS] = &UPDATE_TASK_STATUS_SQL,
+    [STMT_DELETE_TASK] = &DELETE_TASK_SQL,
+    [STMT_SELECT_ALL_TASKS] = &SELECT_ALL_TASKS_SQL,
+    [STMT_SELECT_TASK_BY_ID] = &SELECT_TASK_BY_ID_SQL,
+    [STMT_SELECT_TASKS_PAGE] = &SELECT_TASKS_PAGE_SQL,
+    [STMT_RESERVE_IDS] = &RESERVE_IDS_SQL,
+    [STMT_RELEASE_IDS] = &RELEASE_IDS_SQL,
+    [STMT_COUNT_TASKS] = &COUNT_TASKS_SQL,
+    [STMT_SELECT_TASK_SUMMARIES] = &SELECT_TASK_SUMMARIES_SQL,
+    [STMT_SELECT_DUE_TASK_IDS] = &SELECT_DUE_TASK_IDS_SQL,
+    [STMT_INSERT_DEPENDENCY] = &INSERT_DEPENDENCY_SQL,
+    [STMT_DELETE_DEPENDENCY] = &DELETE_DEPENDENCY_SQL,
+    [STMT_DELETE_TASK_DEPENDENCIES] = &DELETE_TASK_DEPENDENCIES_SQL,
+    [STMT_SELECT_ALL_DEPENDENCIES] = &SELECT_ALL_DEPENDENCIES_SQL,
+    [STMT_SAVE_WORKFLOW_RUN] = &SAVE_WORKFLOW_RUN_SQL,
+    [STMT_SELECT_WORKFLOW_RUN] = &SELECT_WORKFLOW_RUN_SQL,
+    [STMT_INSERT_TASK_RUN] = &INSERT_TASK_RUN_SQL,
+    [STMT_SELECT_LAST_TASK_RUN] = &SELECT_LAST_TASK_RUN_SQL,
+    [STMT_PRUNE_TASK_RUNS_BY_AGE] = &PRUNE_TASK_RUNS_BY_AGE_SQL,
+    [STMT_PRUNE_TASK_RUNS_BY_COUNT] = &PRUNE_TASK_RUNS_BY_COUNT_SQL,
+    [STMT_SAVE_SCRIPT] = &SAVE_SCRIPT_SQL,
+    [STMT_SELECT_SCRIPT] = &SELECT_SCRIPT_SQL,
+    [STMT_SELECT_SCRIPT_SIZE] = &SELECT_SCRIPT_SIZE_SQL,
+    [STMT_PRUNE_SCRIPTS] = &PRUNE_SCRIPTS_SQL,
+};
+
+static bool sqlite_open(const char *db_path, const DbStorageConfig *config) {
+    pthread_once(&db_lock_once, db_lock_init);
+
+    // Open database connection
+    int rc = sqlite3_open(db_path, &db);
+    if (rc != SQLITE_OK) {
+        log_message(LOG_ERROR, "Failed to open database: %s", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    // Create tables if they don't exist
+    char *err_msg = NULL;
+    rc = sqlite3_exec(db, CREATE_TABLE_SQL, NULL, NULL, &err_msg);
+    if (rc != SQLITE_OK) {
+        log_message(LOG_ERROR, "SQL error: %s", err_msg);
+        sqlite3_free(err_msg);
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    // Bring tables created by older versions up to date
+    for (int i = 0; MIGRATIONS_SQL[i] != NULL; i++) {
+        rc = sqlite3_exec(db, MIGRATIONS_SQL[i], NULL, NULL, &err_msg);
+        if (rc != SQLITE_OK) {
+            if (!err_msg || strstr(err_msg, "duplicate column") == NULL) {
+                log_message(LOG_ERROR, "SQL error migrating database: %s", err_msg ? err_msg : "unknown");
+            }
+            sqlite3_free(err_msg);
+            err_msg = NULL;
+        }
+    }
+
+    rc = sqlite3_exec(db, SEED_ID_COUNTERS_SQL, NULL, NULL, &err_msg);
+    if (rc != SQLITE_OK) {
+        log_message(LOG_ERROR, "SQL error seeding ID counters: %s", err_msg);
+        sqlite3_free(err_msg);
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    // Enable foreign keys
+    rc = sqlite3_exec(db, "PRAGMA foreign_keys = ON;", NULL, NULL, &err_msg);
+    if (rc != SQLITE_OK) {
+        log_message(LOG_ERROR, "SQL error enabling foreign keys: %s", err_msg);
+        sqlite3_free(err_msg);
+        // Not critical, continue anyway
+    }
+
+    history_days = config->history_days;
+    history_max_rows = config->history_max_rows;
+    if (!apply_storage_config(config)) {
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    if (!prepare_statements()) {
+        finalize_statements();
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    if (!migrate_inline_scripts()) {
+        finalize_statements();
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    // Opened last, once the schema and the WAL files exist
+    if (!open_readers(db_path, config)) {
+        log_message(LOG_WARNING, "Read connections unavailable, reading through the writer");
+        close_readers();
+    }
+
+    return true;
+}
+
+static void sqlite_close(void) {
+    if (db != NULL) {
+        close_readers();
+        // Leave a compact database file behind for other readers
+        sqlite_checkpoint(true);
+        finalize_statements();
+        sqlite3_close(db);
+        db = NULL;
+    }
+}
+
+static bool sqlite_begin_transaction(void) {
+    if (db == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&db_lock);
+    char *err_msg = NULL;
+    if (sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, &err_msg) != SQLITE_OK) {
+        log_message(LOG_ERROR, "Failed to begin transaction: %s", err_msg ? err_msg : "unknown");
+        sqlite3_free(err_msg);
+        pthread_mutex_unlock(&db_lock);
+        return false;
+    }
+
+    pthread_setspecific(transaction_key, &db_lock);
+    return true;
+}
+
+static bool sqlite_commit_transaction(void) {
+    if (db == NULL) {
+        return false;
+    }
+
+    char *err_msg = NULL;
+    bool success = true;
+    if (sqlite3_exec(db, "COMMIT;", NULL, NULL, &err_msg) != SQLITE_OK) {
+        log_message(LOG_ERROR, "Failed to commit transaction: %s", err_msg ? err_msg : "unknown");
+        sqlite3_free(err_msg);
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        success = false;
+    }
+
+    pthread_setspecific(transaction_key, NULL);
+    pthread_mutex_unlock(&db_lock);
+    return success;
+}
+
+static void sqlite_rollback_transaction(void) {
+    if (db == NULL) {
+        return;
+    }
+
+    sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    pthread_setspecific(transaction_key, NULL);
+    pthread_mutex_unlock(&db_lock);
+}
+
+static bool sqlite_checkpoint(bool truncate) {
+    if (db == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&db_lock);
+    int log_frames = 0;
+    int checkpointed = 0;
+    int rc = sqlite3_wal_checkpoint_v2(db, NULL,
+                                       truncate ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE,
+                                       &log_frames, &checkpointed);
+    pthread_mutex_unlock(&db_lock);
+
+    // A busy truncate still checkpointed what it could
+    if (rc != SQLITE_OK && rc != SQLITE_BUSY) {
+        log_message(LOG_ERROR, "Failed to checkpoint database: %s", sqlite3_errstr(rc));
+        return false;
+    }
+
+    log_message(LOG_DEBUG, "Database checkpoint: %d of %d WAL frames copied", checkpointed, log_frames);
+    return true;
+}
+
+static bool sqlite_save_task(const Task *task) {
+    if (db == NULL || task == NULL) {
+        return false;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_INSERT_TASK);
+    bind_task_row(stmt, task);
+    
+    // Execute the statement
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+    
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to insert task: %s", sqlite3_errmsg(db));
+        return false;
+    }
+    
+    return true;
+}
+
+static bool sqlite_upsert_task(const Task *task) {
+    if (db == NULL || task == NULL) {
+        return false;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_UPSERT_TASK);
+    bind_task_row(stmt, task);
+    
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+    
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to write task: %s", sqlite3_errmsg(db));
+        return false;
+    }
+    
+    return true;
+}
+
+static bool sqlite_update_task(const Task *task) {
+    if (db == NULL || task == NULL) {
+        return false;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_UPDATE_TASK);
+    
+    // Bind parameters
+    sqlite3_bind_text(stmt, 1, task->name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, task->command, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, task->next_run_time);
+    sqlite3_bind_int64(stmt, 4, task->last_run_time);
+    sqlite3_bind_int(stmt, 5, task->frequency);
+    sqlite3_bind_int(stmt, 6, task->interval);
+    sqlite3_bind_int(stmt, 7, task->enabled ? 1 : 0);
+    sqlite3_bind_int(stmt, 8, task->exit_code);
+    sqlite3_bind_int(stmt, 9, task->max_runtime);
+    sqlite3_bind_text(stmt, 10, task->working_dir, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 11, task->exec_mode);
+    sqlite3_bind_text(stmt, 12, task->script_hash, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 13, task->dep_behavior);
+    sqlite3_bind_int(stmt, 14, task->schedule_type);
+    sqlite3_bind_text(stmt, 15, task->cron_expression, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 16, task->ai_prompt, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 17, task->system_metrics, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 18, task->last_run_id);
+    sqlite3_bind_double(stmt, 19, task->avg_runtime);
+    sqlite3_bind_text(stmt, 20, task->resource_limits, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 21, task->id);
+    
+    // Execute the statement
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+    
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to update task: %s", sqlite3_errmsg(db));
+        return false;
+    }
+    
+    return true;
+}
+
+static bool sqlite_update_task_status(const Task *task) {
+    if (db == NULL || task == NULL) {
+        return false;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_UPDATE_TASK_STATUS);
+    
+    sqlite3_bind_int64(stmt, 1, task->next_run_time);
+    sqlite3_bind_int64(stmt, 2, task->last_run_time);
+    sqlite3_bind_int(stmt, 3, task->exit_code);
+    sqlite3_bind_int(stmt, 4, task->last_run_id);
+    sqlite3_bind_double(stmt, 5, task->avg_runtime);
+    sqlite3_bind_int(stmt, 6, task->id);
+    
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+    
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to update task status: %s", sqlite3_errmsg(db));
+        return false;
+    }
+    
+    return true;
+}
+
+static bool sqlite_delete_task(int task_id) {
+    if (db == NULL) {
+        return false;
+    }
+
+    // Hold the connection for the whole transaction
+    pthread_mutex_lock(&db_lock);
+    sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+
+    // Delete all edges touching the task first, in both directions
+    // With foreign keys enabled, this isn't strictly necessary, but let's be explicit
+    sqlite3_stmt *stmt = stmt_acquire(STMT_DELETE_TASK_DEPENDENCIES);
+    
+    sqlite3_bind_int(stmt, 1, task_id);
+    sqlite3_bind_int(stmt, 2, task_id);
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to delete task dependencies: %s", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        pthread_mutex_unlock(&db_lock);
+        return false;
+    }
+
+    // Now delete the task
+    stmt = stmt_acquire(STMT_DELETE_TASK);
+    sqlite3_bind_int(stmt, 1, task_id);
+    rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to delete task: %s", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        pthread_mutex_unlock(&db_lock);
+        return false;
+    }
+
+    // Commit the transaction
+    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    pthread_mutex_unlock(&db_lock);
+
+    return true;
+}
+
+static bool sqlite_load_tasks(Task **tasks, int *count) {
+    if (db == NULL || tasks == NULL || count == NULL) {
+        return false;
+    }
+    
+    // One pass over the rows into a growing array
+    int capacity = INITIAL_LOAD_CAPACITY;
+    int task_count = 0;
+    Task *result = (Task*)malloc(sizeof(Task) * capacity);
+    if (!result) {
+        log_message(LOG_ERROR, "Failed to allocate memory for tasks");
+        return false;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_ALL_TASKS);
+    
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (task_count == capacity) {
+            Task *grown = (Task*)realloc(result, sizeof(Task) * capacity * 2);
+            if (!grown) {
+                log_message(LOG_ERROR, "Failed to allocate memory for tasks");
+                stmt_release(stmt);
+                free(result);
+                return false;
+            }
+            result = grown;
+            capacity *= 2;
+        }
+        
+        read_task_row(stmt, &result[task_count++]);
+    }
+    
+    // The statement may belong to a read connection, which holds the message
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to load tasks: %s", sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        stmt_release(stmt);
+        free(result);
+        return false;
+    }
+    
+    stmt_release(stmt);
+    
+    if (task_count == 0) {
+        free(result);
+        *tasks = NULL;
+        *count = 0;
+        return true;
+    }
+    
+    // Give back the unused tail; shrinking does not move the block
+    Task *trimmed = (Task*)realloc(result, sizeof(Task) * task_count);
+    *tasks = trimmed ? trimmed : result;
+    *count = task_count;
+    
+    return true;
+}
+
+static bool sqlite_load_tasks_page(int after_id, int limit, Task **tasks, int *count) {
+    if (db == NULL || tasks == NULL || count == NULL || limit <= 0) {
+        return false;
+    }
+    
+    *tasks = NULL;
+    *count = 0;
+    
+    Task *result = (Task*)malloc(sizeof(Task) * limit);
+    if (!result) {
+        log_message(LOG_ERROR, "Failed to allocate memory for tasks");
+        return false;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_TASKS_PAGE);
+    
+    sqlite3_bind_int(stmt, 1, after_id);
+    sqlite3_bind_int(stmt, 2, limit);
+    
+    int n = 0;
+    int rc;
+    while (n < limit && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        read_task_row(stmt, &result[n++]);
+    }
+    
+    if (n < limit && rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to load tasks: %s", sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        stmt_release(stmt);
+        free(result);
+        return false;
+    }
+    
+    stmt_release(stmt);
+    
+    if (n == 0) {
+        free(result);
+        return true;
+    }
+    
+    *tasks = result;
+    *count = n;
+    return true;
+}
+
+static bool sqlite_get_task(int task_id, Task *task) {
+    if (db == NULL || task_id < 0 || task == NULL) {
+        return false;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_TASK_BY_ID);
+    
+    sqlite3_bind_int(stmt, 1, task_id);
+    
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        log_message(LOG_WARNING, "Task not found: ID=%d", task_id);
+        stmt_release(stmt);
+        return false;
+    }
+    
+    read_task_row(stmt, task);
+    
+    stmt_release(stmt);
+    
+    return true;
+}
+
+static int sqlite_count_tasks(void) {
+    if (db == NULL) {
+        return -1;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_COUNT_TASKS);
+    
+    int count = -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int(stmt, 0);
+    }
+    
+    stmt_release(stmt);
+    return count;
+}
+
+static bool sqlite_load_task_summaries(TaskSummary **summaries, int *count) {
+    if (db == NULL || summaries == NULL || count == NULL) {
+        return false;
+    }
+    
+    *summaries = NULL;
+    *count = 0;
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_TASK_SUMMARIES);
+    
+    int capacity = INITIAL_LOAD_CAPACITY;
+    TaskSummary *rows = (TaskSummary*)malloc(sizeof(TaskSummary) * capacity);
+    if (!rows) {
+        log_message(LOG_ERROR, "Failed to allocate memory for task summaries");
+        stmt_release(stmt);
+        return false;
+    }
+    
+    int n = 0;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (n == capacity) {
+            capacity *= 2;
+            TaskSummary *grown = (TaskSummary*)realloc(rows, sizeof(TaskSummary) * capacity);
+            if (!grown) {
+                log_message(LOG_ERROR, "Failed to allocate memory for task summaries");
+                free(rows);
+                stmt_release(stmt);
+                return false;
+            }
+            rows = grown;
+        }
+        
+        rows[n].id = sqlite3_column_int(stmt, 0);
+        rows[n].last_run_time = sqlite3_column_int64(stmt, 1);
+        rows[n].exit_code = sqlite3_column_int(stmt, 2);
+        rows[n].avg_runtime = sqlite3_column_double(stmt, 3);
+        n++;
+    }
+    
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to load task summaries: %s", sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        stmt_release(stmt);
+        free(rows);
+        return false;
+    }
+    
+    stmt_release(stmt);
+    
+    *summaries = rows;
+    *count = n;
+    return true;
+}
+
+static bool sqlite_get_due_task_ids(time_t until, int limit, int **ids, int *count) {
+    if (db == NULL || ids == NULL || count == NULL || limit <= 0) {
+        return false;
+    }
+    
+    *ids = NULL;
+    *count = 0;
+    
+    int *rows = (int*)malloc(sizeof(int) * limit);
+    if (!rows) {
+        log_message(LOG_ERROR, "Failed to allocate memory for due task IDs");
+        return false;
+    }
+    
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_DUE_TASK_IDS);
+    
+    sqlite3_bind_int64(stmt, 1, until);
+    sqlite3_bind_int(stmt, 2, limit);
+    
+    int n = 0;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW && n < limit) {
+        rows[n++] = sqlite3_column_int(stmt, 0);
+    }
+    
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+        log_message(LOG_ERROR, "Failed to query due tasks: %s", sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        stmt_release(stmt);
+        free(rows);
+        return false;
+    }
+    
+    stmt_release(stmt);
+    
+    *ids = rows;
+    *count = n;
+    return true;
+}
+
+static bool sqlite_reserve_ids(DbIdCounter counter, int count, int *first) {
+    if (db == NULL || count <= 0 || first == NULL) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_RESERVE_IDS);
+
+    sqlite3_bind_int(stmt, 1, count);
+    sqlite3_bind_text(stmt, 2, ID_COUNTER_KEYS[counter], -1, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt);
+    bool success = rc == SQLITE_ROW;
+    if (success) {
+        *first = sqlite3_column_int(stmt, 0);
+        // Run to completion so the update is committed before the release
+        rc = sqlite3_step(stmt);
+        success = rc == SQLITE_DONE;
+    }
+
+    if (!success) {
+        log_message(LOG_ERROR, "Failed to reserve IDs: %s", sqlite3_errmsg(db));
+    }
+
+    stmt_release(stmt);
+    return success;
+}
+
+static bool sqlite_release_ids(DbIdCounter counter, int first, int limit) {
+    if (db == NULL || first >= limit) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_RELEASE_IDS);
+
+    sqlite3_bind_int(stmt, 1, first);
+    sqlite3_bind_text(stmt, 2, ID_COUNTER_KEYS[counter], -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, limit);
+
+    int rc = sqlite3_step(stmt);
+    bool released = rc == SQLITE_DONE && sqlite3_changes(db) > 0;
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to release IDs: %s", sqlite3_errmsg(db));
+    }
+
+    stmt_release(stmt);
+    return released;
+}
+
+static bool sqlite_add_dependency(int task_id, int dependency_id) {
+    if (db == NULL || task_id < 0 || dependency_id < 0) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_INSERT_DEPENDENCY);
+    
+    sqlite3_bind_int(stmt, 1, task_id);
+    sqlite3_bind_int(stmt, 2, dependency_id);
+
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to insert dependency: %s", sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
+
+static bool sqlite_remove_dependency(int task_id, int dependency_id) {
+    if (db == NULL || task_id < 0 || dependency_id < 0) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_DELETE_DEPENDENCY);
+    
+    sqlite3_bind_int(stmt, 1, task_id);
+    sqlite3_bind_int(stmt, 2, dependency_id);
+
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to delete dependency: %s", sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
+
+static bool sqlite_load_dependency_edges(int **task_ids, int **dependency_ids, int *count) {
+    if (db == NULL || task_ids == NULL || dependency_ids == NULL || count == NULL) {
+        return false;
+    }
+
+    // One pass over the rows into growing arrays, so the edges all come
+    // from the snapshot of a single statement
+    int capacity = INITIAL_LOAD_CAPACITY;
+    int edge_count = 0;
+    int *tasks = (int*)malloc(sizeof(int) * capacity);
+    int *dependencies = (int*)malloc(sizeof(int) * capacity);
+    if (!tasks || !dependencies) {
+        log_message(LOG_ERROR, "Failed to allocate memory for dependencies");
+        free(tasks);
+        free(dependencies);
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_ALL_DEPENDENCIES);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (edge_count == capacity) {
+            int *grown_tasks = (int*)realloc(tasks, sizeof(int) * capacity * 2);
+            if (grown_tasks) {
+                tasks = grown_tasks;
+            }
+            int *grown_dependencies = (int*)realloc(dependencies, sizeof(int) * capacity * 2);
+            if (grown_dependencies) {
+                dependencies = grown_dependencies;
+            }
+            if (!grown_tasks || !grown_dependencies) {
+                log_message(LOG_ERROR, "Failed to allocate memory for dependencies");
+                stmt_release(stmt);
+                free(tasks);
+                free(dependencies);
+                return false;
+            }
+            capacity *= 2;
+        }
+
+        tasks[edge_count] = sqlite3_column_int(stmt, 0);
+        dependencies[edge_count] = sqlite3_column_int(stmt, 1);
+        edge_count++;
+    }
+
+    // A partial edge list would let tasks run ahead of their dependencies
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to load dependencies: %s",
+                   sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        stmt_release(stmt);
+        free(tasks);
+        free(dependencies);
+        return false;
+    }
+    stmt_release(stmt);
+
+    *task_ids = tasks;
+    *dependency_ids = dependencies;
+    *count = edge_count;
+    return true;
+}
+
+static bool sqlite_save_workflow_run(const WorkflowRunRecord *run) {
+    if (db == NULL || run == NULL || run->node_count < 0) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SAVE_WORKFLOW_RUN);
+    
+    // Node data is stored as two packed arrays: int task IDs and one state byte per node
+    sqlite3_bind_int(stmt, 1, run->run_id);
+    sqlite3_bind_int(stmt, 2, run->root_task_id);
+    sqlite3_bind_int64(stmt, 3, run->start_time);
+    sqlite3_bind_int64(stmt, 4, run->end_time);
+    sqlite3_bind_int(stmt, 5, run->status);
+    sqlite3_bind_int(stmt, 6, run->node_count);
+    sqlite3_bind_blob(stmt, 7, run->task_ids, (int)(sizeof(int) * run->node_count), SQLITE_STATIC);
+    sqlite3_bind_blob(stmt, 8, run->node_states, run->node_count, SQLITE_STATIC);
+
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to save workflow run: %s", sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
+
+static bool sqlite_get_workflow_run(int run_id, WorkflowRunRecord *run) {
+    if (db == NULL || run == NULL) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_WORKFLOW_RUN);
+    
+    sqlite3_bind_int(stmt, 1, run_id);
+
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        stmt_release(stmt);
+        return false;
+    }
+
+    memset(run, 0, sizeof(WorkflowRunRecord));
+    run->run_id = run_id;
+    run->root_task_id = sqlite3_column_int(stmt, 0);
+    run->start_time = sqlite3_column_int64(stmt, 1);
+    run->end_time = sqlite3_column_int64(stmt, 2);
+    run->status = sqlite3_column_int(stmt, 3);
+
+    int node_count = sqlite3_column_int(stmt, 4);
+    const void *ids_blob = sqlite3_column_blob(stmt, 5);
+    int ids_bytes = sqlite3_column_bytes(stmt, 5);
+    const void *states_blob = sqlite3_column_blob(stmt, 6);
+    int states_bytes = sqlite3_column_bytes(stmt, 6);
+
+    if (node_count < 0 || ids_bytes != (int)(sizeof(int) * node_count) || states_bytes != node_count) {
+        log_message(LOG_ERROR, "Corrupt workflow run record: ID=%d", run_id);
+        stmt_release(stmt);
+        return false;
+    }
+
+    if (node_count > 0) {
+        run->task_ids = (int*)malloc(ids_bytes);
+        run->node_states = (unsigned char*)malloc(states_bytes);
+        if (!run->task_ids || !run->node_states) {
+            log_message(LOG_ERROR, "Failed to allocate memory for workflow run");
+            free(run->task_ids);
+            free(run->node_states);
+            stmt_release(stmt);
+            return false;
+        }
+        memcpy(run->task_ids, ids_blob, ids_bytes);
+        memcpy(run->node_states, states_blob, states_bytes);
+    }
+    run->node_count = node_count;
+
+    stmt_release(stmt);
+    return true;
+}
+
+static bool sqlite_insert_task_run(const TaskRunRecord *run) {
+    if (db == NULL || run == NULL) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_INSERT_TASK_RUN);
+
+    sqlite3_bind_int(stmt, 1, run->task_id);
+    sqlite3_bind_int(stmt, 2, run->run_id);
+    sqlite3_bind_int(stmt, 3, run->trigger);
+    sqlite3_bind_double(stmt, 4, run->start_time);
+    sqlite3_bind_double(stmt, 5, run->end_time);
+    sqlite3_bind_double(stmt, 6, run->duration);
+    sqlite3_bind_int(stmt, 7, run->exit_code);
+    sqlite3_bind_int(stmt, 8, run->term_signal);
+    sqlite3_bind_int(stmt, 9, run->timed_out ? 1 : 0);
+    sqlite3_bind_double(stmt, 10, run->user_cpu);
+    sqlite3_bind_double(stmt, 11, run->sys_cpu);
+    sqlite3_bind_int64(stmt, 12, run->max_rss_kb);
+    bind_output(stmt, 13, &run->output);
+    bind_output(stmt, 15, &run->error_output);
+    bind_measure(stmt, 17, run->memory_peak_kb);
+    bind_measure(stmt, 18, run->io_read_bytes);
+    bind_measure(stmt, 19, run->io_write_bytes);
+
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to insert task run: %s", sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
+
+static bool sqlite_get_last_task_run(int task_id, TaskRunRecord *run) {
+    if (db == NULL || run == NULL) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_LAST_TASK_RUN);
+    sqlite3_bind_int(stmt, 1, task_id);
+
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        stmt_release(stmt);
+        return false;
+    }
+
+    memset(run, 0, sizeof(TaskRunRecord));
+    run->task_id = task_id;
+    run->run_id = sqlite3_column_int(stmt, 0);
+    run->trigger = (TaskRunTrigger)sqlite3_column_int(stmt, 1);
+    run->start_time = sqlite3_column_double(stmt, 2);
+    run->end_time = sqlite3_column_double(stmt, 3);
+    run->duration = sqlite3_column_double(stmt, 4);
+    run->exit_code = sqlite3_column_int(stmt, 5);
+    run->term_signal = sqlite3_column_int(stmt, 6);
+    run->timed_out = sqlite3_column_int(stmt, 7) != 0;
+    run->user_cpu = sqlite3_column_double(stmt, 8);
+    run->sys_cpu = sqlite3_column_double(stmt, 9);
+    run->max_rss_kb = (long)sqlite3_column_int64(stmt, 10);
+    run->memory_peak_kb = (long)column_measure(stmt, 15);
+    run->io_read_bytes = column_measure(stmt, 16);
+    run->io_write_bytes = column_measure(stmt, 17);
+
+    bool success = column_output(stmt, 11, &run->output) &&
+                   column_output(stmt, 13, &run->error_output);
+    stmt_release(stmt);
+
+    if (!success) {
+        log_message(LOG_ERROR, "Failed to allocate memory for task run output");
+        free(run->output.data);
+        free(run->error_output.data);
+        return false;
+    }
+
+    return true;
+}
+
+static int sqlite_prune_task_runs(void) {
+    if (db == NULL) {
+        return -1;
+    }
+
+    int deleted = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        DbStatement id;
+        if (pass == 0) {
+            if (history_days <= 0) {
+                continue;
+            }
+            id = STMT_PRUNE_TASK_RUNS_BY_AGE;
+        } else {
+            if (history_max_rows <= 0) {
+                continue;
+            }
+            id = STMT_PRUNE_TASK_RUNS_BY_COUNT;
+        }
+
+        // Each chunk is its own implicit transaction, releasing the
+        // connection in between
+        for (;;) {
+            sqlite3_stmt *stmt = stmt_acquire(id);
+            if (pass == 0) {
+                sqlite3_bind_double(stmt, 1, (double)time(NULL) - history_days * 86400.0);
+            } else {
+                sqlite3_bind_int(stmt, 1, history_max_rows);
+            }
+            sqlite3_bind_int(stmt, 2, PRUNE_CHUNK_ROWS);
+
+            int rc = sqlite3_step(stmt);
+            int changes = sqlite3_changes(db);
+            stmt_release(stmt);
+
+            if (rc != SQLITE_DONE) {
+                log_message(LOG_ERROR, "Failed to prune task runs: %s", sqlite3_errmsg(db));
+                return -1;
+            }
+
+            deleted += changes;
+            if (changes < PRUNE_CHUNK_ROWS) {
+                break;
+            }
+        }
+    }
+
+    return deleted;
+}
+
+static bool sqlite_save_script(const char *hash, const unsigned char *blob, size_t size, size_t raw_size) {
+    if (db == NULL) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SAVE_SCRIPT);
+    sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)raw_size);
+    sqlite3_bind_blob(stmt, 3, blob, (int)size, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 4, time(NULL));
+
+    int rc = sqlite3_step(stmt);
+    stmt_release(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to save script: %s", sqlite3_errmsg(db));
+        return false;
+    }
+
+    return true;
+}
+
+static bool sqlite_load_script(const char *hash, unsigned char **blob, size_t *size, size_t *raw_size) {
+    if (db == NULL) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_SCRIPT);
+    sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+
+    bool found = false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        int bytes = sqlite3_column_bytes(stmt, 1);
+        const void *body = sqlite3_column_blob(stmt, 1);
+        *blob = (unsigned char*)malloc(bytes > 0 ? (size_t)bytes : 1);
+        if (*blob) {
+            memcpy(*blob, body, (size_t)bytes);
+            *size = (size_t)bytes;
+            *raw_size = (size_t)sqlite3_column_int64(stmt, 0);
+            found = true;
+        } else {
+            log_message(LOG_ERROR, "Failed to allocate memory for script");
+        }
+    }
+
+    stmt_release(stmt);
+    return found;
+}
+
+static bool sqlite_get_script_size(const char *hash, size_t *raw_size) {
+    if (db == NULL) {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_SELECT_SCRIPT_SIZE);
+    sqlite3_bind_text(stmt, 1, hash, -1, SQLITE_STATIC);
+
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        *raw_size = (size_t)sqlite3_column_int64(stmt, 0);
+    }
+
+    stmt_release(stmt);
+    return found;
+}
+
+static int sqlite_prune_scripts(time_t older_than) {
+    if (db == NULL) {
+        return -1;
+    }
+
+    sqlite3_stmt *stmt = stmt_acquire(STMT_PRUNE_SCRIPTS);
+    sqlite3_bind_int64(stmt, 1, older_than);
+
+    int rc = sqlite3_step(stmt);
+    int deleted = sqlite3_changes(db);
+    stmt_release(stmt);
+
+    if (rc != SQLITE_DONE) {
+        log_message(LOG_ERROR, "Failed to prune scripts: %s", sqlite3_errmsg(db));
+        return -1;
+    }
+
+    return deleted;
+}
+
+const StorageBackend SQLITE_STORAGE_BACKEND = {
+    .name = "sqlite",
+    .open = sqlite_open,
+    .close = sqlite_close,
+    .begin_transaction = sqlite_begin_transaction,
+    .commit_transaction = sqlite_commit_transaction,
+    .rollback_transaction = sqlite_rollback_transaction,
+    .checkpoint = sqlite_checkpoint,
+    .save_task = sqlite_save_task,
+    .upsert_task = sqlite_upsert_task,
+    .update_task = sqlite_update_task,
+    .update_task_status = sqlite_update_task_status,
+    .delete_task = sqlite_delete_task,
+    .load_tasks = sqlite_load_tasks,
+    .load_tasks_page = sqlite_load_tasks_page,
+    .get_task = sqlite_get_task,
+    .count_tasks = sqlite_count_tasks,
+    .load_task_summaries = sqlite_load_task_summaries,
+    .get_due_task_ids = sqlite_get_due_task_ids,
+    .reserve_ids = sqlite_reserve_ids,
+    .release_ids = sqlite_release_ids,
+    .add_dependency = sqlite_add_dependency,
+    .remove_dependency = sqlite_remove_dependency,
+    .load_dependency_edges = sqlite_load_dependency_edges,
+    .save_workflow_run = sqlite_save_workflow_run,
+    .get_workflow_run = sqlite_get_workflow_run,
+    .insert_task_run = sqlite_insert_task_run,
+    .get_last_task_run = sqlite_get_last_task_run,
+    .prune_task_runs = sqlite_prune_task_runs,
+    .save_script = sqlite_save_script,
+    .load_script = sqlite_load_script,
+    .get_script_size = sqlite_get_script_size,
+    .prune_scripts = sqlite_prune_scripts,
+};
+
+// Switch to WAL and apply the durability level and cache settings
+static bool apply_storage_config(const DbStorageConfig *config) {
+    static const char *SYNCHRONOUS[] = { "FULL", "NORMAL", "OFF" };
+
+    sqlite3_busy_timeout(db, config->busy_timeout_ms);
+
+    char *err_msg = NULL;
+    if (sqlite3_exec(db, "PRAGMA journal_mode = WAL;", NULL, NULL, &err_msg) != SQLITE_OK) {
+        log_message(LOG_ERROR, "Failed to enable WAL journaling: %s", err_msg ? err_msg : "unknown");
+        sqlite3_free(err_msg);
+        return false;
+    }
+
+    char sql[256];
+    snprintf(sql, sizeof(sql),
+             "PRAGMA synchronous = %s; PRAGMA cache_size = -%d; "
+             "PRAGMA mmap_size = %lld; PRAGMA wal_autocheckpoint = %d;",
+             SYNCHRONOUS[config->durability], config->cache_size_kb,
+             (long long)config->mmap_size_mb * 1024 * 1024, config->wal_autocheckpoint);
+    if (sqlite3_exec(db, sql, NULL, NULL, &err_msg) != SQLITE_OK) {
+        log_message(LOG_ERROR, "Failed to apply storage settings: %s", err_msg ? err_msg : "unknown");
+        sqlite3_free(err_msg);
+        return false;
+    }
+
+    log_message(LOG_INFO, "Database storage: WAL, synchronous=%s, cache=%d KB, mmap=%d MB",
+                SYNCHRONOUS[config->durability], config->cache_size_kb, config->mmap_size_mb);
+    return true;
+}
+
+static void db_lock_init(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&db_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_key_create(&transaction_key, NULL);
+}
+
+// Compile every statement once; tables must already exist
+static bool prepare_statements(void) {
+    for (int i = 0; i < STMT_COUNT; i++) {
+        int rc = sqlite3_prepare_v3(db, *STATEMENT_SQL[i], -1, SQLITE_PREPARE_PERSISTENT,
+                                    &statements[i], NULL);
+        if (rc != SQLITE_OK) {
+            log_message(LOG_ERROR, "Failed to prepare statement: %s", sqlite3_errmsg(db));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void finalize_statements(void) {
+    for (int i = 0; i < STMT_COUNT; i++) {
+        sqlite3_finalize(statements[i]);
+        statements[i] = NULL;
+    }
+}
+
+// Open the read-only connections and prepare every statement that does not
+// write on each of them
+static bool open_readers(const char *db_path, const DbStorageConfig *config) {
+    int count = config->read_connections < MAX_READ_CONNECTIONS
+                ? config->read_connections : MAX_READ_CONNECTIONS;
+
+    // An in-memory or temporary database cannot be shared between connections
+    const char *filename = sqlite3_db_filename(db, "main");
+    if (count <= 0 || filename == NULL || filename[0] == '\0') {
+        return true;
+    }
+
+    char sql[256];
+    snprintf(sql, sizeof(sql), "PRAGMA cache_size = -%d; PRAGMA mmap_size = %lld;",
+             config->cache_size_kb, (long long)config->mmap_size_mb * 1024 * 1024);
+
+    for (int i = 0; i < count; i++) {
+        ReadConnection *reader = &readers[reader_count];
+        memset(reader, 0, sizeof(ReadConnection));
+
+        if (sqlite3_open_v2(db_path, &reader->conn, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                            NULL) != SQLITE_OK) {
+            log_message(LOG_ERROR, "Failed to open read connection: %s", sqlite3_errmsg(reader->conn));
+            sqlite3_close(reader->conn);
+            return false;
+        }
+        // Counted before anything else can fail so close_readers frees it
+        reader_count++;
+
+        sqlite3_busy_timeout(reader->conn, config->busy_timeout_ms);
+        if (sqlite3_exec(reader->conn, sql, NULL, NULL, NULL) != SQLITE_OK) {
+            log_message(LOG_ERROR, "Failed to configure read connection: %s", sqlite3_errmsg(reader->conn));
+            return false;
+        }
+
+        for (int id = 0; id < STMT_COUNT; id++) {
+            if (!sqlite3_stmt_readonly(statements[id])) {
+                continue;
+            }
+            if (sqlite3_prepare_v3(reader->conn, *STATEMENT_SQL[id], -1, SQLITE_PREPARE_PERSISTENT,
+                                   &reader->statements[id], NULL) != SQLITE_OK) {
+                log_message(LOG_ERROR, "Failed to prepare read statement: %s", sqlite3_errmsg(reader->conn));
+                return false;
+            }
+        }
+    }
+
+    log_message(LOG_INFO, "Database read connections: %d", reader_count);
+    return true;
+}
+
+static void close_readers(void) {
+    for (int i = 0; i < reader_count; i++) {
+        for (int id = 0; id < STMT_COUNT; id++) {
+            sqlite3_finalize(readers[i].statements[id]);
+        }
+        sqlite3_close(readers[i].conn);
+        memset(&readers[i], 0, sizeof(ReadConnection));
+    }
+    reader_count = 0;
+}
+
+// Hand out a ready-to-bind statement. Reads take a free read connection
+// (waiting for one if all are in use); writes, and reads inside this
+// thread's transaction, lock the writer connection.
+static sqlite3_stmt* stmt_acquire(DbStatement id) {
+    if (reader_count > 0 && readers[0].statements[id] != NULL &&
+        pthread_getspecific(transaction_key) == NULL) {
+        pthread_mutex_lock(&reader_lock);
+        for (;;) {
+            for (int i = 0; i < reader_count; i++) {
+                if (!readers[i].busy) {
+                    readers[i].busy = true;
+                    pthread_mutex_unlock(&reader_lock);
+                    return readers[i].statements[id];
+                }
+            }
+            pthread_cond_wait(&reader_free, &reader_lock);
+        }
+    }
+
+    pthread_mutex_lock(&db_lock);
+    return statements[id];
+}
+
+// Reset a statement for its next use and give back its connection
+static void stmt_release(sqlite3_stmt *stmt) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    sqlite3 *conn = sqlite3_db_handle(stmt);
+    if (conn == db) {
+        pthread_mutex_unlock(&db_lock);
+        return;
+    }
+
+    pthread_mutex_lock(&reader_lock);
+    for (int i = 0; i < reader_count; i++) {
+        if (readers[i].conn == conn) {
+            readers[i].busy = false;
+            break;
+        }
+    }
+    pthread_cond_signal(&reader_free);
+    pthread_mutex_unlock(&reader_lock);
+}
+
+// Bind every column of a task in INSERT_TASK_SQL order
+static void bind_task_row(sqlite3_stmt *stmt, const Task *task) {
+    sqlite3_bind_int(stmt, 1, task->id);
+    sqlite3_bind_text(stmt, 2, task->name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, task->command, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 4, task->creation_time);
+    sqlite3_bind_int64(stmt, 5, task->next_run_time);
+    sqlite3_bind_int64(stmt, 6, task->last_run_time);
+    sqlite3_bind_int(stmt, 7, task->frequency);
+    sqlite3_bind_int(stmt, 8, task->interval);
+    sqlite3_bind_int(stmt, 9, task->enabled ? 1 : 0);
+    sqlite3_bind_int(stmt, 10, task->exit_code);
+    sqlite3_bind_int(stmt, 11, task->max_runtime);
+    sqlite3_bind_text(stmt, 12, task->working_dir, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 13, task->exec_mode);
+    sqlite3_bind_text(stmt, 14, task->script_hash, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 15, task->dep_behavior);
+    sqlite3_bind_int(stmt, 16, task->schedule_type);
+    sqlite3_bind_text(stmt, 17, task->cron_expression, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 18, task->ai_prompt, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 19, task->system_metrics, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 20, task->last_run_id);
+    sqlite3_bind_double(stmt, 21, task->avg_runtime);
+    sqlite3_bind_text(stmt, 22, task->resource_limits, -1, SQLITE_STATIC);
+}
+
+// Fill a task from a SELECT * row
+static void read_task_row(sqlite3_stmt *stmt, Task *task) {
+    task->id = sqlite3_column_int(stmt, 0);
+    read_text_column(stmt, 1, task->name, sizeof(task->name));
+    read_text_column(stmt, 2, task->command, sizeof(task->command));
+    task->creation_time = sqlite3_column_int64(stmt, 3);
+    task->next_run_time = sqlite3_column_int64(stmt, 4);
+    task->last_run_time = sqlite3_column_int64(stmt, 5);
+    task->frequency = sqlite3_column_int(stmt, 6);
+    task->interval = sqlite3_column_int(stmt, 7);
+    task->enabled = sqlite3_column_int(stmt, 8) != 0;
+    task->exit_code = sqlite3_column_int(stmt, 9);
+    task->max_runtime = sqlite3_column_int(stmt, 10);
+    read_text_column(stmt, 11, task->working_dir, sizeof(task->working_dir));
+    task->exec_mode = sqlite3_column_int(stmt, 12);
+    task->dep_behavior = sqlite3_column_int(stmt, 14);
+    task->schedule_type = sqlite3_column_int(stmt, 15);
+    read_text_column(stmt, 16, task->cron_expression, sizeof(task->cron_expression));
+    read_text_column(stmt, 17, task->ai_prompt, sizeof(task->ai_prompt));
+    read_text_column(stmt, 18, task->system_metrics, sizeof(task->system_metrics));
+    task->last_run_id = sqlite3_column_int(stmt, 19);
+    task->avg_runtime = sqlite3_column_double(stmt, 20);
+    read_text_column(stmt, 21, task->script_hash, sizeof(task->script_hash));
+    read_text_column(stmt, 22, task->resource_limits, sizeof(task->resource_limits));
+}
+
+// Copy a text column into a fixed buffer, empty for NULL. Only the bytes
+// present are copied, not the whole buffer.
+static void read_text_column(sqlite3_stmt *stmt, int column, char *dest, size_t size) {
+    const unsigned char *text = sqlite3_column_text(stmt, column);
+    if (!text) {
+        dest[0] = '\0';
+        return;
+    }
+
+    size_t length = (size_t)sqlite3_column_bytes(stmt, column);
+    if (length >= size) {
+        length = size - 1;
+    }
+    memcpy(dest, text, length);
+    dest[length] = '\0';
+}
+
+// Bind captured output to column (the blob) and column + 1 (its total)
+static void bind_output(sqlite3_stmt *stmt, int column, const CapturedOutput *output) {
+    if (output->data) {
+        sqlite3_bind_blob(stmt, column, output->data, (int)output->length, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_null(stmt, column);
+    }
+    sqlite3_bind_int64(stmt, column + 1, output->total);
+}
+
+// Read captured output from column and column + 1; the data is newly
+// allocated and NUL-terminated
+static bool column_output(sqlite3_stmt *stmt, int column, CapturedOutput *output) {
+    memset(output, 0, sizeof(CapturedOutput));
+    output->total = sqlite3_column_int64(stmt, column + 1);
+
+    const void *blob = sqlite3_column_blob(stmt, column);
+    if (!blob) {
+        return true;
+    }
+
+    size_t length = (size_t)sqlite3_column_bytes(stmt, column);
+    output->data = (char*)malloc(length + 1);
+    if (!output->data) {
+        return false;
+    }
+    memcpy(output->data, blob, length);
+    output->data[length] = '\0';
+    output->length = length;
+    return true;
+}
+
+// Bind a cgroup measurement, NULL if it was not taken (-1)
+static void bind_measure(sqlite3_stmt *stmt, int column, long long value) {
+    if (value < 0) {
+        sqlite3_bind_null(stmt, column);
+    } else {
+        sqlite3_bind_int64(stmt, column, value);
+    }
+}
+
+static long long column_measure(sqlite3_stmt *stmt, int column) {
+    return sqlite3_column_type(stmt, column) == SQLITE_NULL ? -1 : sqlite3_column_int64(stmt, column);
+}
+
+// Move scripts stored inline by older versions into the scripts table. Rows
+// are cleared as they move, so this only finds work once.
+static bool migrate_inline_scripts(void) {
+    sqlite3_stmt *select = NULL;
+    sqlite3_stmt *update = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT id, script_content FROM tasks "
+                               "WHERE script_content IS NOT NULL AND script_content <> '';",
+                           -1, &select, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "UPDATE tasks SET script_hash = ?, script_content = NULL WHERE id = ?;",
+                           -1, &update, NULL) != SQLITE_OK) {
+        log_message(LOG_ERROR, "Failed to prepare script migration: %s", sqlite3_errmsg(db));
+        sqlite3_finalize(select);
+        sqlite3_finalize(update);
+        return false;
+    }
+
+    if (!sqlite_begin_transaction()) {
+        sqlite3_finalize(select);
+        sqlite3_finalize(update);
+        return false;
+    }
+
+    int moved = 0;
+    bool success = true;
+    int rc = SQLITE_DONE;
+    while (success && (rc = sqlite3_step(select)) == SQLITE_ROW) {
+        int task_id = sqlite3_column_int(select, 0);
+        const char *content = (const char*)sqlite3_column_text(select, 1);
+        size_t length = (size_t)sqlite3_column_bytes(select, 1);
+
+        char hash[SCRIPT_HASH_LENGTH + 1];
+        unsigned char *blob = NULL;
+        size_t size = 0;
+        success = script_hash(content, length, hash) && script_compress(content, length, &blob, &size) &&
+                  sqlite_save_script(hash, blob, size, length);
+        free(blob);
+
+        if (success) {
+            sqlite3_bind_text(update, 1, hash, -1, SQLITE_STATIC);
+            sqlite3_bind_int(update, 2, task_id);
+            success = sqlite3_step(update) == SQLITE_DONE;
+            sqlite3_reset(update);
+            moved++;
+        }
+    }
+    success = success && rc == SQLITE_DONE;
+    sqlite3_finalize(select);
+    sqlite3_finalize(update);
+
+    if (!success) {
+        log_message(LOG_ERROR, "Failed to move inline scripts: %s", sqlite3_errmsg(db));
+        sqlite_rollback_transaction();
+        return false;
+    }
+
+    if (!sqlite_commit_transaction()) {
+        return false;
+    }
+
+    if (moved > 0) {
+        log_message(LOG_INFO, "Moved %d inline scripts to the script store", moved);
+    }
+    return true;
+}
@@ -18,10 +18,12 @@
 // Global objects
 static Scheduler scheduler;
 static int pid_file_fd = -1;
+static volatile sig_atomic_t stop_signal = 0;   // Signal that asked us to exit, 0 for none
 
 // Forward declarations
 static void cleanup(void);
 static void signal_handler(int sig);
+static void install_signal_handlers(void);
 static bool setup_daemon(const char *pid_file);
 static bool create_pid_file(const char *pid_file);
 
@@ -66,8 +68,7 @@ int main(int argc, char *argv[]) {
     }
     
     // Set up signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    install_signal_handlers();
     
     // Initialize email module
     if (!email_init(NULL)) {
@@ -96,15 +97,24 @@ int main(int argc, char *argv[]) {
         } else {
             log_message(LOG_INFO, "Task Scheduler daemon started");
             
-            // Wait forever
-            while (1) {
-                // Sync with database every minute
+            // Sync with database every minute until asked to exit. The
+            // signal cuts the current sleep short.
+            while (!stop_signal) {
                 scheduler_sync(&scheduler);
-                sleep(60);
+                for (int waited = 0; waited < 60 && !stop_signal; waited++) {
+                    sleep(1);
+                }
             }
         }
     }
     
+    if (stop_signal) {
+        log_message(LOG_INFO, "Received signal %d, exiting", (int)stop_signal);
+        
+        // Sync before exiting to ensure all tasks are saved
+        scheduler_sync(&scheduler);
+    }
+    
     // Clean up
     cleanup();
     return exit_code;
@@ -124,14 +134,22 @@ static void cleanup(void) {
     }
 }
 
+// Only records the request: syncing and cleaning up take locks the
+// interrupted code may hold, so main() does them once its loop sees this
 static void signal_handler(int sig) {
-    log_message(LOG_INFO, "Received signal %d, exiting", sig);
-    
-    // Sync before exiting to ensure all tasks are saved
-    scheduler_sync(&scheduler);
-    
-    cleanup();
-    exit(EXIT_SUCCESS);
+    stop_signal = sig;
+    cli_request_stop();
+}
+
+// Worker threads block SIGINT and SIGTERM (see thread_create()), so these
+// run on the main thread. No SA_RESTART: they interrupt its sleep or read.
+static void install_signal_handlers(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
 }
 
 static bool setup_daemon(const char *pid_file) {
@@ -0,0 +1,574 @@
+#include "../../include/cgroup.h"
+#include "../../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cjson/cJSON.h>
+
+#define DEFAULT_CONFIG_PATH "data/config.json"
+#define SCHEDULER_LEAF "scheduler"     // Where the daemon moves when the root is its own cgroup
+#define TASK_PREFIX "task-"
+#define MAX_LINGERING 64
+
+// Controllers the limits need, as named in cgroup.controllers
+typedef enum {
+    CONTROLLER_CPU,
+    CONTROLLER_MEMORY,
+    CONTROLLER_IO,
+    CONTROLLER_PIDS,
+    CONTROLLER_COUNT
+} Controller;
+
+static const char *controller_names[CONTROLLER_COUNT] = { "cpu", "memory", "io", "pids" };
+
+static bool enabled = false;
+static char root_path[PATH_MAX];
+static bool controllers[CONTROLLER_COUNT];   // Enabled for the children of the root
+static char default_limits[CGROUP_LIMITS_MAX_LENGTH];
+static unsigned int run_counter = 0;
+
+// Cgroups whose removal failed because processes were left in them;
+// retried before every new cgroup is created
+static pthread_mutex_t lingering_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *lingering[MAX_LINGERING];
+static int lingering_count = 0;
+
+// Helper functions
+static bool find_cgroup2_mount(char *mount, size_t size);
+static bool find_own_cgroup(char *path, size_t size);
+static bool write_file_at(int dir_fd, const char *name, const char *value);
+static bool read_file_at(int dir_fd, const char *name, char *buffer, size_t size);
+static void enable_controllers(void);
+static void remove_stale(void);
+static void retry_lingering(void);
+static bool apply_limit(const TaskCgroup *cgroup, Controller controller, const char *file,
+                        const char *value, int task_id);
+static bool parse_size(const char *text, long long *value);
+
+bool cgroup_load_config(const char *config_path, CgroupConfig *config) {
+    if (!config) {
+        return false;
+    }
+
+    memset(config, 0, sizeof(CgroupConfig));
+
+    const char *path = config_path ? config_path : DEFAULT_CONFIG_PATH;
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return true;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *buffer = (char*)malloc(file_size + 1);
+    if (!buffer) {
+        fclose(file);
+        return false;
+    }
+
+    size_t read_size = fread(buffer, 1, file_size, file);
+    buffer[read_size] = '\0';
+    fclose(file);
+
+    cJSON *json = cJSON_Parse(buffer);
+    free(buffer);
+    if (!json) {
+        log_message(LOG_WARNING, "Failed to parse config file, cgroups stay disabled: %s", path);
+        return false;
+    }
+
+    cJSON *cgroup = cJSON_GetObjectItem(json, "cgroup");
+    if (cgroup) {
+        cJSON *enabled_item = cJSON_GetObjectItem(cgroup, "enabled");
+        cJSON *root = cJSON_GetObjectItem(cgroup, "root");
+        cJSON *limits = cJSON_GetObjectItem(cgroup, "default_limits");
+
+        if (enabled_item && cJSON_IsBool(enabled_item)) {
+            config->enabled = cJSON_IsTrue(enabled_item);
+        }
+
+        if (root && cJSON_IsString(root)) {
+            safe_strcpy(config->root, root->valuestring, sizeof(config->root));
+        }
+
+        if (limits && cJSON_IsString(limits)) {
+            safe_strcpy(config->default_limits, limits->valuestring, sizeof(config->default_limits));
+        }
+    }
+
+    cJSON_Delete(json);
+    return true;
+}
+
+bool cgroup_init(const CgroupConfig *config) {
+    if (!config || !config->enabled) {
+        return false;
+    }
+    if (enabled) {
+        return true;
+    }
+
+    char error[128];
+    CgroupLimits limits;
+    if (!cgroup_parse_limits(config->default_limits, &limits, error, sizeof(error))) {
+        log_message(LOG_WARNING, "Ignoring default cgroup limits: %s", error);
+    } else {
+        safe_strcpy(default_limits, config->default_limits, sizeof(default_limits));
+    }
+
+    char mount[PATH_MAX];
+    char own[PATH_MAX];
+    if (!find_cgroup2_mount(mount, sizeof(mount)) || !find_own_cgroup(own, sizeof(own))) {
+        log_message(LOG_WARNING, "No cgroup v2 hierarchy found, tasks run without cgroups");
+        return false;
+    }
+
+    char own_path[PATH_MAX];
+    if ((size_t)snprintf(own_path, sizeof(own_path), "%s%s", mount,
+                         strcmp(own, "/") == 0 ? "" : own) >= sizeof(own_path)) {
+        return false;
+    }
+
+    if (config->root[0]) {
+        safe_strcpy(root_path, config->root, sizeof(root_path));
+    } else {
+        safe_strcpy(root_path, own_path, sizeof(root_path));
+    }
+
+    if (strcmp(root_path, own_path) == 0) {
+        // Controllers only go to children of a cgroup without processes
+        char leaf[PATH_MAX];
+        char pid[32];
+        snprintf(pid, sizeof(pid), "%d", (int)getpid());
+        bool moved = (size_t)snprintf(leaf, sizeof(leaf), "%s/%s", root_path, SCHEDULER_LEAF) < sizeof(leaf) &&
+                     (mkdir(leaf, 0755) == 0 || errno == EEXIST);
+        if (moved) {
+            int leaf_fd = open(leaf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            moved = leaf_fd >= 0 && write_file_at(leaf_fd, "cgroup.procs", pid);
+            if (leaf_fd >= 0) {
+                close(leaf_fd);
+            }
+        }
+        if (!moved) {
+            log_message(LOG_WARNING, "Cannot move the scheduler into %s/%s: %s",
+                       root_path, SCHEDULER_LEAF, strerror(errno));
+            return false;
+        }
+    } else if (mkdir(root_path, 0755) != 0 && errno != EEXIST) {
+        log_message(LOG_WARNING, "Cannot create cgroup %s: %s", root_path, strerror(errno));
+        return false;
+    }
+
+    enable_controllers();
+    remove_stale();
+    enabled = true;
+
+    char available[64] = "";
+    for (int i = 0; i < CONTROLLER_COUNT; i++) {
+        if (controllers[i]) {
+            strcat(available, " ");
+            strcat(available, controller_names[i]);
+        }
+    }
+    log_message(LOG_INFO, "Tasks run in cgroups under %s (controllers:%s)",
+               root_path, available[0] ? available : " none");
+    return true;
+}
+
+bool cgroup_enabled(void) {
+    return enabled;
+}
+
+bool cgroup_parse_limits(const char *text, CgroupLimits *limits, char *error, size_t error_size) {
+    memset(limits, 0, sizeof(CgroupLimits));
+    if (!text || !text[0]) {
+        return true;
+    }
+
+    char copy[CGROUP_LIMITS_MAX_LENGTH];
+    if (strlen(text) >= sizeof(copy)) {
+        snprintf(error, error_size, "limits longer than %d characters", CGROUP_LIMITS_MAX_LENGTH - 1);
+        return false;
+    }
+    safe_strcpy(copy, text, sizeof(copy));
+
+    char *saveptr = NULL;
+    for (char *item = strtok_r(copy, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        while (isspace((unsigned char)*item)) {
+            item++;
+        }
+        char *value = strchr(item, '=');
+        if (!value) {
+            snprintf(error, error_size, "'%s' is not key=value", item);
+            return false;
+        }
+        *value++ = '\0';
+
+        char *end;
+        if (strcmp(item, "cpu") == 0) {
+            double percent = strtod(value, &end);
+            if (*end == '%') {
+                end++;
+            }
+            if (end == value || *end || percent <= 0) {
+                snprintf(error, error_size, "cpu wants a percentage of one CPU, e.g. cpu=50%%");
+                return false;
+            }
+            // The kernel takes at least 1 ms per period
+            limits->cpu_quota_us = (long long)(percent * CGROUP_CPU_PERIOD_US / 100);
+            if (limits->cpu_quota_us < 1000) {
+                limits->cpu_quota_us = 1000;
+            }
+        } else if (strcmp(item, "memory") == 0) {
+            if (!parse_size(value, &limits->memory_max)) {
+                snprintf(error, error_size, "memory wants a size, e.g. memory=512M");
+                return false;
+            }
+        } else if (strcmp(item, "pids") == 0) {
+            limits->pids_max = strtoll(value, &end, 10);
+            if (end == value || *end || limits->pids_max <= 0) {
+                snprintf(error, error_size, "pids wants a positive count");
+                return false;
+            }
+        } else if (strcmp(item, "io") == 0) {
+            unsigned int major, minor;
+            int consumed = 0;
+            if (sscanf(value, "%u:%u%n", &major, &minor, &consumed) != 2 ||
+                (value[consumed] && value[consumed] != ' ')) {
+                snprintf(error, error_size, "io wants MAJOR:MINOR followed by io.max keys, e.g. io=8:0 wbps=1048576");
+                return false;
+            }
+            if (limits->io_count == CGROUP_MAX_IO_DEVICES ||
+                strlen(value) >= sizeof(limits->io_max[0])) {
+                snprintf(error, error_size, "too many or too long io limits");
+                return false;
+            }
+            safe_strcpy(limits->io_max[limits->io_count++], value, sizeof(limits->io_max[0]));
+        } else {
+            snprintf(error, error_size, "unknown limit '%s' (cpu, memory, pids or io)", item);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool cgroup_create(int task_id, const char *limits, TaskCgroup *cgroup) {
+    cgroup->path[0] = '\0';
+    cgroup->dir_fd = -1;
+    cgroup->kill_fd = -1;
+    if (!enabled) {
+        return false;
+    }
+
+    retry_lingering();
+
+    // Runs of one task may overlap, and other processes may share the root
+    unsigned int run = __atomic_add_fetch(&run_counter, 1, __ATOMIC_RELAXED);
+    if ((size_t)snprintf(cgroup->path, sizeof(cgroup->path), "%s/" TASK_PREFIX "%d.%d.%u",
+                         root_path, task_id, (int)getpid(), run) >= sizeof(cgroup->path) ||
+        mkdir(cgroup->path, 0755) != 0) {
+        log_message(LOG_WARNING, "Failed to create cgroup for task %d: %s", task_id, strerror(errno));
+        cgroup->path[0] = '\0';
+        return false;
+    }
+
+    cgroup->dir_fd = open(cgroup->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroup->dir_fd < 0) {
+        log_message(LOG_WARNING, "Failed to open cgroup %s: %s", cgroup->path, strerror(errno));
+        cgroup_destroy(cgroup);
+        return false;
+    }
+    // Since Linux 5.14; older kernels kill by process group instead
+    cgroup->kill_fd = openat(cgroup->dir_fd, "cgroup.kill", O_WRONLY | O_CLOEXEC);
+
+    const char *text = limits && limits[0] ? limits : default_limits;
+    CgroupLimits parsed;
+    char error[128];
+    if (!cgroup_parse_limits(text, &parsed, error, sizeof(error))) {
+        log_message(LOG_WARNING, "Ignoring cgroup limits of task %d: %s", task_id, error);
+        return true;
+    }
+
+    char value[96];
+    if (parsed.cpu_quota_us > 0) {
+        snprintf(value, sizeof(value), "%lld %d", parsed.cpu_quota_us, CGROUP_CPU_PERIOD_US);
+        apply_limit(cgroup, CONTROLLER_CPU, "cpu.max", value, task_id);
+    }
+    if (parsed.memory_max > 0) {
+        snprintf(value, sizeof(value), "%lld", parsed.memory_max);
+        apply_limit(cgroup, CONTROLLER_MEMORY, "memory.max", value, task_id);
+    }
+    if (parsed.pids_max > 0) {
+        snprintf(value, sizeof(value), "%lld", parsed.pids_max);
+        apply_limit(cgroup, CONTROLLER_PIDS, "pids.max", value, task_id);
+    }
+    for (int i = 0; i < parsed.io_count; i++) {
+        apply_limit(cgroup, CONTROLLER_IO, "io.max", parsed.io_max[i], task_id);
+    }
+
+    return true;
+}
+
+bool cgroup_collect(const TaskCgroup *cgroup, CgroupStats *stats) {
+    stats->user_cpu = 0;
+    stats->sys_cpu = 0;
+    stats->memory_peak_kb = -1;
+    stats->io_read_bytes = -1;
+    stats->io_write_bytes = -1;
+    if (cgroup->dir_fd < 0) {
+        return false;
+    }
+
+    // cpu.stat exists without the cpu controller
+    char buffer[4096];
+    if (!read_file_at(cgroup->dir_fd, "cpu.stat", buffer, sizeof(buffer))) {
+        return false;
+    }
+    char *line = strstr(buffer, "user_usec ");
+    if (line) {
+        stats->user_cpu = strtoll(line + 10, NULL, 10) / 1e6;
+    }
+    line = strstr(buffer, "system_usec ");
+    if (line) {
+        stats->sys_cpu = strtoll(line + 12, NULL, 10) / 1e6;
+    }
+
+    // memory.peak is there with the memory controller, since Linux 5.19
+    if (read_file_at(cgroup->dir_fd, "memory.peak", buffer, sizeof(buffer))) {
+        stats->memory_peak_kb = (long)(strtoll(buffer, NULL, 10) / 1024);
+    }
+
+    // One line per device: "8:0 rbytes=... wbytes=... rios=... ..."
+    if (read_file_at(cgroup->dir_fd, "io.stat", buffer, sizeof(buffer))) {
+        stats->io_read_bytes = 0;
+        stats->io_write_bytes = 0;
+        for (char *pos = buffer; (pos = strstr(pos, "bytes=")) != NULL; pos += 6) {
+            long long bytes = strtoll(pos + 6, NULL, 10);
+            if (pos - buffer >= 1 && pos[-1] == 'r') {
+                stats->io_read_bytes += bytes;
+            } else if (pos - buffer >= 1 && pos[-1] == 'w') {
+                stats->io_write_bytes += bytes;
+            }
+        }
+    }
+
+    return true;
+}
+
+void cgroup_destroy(TaskCgroup *cgroup) {
+    if (cgroup->kill_fd >= 0) {
+        close(cgroup->kill_fd);
+        cgroup->kill_fd = -1;
+    }
+    if (cgroup->dir_fd >= 0) {
+        close(cgroup->dir_fd);
+        cgroup->dir_fd = -1;
+    }
+    if (!cgroup->path[0]) {
+        return;
+    }
+
+    if (rmdir(cgroup->path) != 0 && errno == EBUSY) {
+        // The task left processes behind (or killed ones are still exiting)
+        pthread_mutex_lock(&lingering_lock);
+        if (lingering_count < MAX_LINGERING) {
+            lingering[lingering_count] = strdup(cgroup->path);
+            if (lingering[lingering_count]) {
+                lingering_count++;
+            }
+        }
+        pthread_mutex_unlock(&lingering_lock);
+        log_message(LOG_DEBUG, "Cgroup %s still has processes, removing it later", cgroup->path);
+    }
+    cgroup->path[0] = '\0';
+}
+
+// Mount point of the cgroup v2 hierarchy, from /proc/self/mountinfo
+static bool find_cgroup2_mount(char *mount, size_t size) {
+    FILE *file = fopen("/proc/self/mountinfo", "r");
+    if (!file) {
+        return false;
+    }
+
+    // "36 25 0:31 / /sys/fs/cgroup rw,... shared:9 - cgroup2 cgroup2 rw"
+    char line[1024];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file)) {
+        char *separator = strstr(line, " - ");
+        char point[PATH_MAX];
+        char type[32];
+        if (separator && sscanf(separator + 3, "%31s", type) == 1 && strcmp(type, "cgroup2") == 0 &&
+            sscanf(line, "%*s %*s %*s %*s %4095s", point) == 1) {
+            safe_strcpy(mount, point, size);
+            found = true;
+        }
+    }
+
+    fclose(file);
+    return found;
+}
+
+// Path of our cgroup in the v2 hierarchy, from the "0::" line of /proc/self/cgroup
+static bool find_own_cgroup(char *path, size_t size) {
+    FILE *file = fopen("/proc/self/cgroup", "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[PATH_MAX + 16];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            safe_strcpy(path, line + 3, size);
+            found = true;
+        }
+    }
+
+    fclose(file);
+    return found;
+}
+
+static bool write_file_at(int dir_fd, const char *name, const char *value) {
+    int fd = openat(dir_fd, name, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t length = strlen(value);
+    bool success = write(fd, value, length) == (ssize_t)length;
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return success;
+}
+
+static bool read_file_at(int dir_fd, const char *name, char *buffer, size_t size) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    ssize_t n = read(fd, buffer, size - 1);
+    close(fd);
+    if (n < 0) {
+        return false;
+    }
+    buffer[n] = '\0';
+    return true;
+}
+
+// Hand every controller the limits use to the children of the root
+static void enable_controllers(void) {
+    int root_fd = open(root_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    char available[256];
+    if (root_fd < 0 || !read_file_at(root_fd, "cgroup.controllers", available, sizeof(available))) {
+        if (root_fd >= 0) {
+            close(root_fd);
+        }
+        return;
+    }
+
+    for (int i = 0; i < CONTROLLER_COUNT; i++) {
+        // Whole words only: "io" must not match inside another name
+        size_t length = strlen(controller_names[i]);
+        bool listed = false;
+        for (char *pos = available; (pos = strstr(pos, controller_names[i])) != NULL; pos += length) {
+            if ((pos == available || pos[-1] == ' ') && (isspace((unsigned char)pos[length]) || !pos[length])) {
+                listed = true;
+                break;
+            }
+        }
+        if (!listed) {
+            continue;
+        }
+
+        char request[16];
+        snprintf(request, sizeof(request), "+%s", controller_names[i]);
+        controllers[i] = write_file_at(root_fd, "cgroup.subtree_control", request);
+        if (!controllers[i]) {
+            log_message(LOG_WARNING, "Cannot enable the %s controller in %s: %s",
+                       controller_names[i], root_path, strerror(errno));
+        }
+    }
+
+    close(root_fd);
+}
+
+// Remove the empty task cgroups of earlier daemons
+static void remove_stale(void) {
+    DIR *dir = opendir(root_path);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, TASK_PREFIX, strlen(TASK_PREFIX)) == 0) {
+            unlinkat(dirfd(dir), entry->d_name, AT_REMOVEDIR);
+        }
+    }
+
+    closedir(dir);
+}
+
+static void retry_lingering(void) {
+    pthread_mutex_lock(&lingering_lock);
+    for (int i = lingering_count - 1; i >= 0; i--) {
+        if (rmdir(lingering[i]) == 0 || errno != EBUSY) {
+            free(lingering[i]);
+            lingering[i] = lingering[--lingering_count];
+        }
+    }
+    pthread_mutex_unlock(&lingering_lock);
+}
+
+static bool apply_limit(const TaskCgroup *cgroup, Controller controller, const char *file,
+                        const char *value, int task_id) {
+    if (!controllers[controller]) {
+        log_message(LOG_WARNING, "Task %d: %s not applied, the %s controller is not available",
+                   task_id, file, controller_names[controller]);
+        return false;
+    }
+    if (!write_file_at(cgroup->dir_fd, file, value)) {
+        log_message(LOG_WARNING, "Task %d: failed to write '%s' to %s: %s",
+                   task_id, value, file, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Bytes with an optional K, M or G suffix
+static bool parse_size(const char *text, long long *value) {
+    char *end;
+    double number = strtod(text, &end);
+    if (end == text || number <= 0) {
+        return false;
+    }
+
+    switch (toupper((unsigned char)*end)) {
+        case 'K': number *= 1024.0; end++; break;
+        case 'M': number *= 1024.0 * 1024; end++; break;
+        case 'G': number *= 1024.0 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    if (toupper((unsigned char)*end) == 'B') {
+        end++;
+    }
+    if (*end) {
+        return false;
+    }
+
+    *value = (long long)number;
+    return true;
+}
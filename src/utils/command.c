@@ -0,0 +1,276 @@
+#include "../../include/command.h"
+#include "../../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Default search path of the shell when PATH is unset
+#define COMMAND_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+// Parsed form of one command text
+typedef struct {
+    char *command;               // Key, NULL for an empty slot
+    bool direct;                 // Can be executed without a shell
+    size_t text_length;          // Bytes of text, including the last NUL
+    char *text;                  // Arguments, NUL-separated
+    char *path;                  // Resolved program
+} CommandEntry;
+
+// Result of searching PATH for one program name
+typedef struct {
+    char *name;                  // Key, NULL for an empty slot
+    char *path;                  // Resolved program, NULL if not found
+} PathEntry;
+
+// Characters that make a command need the shell. Conservative: a few of
+// them are only special in some positions.
+static const char SHELL_METACHARACTERS[] = "|&;<>()$`\\\"'*?[]{}#~!\n\r";
+
+// Words the shell handles itself, for which running a binary of the same
+// name would behave differently or not at all
+static const char *SHELL_BUILTINS[] = {
+    ".", ":", "alias", "bg", "break", "case", "cd", "command", "continue",
+    "do", "done", "elif", "else", "esac", "eval", "exec", "exit", "export",
+    "fc", "fg", "fi", "for", "function", "getopts", "hash", "if", "jobs",
+    "local", "read", "readonly", "return", "select", "set", "shift",
+    "source", "then", "time", "times", "trap", "type", "ulimit", "umask",
+    "unalias", "unset", "until", "wait", "while", NULL
+};
+
+static pthread_mutex_t command_lock = PTHREAD_MUTEX_INITIALIZER;
+static CommandEntry commands[COMMAND_CACHE_SLOTS];
+static PathEntry paths[COMMAND_PATH_CACHE_SLOTS];
+static char *cached_path_env = NULL;    // PATH the caches were filled under
+
+// Helper functions
+static unsigned int hash_string(const char *text);
+static void clear_entry(CommandEntry *entry);
+static void clear_caches(void);
+static void refresh_path_env(void);
+static bool is_shell_builtin(const char *word);
+static bool parse_command(const char *command, CommandEntry *entry);
+static const char* lookup_program(const char *name);
+static char* search_path(const char *name);
+static CommandEntry* entry_for(const char *command);
+
+bool command_plan(const char *command, CommandPlan *plan) {
+    if (!command || !plan) {
+        return false;
+    }
+
+    size_t length = strlen(command);
+    if (length == 0 || length >= COMMAND_MAX_LENGTH) {
+        return false;
+    }
+
+    pthread_mutex_lock(&command_lock);
+
+    refresh_path_env();
+    CommandEntry *entry = entry_for(command);
+    bool direct = entry && entry->direct;
+
+    if (direct) {
+        memcpy(plan->text, entry->text, entry->text_length);
+        safe_strcpy(plan->path, entry->path, sizeof(plan->path));
+
+        int argc = 0;
+        for (size_t offset = 0; offset < entry->text_length; offset += strlen(plan->text + offset) + 1) {
+            plan->argv[argc++] = plan->text + offset;
+        }
+        plan->argv[argc] = NULL;
+    }
+
+    pthread_mutex_unlock(&command_lock);
+    return direct;
+}
+
+void command_require_shell(const char *command) {
+    if (!command) {
+        return;
+    }
+
+    pthread_mutex_lock(&command_lock);
+    CommandEntry *entry = entry_for(command);
+    if (entry && entry->direct) {
+        free(entry->text);
+        free(entry->path);
+        entry->text = NULL;
+        entry->path = NULL;
+        entry->direct = false;
+    }
+    pthread_mutex_unlock(&command_lock);
+}
+
+void command_cache_clear(void) {
+    pthread_mutex_lock(&command_lock);
+    clear_caches();
+    pthread_mutex_unlock(&command_lock);
+}
+
+// FNV-1a
+static unsigned int hash_string(const char *text) {
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char*)text; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void clear_entry(CommandEntry *entry) {
+    free(entry->command);
+    free(entry->text);
+    free(entry->path);
+    memset(entry, 0, sizeof(CommandEntry));
+}
+
+static void clear_caches(void) {
+    for (int i = 0; i < COMMAND_CACHE_SLOTS; i++) {
+        clear_entry(&commands[i]);
+    }
+    for (int i = 0; i < COMMAND_PATH_CACHE_SLOTS; i++) {
+        free(paths[i].name);
+        free(paths[i].path);
+        paths[i].name = NULL;
+        paths[i].path = NULL;
+    }
+}
+
+// Resolved programs depend on PATH, so a new PATH starts over
+static void refresh_path_env(void) {
+    const char *env = getenv("PATH");
+    if (env == cached_path_env ||
+        (env && cached_path_env && strcmp(env, cached_path_env) == 0)) {
+        return;
+    }
+
+    clear_caches();
+    free(cached_path_env);
+    cached_path_env = env ? strdup(env) : NULL;
+}
+
+static bool is_shell_builtin(const char *word) {
+    for (int i = 0; SHELL_BUILTINS[i]; i++) {
+        if (strcmp(word, SHELL_BUILTINS[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Fill entry from command. Leaves entry->direct false if the command
+// needs a shell.
+static bool parse_command(const char *command, CommandEntry *entry) {
+    if (strpbrk(command, SHELL_METACHARACTERS)) {
+        return true;
+    }
+
+    size_t length = strlen(command);
+    char *text = (char*)malloc(length + 1);
+    if (!text) {
+        return false;
+    }
+
+    // Split on blanks, packing the words NUL-separated
+    size_t used = 0;
+    int argc = 0;
+    const char *p = command;
+    while (*p) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        while (*p && *p != ' ' && *p != '\t') {
+            text[used++] = *p++;
+        }
+        text[used++] = '\0';
+        argc++;
+    }
+
+    // A leading NAME=value is an assignment, not a program
+    if (argc == 0 || argc > COMMAND_MAX_ARGS || strchr(text, '=') || is_shell_builtin(text)) {
+        free(text);
+        return true;
+    }
+
+    const char *program = strchr(text, '/') ? text : lookup_program(text);
+    if (!program) {
+        free(text);
+        return true;
+    }
+
+    entry->path = strdup(program);
+    if (!entry->path) {
+        free(text);
+        return false;
+    }
+    entry->text = text;
+    entry->text_length = used;
+    entry->direct = true;
+    return true;
+}
+
+static const char* lookup_program(const char *name) {
+    PathEntry *entry = &paths[hash_string(name) % COMMAND_PATH_CACHE_SLOTS];
+    if (entry->name && strcmp(entry->name, name) == 0) {
+        return entry->path;
+    }
+
+    free(entry->name);
+    free(entry->path);
+    entry->name = strdup(name);
+    entry->path = entry->name ? search_path(name) : NULL;
+    return entry->path;
+}
+
+static char* search_path(const char *name) {
+    const char *dirs = cached_path_env ? cached_path_env : COMMAND_DEFAULT_PATH;
+    char candidate[PATH_MAX];
+
+    while (*dirs) {
+        const char *end = strchr(dirs, ':');
+        size_t dir_length = end ? (size_t)(end - dirs) : strlen(dirs);
+
+        // An empty entry means the current directory, which is the task's
+        // working directory rather than ours; leave that to the shell
+        if (dir_length == 0) {
+            return NULL;
+        }
+
+        int written = snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)dir_length, dirs, name);
+        struct stat st;
+        if (written > 0 && (size_t)written < sizeof(candidate) &&
+            stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            return strdup(candidate);
+        }
+
+        if (!end) {
+            break;
+        }
+        dirs = end + 1;
+    }
+
+    return NULL;
+}
+
+// Cached entry for command, parsing it on a miss. Returns NULL only if
+// memory runs out.
+static CommandEntry* entry_for(const char *command) {
+    CommandEntry *entry = &commands[hash_string(command) % COMMAND_CACHE_SLOTS];
+    if (entry->command && strcmp(entry->command, command) == 0) {
+        return entry;
+    }
+
+    clear_entry(entry);
+    entry->command = strdup(command);
+    if (!entry->command || !parse_command(command, entry)) {
+        clear_entry(entry);
+        return NULL;
+    }
+    return entry;
+}
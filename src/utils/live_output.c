@@ -0,0 +1,298 @@
+#include "../../include/live_output.h"
+#include "../../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// A run of consecutive output bytes
+typedef struct LiveChunk {
+    struct LiveChunk *next;      // Next newer chunk
+    long long offset;            // Stream offset of data[0]
+    size_t length;
+    size_t capacity;
+    char data[];
+} LiveChunk;
+
+struct LiveOutput {
+    int task_id;
+    LiveChunk *first;            // Oldest kept chunk
+    LiveChunk *last;             // Newest chunk, filled up before a new one is added
+    size_t kept;                 // Bytes in the chunks
+    size_t backlog;              // Bytes to keep
+    long long total;             // Bytes produced, including skipped ones
+    bool ended;
+    int subscribers;
+    int refs;                    // Producer, registry entry and cursors
+    struct LiveOutput *next;     // Next registered stream
+};
+
+// Everything is guarded by one lock: the producer only holds it to link
+// data in, a subscriber for one non-blocking sendmsg()
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+static LiveOutput *streams = NULL;       // Registered streams, one per running task
+static pthread_once_t event_once = PTHREAD_ONCE_INIT;
+static int event_fd = -1;
+
+// Helper functions
+static void event_init(void);
+static void notify(LiveOutput *output);
+static void unregister(LiveOutput *output);
+static void release(LiveOutput *output);
+static void evict(LiveOutput *output);
+
+LiveOutput* live_output_begin(int task_id, size_t backlog) {
+    LiveOutput *output = (LiveOutput*)calloc(1, sizeof(LiveOutput));
+    if (!output) {
+        log_message(LOG_ERROR, "Failed to allocate memory for live output");
+        return NULL;
+    }
+    output->task_id = task_id;
+    output->backlog = backlog;
+    output->refs = 2;
+
+    pthread_mutex_lock(&live_lock);
+    for (LiveOutput *other = streams; other; other = other->next) {
+        if (other->task_id == task_id) {
+            // An overlapping run of the same task; new subscribers follow this one
+            unregister(other);
+            break;
+        }
+    }
+    output->next = streams;
+    streams = output;
+    pthread_mutex_unlock(&live_lock);
+
+    return output;
+}
+
+void live_output_append(LiveOutput *output, const char *data, size_t length) {
+    if (!output || length == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&live_lock);
+
+    LiveChunk *last = output->last;
+    size_t room = last && last->offset + (long long)last->length == output->total ?
+                  last->capacity - last->length : 0;
+    if (room > length) {
+        room = length;
+    }
+    if (room > 0) {
+        memcpy(last->data + last->length, data, room);
+        last->length += room;
+        output->kept += room;
+        output->total += room;
+        data += room;
+        length -= room;
+    }
+
+    if (length > 0) {
+        size_t capacity = length > LIVE_OUTPUT_CHUNK_BYTES ? length : LIVE_OUTPUT_CHUNK_BYTES;
+        LiveChunk *chunk = (LiveChunk*)malloc(sizeof(LiveChunk) + capacity);
+        if (chunk) {
+            chunk->next = NULL;
+            chunk->offset = output->total;
+            chunk->length = length;
+            chunk->capacity = capacity;
+            memcpy(chunk->data, data, length);
+            if (output->last) {
+                output->last->next = chunk;
+            } else {
+                output->first = chunk;
+            }
+            output->last = chunk;
+            output->kept += length;
+        }
+        // Without memory the bytes are lost to subscribers, who see a gap
+        output->total += length;
+    }
+
+    evict(output);
+    notify(output);
+    pthread_mutex_unlock(&live_lock);
+}
+
+void live_output_skip(LiveOutput *output, size_t length) {
+    if (!output || length == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&live_lock);
+    output->total += length;
+    pthread_mutex_unlock(&live_lock);
+}
+
+bool live_output_watched(LiveOutput *output) {
+    if (!output) {
+        return false;
+    }
+
+    pthread_mutex_lock(&live_lock);
+    bool watched = output->subscribers > 0;
+    pthread_mutex_unlock(&live_lock);
+    return watched;
+}
+
+void live_output_end(LiveOutput *output) {
+    if (!output) {
+        return;
+    }
+
+    pthread_mutex_lock(&live_lock);
+    output->ended = true;
+    unregister(output);
+    notify(output);
+    release(output);
+    pthread_mutex_unlock(&live_lock);
+}
+
+bool live_output_subscribe(int task_id, LiveCursor *cursor) {
+    if (!cursor) {
+        return false;
+    }
+
+    pthread_once(&event_once, event_init);
+
+    pthread_mutex_lock(&live_lock);
+    LiveOutput *output = streams;
+    while (output && output->task_id != task_id) {
+        output = output->next;
+    }
+    if (output) {
+        output->refs++;
+        output->subscribers++;
+        cursor->output = output;
+        cursor->position = output->first ? output->first->offset : output->total;
+    }
+    pthread_mutex_unlock(&live_lock);
+
+    return output != NULL;
+}
+
+void live_output_unsubscribe(LiveCursor *cursor) {
+    if (!cursor || !cursor->output) {
+        return;
+    }
+
+    pthread_mutex_lock(&live_lock);
+    cursor->output->subscribers--;
+    release(cursor->output);
+    pthread_mutex_unlock(&live_lock);
+    cursor->output = NULL;
+}
+
+LiveSendResult live_output_send(LiveCursor *cursor, int fd, long long *skipped) {
+    LiveOutput *output = cursor->output;
+
+    pthread_mutex_lock(&live_lock);
+
+    // First kept chunk that still has bytes for this cursor
+    LiveChunk *chunk = output->first;
+    while (chunk && chunk->offset + (long long)chunk->length <= cursor->position) {
+        chunk = chunk->next;
+    }
+
+    // Bytes before it were dropped (evicted, skipped unread or lost)
+    long long resume = chunk ? chunk->offset : output->total;
+    if (resume > cursor->position) {
+        *skipped = resume - cursor->position;
+        cursor->position = resume;
+        pthread_mutex_unlock(&live_lock);
+        return LIVE_SEND_SKIPPED;
+    }
+
+    if (!chunk) {
+        LiveSendResult result = output->ended ? LIVE_SEND_END : LIVE_SEND_IDLE;
+        pthread_mutex_unlock(&live_lock);
+        return result;
+    }
+
+    struct iovec iov[LIVE_OUTPUT_MAX_IOV];
+    int count = 0;
+    size_t start = (size_t)(cursor->position - chunk->offset);
+    for (; chunk && count < LIVE_OUTPUT_MAX_IOV; chunk = chunk->next) {
+        iov[count].iov_base = chunk->data + start;
+        iov[count].iov_len = chunk->length - start;
+        count++;
+        start = 0;
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    message.msg_iovlen = (size_t)count;
+    ssize_t written = sendmsg(fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+    pthread_mutex_unlock(&live_lock);
+
+    if (written < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? LIVE_SEND_FULL : LIVE_SEND_ERROR;
+    }
+    cursor->position += written;
+    return LIVE_SEND_PROGRESS;
+}
+
+int live_output_event_fd(void) {
+    pthread_once(&event_once, event_init);
+    return event_fd;
+}
+
+static void event_init(void) {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        log_message(LOG_ERROR, "Failed to create live output event: %s", strerror(errno));
+    }
+}
+
+// Wake the subscribers' thread if anyone follows output
+static void notify(LiveOutput *output) {
+    if (output->subscribers > 0 && event_fd >= 0) {
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            log_message(LOG_WARNING, "Failed to signal live output: %s", strerror(errno));
+        }
+    }
+}
+
+static void unregister(LiveOutput *output) {
+    for (LiveOutput **link = &streams; *link; link = &(*link)->next) {
+        if (*link == output) {
+            *link = output->next;
+            output->next = NULL;
+            release(output);
+            return;
+        }
+    }
+}
+
+static void release(LiveOutput *output) {
+    if (--output->refs > 0) {
+        return;
+    }
+
+    LiveChunk *chunk = output->first;
+    while (chunk) {
+        LiveChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(output);
+}
+
+// Drop the oldest chunks while the rest still cover the backlog
+static void evict(LiveOutput *output) {
+    while (output->first && output->first != output->last &&
+           output->kept - output->first->length >= output->backlog) {
+        LiveChunk *chunk = output->first;
+        output->first = chunk->next;
+        output->kept -= chunk->length;
+        free(chunk);
+    }
+}
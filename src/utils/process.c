@@ -0,0 +1,917 @@
+#include "../../include/process.h"
+#include "../../include/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define REAPER_MAX_EVENTS 64
+#define REAPER_INITIAL_CAPACITY 64
+#define REAPER_READ_BYTES (64 * 1024)
+#define REAPER_READS_PER_EVENT 16      // Reads per readiness event before serving others
+#define STREAM_COUNT 2                 // stdout, stderr
+#define CHILD_STACK_SIZE (64 * 1024)   // Stack of a child until it execs
+
+extern char **environ;
+
+struct Watch;
+
+// Shared with a child of spawn_into_cgroup() until it execs
+typedef struct {
+    const ProcessSpec *spec;
+    int procs_fd;                // cgroup.procs of the cgroup to join
+    int error;                   // Set by the child if setup or exec failed
+} ChildStart;
+
+// What an epoll event refers to: a child's pidfd or one of its streams
+typedef struct {
+    struct Watch *watch;
+    int stream;                  // -1 for the pidfd, else the stream index
+} WatchSource;
+
+// One child handed to the reaper
+typedef struct Watch {
+    pid_t pid;
+    int pidfd;                   // -1 when reaped through the SIGCHLD fallback
+    double deadline;             // Monotonic deadline, 0 for none
+    bool kill_group;             // Kill the whole process group on timeout
+    int kill_fd;                 // cgroup.kill to write on timeout instead, -1 for none
+    int index;                   // Position in the watch list
+    int timer_index;             // Position in the timer heap, -1 if not in it
+    int stream_fds[STREAM_COUNT]; // Output pipes still open, -1 once closed
+    size_t output_limit;
+    LiveOutput *live;            // Also gets the output, NULL for none
+    WatchSource sources[1 + STREAM_COUNT];
+    ProcessExit outcome;
+    ProcessExitFunc func;
+    void *arg;
+    struct Watch *next;          // Link in the list of reaped children
+} Watch;
+
+// Caller of process_wait() blocked until its child is reaped
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    bool done;
+    ProcessExit outcome;
+} ExitWaiter;
+
+// Reaper state, everything below is protected by reaper_lock
+static pthread_once_t reaper_once = PTHREAD_ONCE_INIT;
+static bool reaper_ready = false;
+static pthread_mutex_t reaper_lock = PTHREAD_MUTEX_INITIALIZER;
+static int epoll_fd = -1;
+static int wake_pipe[2] = { -1, -1 };
+static int null_fd = -1;         // /dev/null, where dropped output is spliced
+static char *read_buffer = NULL; // Used by the reaper thread only
+static Watch **watches = NULL;   // Every watched child
+static int watch_count = 0;
+static Watch **timers = NULL;    // Min-heap of children with a deadline
+static int timer_count = 0;
+static int watch_capacity = 0;   // Capacity of both arrays
+static int fallback_count = 0;   // Watched children without a pidfd
+static bool sigchld_installed = false;
+
+// Helper functions
+static int spawn_into_cgroup(const ProcessSpec *spec, pid_t *pid);
+static int exec_child(void *arg);
+static void log_spawn_failure(const ProcessSpec *spec, int error);
+static void reaper_init(void);
+static void* reaper_thread_func(void *arg);
+static void wake_reaper(void);
+static void drain_wake_pipe(void);
+static void sigchld_handler(int sig);
+static void install_sigchld_handler(void);
+static int open_pidfd(pid_t pid);
+static bool reserve_watch(void);
+static void unwatch(Watch *watch);
+static void try_reap(Watch *watch, Watch **reaped);
+static OutputBuffer* stream_buffer(Watch *watch, int stream);
+static bool watch_stream(Watch *watch, int stream, int fd);
+static void close_stream(Watch *watch, int stream);
+static void drain_stream(Watch *watch, int stream, int max_reads);
+static void sweep_fallback(Watch **reaped);
+static void expire_timers(void);
+static int next_timeout_ms(void);
+static void timer_swap(int a, int b);
+static void timer_sift_up(int index);
+static void timer_sift_down(int index);
+static void timer_push(Watch *watch);
+static void timer_remove(Watch *watch);
+static void wake_waiter(pid_t pid, ProcessExit *outcome, void *arg);
+
+void process_spec_init(ProcessSpec *spec) {
+    if (!spec) {
+        return;
+    }
+
+    memset(spec, 0, sizeof(ProcessSpec));
+    spec->stdout_fd = -1;
+    spec->stderr_fd = -1;
+    spec->inherit_fd = -1;
+    spec->cgroup_fd = -1;
+}
+
+bool process_spawn(const ProcessSpec *spec, pid_t *pid) {
+    if (!spec || !spec->path || !spec->argv || !pid) {
+        return false;
+    }
+
+    if (spec->cgroup_fd >= 0) {
+        int rc = spawn_into_cgroup(spec, pid);
+        if (rc != 0 && !spec->quiet) {
+            log_spawn_failure(spec, rc);
+        }
+        errno = rc;
+        return rc == 0;
+    }
+
+    // posix_spawn() starts the child on a shared address space (glibc uses
+    // clone with CLONE_VM | CLONE_VFORK), so the cost does not grow with
+    // the daemon's heap the way fork()'s page table copy does, and nothing
+    // runs in the child that could trip over a lock held by another thread
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    if (posix_spawn_file_actions_init(&actions) != 0) {
+        log_message(LOG_ERROR, "Failed to initialize spawn file actions");
+        return false;
+    }
+    if (posix_spawnattr_init(&attr) != 0) {
+        log_message(LOG_ERROR, "Failed to initialize spawn attributes");
+        posix_spawn_file_actions_destroy(&actions);
+        return false;
+    }
+
+    int rc = 0;
+    if (spec->working_dir) {
+        rc = posix_spawn_file_actions_addchdir_np(&actions, spec->working_dir);
+    }
+    if (rc == 0 && spec->stdout_fd >= 0) {
+        rc = posix_spawn_file_actions_adddup2(&actions, spec->stdout_fd, STDOUT_FILENO);
+    }
+    if (rc == 0 && spec->stderr_fd >= 0) {
+        rc = posix_spawn_file_actions_adddup2(&actions, spec->stderr_fd, STDERR_FILENO);
+    }
+    if (rc == 0 && spec->inherit_fd >= 0) {
+        // dup2 onto itself clears close-on-exec in the child only
+        rc = posix_spawn_file_actions_adddup2(&actions, spec->inherit_fd, spec->inherit_fd);
+    }
+
+    // Worker threads may block signals and the daemon may ignore some;
+    // neither should leak into the task
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    sigset_t mask;
+    sigset_t defaults;
+    sigemptyset(&mask);
+    sigfillset(&defaults);
+    if (rc == 0) {
+        rc = posix_spawnattr_setsigmask(&attr, &mask);
+    }
+    if (rc == 0) {
+        rc = posix_spawnattr_setsigdefault(&attr, &defaults);
+    }
+    if (rc == 0 && spec->new_group) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        rc = posix_spawnattr_setpgroup(&attr, 0);
+    }
+    if (rc == 0) {
+        rc = posix_spawnattr_setflags(&attr, flags);
+    }
+
+    if (rc == 0) {
+        rc = posix_spawn(pid, spec->path, &actions, &attr, spec->argv,
+                         spec->envp ? spec->envp : environ);
+        if (rc != 0 && !spec->quiet) {
+            log_spawn_failure(spec, rc);
+        }
+    } else {
+        log_message(LOG_ERROR, "Failed to prepare spawn of %s: %s", spec->path, strerror(rc));
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    errno = rc;
+    return rc == 0;
+}
+
+// Start a child the way posix_spawn() does, on a shared address space
+// and a stack of its own, with the parent suspended until the exec. The
+// child joins the cgroup before it execs, which posix_spawn() has no step
+// for. Returns 0 or the errno of the failed step.
+static int spawn_into_cgroup(const ProcessSpec *spec, pid_t *pid) {
+    ChildStart start = { spec, -1, 0 };
+    start.procs_fd = openat(spec->cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (start.procs_fd < 0) {
+        return errno;
+    }
+
+    void *stack = mmap(NULL, CHILD_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        int error = errno;
+        close(start.procs_fd);
+        return error;
+    }
+
+    // No handler may run in the child, on our memory, before it resets them
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    // Stacks grow down on every architecture this builds for
+    pid_t child = clone(exec_child, (char*)stack + CHILD_STACK_SIZE,
+                        CLONE_VM | CLONE_VFORK | SIGCHLD, &start);
+    int clone_error = errno;
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    munmap(stack, CHILD_STACK_SIZE);
+    close(start.procs_fd);
+
+    if (child < 0) {
+        return clone_error;
+    }
+    if (start.error != 0) {
+        // Not handed to the reaper yet, nobody else waits for it
+        waitpid(child, NULL, 0);
+        return start.error;
+    }
+
+    *pid = child;
+    return 0;
+}
+
+// Runs in the child of spawn_into_cgroup() on our memory: only
+// async-signal-safe calls, and nothing written but start->error
+static int exec_child(void *arg) {
+    ChildStart *start = (ChildStart*)arg;
+    const ProcessSpec *spec = start->spec;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (sig != SIGKILL && sig != SIGSTOP) {
+            sigaction(sig, &action, NULL);
+        }
+    }
+
+    // "0" moves the writer itself
+    sigset_t none;
+    sigemptyset(&none);
+    bool ok = write(start->procs_fd, "0", 1) == 1 &&
+              sigprocmask(SIG_SETMASK, &none, NULL) == 0 &&
+              (!spec->new_group || setpgid(0, 0) == 0) &&
+              (!spec->working_dir || chdir(spec->working_dir) == 0) &&
+              (spec->stdout_fd < 0 || dup2(spec->stdout_fd, STDOUT_FILENO) >= 0) &&
+              (spec->stderr_fd < 0 || dup2(spec->stderr_fd, STDERR_FILENO) >= 0) &&
+              (spec->inherit_fd < 0 || fcntl(spec->inherit_fd, F_SETFD, 0) == 0);
+    if (ok) {
+        execve(spec->path, spec->argv, spec->envp ? spec->envp : environ);
+    }
+
+    start->error = errno;
+    _exit(127);
+}
+
+static void log_spawn_failure(const ProcessSpec *spec, int error) {
+    log_message(LOG_ERROR, "Failed to start %s%s%s: %s", spec->path,
+               spec->working_dir ? " in " : "",
+               spec->working_dir ? spec->working_dir : "", strerror(error));
+}
+
+void process_watch_options_init(ProcessWatchOptions *options) {
+    if (!options) {
+        return;
+    }
+
+    memset(options, 0, sizeof(ProcessWatchOptions));
+    options->kill_fd = -1;
+    options->output_fd = -1;
+    options->error_fd = -1;
+}
+
+bool process_watch(pid_t pid, const ProcessWatchOptions *options,
+                   ProcessExitFunc func, void *arg) {
+    int fds[STREAM_COUNT] = { options ? options->output_fd : -1, options ? options->error_fd : -1 };
+
+    Watch *watch = NULL;
+    if (pid > 0 && options && func) {
+        pthread_once(&reaper_once, reaper_init);
+        if (reaper_ready) {
+            watch = (Watch*)calloc(1, sizeof(Watch));
+            if (!watch) {
+                log_message(LOG_ERROR, "Failed to allocate memory for process watch");
+            }
+        }
+    }
+    if (!watch) {
+        for (int i = 0; i < STREAM_COUNT; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        return false;
+    }
+
+    watch->pid = pid;
+    watch->deadline = options->timeout_sec > 0 ? monotonic_seconds() + options->timeout_sec : 0;
+    watch->kill_group = options->kill_group;
+    watch->kill_fd = options->kill_fd;
+    watch->timer_index = -1;
+    watch->output_limit = options->output_limit;
+    watch->live = options->live;
+    watch->func = func;
+    watch->arg = arg;
+    for (int i = 0; i < 1 + STREAM_COUNT; i++) {
+        watch->sources[i].watch = watch;
+        watch->sources[i].stream = i - 1;
+    }
+    watch->pidfd = open_pidfd(pid);
+
+    pthread_mutex_lock(&reaper_lock);
+
+    if (!reserve_watch()) {
+        pthread_mutex_unlock(&reaper_lock);
+        if (watch->pidfd >= 0) {
+            close(watch->pidfd);
+        }
+        for (int i = 0; i < STREAM_COUNT; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        free(watch);
+        return false;
+    }
+
+    if (watch->pidfd >= 0) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = &watch->sources[0];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watch->pidfd, &event) != 0) {
+            log_message(LOG_WARNING, "Failed to watch pidfd of process %d: %s",
+                       (int)pid, strerror(errno));
+            close(watch->pidfd);
+            watch->pidfd = -1;
+        }
+    }
+    if (watch->pidfd < 0) {
+        install_sigchld_handler();
+        fallback_count++;
+    }
+
+    for (int i = 0; i < STREAM_COUNT; i++) {
+        watch->stream_fds[i] = -1;
+        if (fds[i] >= 0 && !watch_stream(watch, i, fds[i])) {
+            close(fds[i]);
+        }
+    }
+
+    watch->index = watch_count;
+    watches[watch_count++] = watch;
+    if (watch->deadline > 0) {
+        timer_push(watch);
+    }
+
+    pthread_mutex_unlock(&reaper_lock);
+
+    // New deadline to sleep towards, and a child reaped through the
+    // fallback may already have exited
+    wake_reaper();
+    return true;
+}
+
+bool process_wait(pid_t pid, const ProcessWatchOptions *options, ProcessExit *outcome) {
+    if (!outcome) {
+        return false;
+    }
+
+    ExitWaiter waiter;
+    pthread_mutex_init(&waiter.lock, NULL);
+    pthread_cond_init(&waiter.done_cond, NULL);
+    waiter.done = false;
+
+    bool watched = process_watch(pid, options, wake_waiter, &waiter);
+    if (watched) {
+        pthread_mutex_lock(&waiter.lock);
+        while (!waiter.done) {
+            pthread_cond_wait(&waiter.done_cond, &waiter.lock);
+        }
+        pthread_mutex_unlock(&waiter.lock);
+        *outcome = waiter.outcome;
+    }
+
+    pthread_cond_destroy(&waiter.done_cond);
+    pthread_mutex_destroy(&waiter.lock);
+    return watched;
+}
+
+static void reaper_init(void) {
+    if (pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        log_message(LOG_ERROR, "Failed to create reaper wake pipe: %s", strerror(errno));
+        return;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        log_message(LOG_ERROR, "Failed to create reaper epoll instance: %s", strerror(errno));
+        return;
+    }
+
+    // A NULL pointer marks the wake pipe
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &event) != 0) {
+        log_message(LOG_ERROR, "Failed to watch reaper wake pipe: %s", strerror(errno));
+        return;
+    }
+
+    null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    read_buffer = (char*)malloc(REAPER_READ_BYTES);
+    if (null_fd < 0 || !read_buffer) {
+        log_message(LOG_ERROR, "Failed to set up output capture: %s", strerror(errno));
+        return;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = thread_create(&thread, &attr, reaper_thread_func, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        log_message(LOG_ERROR, "Failed to create reaper thread: %s", strerror(rc));
+        return;
+    }
+
+    reaper_ready = true;
+}
+
+static void* reaper_thread_func(void *arg) {
+    (void)arg;
+    struct epoll_event events[REAPER_MAX_EVENTS];
+
+    for (;;) {
+        pthread_mutex_lock(&reaper_lock);
+        int timeout_ms = next_timeout_ms();
+        pthread_mutex_unlock(&reaper_lock);
+
+        int count = epoll_wait(epoll_fd, events, REAPER_MAX_EVENTS, timeout_ms);
+        if (count < 0) {
+            if (errno != EINTR) {
+                log_message(LOG_ERROR, "Reaper epoll_wait failed: %s", strerror(errno));
+            }
+            count = 0;
+        }
+
+        Watch *reaped = NULL;
+        bool woken = false;
+
+        pthread_mutex_lock(&reaper_lock);
+        for (int i = 0; i < count; i++) {
+            WatchSource *source = (WatchSource*)events[i].data.ptr;
+            if (!source) {
+                woken = true;
+            } else if (source->stream < 0) {
+                try_reap(source->watch, &reaped);
+            } else if (source->watch->stream_fds[source->stream] >= 0) {
+                drain_stream(source->watch, source->stream, REAPER_READS_PER_EVENT);
+            }
+        }
+        if (woken) {
+            drain_wake_pipe();
+            if (fallback_count > 0) {
+                sweep_fallback(&reaped);
+            }
+        }
+        expire_timers();
+        pthread_mutex_unlock(&reaper_lock);
+
+        // Completions are delivered without the lock, so callbacks may
+        // watch further children
+        while (reaped) {
+            Watch *next = reaped->next;
+            reaped->func(reaped->pid, &reaped->outcome, reaped->arg);
+            free(reaped);
+            reaped = next;
+        }
+    }
+
+    return NULL;
+}
+
+static void wake_reaper(void) {
+    // A full pipe already means a wakeup is pending
+    ssize_t written = write(wake_pipe[1], "", 1);
+    (void)written;
+}
+
+static void drain_wake_pipe(void) {
+    char buffer[256];
+    while (read(wake_pipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+static void sigchld_handler(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    wake_reaper();
+    errno = saved_errno;
+}
+
+// Reaping on SIGCHLD: every wakeup polls the children that have no pidfd
+static void install_sigchld_handler(void) {
+    if (sigchld_installed) {
+        return;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sigchld_handler;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGCHLD, &action, NULL) != 0) {
+        log_message(LOG_ERROR, "Failed to install SIGCHLD handler: %s", strerror(errno));
+        return;
+    }
+
+    log_message(LOG_INFO, "pidfd not available, reaping children on SIGCHLD");
+    sigchld_installed = true;
+}
+
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    // pidfds are created close-on-exec
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Make room for one more watch in both the list and the timer heap
+static bool reserve_watch(void) {
+    if (watch_count < watch_capacity) {
+        return true;
+    }
+
+    int capacity = watch_capacity > 0 ? watch_capacity * 2 : REAPER_INITIAL_CAPACITY;
+    Watch **new_watches = (Watch**)realloc(watches, capacity * sizeof(Watch*));
+    if (!new_watches) {
+        log_message(LOG_ERROR, "Failed to allocate memory for process watches");
+        return false;
+    }
+    watches = new_watches;
+
+    Watch **new_timers = (Watch**)realloc(timers, capacity * sizeof(Watch*));
+    if (!new_timers) {
+        log_message(LOG_ERROR, "Failed to allocate memory for process timers");
+        return false;
+    }
+    timers = new_timers;
+
+    watch_capacity = capacity;
+    return true;
+}
+
+static void unwatch(Watch *watch) {
+    // The child is gone; take what its pipes still hold. Descendants that
+    // kept a pipe open are not waited for.
+    for (int i = 0; i < STREAM_COUNT; i++) {
+        if (watch->stream_fds[i] >= 0) {
+            drain_stream(watch, i, REAPER_READS_PER_EVENT);
+            close_stream(watch, i);
+        }
+    }
+
+    if (watch->pidfd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, watch->pidfd, NULL);
+        close(watch->pidfd);
+        watch->pidfd = -1;
+    } else {
+        fallback_count--;
+    }
+
+    if (watch->timer_index >= 0) {
+        timer_remove(watch);
+    }
+
+    Watch *last = watches[--watch_count];
+    watches[watch->index] = last;
+    last->index = watch->index;
+}
+
+static void try_reap(Watch *watch, Watch **reaped) {
+    pid_t result;
+    do {
+        result = wait4(watch->pid, &watch->outcome.status, WNOHANG, &watch->outcome.usage);
+    } while (result < 0 && errno == EINTR);
+
+    if (result == 0) {
+        return;
+    }
+    if (result < 0) {
+        watch->outcome.error = errno;
+        log_message(LOG_ERROR, "Failed to reap process %d: %s", (int)watch->pid, strerror(errno));
+    }
+
+    unwatch(watch);
+    watch->next = *reaped;
+    *reaped = watch;
+}
+
+static OutputBuffer* stream_buffer(Watch *watch, int stream) {
+    return stream == 0 ? &watch->outcome.output : &watch->outcome.error_output;
+}
+
+static bool watch_stream(Watch *watch, int stream, int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        log_message(LOG_WARNING, "Failed to make output pipe of process %d non-blocking: %s",
+                   (int)watch->pid, strerror(errno));
+        return false;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &watch->sources[1 + stream];
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        log_message(LOG_WARNING, "Failed to watch output pipe of process %d: %s",
+                   (int)watch->pid, strerror(errno));
+        return false;
+    }
+
+    watch->stream_fds[stream] = fd;
+    return true;
+}
+
+static void close_stream(Watch *watch, int stream) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, watch->stream_fds[stream], NULL);
+    close(watch->stream_fds[stream]);
+    watch->stream_fds[stream] = -1;
+}
+
+// Move what a pipe holds into the stream's buffer, closing it at EOF
+static void drain_stream(Watch *watch, int stream, int max_reads) {
+    int fd = watch->stream_fds[stream];
+    OutputBuffer *buffer = stream_buffer(watch, stream);
+    size_t half = watch->output_limit / 2;
+
+    for (int i = 0; i < max_reads; i++) {
+        // Once the head is full, only the last `half` bytes can survive;
+        // anything before them is discarded in the kernel, never copied
+        int pending = 0;
+        if (buffer->head && buffer->head_length == buffer->half &&
+            ioctl(fd, FIONREAD, &pending) == 0 && (size_t)pending > half &&
+            !live_output_watched(watch->live)) {
+            ssize_t skipped = splice(fd, NULL, null_fd, NULL, (size_t)pending - half, SPLICE_F_NONBLOCK);
+            if (skipped > 0) {
+                buffer->total += skipped;
+                live_output_skip(watch->live, (size_t)skipped);
+            }
+        }
+
+        ssize_t n = read(fd, read_buffer, REAPER_READ_BYTES);
+        if (n > 0) {
+            output_buffer_append(buffer, read_buffer, (size_t)n, watch->output_limit);
+            live_output_append(watch->live, read_buffer, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || errno != EAGAIN) {
+            close_stream(watch, stream);
+        }
+        return;
+    }
+}
+
+static void sweep_fallback(Watch **reaped) {
+    // Backwards, since reaping moves the last watch into the freed slot
+    for (int i = watch_count - 1; i >= 0; i--) {
+        if (watches[i]->pidfd < 0) {
+            try_reap(watches[i], reaped);
+        }
+    }
+}
+
+static void expire_timers(void) {
+    double now = monotonic_seconds();
+
+    while (timer_count > 0 && timers[0]->deadline <= now) {
+        Watch *watch = timers[0];
+        timer_remove(watch);
+
+        // Reaped once the kill lands, like any other exit. cgroup.kill also
+        // reaches descendants that left the process group.
+        watch->outcome.timed_out = true;
+        if (watch->kill_fd < 0 || write(watch->kill_fd, "1", 1) != 1) {
+            kill(watch->kill_group ? -watch->pid : watch->pid, SIGKILL);
+        }
+    }
+}
+
+static int next_timeout_ms(void) {
+    if (timer_count == 0) {
+        return -1;
+    }
+
+    double remaining = timers[0]->deadline - monotonic_seconds();
+    if (remaining <= 0) {
+        return 0;
+    }
+    if (remaining * 1000.0 >= INT_MAX) {
+        return INT_MAX;
+    }
+    // Round up so the deadline has passed when we wake
+    return (int)(remaining * 1000.0) + 1;
+}
+
+static void timer_swap(int a, int b) {
+    Watch *watch = timers[a];
+    timers[a] = timers[b];
+    timers[b] = watch;
+    timers[a]->timer_index = a;
+    timers[b]->timer_index = b;
+}
+
+static void timer_sift_up(int index) {
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (timers[parent]->deadline <= timers[index]->deadline) {
+            break;
+        }
+        timer_swap(parent, index);
+        index = parent;
+    }
+}
+
+static void timer_sift_down(int index) {
+    for (;;) {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = left + 1;
+        if (left < timer_count && timers[left]->deadline < timers[smallest]->deadline) {
+            smallest = left;
+        }
+        if (right < timer_count && timers[right]->deadline < timers[smallest]->deadline) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        timer_swap(index, smallest);
+        index = smallest;
+    }
+}
+
+static void timer_push(Watch *watch) {
+    watch->timer_index = timer_count;
+    timers[timer_count++] = watch;
+    timer_sift_up(watch->timer_index);
+}
+
+static void timer_remove(Watch *watch) {
+    int index = watch->timer_index;
+    watch->timer_index = -1;
+
+    timer_count--;
+    if (index == timer_count) {
+        return;
+    }
+
+    timers[index] = timers[timer_count];
+    timers[index]->timer_index = index;
+    timer_sift_down(index);
+    timer_sift_up(index);
+}
+
+static void wake_waiter(pid_t pid, ProcessExit *outcome, void *arg) {
+    (void)pid;
+    ExitWaiter *waiter = (ExitWaiter*)arg;
+
+    pthread_mutex_lock(&waiter->lock);
+    waiter->outcome = *outcome;
+    waiter->done = true;
+    pthread_cond_signal(&waiter->done_cond);
+    pthread_mutex_unlock(&waiter->lock);
+}
+
+void output_buffer_append(OutputBuffer *buffer, const char *data, size_t length, size_t limit) {
+    if (!buffer || !data) {
+        return;
+    }
+
+    buffer->total += (long long)length;
+
+    if (!buffer->head) {
+        size_t half = limit / 2;
+        if (half == 0) {
+            return;
+        }
+        // Head and tail share one allocation
+        buffer->head = (char*)malloc(half * 2);
+        if (!buffer->head) {
+            return;
+        }
+        buffer->tail = buffer->head + half;
+        buffer->half = half;
+    }
+
+    size_t to_head = buffer->half - buffer->head_length;
+    if (to_head > length) {
+        to_head = length;
+    }
+    memcpy(buffer->head + buffer->head_length, data, to_head);
+    buffer->head_length += to_head;
+    data += to_head;
+    length -= to_head;
+
+    // Only the last `half` bytes of what remains can stay in the ring
+    if (length > buffer->half) {
+        data += length - buffer->half;
+        length = buffer->half;
+    }
+    while (length > 0) {
+        size_t end = (buffer->tail_start + buffer->tail_length) % buffer->half;
+        size_t chunk = buffer->half - end;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(buffer->tail + end, data, chunk);
+        data += chunk;
+        length -= chunk;
+
+        buffer->tail_length += chunk;
+        if (buffer->tail_length > buffer->half) {
+            // Overwrote the oldest bytes
+            buffer->tail_start = (buffer->tail_start + buffer->tail_length - buffer->half) % buffer->half;
+            buffer->tail_length = buffer->half;
+        }
+    }
+}
+
+char* output_buffer_flatten(const OutputBuffer *buffer, size_t *length) {
+    if (!buffer || buffer->total == 0) {
+        return NULL;
+    }
+
+    long long dropped = buffer->total - (long long)buffer->head_length - (long long)buffer->tail_length;
+    char marker[96] = "";
+    int marker_length = 0;
+    if (dropped > 0) {
+        marker_length = snprintf(marker, sizeof(marker), "\n[... %lld bytes omitted ...]\n", dropped);
+    }
+
+    size_t size = buffer->head_length + (size_t)marker_length + buffer->tail_length;
+    char *text = (char*)malloc(size + 1);
+    if (!text) {
+        log_message(LOG_ERROR, "Failed to allocate memory for captured output");
+        return NULL;
+    }
+
+    size_t pos = 0;
+    if (buffer->head_length > 0) {
+        memcpy(text, buffer->head, buffer->head_length);
+        pos = buffer->head_length;
+    }
+    memcpy(text + pos, marker, (size_t)marker_length);
+    pos += (size_t)marker_length;
+    for (size_t i = 0; i < buffer->tail_length; i++) {
+        text[pos++] = buffer->tail[(buffer->tail_start + i) % buffer->half];
+    }
+    text[pos] = '\0';
+
+    if (length) {
+        *length = pos;
+    }
+    return text;
+}
+
+void output_buffer_free(OutputBuffer *buffer) {
+    if (!buffer) {
+        return;
+    }
+
+    free(buffer->head);
+    memset(buffer, 0, sizeof(OutputBuffer));
+}
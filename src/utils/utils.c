@@ -11,16 +11,23 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/sysinfo.h>
 #include <sys/statvfs.h>
 #include <curl/curl.h>
 #include <cjson/cJSON.h>
 #include <ctype.h>
 #include "../../include/ai.h"
+#include "../../include/process.h"
+#include "../../include/command.h"
+#include "../../include/cgroup.h"
 
 // Khai báo đường dẫn file cấu hình mặc định
 #define DEFAULT_CONFIG_PATH "data/config.json"
 
+// Bytes of each command's stdout and stderr kept (head plus tail)
+static size_t output_limit = (size_t)COMMAND_DEFAULT_OUTPUT_KB * 1024;
+
 // Static variables for logging
 static FILE *log_file_handle = NULL;
 static LogLevel current_log_level = LOG_INFO;
@@ -103,6 +110,31 @@ char* time_to_string(time_t time_value, char *buffer, size_t size, const char *f
     return buffer;
 }
 
+double monotonic_seconds(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return 0;
+    }
+    
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int thread_create(pthread_t *thread, const pthread_attr_t *attr,
+                  void *(*func)(void*), void *arg) {
+    // The new thread inherits the mask in force when it is created
+    sigset_t stop;
+    sigset_t old;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, &old);
+    
+    int rc = pthread_create(thread, attr, func, arg);
+    
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rc;
+}
+
 bool ensure_directory_exists(const char *path) {
     if (!path) {
         return false;
@@ -156,127 +188,273 @@ char* safe_strcpy(char *dest, const char *src, size_t size) {
     return dest;
 }
 
-// Helper for run_command_with_timeout
-static void alarm_handler(int signum __attribute__((unused))) {
-    // Just need to interrupt the wait
-}
-
 bool run_command_with_timeout(const char *command, const char *working_dir, 
                             int timeout_sec, int *exit_code) {
-    if (!command || !exit_code) {
+    if (!exit_code) {
         return false;
     }
     
+    CommandResult result;
+    bool success = run_command_ex(command, working_dir, timeout_sec, 0, NULL, &result);
+    *exit_code = result.exit_code;
+    command_result_free(&result);
+    return success;
+}
+
+void command_output_init(int output_kb) {
+    output_limit = output_kb > 0 ? (size_t)output_kb * 1024 : 0;
+}
+
+void command_result_free(CommandResult *result) {
+    if (!result) {
+        return;
+    }
+    
+    free(result->output.data);
+    free(result->error_output.data);
+    memset(&result->output, 0, sizeof(CapturedOutput));
+    memset(&result->error_output, 0, sizeof(CapturedOutput));
+}
+
+// Move a reaper buffer into a command result
+static void take_output(OutputBuffer *buffer, CapturedOutput *captured) {
+    captured->data = output_buffer_flatten(buffer, &captured->length);
+    captured->total = buffer->total;
+    output_buffer_free(buffer);
+}
+
+static void close_fd(int *fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+static void close_pipe(int fds[2]) {
+    close_fd(&fds[0]);
+    close_fd(&fds[1]);
+}
+
+// Start spec in a process group of its own, so a timeout takes down
+// everything it started, and wait for it. A failed direct start of
+// fallback_command is retried through the shell.
+static bool run_process(ProcessSpec *spec, const char *label, const char *fallback_command,
+                        int timeout_sec, int task_id, const char *limits, CommandResult *result) {
     log_message(LOG_DEBUG, "Executing command with timeout %d seconds: %s", 
-               timeout_sec > 0 ? timeout_sec : 0, command);
+               timeout_sec > 0 ? timeout_sec : 0, label);
+    
+    if (spec->working_dir) {
+        log_message(LOG_DEBUG, "Working directory: %s", spec->working_dir);
+    }
+    
+    // Wall-clock start for the run record, monotonic start for the duration
+    struct timespec wall_start;
+    clock_gettime(CLOCK_REALTIME, &wall_start);
+    double started = monotonic_seconds();
+    
+    spec->new_group = true;
+    result->memory_peak_kb = -1;
+    result->io_read_bytes = -1;
+    result->io_write_bytes = -1;
+    
+    // Output goes through pipes the reaper drains into bounded buffers
+    int output_pipe[2] = { -1, -1 };
+    int error_pipe[2] = { -1, -1 };
+    if (output_limit > 0) {
+        if (pipe2(output_pipe, O_CLOEXEC) != 0 || pipe2(error_pipe, O_CLOEXEC) != 0) {
+            log_message(LOG_ERROR, "Failed to create output pipes: %s", strerror(errno));
+            close_pipe(output_pipe);
+            close_pipe(error_pipe);
+            return false;
+        }
+        spec->stdout_fd = output_pipe[1];
+        spec->stderr_fd = error_pipe[1];
+    }
     
-    if (working_dir) {
-        log_message(LOG_DEBUG, "Working directory: %s", working_dir);
+    // A task run gets a cgroup of its own, if enabled: its limits, a kill
+    // that reaches every descendant, and accounting for all of them
+    TaskCgroup cgroup = { .dir_fd = -1, .kill_fd = -1 };
+    if (task_id > 0 && cgroup_create(task_id, limits, &cgroup)) {
+        spec->cgroup_fd = cgroup.dir_fd;
+    } else if (task_id > 0 && limits && limits[0]) {
+        log_message(LOG_DEBUG, "Limits of task %d not applied: cgroups are disabled", task_id);
     }
     
-    pid_t pid = fork();
+    pid_t pid;
+    bool spawned = process_spawn(spec, &pid);
     
-    if (pid < 0) {
-        log_message(LOG_ERROR, "Fork failed: %s", strerror(errno));
-        return false;
+    if (!spawned && fallback_command) {
+        // A file without a #! line only runs through the shell; anything
+        // else (program moved, directory missing) may be stale cache.
+        // Either way the shell reports it the way it always has.
+        if (errno == ENOEXEC) {
+            command_require_shell(fallback_command);
+        } else {
+            command_cache_clear();
+        }
+        char *const shell_argv[] = { "sh", "-c", (char*)fallback_command, NULL };
+        spec->path = "/bin/sh";
+        spec->argv = shell_argv;
+        spec->quiet = false;
+        spawned = process_spawn(spec, &pid);
     }
     
-    if (pid == 0) {
-        // Child process
-        
-        // Change to the working directory if specified
-        if (working_dir && chdir(working_dir) != 0) {
-            fprintf(stderr, "Failed to change to working directory: %s\n", working_dir);
-            _exit(127);
-        }
-        
-        // Create log file for command output if in debug mode
-        #ifdef DEBUG_OUTPUT
-        // Use a log file for command output to debug script issues
-        char output_log[256];
-        snprintf(output_log, sizeof(output_log), "/tmp/taskscheduler_cmd_%d.log", getpid());
-        int log_fd = open(output_log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (log_fd >= 0) {
-            // Write command details to log
-            char header[512];
-            snprintf(header, sizeof(header), 
-                    "Command: %s\nWorking dir: %s\nPID: %d\nTime: %ld\n\n", 
-                    command, working_dir ? working_dir : "(default)", getpid(), time(NULL));
-            write(log_fd, header, strlen(header));
-            
-            // Redirect stdout and stderr to the log file
-            dup2(log_fd, STDOUT_FILENO);
-            dup2(log_fd, STDERR_FILENO);
-            close(log_fd);
-        }
-        #endif
-        
-        // Execute the command
-        execl("/bin/sh", "sh", "-c", command, NULL);
-        
-        // If execl returns, it failed
-        fprintf(stderr, "Failed to execute command: %s\n", command);
-        _exit(127);
+    // Only the child writes to the pipes
+    close_fd(&output_pipe[1]);
+    close_fd(&error_pipe[1]);
+    
+    if (!spawned) {
+        close_pipe(output_pipe);
+        close_pipe(error_pipe);
+        cgroup_destroy(&cgroup);
+        return false;
     }
     
     // Parent process
-    int status;
-    pid_t waited_pid;
-    bool timed_out = false;
-    
-    if (timeout_sec > 0) {
-        // Set up alarm for timeout
-        struct sigaction sa;
-        memset(&sa, 0, sizeof(sa));
-        sa.sa_handler = alarm_handler;
-        sigaction(SIGALRM, &sa, NULL);
-        
-        alarm(timeout_sec);
-        
-        waited_pid = waitpid(pid, &status, 0);
-        
-        // Cancel the alarm
-        alarm(0);
-        
-        if (waited_pid == -1 && errno == EINTR) {
-            // Interrupted by alarm, kill the child
-            log_message(LOG_WARNING, "Command timed out after %d seconds, killing process %d", 
-                      timeout_sec, (int)pid);
-            kill(pid, SIGKILL);
-            waitpid(pid, &status, 0);
-            timed_out = true;
-        }
-    } else {
-        // No timeout, just wait
-        waited_pid = waitpid(pid, &status, 0);
+    result->start_time = wall_start.tv_sec + wall_start.tv_nsec / 1e9;
+    
+    // The reaper thread enforces the deadline, collects the output and
+    // hands back the status together with the child's resource usage
+    ProcessWatchOptions options;
+    process_watch_options_init(&options);
+    options.timeout_sec = timeout_sec;
+    options.kill_group = true;
+    options.kill_fd = cgroup.kill_fd;
+    options.output_fd = output_pipe[0];
+    options.error_fd = error_pipe[0];
+    options.output_limit = output_limit;
+    
+    // Subscribers of the task can follow the output while it runs
+    if (task_id > 0 && output_limit > 0) {
+        options.live = live_output_begin(task_id, output_limit);
+    }
+    
+    ProcessExit outcome;
+    bool watched = process_wait(pid, &options, &outcome);
+    live_output_end(options.live);
+    if (!watched) {
+        log_message(LOG_ERROR, "Failed to watch process %d, killing it", (int)pid);
+        kill(-pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        cgroup_destroy(&cgroup);
+        return false;
     }
     
-    if (waited_pid == -1) {
-        log_message(LOG_ERROR, "waitpid failed: %s", strerror(errno));
+    CgroupStats stats;
+    bool accounted = cgroup_collect(&cgroup, &stats);
+    bool killable = cgroup.kill_fd >= 0;
+    cgroup_destroy(&cgroup);
+    
+    result->duration = monotonic_seconds() - started;
+    result->end_time = result->start_time + result->duration;
+    take_output(&outcome.output, &result->output);
+    take_output(&outcome.error_output, &result->error_output);
+    
+    if (outcome.error != 0) {
         return false;
     }
     
-    if (timed_out) {
-        log_message(LOG_WARNING, "Command timed out after %d seconds: %s", timeout_sec, command);
-        *exit_code = -1;
+    struct rusage usage = outcome.usage;
+    int status = outcome.status;
+    result->user_cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    result->sys_cpu = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    result->max_rss_kb = usage.ru_maxrss;
+    if (accounted) {
+        // Also counts descendants that were never waited for
+        result->user_cpu = stats.user_cpu;
+        result->sys_cpu = stats.sys_cpu;
+        result->memory_peak_kb = stats.memory_peak_kb;
+        result->io_read_bytes = stats.io_read_bytes;
+        result->io_write_bytes = stats.io_write_bytes;
+    }
+    
+    if (WIFSIGNALED(status)) {
+        result->term_signal = WTERMSIG(status);
+    }
+    
+    if (outcome.timed_out) {
+        log_message(LOG_WARNING, "Command timed out after %d seconds, killed %s %d: %s",
+                   timeout_sec, killable ? "cgroup of process" : "process group", (int)pid, label);
+        result->timed_out = true;
         return false;
     }
     
     if (WIFEXITED(status)) {
-        *exit_code = WEXITSTATUS(status);
-        log_message(LOG_DEBUG, "Command completed with exit code %d: %s", *exit_code, command);
+        result->exit_code = WEXITSTATUS(status);
+        log_message(LOG_DEBUG, "Command completed with exit code %d: %s", result->exit_code, label);
         return true;
     } else if (WIFSIGNALED(status)) {
-        log_message(LOG_WARNING, "Command terminated by signal %d: %s", WTERMSIG(status), command);
-        *exit_code = -1;
+        log_message(LOG_WARNING, "Command terminated by signal %d: %s", result->term_signal, label);
         return false;
     }
     
     log_message(LOG_ERROR, "Unexpected wait status: %d", status);
-    *exit_code = -1;
     return false;
 }
 
+bool run_command_ex(const char *command, const char *working_dir, 
+                    int timeout_sec, int task_id, const char *limits, CommandResult *result) {
+    if (!result) {
+        return false;
+    }
+    
+    memset(result, 0, sizeof(CommandResult));
+    result->exit_code = -1;
+    
+    if (!command) {
+        return false;
+    }
+    
+    ProcessSpec spec;
+    process_spec_init(&spec);
+    char *const shell_argv[] = { "sh", "-c", (char*)command, NULL };
+    spec.working_dir = working_dir;
+    
+    // Plain commands skip the shell: one exec instead of two
+    CommandPlan plan;
+    bool direct = command_plan(command, &plan);
+    if (direct) {
+        spec.path = plan.path;
+        spec.argv = plan.argv;
+        spec.quiet = true;
+    } else {
+        spec.path = "/bin/sh";
+        spec.argv = shell_argv;
+    }
+    
+    return run_process(&spec, command, direct ? command : NULL, timeout_sec, task_id, limits, result);
+}
+
+bool run_script_ex(int script_fd, bool shebang, const char *working_dir,
+                   int timeout_sec, int task_id, const char *limits, CommandResult *result) {
+    if (!result) {
+        return false;
+    }
+    
+    memset(result, 0, sizeof(CommandResult));
+    result->exit_code = -1;
+    
+    if (script_fd < 0) {
+        return false;
+    }
+    
+    // The child reaches the image through its own copy of the descriptor,
+    // which is also the path an interpreter named on the #! line opens
+    char script_path[64];
+    snprintf(script_path, sizeof(script_path), "/proc/self/fd/%d", script_fd);
+    char *const direct_argv[] = { script_path, NULL };
+    char *const shell_argv[] = { "sh", script_path, NULL };
+    
+    ProcessSpec spec;
+    process_spec_init(&spec);
+    spec.path = shebang ? script_path : "/bin/sh";
+    spec.argv = shebang ? direct_argv : shell_argv;
+    spec.working_dir = working_dir;
+    spec.inherit_fd = script_fd;
+    
+    return run_process(&spec, script_path, NULL, timeout_sec, task_id, limits, result);
+}
+
 void init_system_metrics(SystemMetrics *metrics) {
     if (!metrics) {
         return;
@@ -480,7 +480,7 @@ class TaskAPI:
                 
                 # Truy vấn để lấy phụ thuộc
                 cursor.execute("""
-                    SELECT dependency_id FROM dependencies WHERE task_id = ?
+                    SELECT depends_on FROM dependencies WHERE task_id = ?
                 """, (task['id'],))
                 
                 for dep_row in cursor.fetchall():
@@ -494,6 +494,79 @@ class TaskAPI:
             print(f"Error accessing database: {e}")
             return []
     
+    def get_run_counts(self, since):
+        """Đếm số lần thực thi thành công và thất bại từ lịch sử task_runs
+        
+        Args:
+            since (float): Chỉ tính các lần chạy bắt đầu sau thời điểm này (epoch)
+            
+        Returns:
+            tuple: (success, failed), hoặc None nếu chưa có bảng lịch sử
+        """
+        try:
+            import sqlite3
+            db_path = os.path.join(self.data_dir, "tasks.db")
+            if not os.path.exists(db_path):
+                return None
+            
+            conn = sqlite3.connect(db_path)
+            cursor = conn.cursor()
+            
+            # Dùng chỉ mục idx_task_runs_start cho truy vấn theo khoảng thời gian
+            cursor.execute("""
+                SELECT COALESCE(SUM(exit_code = 0), 0), COALESCE(SUM(exit_code != 0), 0)
+                FROM task_runs WHERE start_time >= ?
+            """, (since,))
+            success, failed = cursor.fetchone()
+            
+            conn.close()
+            return int(success), int(failed)
+        except Exception as e:
+            print(f"Error reading execution history: {e}")
+            return None
+    
+    def tail_output(self, task_id):
+        """Theo dõi output của lần chạy hiện tại của tác vụ qua socket điều khiển
+        
+        Args:
+            task_id (int): ID của tác vụ
+            
+        Yields:
+            bytes: Output theo thứ tự xuất hiện, từ phần còn giữ lại đến khi lần chạy kết thúc
+            
+        Raises:
+            RuntimeError: Nếu tác vụ không chạy hoặc không kết nối được scheduler
+        """
+        import socket
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            try:
+                sock.connect(os.path.join(self.data_dir, "control.sock"))
+                sock.sendall(f"tail {task_id}\n".encode())
+            except OSError as e:
+                raise RuntimeError(f"cannot reach the scheduler: {e}")
+            
+            # Dòng đầu tiên là "ok" hoặc "error <lý do>"
+            reply = b""
+            while b"\n" not in reply:
+                chunk = sock.recv(4096)
+                if not chunk:
+                    raise RuntimeError("no reply from the scheduler")
+                reply += chunk
+            status, rest = reply.split(b"\n", 1)
+            if status != b"ok":
+                raise RuntimeError(status.decode(errors="replace").replace("error ", "", 1))
+            
+            if rest:
+                yield rest
+            while True:
+                chunk = sock.recv(65536)
+                if not chunk:
+                    break
+                yield chunk
+        finally:
+            sock.close()
+    
     def get_task(self, task_id, force_refresh=False):
         """Lấy thông tin chi tiết của một tác vụ theo ID
         
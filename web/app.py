@@ -3,7 +3,7 @@
 
 import os
 import sys
-from flask import Flask, render_template, request, redirect, url_for, flash, jsonify, session
+from flask import Flask, render_template, request, redirect, url_for, flash, jsonify, session, Response, stream_with_context
 from datetime import datetime
 import time
 import uuid
@@ -165,8 +165,6 @@ def create_task():
     if dependencies:
         # Chuyển đổi từ danh sách chuỗi sang danh sách số nguyên
         dependencies = [int(dep_id) for dep_id in dependencies if dep_id.isdigit()]
-        # Giới hạn số lượng phụ thuộc tối đa
-        dependencies = dependencies[:10]
         task_data['dependencies'] = dependencies
     else:
         task_data['dependencies'] = []
@@ -378,8 +376,6 @@ def update_task(task_id):
     if dependencies:
         # Chuyển đổi từ danh sách chuỗi sang danh sách số nguyên
         dependencies = [int(dep_id) for dep_id in dependencies if dep_id.isdigit()]
-        # Giới hạn số lượng phụ thuộc tối đa
-        dependencies = dependencies[:10]
         
         # Lấy danh sách phụ thuộc hiện tại
         current_task = task_api.get_task(task_id, force_refresh=True)
@@ -513,6 +509,24 @@ def run_task(task_id):
     
     return redirect(url_for('view_task', task_id=task_id))
 
+# Theo dõi output của tác vụ đang chạy
+@app.route('/task/<int:task_id>/output/stream')
+def stream_task_output(task_id):
+    stream = task_api.tail_output(task_id)
+    try:
+        # Lấy phần đầu ngay để báo lỗi bằng mã HTTP thay vì giữa luồng
+        first = next(stream, b'')
+    except RuntimeError as e:
+        return Response(f'Không thể theo dõi tác vụ {task_id}: {e}\n', status=404, mimetype='text/plain')
+    
+    def generate():
+        yield first
+        yield from stream
+    
+    # Tắt bộ đệm của proxy để output đến trình duyệt ngay khi có
+    return Response(stream_with_context(generate()), mimetype='text/plain',
+                    headers={'X-Accel-Buffering': 'no', 'Cache-Control': 'no-cache'})
+
 # Bật/tắt tác vụ
 @app.route('/task/<int:task_id>/toggle', methods=['POST'])
 def toggle_task(task_id):
@@ -591,10 +605,15 @@ def stats():
     
     for days in time_ranges:
         time_threshold = current_time - (days * 24 * 60 * 60)
-        recent_tasks = [t for t in tasks if t.get('last_run_time', 0) > time_threshold]
         
-        success_count = sum(1 for t in recent_tasks if t.get('exit_code', -1) == 0)
-        failed_count = sum(1 for t in recent_tasks if t.get('exit_code', -1) != 0 and t.get('exit_code', -1) != -1)
+        # Đếm mọi lần chạy trong lịch sử; nếu chưa có thì ước lượng từ lần chạy cuối
+        run_counts = task_api.get_run_counts(time_threshold)
+        if run_counts is not None:
+            success_count, failed_count = run_counts
+        else:
+            recent_tasks = [t for t in tasks if t.get('last_run_time', 0) > time_threshold]
+            success_count = sum(1 for t in recent_tasks if t.get('exit_code', -1) == 0)
+            failed_count = sum(1 for t in recent_tasks if t.get('exit_code', -1) != 0 and t.get('exit_code', -1) != -1)
         total_executed = success_count + failed_count
         
         execution_history.append({